@@ -0,0 +1,54 @@
+#!/bin/bash -e
+
+######################################################################################
+# This script compares the wall time of in-process zlib decompression against the
+# forked gunzip pipe (-gunzip) on one trace, and checks that both give the same
+# results.
+# Usage: bench_gunzip.sh [trace] [sim options...]  (default trace: ../traces/gcc.ptr.gz)
+# You will need to first compile your code in ../src (e.g. make fast)
+######################################################################################
+
+cd "$(dirname "$0")"
+
+trace="${1:-../traces/gcc.ptr.gz}"
+shift || true
+sim_args=("$@")
+
+if [[ ! -x '../src/sim' ]]; then
+    echo 'sim binary not found. Please compile first using `make`' >&2
+    exit 1
+fi
+
+if [[ ! -f "$trace" ]]; then
+    echo "trace not found: $trace" >&2
+    exit 1
+fi
+
+zlib_results="$(mktemp)"
+gunzip_results="$(mktemp)"
+
+time_run() {
+    local start end
+    start="$(date +%s.%N)"
+    ../src/sim "${sim_args[@]}" "$@" > "$out"
+    end="$(date +%s.%N)"
+    awk "BEGIN { printf \"%.3f\", $end - $start }"
+}
+
+out="$gunzip_results"; gunzip_time="$(time_run -gunzip "$trace")"
+out="$zlib_results";   zlib_time="$(time_run "$trace")"
+
+echo "Trace:              $trace"
+echo "fork+pipe gunzip:   ${gunzip_time}s"
+echo "in-process zlib:    ${zlib_time}s"
+echo "Speedup:            $(awk "BEGIN { printf \"%.2f\", $gunzip_time / $zlib_time }")x"
+
+if diff -q <(grep '^LAB2_' "$gunzip_results") <(grep '^LAB2_' "$zlib_results") > /dev/null; then
+    echo "Results match."
+else
+    echo "Results differ!" >&2
+    rm -f "$zlib_results" "$gunzip_results"
+    exit 1
+fi
+
+rm -f "$zlib_results" "$gunzip_results"
@@ -7,6 +7,9 @@
 
 
 
+# Decompress each trace once and let every later run map the cached copy.
+export TRACE_CACHE_DIR="${TRACE_CACHE_DIR:-../traces/.cache}"
+
 ########## ---------------  A.1 ---------------- ################
 
 echo "Testing A1 on bzip2..."
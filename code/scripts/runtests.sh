@@ -12,6 +12,9 @@ if [[ ! -x '../src/sim' ]]; then
     exit 1
 fi
 
+# Decompress each trace once and let every later run map the cached copy.
+export TRACE_CACHE_DIR="${TRACE_CACHE_DIR:-../traces/.cache}"
+
 total_tests=0
 passed_tests=0
 
@@ -9,6 +9,7 @@
 
 #include "bpred.h"
 #include <iostream>
+#include <string.h>
 
 /**
  * Construct a branch predictor with the given policy.
@@ -18,20 +19,155 @@
  * @param policy the policy this branch predictor should use
  */
 BPred::BPred(BPredPolicy policy)
+    : BPred(policy, BPRED_DEFAULT_HIST_BITS, BPRED_DEFAULT_PHT_ENTRIES)
 {
-    // TODO: Initialize member variables here.
-    // As a reminder, you can declare any additional member variables you need
-    // in the BPred class in bpred.h and initialize them here.
+}
 
+/**
+ * Construct a branch predictor with the given policy and, for BPRED_GSHARE and
+ * BPRED_TOURNAMENT, the given gshare table geometry, which must satisfy
+ * bpred_geometry_valid(), or, for BPRED_TAGE and BPRED_PERCEPTRON, the given
+ * geometry, which must satisfy tage_config_valid() or
+ * perceptron_config_valid().
+ *
+ * @param policy the policy this branch predictor should use
+ * @param hist_bits the length of the global history register, in bits
+ * @param pht_entries the number of counters in the pattern history table
+ * @param tage_config the TAGE geometry, or NULL for the default
+ * @param perceptron_config the perceptron geometry, or NULL for the default
+ */
+BPred::BPred(BPredPolicy policy, uint32_t hist_bits, uint32_t pht_entries,
+             const TageConfig *tage_config,
+             const PerceptronConfig *perceptron_config)
+{
     /* initialize branch policy*/
     this->policy = policy;
 
-    /* initialize GHR and PHT */
+    /* initialize statistics */
+    stat_num_branches = 0;
+    stat_num_mispred = 0;
+
+    /* initialize geometry; only gshare and the tournament have its tables */
+    if (policy != BPRED_GSHARE && policy != BPRED_TOURNAMENT) {
+        hist_bits = 0;
+        pht_entries = 0;
+    }
+    this->hist_bits = hist_bits;
+    this->hist_mask = (uint32_t)((1ull << hist_bits) - 1);
+    this->pht_entries = pht_entries;
+    this->index_bits = 0;
+    while ((1ull << index_bits) < pht_entries) {
+        index_bits++;
+    }
+    this->pht_packed = pht_entries >= BPRED_PACKED_MIN_ENTRIES;
+
+    /* initialize GHR and PHT, every counter weakly taken */
     GHR = 0;
-    for (int i = 0; i < 4096; i++) {
-        PHT[i] = 2;
+    PHT = NULL;
+    if (pht_entries > 0) {
+        PHT = new uint8_t[pht_bytes()];
+        memset(PHT, pht_packed ? 0xAA : 2, pht_bytes());
+    }
+
+    /* initialize TAGE tables */
+    tage = NULL;
+    if (policy == BPRED_TAGE) {
+        TageConfig default_config;
+        if (tage_config == NULL) {
+            tage_config_init(&default_config);
+            tage_config = &default_config;
+        }
+        tage = tage_init(tage_config);
+    }
+
+    /* initialize perceptrons */
+    perceptron = NULL;
+    if (policy == BPRED_PERCEPTRON) {
+        PerceptronConfig default_config;
+        if (perceptron_config == NULL) {
+            perceptron_config_init(&default_config);
+            perceptron_config = &default_config;
+        }
+        perceptron = perceptron_init(perceptron_config);
+    }
+
+    /* initialize tournament tables */
+    tournament = NULL;
+    if (policy == BPRED_TOURNAMENT) {
+        tournament = tournament_init();
+    }
+
+}
+
+/**
+ * Free the tables of the predictor.
+ */
+BPred::~BPred()
+{
+    delete[] PHT;
+    tage_free(tage);
+    perceptron_free(perceptron);
+    tournament_free(tournament);
+}
+
+/**
+ * [Internal] Get the pattern history table index of a branch: its address
+ * XORed with the global history, folded down to the index width if the
+ * history is longer.
+ *
+ * @param pc the address (program counter) of the branch
+ * @return the index of the branch's counter
+ */
+inline uint32_t BPred::pht_index(uint64_t pc) const
+{
+    uint32_t history = GHR;
+    if (hist_bits > index_bits) {
+        history = 0;
+        for (uint32_t shift = 0; shift < hist_bits; shift += index_bits) {
+            history ^= GHR >> shift;
+        }
     }
+    return (uint32_t)(pc ^ history) & (pht_entries - 1);
+}
 
+/**
+ * [Internal] Read a counter of the pattern history table.
+ *
+ * @param index the index of the counter
+ * @return the counter, from 0 to 3
+ */
+inline uint32_t BPred::pht_read(uint32_t index) const
+{
+    if (pht_packed) {
+        return (PHT[index >> 2] >> ((index & 3) * 2)) & 3;
+    }
+    return PHT[index];
+}
+
+/**
+ * [Internal] Write a counter of the pattern history table.
+ *
+ * @param index the index of the counter
+ * @param counter the new counter, from 0 to 3
+ */
+inline void BPred::pht_write(uint32_t index, uint32_t counter)
+{
+    if (pht_packed) {
+        uint32_t shift = (index & 3) * 2;
+        PHT[index >> 2] = (PHT[index >> 2] & ~(3u << shift)) | (counter << shift);
+        return;
+    }
+    PHT[index] = counter;
+}
+
+/**
+ * [Internal] Get the number of bytes the pattern history table takes up.
+ *
+ * @return the table size in bytes, or 0 for policies other than gshare
+ */
+inline size_t BPred::pht_bytes() const
+{
+    return pht_packed ? (pht_entries + 3) / 4 : pht_entries;
 }
 
 /**
@@ -52,7 +188,24 @@ BranchDirection BPred::predict(uint64_t pc)
 
     /* if its BPRED_GSHARE */
     if (policy == BPRED_GSHARE) {
-        return PHT[(pc ^ GHR) & 0x0FFF] >= 2 ? TAKEN : NOT_TAKEN;
+        return pht_read(pht_index(pc)) >= 2 ? TAKEN : NOT_TAKEN;
+    }
+
+    /* if its BPRED_TAGE */
+    if (policy == BPRED_TAGE) {
+        return tage_predict(tage, pc) ? TAKEN : NOT_TAKEN;
+    }
+
+    /* if its BPRED_PERCEPTRON */
+    if (policy == BPRED_PERCEPTRON) {
+        return perceptron_predict(perceptron, pc) ? TAKEN : NOT_TAKEN;
+    }
+
+    /* if its BPRED_TOURNAMENT */
+    if (policy == BPRED_TOURNAMENT) {
+        bool gshare_pred = pht_read(pht_index(pc)) >= 2;
+        return tournament_predict(tournament, pc, gshare_pred) ? TAKEN
+                                                               : NOT_TAKEN;
     }
 
     /* if its BPRED_PERFECT */
@@ -86,19 +239,31 @@ void BPred::update(uint64_t pc, BranchDirection prediction,
         stat_num_mispred++;
     }
 
-    if (policy == BPRED_GSHARE) {
+    if (policy == BPRED_TOURNAMENT) {
+        tournament_update(tournament, pc, resolution == TAKEN);
+    }
+
+    if (policy == BPRED_GSHARE || policy == BPRED_TOURNAMENT) {
         /* get PHT index */
-        int pht_index = (pc ^ GHR) & 0x0FFF;
+        uint32_t index = pht_index(pc);
 
         /* update PHT counter */
         if (resolution == TAKEN) {
-            PHT[pht_index] = sat_increment(PHT[pht_index], 3);
+            pht_write(index, sat_increment(pht_read(index), 3));
         } else if (resolution == NOT_TAKEN) {
-            PHT[pht_index] = sat_decrement(PHT[pht_index]);
+            pht_write(index, sat_decrement(pht_read(index)));
         }
 
         /* update GHR */
-        GHR = (GHR << 1) | (resolution & 1);
+        GHR = ((GHR << 1) | (resolution & 1)) & hist_mask;
+    }
+
+    if (policy == BPRED_TAGE) {
+        tage_update(tage, pc, resolution == TAKEN);
+    }
+
+    if (policy == BPRED_PERCEPTRON) {
+        perceptron_update(perceptron, pc, resolution == TAKEN);
     }
 
 
@@ -108,3 +273,152 @@ void BPred::update(uint64_t pc, BranchDirection prediction,
     // Note that you do not have to handle the BPRED_PERFECT policy here; this
     // function will not be called for that policy.
 }
+
+/**
+ * Write this branch predictor's policy, internal state, and statistics to a
+ * checkpoint file.
+ *
+ * @param file the file to write to
+ * @return true on success, or false if the file could not be written
+ */
+bool BPred::save(FILE *file) const
+{
+    uint32_t saved_policy = policy;
+
+    return fwrite(&saved_policy, sizeof(saved_policy), 1, file) == 1 &&
+           fwrite(&hist_bits, sizeof(hist_bits), 1, file) == 1 &&
+           fwrite(&GHR, sizeof(GHR), 1, file) == 1 &&
+           fwrite(&pht_entries, sizeof(pht_entries), 1, file) == 1 &&
+           fwrite(PHT, 1, pht_bytes(), file) == pht_bytes() &&
+           fwrite(&stat_num_branches, sizeof(stat_num_branches), 1, file) == 1 &&
+           fwrite(&stat_num_mispred, sizeof(stat_num_mispred), 1, file) == 1 &&
+           (tage == NULL || tage_save(tage, file)) &&
+           (perceptron == NULL || perceptron_save(perceptron, file)) &&
+           (tournament == NULL || tournament_save(tournament, file));
+}
+
+/**
+ * Replace this branch predictor's internal state and statistics with those
+ * written to a checkpoint file by save().
+ *
+ * @param file the file to read from
+ * @return true on success, or false if the file could not be read or was
+ *         saved by a branch predictor with a different policy or geometry
+ */
+bool BPred::restore(FILE *file)
+{
+    uint32_t saved_policy;
+    uint32_t saved_hist_bits;
+    uint32_t saved_pht_entries;
+
+    if (fread(&saved_policy, sizeof(saved_policy), 1, file) != 1 ||
+        saved_policy != (uint32_t)policy ||
+        fread(&saved_hist_bits, sizeof(saved_hist_bits), 1, file) != 1 ||
+        saved_hist_bits != hist_bits ||
+        fread(&GHR, sizeof(GHR), 1, file) != 1 ||
+        fread(&saved_pht_entries, sizeof(saved_pht_entries), 1, file) != 1 ||
+        saved_pht_entries != pht_entries)
+    {
+        return false;
+    }
+
+    return fread(PHT, 1, pht_bytes(), file) == pht_bytes() &&
+           fread(&stat_num_branches, sizeof(stat_num_branches), 1, file) == 1 &&
+           fread(&stat_num_mispred, sizeof(stat_num_mispred), 1, file) == 1 &&
+           (tage == NULL || tage_restore(tage, file)) &&
+           (perceptron == NULL || perceptron_restore(perceptron, file)) &&
+           (tournament == NULL || tournament_restore(tournament, file));
+}
+
+/**
+ * Get the number of bits of state the modeled hardware would need: the global
+ * history register and the pattern history table, plus the other tournament
+ * tables, or the state of the TAGE or perceptron predictor.
+ *
+ * @return the storage budget in bits, or 0 for policies without tables
+ */
+uint64_t BPred::storage_bits() const
+{
+    if (tage != NULL) {
+        return tage_storage_bits(tage);
+    }
+    if (perceptron != NULL) {
+        return perceptron_storage_bits(perceptron);
+    }
+
+    uint64_t bits = component_storage_bits(TOURNAMENT_GSHARE);
+    if (tournament != NULL) {
+        /* the other components, and the chooser */
+        for (int c = 0; c <= NUM_TOURNAMENT_COMPONENTS; c++) {
+            if (c != TOURNAMENT_GSHARE) {
+                bits += component_storage_bits((TournamentComponent)c);
+            }
+        }
+    }
+    return bits;
+}
+
+/**
+ * Get the number of bits of state the modeled hardware would need for one
+ * component of a tournament predictor, or for its chooser, as counted in
+ * storage_bits().
+ *
+ * @param component the component, or NUM_TOURNAMENT_COMPONENTS for the
+ *        chooser
+ * @return the storage budget in bits; for TOURNAMENT_GSHARE, that of the
+ *         global history register and the pattern history table
+ */
+uint64_t BPred::component_storage_bits(TournamentComponent component) const
+{
+    /* the gshare component is this predictor's own history and table */
+    if (component == TOURNAMENT_GSHARE) {
+        return hist_bits + 2 * (uint64_t)pht_entries;
+    }
+    return tournament_storage_bits(component);
+}
+
+/**
+ * Get the number of bytes the pattern history table and tournament tables,
+ * TAGE tables, or perceptron weights take up in the simulator's memory.
+ *
+ * @return the table size in bytes, or 0 for policies without tables
+ */
+size_t BPred::table_bytes() const
+{
+    if (tage != NULL) {
+        return tage_table_bytes(tage);
+    }
+    if (perceptron != NULL) {
+        return perceptron_table_bytes(perceptron);
+    }
+    if (tournament != NULL) {
+        return pht_bytes() + sizeof(Tournament);
+    }
+    return pht_bytes();
+}
+
+/**
+ * Get the tables and per-component statistics of a tournament predictor.
+ *
+ * @return the tournament state, or NULL for other policies
+ */
+const Tournament *BPred::tournament_state() const
+{
+    return tournament;
+}
+
+/**
+ * Check whether a gshare geometry can be simulated: the history is at most
+ * BPRED_MAX_HIST_BITS long, and the table has a power of two entries between
+ * 2 and BPRED_MAX_PHT_ENTRIES.
+ *
+ * @param hist_bits the length of the global history register, in bits
+ * @param pht_entries the number of counters in the pattern history table
+ * @return true if the geometry is valid
+ */
+bool bpred_geometry_valid(uint32_t hist_bits, uint32_t pht_entries)
+{
+    return hist_bits <= BPRED_MAX_HIST_BITS && pht_entries >= 2 &&
+           pht_entries <= BPRED_MAX_PHT_ENTRIES &&
+           (pht_entries & (pht_entries - 1)) == 0;
+}
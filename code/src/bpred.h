@@ -12,7 +12,12 @@
 #ifndef _BPRED_H_
 #define _BPRED_H_
 
+#include "perceptron.h"
+#include "tage.h"
+#include "tournament.h"
 #include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
 
 /**
  * The possible branch prediction policies the simulator can use.
@@ -24,9 +29,40 @@ typedef enum BPredPolicyEnum
     BPRED_PERFECT,      // The branch predictor is (magically) always correct.
     BPRED_ALWAYS_TAKEN, // The branch predictor always predicts a branch taken.
     BPRED_GSHARE,       // The branch predictor uses the Gshare algorithm.
+    BPRED_TAGE,         // The branch predictor uses the TAGE algorithm.
+    BPRED_PERCEPTRON,   // The branch predictor uses a perceptron per branch.
+    BPRED_TOURNAMENT,   // The branch predictor picks bimodal, local, or Gshare.
     NUM_BPRED_POLICIES
 } BPredPolicy;
 
+/**
+ * The default length of the gshare global history register, in bits.
+ */
+#define BPRED_DEFAULT_HIST_BITS 12
+
+/**
+ * The default number of 2-bit counters in the gshare pattern history table.
+ */
+#define BPRED_DEFAULT_PHT_ENTRIES 4096
+
+/**
+ * The longest gshare global history register, in bits.
+ */
+#define BPRED_MAX_HIST_BITS 32
+
+/**
+ * The most counters a gshare pattern history table can have: a 16 MiB
+ * predictor.
+ */
+#define BPRED_MAX_PHT_ENTRIES (1u << 26)
+
+/**
+ * The smallest pattern history table stored four counters per byte rather
+ * than one. Below this, the byte-per-counter table fits in the host's caches
+ * anyway, and skipping the shifts and masks is cheaper.
+ */
+#define BPRED_PACKED_MIN_ENTRIES (1u << 16)
+
 /**
  * Whether a branch is taken or not taken.
  * 
@@ -50,11 +86,34 @@ private:
     /** The policy this branch predictor uses. */
     BPredPolicy policy;
 
-    /* 12-bit global history register */
-    uint16_t GHR;
+    /* global history register, hist_bits long */
+    uint32_t GHR;
+
+    /* pattern history table: pht_entries 2-bit saturating counters, one per
+       byte, or four per byte if pht_packed */
+    uint8_t *PHT;
+
+    /* geometry of the gshare tables */
+    uint32_t hist_bits;
+    uint32_t hist_mask;
+    uint32_t pht_entries;
+    uint32_t index_bits;
+    bool pht_packed;
+
+    /* TAGE tables, if the policy is BPRED_TAGE */
+    Tage *tage;
 
-    /* pattern history table: 2^12 entries, each 2-bit saturating counter */
-    uint8_t PHT[4096];
+    /* perceptrons, if the policy is BPRED_PERCEPTRON */
+    Perceptron *perceptron;
+
+    /* bimodal, local, and chooser tables, if the policy is BPRED_TOURNAMENT,
+       which also uses the gshare tables */
+    Tournament *tournament;
+
+    uint32_t pht_index(uint64_t pc) const;
+    uint32_t pht_read(uint32_t index) const;
+    void pht_write(uint32_t index, uint32_t counter);
+    size_t pht_bytes() const;
 
 public:
     /** The total number of branches this branch predictor has seen. */
@@ -71,6 +130,31 @@ public:
      */
     BPred(BPredPolicy policy);
 
+    /**
+     * Construct a branch predictor with the given policy and, for
+     * BPRED_GSHARE and BPRED_TOURNAMENT, the given gshare table geometry, which must satisfy
+     * bpred_geometry_valid(), or, for BPRED_TAGE and BPRED_PERCEPTRON, the
+     * given geometry, which must satisfy tage_config_valid() or
+     * perceptron_config_valid().
+     *
+     * @param policy the policy this branch predictor should use
+     * @param hist_bits the length of the global history register, in bits
+     * @param pht_entries the number of counters in the pattern history table
+     * @param tage_config the TAGE geometry, or NULL for the default
+     * @param perceptron_config the perceptron geometry, or NULL for the
+     *        default
+     */
+    BPred(BPredPolicy policy, uint32_t hist_bits, uint32_t pht_entries,
+          const TageConfig *tage_config = NULL,
+          const PerceptronConfig *perceptron_config = NULL);
+
+    /** Free the tables of the predictor. */
+    ~BPred();
+
+    /* each branch predictor owns its tables */
+    BPred(const BPred &) = delete;
+    BPred &operator=(const BPred &) = delete;
+
     /**
      * Get a prediction for the branch with the given address.
      * 
@@ -94,8 +178,75 @@ public:
      */
     void update(uint64_t pc, BranchDirection prediction,
                 BranchDirection resolution);
+
+    /**
+     * Write this branch predictor's policy, internal state, and statistics
+     * to a checkpoint file.
+     *
+     * @param file the file to write to
+     * @return true on success, or false if the file could not be written
+     */
+    bool save(FILE *file) const;
+
+    /**
+     * Replace this branch predictor's internal state and statistics with
+     * those written to a checkpoint file by save().
+     *
+     * @param file the file to read from
+     * @return true on success, or false if the file could not be read or was
+     *         saved by a branch predictor with a different policy or geometry
+     */
+    bool restore(FILE *file);
+
+    /**
+     * Get the number of bits of state the modeled hardware would need: the
+     * global history register and the pattern history table, plus the other
+     * tournament tables, or the state of the TAGE or perceptron predictor.
+     *
+     * @return the storage budget in bits, or 0 for policies without tables
+     */
+    uint64_t storage_bits() const;
+
+    /**
+     * Get the number of bits of state the modeled hardware would need for one
+     * component of a tournament predictor, or for its chooser, as counted in
+     * storage_bits().
+     *
+     * @param component the component, or NUM_TOURNAMENT_COMPONENTS for the
+     *        chooser
+     * @return the storage budget in bits; for TOURNAMENT_GSHARE, that of the
+     *         global history register and the pattern history table
+     */
+    uint64_t component_storage_bits(TournamentComponent component) const;
+
+    /**
+     * Get the number of bytes the pattern history table and tournament
+     * tables, TAGE tables, or perceptron weights take up in the simulator's
+     * memory.
+     *
+     * @return the table size in bytes, or 0 for policies without tables
+     */
+    size_t table_bytes() const;
+
+    /**
+     * Get the tables and per-component statistics of a tournament predictor.
+     *
+     * @return the tournament state, or NULL for other policies
+     */
+    const Tournament *tournament_state() const;
 };
 
+/**
+ * Check whether a gshare geometry can be simulated: the history is at most
+ * BPRED_MAX_HIST_BITS long, and the table has a power of two entries between
+ * 2 and BPRED_MAX_PHT_ENTRIES.
+ *
+ * @param hist_bits the length of the global history register, in bits
+ * @param pht_entries the number of counters in the pattern history table
+ * @return true if the geometry is valid
+ */
+bool bpred_geometry_valid(uint32_t hist_bits, uint32_t pht_entries);
+
 /**
  * Saturating increment: a utility function to increment a value by 1, stopping
  * at a given maximum value.
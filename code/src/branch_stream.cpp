@@ -0,0 +1,209 @@
+// branch_stream.cpp
+// Implements the branch stream format.
+
+#include "branch_stream.h"
+#include "trace_packed.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/** Bits of the first varint of an encoded branch, below op_distance. */
+#define BS_BR_DIR     0x1
+#define BS_HAS_BR_TGT 0x2
+#define BS_FLAG_BITS  2
+
+bool branch_stream_is_stream(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    char magic[sizeof(((BranchStreamHeader *)0)->magic)];
+    bool is_stream = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                     memcmp(magic, BRANCH_STREAM_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return is_stream;
+}
+
+BranchStreamWriter *branch_stream_create(const char *filename)
+{
+    BranchStreamWriter *w = (BranchStreamWriter *)calloc(
+        1, sizeof(BranchStreamWriter));
+    if (w == NULL)
+    {
+        return NULL;
+    }
+
+    w->file = fopen(filename, "wb");
+    if (w->file == NULL)
+    {
+        free(w);
+        return NULL;
+    }
+
+    memcpy(w->header.magic, BRANCH_STREAM_MAGIC, sizeof(w->header.magic));
+    w->header.version = BRANCH_STREAM_VERSION;
+
+    // Leave room for the header, and fill it in once the counts are known.
+    if (fwrite(&w->header, sizeof(w->header), 1, w->file) != 1)
+    {
+        fclose(w->file);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+int branch_stream_write(BranchStreamWriter *w, const TraceRec *rec)
+{
+    w->header.num_records++;
+    w->op_distance++;
+    if (rec->op_type != OP_CBR)
+    {
+        return 0;
+    }
+
+    if (w->buf_len + BRANCH_STREAM_MAX_REC_SIZE > sizeof(w->buf))
+    {
+        if (fwrite(w->buf, 1, w->buf_len, w->file) != w->buf_len)
+        {
+            return -1;
+        }
+        w->buf_len = 0;
+    }
+
+    uint8_t *out = &w->buf[w->buf_len];
+    uint64_t flags = (rec->br_dir ? BS_BR_DIR : 0) |
+                     (rec->br_target != 0 ? BS_HAS_BR_TGT : 0);
+    out = varint_put(out, w->op_distance << BS_FLAG_BITS | flags);
+    out = varint_put(out, zigzag_encode(
+                              (int64_t)(rec->inst_addr - w->prev_inst_addr)));
+    if (rec->br_target != 0)
+    {
+        out = varint_put(out, zigzag_encode(
+                                  (int64_t)(rec->br_target - rec->inst_addr)));
+    }
+    w->buf_len = out - w->buf;
+
+    w->header.num_branches++;
+    w->op_distance = 0;
+    w->prev_inst_addr = rec->inst_addr;
+    return 0;
+}
+
+int branch_stream_finish(BranchStreamWriter *w)
+{
+    bool ok = fwrite(w->buf, 1, w->buf_len, w->file) == w->buf_len &&
+              fseek(w->file, 0, SEEK_SET) == 0 &&
+              fwrite(&w->header, sizeof(w->header), 1, w->file) == 1;
+    if (fclose(w->file) != 0)
+    {
+        ok = false;
+    }
+    free(w);
+    return ok ? 0 : -1;
+}
+
+BranchStream *branch_stream_open(const char *filename)
+{
+    void *map;
+    size_t map_size;
+    if (trace_reader_map_file(filename, &map, &map_size) != 0)
+    {
+        return NULL;
+    }
+
+    BranchStream *s = (BranchStream *)calloc(1, sizeof(BranchStream));
+    if (s == NULL || map_size < sizeof(BranchStreamHeader))
+    {
+        int error = s == NULL ? ENOMEM : EINVAL;
+        if (map != NULL)
+        {
+            munmap(map, map_size);
+        }
+        free(s);
+        errno = error;
+        return NULL;
+    }
+
+    memcpy(&s->header, map, sizeof(s->header));
+    if (memcmp(s->header.magic, BRANCH_STREAM_MAGIC,
+               sizeof(s->header.magic)) != 0 ||
+        s->header.version != BRANCH_STREAM_VERSION)
+    {
+        munmap(map, map_size);
+        free(s);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    s->map = (uint8_t *)map;
+    s->map_size = map_size;
+    s->pos = s->map + sizeof(s->header);
+    return s;
+}
+
+int branch_stream_read(BranchStream *s, BranchRec *branches,
+                       uint32_t max_branches, uint32_t *num_branches)
+{
+    const uint8_t *in = s->pos;
+    const uint8_t *end = s->map + s->map_size;
+    uint64_t prev_inst_addr = s->prev_inst_addr;
+    uint64_t remaining = s->header.num_branches - s->num_read;
+    uint32_t n = remaining < max_branches ? (uint32_t)remaining
+                                          : max_branches;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        BranchRec *branch = &branches[i];
+        uint64_t v;
+        if ((in = varint_get(in, end, &v)) == NULL)
+        {
+            return -1;
+        }
+        branch->op_distance = v >> BS_FLAG_BITS;
+        branch->br_dir = (v & BS_BR_DIR) != 0;
+        bool has_br_target = (v & BS_HAS_BR_TGT) != 0;
+
+        if ((in = varint_get(in, end, &v)) == NULL)
+        {
+            return -1;
+        }
+        branch->inst_addr = prev_inst_addr + zigzag_decode(v);
+        prev_inst_addr = branch->inst_addr;
+
+        branch->br_target = 0;
+        if (has_br_target)
+        {
+            if ((in = varint_get(in, end, &v)) == NULL)
+            {
+                return -1;
+            }
+            branch->br_target = branch->inst_addr + zigzag_decode(v);
+        }
+    }
+
+    s->pos = in;
+    s->prev_inst_addr = prev_inst_addr;
+    s->num_read += n;
+    *num_branches = n;
+
+    // The last branch must end the file.
+    return s->num_read < s->header.num_branches || in == end ? 0 : -1;
+}
+
+void branch_stream_free(BranchStream *s)
+{
+    if (s == NULL)
+    {
+        return;
+    }
+    if (s->map != NULL)
+    {
+        munmap(s->map, s->map_size);
+    }
+    free(s);
+}
@@ -0,0 +1,180 @@
+// branch_stream.h
+// Declares the branch stream format: just the conditional branches of a
+// trace, extracted once by brstream so that predictor studies, which need
+// nothing else, can replay them from a file about a tenth the size of the
+// trace, without decoding the other records.
+//
+// A branch stream file is a BranchStreamHeader followed by the encoded
+// branches, in trace order, up to the end of the file. Each is encoded as:
+//   varint:   op_distance, shifted left 2, or'ed with whether br_target is
+//             nonzero (bit 1) and br_dir (bit 0)
+//   varint:   inst_addr, as a zigzag delta from the previous inst_addr
+//   varint:   br_target, as a zigzag delta from inst_addr, only if nonzero
+// The varints are those of the packed trace format; see trace_packed.h.
+
+#ifndef _BRANCH_STREAM_H_
+#define _BRANCH_STREAM_H_
+
+#include "trace_reader.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * The magic bytes at the start of every branch stream file.
+ */
+#define BRANCH_STREAM_MAGIC "LAB2PBR1"
+
+/**
+ * The version of the branch stream format.
+ */
+#define BRANCH_STREAM_VERSION 1
+
+/**
+ * The largest number of bytes a single branch can encode to: three varints.
+ */
+#define BRANCH_STREAM_MAX_REC_SIZE 30
+
+/**
+ * The header at the start of every branch stream file.
+ */
+typedef struct BranchStreamHeader
+{
+    /** BRANCH_STREAM_MAGIC, without the terminating NUL. */
+    char magic[8];
+    /** BRANCH_STREAM_VERSION. */
+    uint32_t version;
+    /** Reserved; must be zero. */
+    uint32_t reserved0;
+    /** The number of branches in the file. */
+    uint64_t num_branches;
+    /** The number of records in the trace the branches were extracted
+        from. */
+    uint64_t num_records;
+    /** Reserved; must be zero. */
+    uint8_t reserved[16];
+} BranchStreamHeader;
+
+/**
+ * A conditional branch of a trace.
+ */
+typedef struct BranchRec
+{
+    /** The address of the branch. */
+    uint64_t inst_addr;
+    /** The target of the branch, as in its trace record. */
+    uint64_t br_target;
+    /** The number of records from the previous branch to this one, or from
+        the start of the trace for the first branch; the difference between
+        their op_ids. */
+    uint64_t op_distance;
+    /** The direction of the branch; see BranchDirection. */
+    uint8_t br_dir;
+} BranchRec;
+
+/**
+ * A branch stream file being written.
+ */
+typedef struct BranchStreamWriter
+{
+    /** The file being written. */
+    FILE *file;
+    /** The header to write once the counts are known. */
+    BranchStreamHeader header;
+    /** The number of records since the last branch. */
+    uint64_t op_distance;
+    /** The address of the last branch written. */
+    uint64_t prev_inst_addr;
+    /** The number of bytes of encoded branches in buf. */
+    size_t buf_len;
+    /** The encoded branches not yet written to the file. */
+    uint8_t buf[65536];
+} BranchStreamWriter;
+
+/**
+ * A branch stream file being read, mapped into memory.
+ */
+typedef struct BranchStream
+{
+    /** The header of the file. */
+    BranchStreamHeader header;
+    /** The mapping of the whole file. */
+    uint8_t *map;
+    /** The length of the mapping, in bytes. */
+    size_t map_size;
+    /** The next encoded branch to decode. */
+    const uint8_t *pos;
+    /** The number of branches decoded so far. */
+    uint64_t num_read;
+    /** The address of the last branch decoded. */
+    uint64_t prev_inst_addr;
+} BranchStream;
+
+/**
+ * Check whether a file is a branch stream file, by its magic bytes.
+ *
+ * @param filename the path of the file
+ * @return true if the file starts with BRANCH_STREAM_MAGIC
+ */
+bool branch_stream_is_stream(const char *filename);
+
+/**
+ * Create a branch stream file, to which the records of a trace can be
+ * passed with branch_stream_write().
+ *
+ * @param filename the path of the file to create
+ * @return a pointer to a newly allocated writer, or NULL if the file could
+ *         not be created
+ */
+BranchStreamWriter *branch_stream_create(const char *filename);
+
+/**
+ * Pass the next record of a trace to a branch stream file, which keeps it
+ * only if it is a conditional branch.
+ *
+ * @param w the writer
+ * @param rec the record
+ * @return 0 on success, or -1 if the file could not be written
+ */
+int branch_stream_write(BranchStreamWriter *w, const TraceRec *rec);
+
+/**
+ * Finish writing a branch stream file: write the rest of the branches and
+ * the header, close the file, and free the writer.
+ *
+ * @param w the writer, which is freed even on failure
+ * @return 0 on success, or -1 if the file could not be written
+ */
+int branch_stream_finish(BranchStreamWriter *w);
+
+/**
+ * Map a branch stream file for reading.
+ *
+ * @param filename the path of the branch stream file
+ * @return a pointer to a newly allocated stream, or NULL if the file could
+ *         not be mapped or has an invalid header (errno is EINVAL in that
+ *         case)
+ */
+BranchStream *branch_stream_open(const char *filename);
+
+/**
+ * Decode the next branches of a branch stream.
+ *
+ * @param s the stream
+ * @param branches the buffer to decode into
+ * @param max_branches the most branches to decode
+ * @param num_branches set to the number of branches decoded, which is fewer
+ *        than max_branches only at the end of the stream
+ * @return 0 on success, or -1 if the file is malformed
+ */
+int branch_stream_read(BranchStream *s, BranchRec *branches,
+                       uint32_t max_branches, uint32_t *num_branches);
+
+/**
+ * Unmap a branch stream file and free the stream.
+ *
+ * @param s the stream to free
+ */
+void branch_stream_free(BranchStream *s);
+
+#endif
@@ -0,0 +1,213 @@
+// brstream.cpp
+// Extracts the conditional branches of a trace into a branch stream file,
+// which sim -bpredonly replays much faster than the whole trace, and can
+// verify the result against the trace.
+
+#include "branch_stream.h"
+#include "trace_reader.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+int extract_branches(const char *in_filename, const char *out_filename);
+int verify_branches(const char *in_filename, const char *out_filename);
+void print_usage(char *program_name);
+
+int main(int argc, char *argv[])
+{
+    bool verify = false;
+    const char *filenames[2] = {NULL, NULL};
+    int num_filenames = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+        else if (strcmp(argv[i], "-verify") == 0)
+        {
+            verify = true;
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+            return 2;
+        }
+        else if (num_filenames < 2)
+        {
+            filenames[num_filenames++] = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "Error: too many file names\n");
+            return 2;
+        }
+    }
+
+    if (num_filenames != 2)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    int status = extract_branches(filenames[0], filenames[1]);
+    if (status == 0 && verify)
+    {
+        status = verify_branches(filenames[0], filenames[1]);
+    }
+    return status;
+}
+
+int extract_branches(const char *in_filename, const char *out_filename)
+{
+    TraceOpenMethod method;
+    TraceReader *in = trace_reader_open(in_filename, NULL, &method);
+    if (in == NULL)
+    {
+        perror("Couldn't open trace file");
+        return 1;
+    }
+
+    BranchStreamWriter *out = branch_stream_create(out_filename);
+    if (out == NULL)
+    {
+        perror("Couldn't create branch stream");
+        trace_reader_free(in);
+        return 1;
+    }
+
+    TraceRec rec;
+    TraceReadStatus read_status;
+    int status = 0;
+    while (status == 0 &&
+           (read_status = trace_reader_next(in, &rec)) == TRACE_READ_OK)
+    {
+        if (branch_stream_write(out, &rec) != 0)
+        {
+            perror("Couldn't write branch stream");
+            status = 1;
+        }
+    }
+
+    if (status == 0 && read_status == TRACE_READ_ERROR)
+    {
+        trace_reader_perror(in, "Couldn't read trace");
+        status = 1;
+    }
+    else if (status == 0 && read_status == TRACE_READ_TRUNCATED)
+    {
+        fprintf(stderr, "Error: Invalid trace file: partial trace record\n");
+        status = 1;
+    }
+
+    BranchStreamHeader header = out->header;
+    if (branch_stream_finish(out) != 0 && status == 0)
+    {
+        perror("Couldn't write branch stream");
+        status = 1;
+    }
+
+    if (status == 0)
+    {
+        struct stat in_st, out_st;
+        stat(in_filename, &in_st);
+        stat(out_filename, &out_st);
+
+        printf("Records:            %10llu\n",
+               (unsigned long long)header.num_records);
+        printf("Branches:           %10llu\n",
+               (unsigned long long)header.num_branches);
+        printf("Input size:         %10llu bytes\n",
+               (unsigned long long)in_st.st_size);
+        printf("Stream size:        %10llu bytes (%.2f bytes/branch)\n",
+               (unsigned long long)out_st.st_size,
+               header.num_branches > 0 ? (double)out_st.st_size /
+                                             (double)header.num_branches
+                                       : 0.0);
+        printf("Input / stream:     %10.2fx\n",
+               (double)in_st.st_size / (double)out_st.st_size);
+    }
+    else
+    {
+        remove(out_filename);
+    }
+
+    trace_reader_free(in);
+    return status;
+}
+
+int verify_branches(const char *in_filename, const char *out_filename)
+{
+    TraceOpenMethod method;
+    TraceReader *in = trace_reader_open(in_filename, NULL, &method);
+    BranchStream *stream = branch_stream_open(out_filename);
+    if (in == NULL || stream == NULL)
+    {
+        fprintf(stderr, "Error: couldn't open files to verify\n");
+        trace_reader_free(in);
+        branch_stream_free(stream);
+        return 1;
+    }
+
+    // Every branch must come back with its fields, and at its distance from
+    // the branch before it.
+    uint64_t n = 0;
+    uint64_t op_distance = 0;
+    int status = 0;
+    TraceRec rec;
+    while (status == 0 && trace_reader_next(in, &rec) == TRACE_READ_OK)
+    {
+        op_distance++;
+        if (rec.op_type != OP_CBR)
+        {
+            continue;
+        }
+
+        BranchRec branch;
+        uint32_t num_branches;
+        if (branch_stream_read(stream, &branch, 1, &num_branches) != 0 ||
+            num_branches != 1 || branch.inst_addr != rec.inst_addr ||
+            branch.br_target != rec.br_target || branch.br_dir != rec.br_dir ||
+            branch.op_distance != op_distance)
+        {
+            fprintf(stderr, "Error: branch %llu does not match the trace\n",
+                    (unsigned long long)n);
+            status = 1;
+        }
+        n++;
+        op_distance = 0;
+    }
+
+    BranchRec extra;
+    uint32_t num_extra = 0;
+    if (status == 0 &&
+        (stream->header.num_records != in->stat_num_records ||
+         branch_stream_read(stream, &extra, 1, &num_extra) != 0 ||
+         num_extra != 0))
+    {
+        fprintf(stderr, "Error: branch stream does not end with the trace\n");
+        status = 1;
+    }
+    if (status == 0)
+    {
+        printf("Verified %llu branches\n", (unsigned long long)n);
+    }
+
+    trace_reader_free(in);
+    branch_stream_free(stream);
+    return status;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <trace file> <branch stream file>\n\n",
+            program_name);
+    fprintf(stderr, "Extracts the conditional branches of a trace into a branch stream, which\n");
+    fprintf(stderr, "sim -bpredonly can replay instead of the trace\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -verify             Check that the branch stream matches the trace\n");
+}
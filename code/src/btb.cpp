@@ -0,0 +1,116 @@
+// btb.cpp
+// Implements the branch target buffer declared in btb.h.
+
+#include "btb.h"
+#include <stdlib.h>
+#include <string.h>
+
+void btb_config_init(BtbConfig *config)
+{
+    config->num_entries = 0;
+    config->assoc = 4;
+    config->miss_penalty = 2;
+}
+
+bool btb_config_valid(const BtbConfig *config)
+{
+    bool has_btb = config->num_entries > 0;
+    return config->assoc >= 1 && config->assoc <= BTB_MAX_ASSOC &&
+           (config->assoc & (config->assoc - 1)) == 0 &&
+           config->miss_penalty <= BTB_MAX_MISS_PENALTY &&
+           (!has_btb ||
+            (config->num_entries <= BTB_MAX_ENTRIES &&
+             (config->num_entries & (config->num_entries - 1)) == 0 &&
+             config->assoc <= config->num_entries));
+}
+
+Btb *btb_init(const BtbConfig *config)
+{
+    Btb *btb = (Btb *)calloc(1, sizeof(Btb));
+    btb->config = *config;
+    btb->entries = (BtbEntry *)calloc(config->num_entries, sizeof(BtbEntry));
+
+    btb->set_shift = 32;
+    for (uint32_t sets = config->num_entries / config->assoc; sets > 1;
+         sets >>= 1)
+    {
+        btb->set_shift--;
+    }
+    return btb;
+}
+
+void btb_free(Btb *btb)
+{
+    if (btb == NULL)
+    {
+        return;
+    }
+    free(btb->entries);
+    free(btb);
+}
+
+bool btb_access(Btb *btb, uint64_t pc, uint64_t target)
+{
+    // Pick the set by Fibonacci hashing, like the perceptron predictor picks
+    // its rows, so that every address bit counts.
+    uint64_t hash = (uint32_t)((uint32_t)(pc ^ (pc >> 32)) * 0x9E3779B9u);
+    uint32_t set = (uint32_t)(hash >> btb->set_shift);
+    BtbEntry *ways = &btb->entries[(size_t)set * btb->config.assoc];
+
+    btb->clock++;
+    btb->stat_lookups++;
+
+    // Find the branch, or else the least recently used way, empty ones first.
+    BtbEntry *victim = &ways[0];
+    for (uint32_t w = 0; w < btb->config.assoc; w++)
+    {
+        BtbEntry *entry = &ways[w];
+        if (entry->last_use != 0 && entry->pc == pc)
+        {
+            bool hit = entry->target == target;
+            entry->target = target;
+            entry->last_use = btb->clock;
+            btb->stat_misses += !hit;
+            return hit;
+        }
+        if (entry->last_use < victim->last_use)
+        {
+            victim = entry;
+        }
+    }
+
+    victim->pc = pc;
+    victim->target = target;
+    victim->last_use = btb->clock;
+    btb->stat_misses++;
+    return false;
+}
+
+bool btb_save(const Btb *btb, FILE *file)
+{
+    uint64_t counters[3] = {btb->clock, btb->stat_lookups, btb->stat_misses};
+
+    return fwrite(&btb->config, sizeof(btb->config), 1, file) == 1 &&
+           fwrite(counters, sizeof(counters), 1, file) == 1 &&
+           fwrite(btb->entries, sizeof(BtbEntry), btb->config.num_entries,
+                  file) == btb->config.num_entries;
+}
+
+bool btb_restore(Btb *btb, FILE *file)
+{
+    BtbConfig saved_config;
+    uint64_t counters[3];
+    if (fread(&saved_config, sizeof(saved_config), 1, file) != 1 ||
+        memcmp(&saved_config, &btb->config, sizeof(saved_config)) != 0 ||
+        fread(counters, sizeof(counters), 1, file) != 1 ||
+        fread(btb->entries, sizeof(BtbEntry), btb->config.num_entries,
+              file) != btb->config.num_entries)
+    {
+        return false;
+    }
+
+    btb->clock = counters[0];
+    btb->stat_lookups = counters[1];
+    btb->stat_misses = counters[2];
+    return true;
+}
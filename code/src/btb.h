@@ -0,0 +1,148 @@
+// btb.h
+// Declares the branch target buffer of the pipeline's front end: a
+// set-associative cache of the targets of taken branches, looked up by branch
+// address at fetch so that fetch can be redirected without waiting for the
+// branch to be decoded.
+
+#ifndef _BTB_H_
+#define _BTB_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * The most entries a branch target buffer can have.
+ */
+#define BTB_MAX_ENTRIES (1u << 20)
+
+/**
+ * The most ways a set of a branch target buffer can have.
+ */
+#define BTB_MAX_ASSOC 64
+
+/**
+ * The most bubbles fetch can be made to insert after a BTB miss.
+ */
+#define BTB_MAX_MISS_PENALTY 64
+
+/**
+ * The geometry of a branch target buffer, and the cost of missing in it.
+ *
+ * sim and pipe_config_parse set these with -btb_entries, -btb_assoc and
+ * -btb_miss_penalty.
+ */
+typedef struct BtbConfig
+{
+    /** The number of entries, a power of two, or 0 to leave the front end
+        unmodeled: no BTB, and taken branches redirect fetch for free. */
+    uint32_t num_entries;
+    /** The number of entries per set, a power of two. */
+    uint32_t assoc;
+    /** The number of cycles fetch inserts bubbles for after a taken branch
+        whose target was not in the BTB. */
+    uint32_t miss_penalty;
+} BtbConfig;
+
+/**
+ * One entry of a branch target buffer.
+ */
+typedef struct BtbEntry
+{
+    /** The address of the branch. */
+    uint64_t pc;
+    /** The target of the branch the last time it was taken. */
+    uint64_t target;
+    /** The value of the buffer's clock when the entry was last used, or 0
+        if the entry is empty. */
+    uint64_t last_use;
+} BtbEntry;
+
+/**
+ * A set-associative branch target buffer with LRU replacement.
+ */
+typedef struct Btb
+{
+    /** The geometry of the buffer. */
+    BtbConfig config;
+    /** The shift taking a 32-bit hash of an address to a set. */
+    uint32_t set_shift;
+    /** The entries, assoc per set, one set after another. */
+    BtbEntry *entries;
+    /** The number of accesses so far, which orders the entries by use. */
+    uint64_t clock;
+
+    /** The number of taken branches looked up. */
+    uint64_t stat_lookups;
+    /** The number of taken branches whose target was not found. */
+    uint64_t stat_misses;
+} Btb;
+
+/**
+ * Set a BTB geometry to the defaults: no BTB; when one is enabled, 4 ways
+ * per set and a 2-cycle miss penalty.
+ *
+ * @param config the geometry to initialize
+ */
+void btb_config_init(BtbConfig *config);
+
+/**
+ * Check whether a BTB geometry can be simulated: sets of a power of two ways
+ * up to BTB_MAX_ASSOC, a miss penalty of at most BTB_MAX_MISS_PENALTY, and
+ * either no entries or a power of two up to BTB_MAX_ENTRIES, at least one
+ * set's worth.
+ *
+ * @param config the geometry to check
+ * @return true if the geometry is valid
+ */
+bool btb_config_valid(const BtbConfig *config);
+
+/**
+ * Allocate and initialize a new, empty branch target buffer.
+ *
+ * @param config the geometry of the buffer, which must be valid and have
+ *        entries
+ * @return the new buffer
+ */
+Btb *btb_init(const BtbConfig *config);
+
+/**
+ * Free a branch target buffer.
+ *
+ * @param btb the buffer to free
+ */
+void btb_free(Btb *btb);
+
+/**
+ * Look up the target of a taken branch, and remember it for next time,
+ * evicting the least recently used entry of its set if the branch has none.
+ *
+ * @param btb the buffer
+ * @param pc the address of the branch
+ * @param target the address the branch went to
+ * @return true if the buffer held the branch with that target
+ */
+bool btb_access(Btb *btb, uint64_t pc, uint64_t target);
+
+/**
+ * Write the geometry, entries, and statistics of a branch target buffer to a
+ * checkpoint file.
+ *
+ * @param btb the buffer
+ * @param file the file to write to
+ * @return true on success, or false if the file could not be written
+ */
+bool btb_save(const Btb *btb, FILE *file);
+
+/**
+ * Replace the entries and statistics of a branch target buffer with those
+ * written to a checkpoint file by btb_save().
+ *
+ * @param btb the buffer
+ * @param file the file to read from
+ * @return true on success, or false if the file could not be read or was
+ *         saved by a buffer with a different geometry
+ */
+bool btb_restore(Btb *btb, FILE *file);
+
+#endif
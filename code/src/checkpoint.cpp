@@ -0,0 +1,245 @@
+// checkpoint.cpp
+// Implements simulation checkpoints.
+
+#include "checkpoint.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Write one pipeline latch, with the trace record of its instruction, to a
+ * checkpoint file. Bubbles are written with an empty record.
+ *
+ * @return true on success
+ */
+static bool checkpoint_write_latch(FILE *file, const Pipeline *p,
+                                   const PipelineLatch *latch)
+{
+    uint8_t flags[3] = {latch->valid, latch->stall, latch->is_mispred_cbr};
+    TraceRec rec;
+    if (latch->valid)
+    {
+        rec = *pipe_latch_rec(p, latch);
+    }
+    else
+    {
+        memset(&rec, 0, sizeof(rec));
+    }
+
+    return fwrite(flags, 1, sizeof(flags), file) == sizeof(flags) &&
+           fwrite(&latch->op_id, sizeof(latch->op_id), 1, file) == 1 &&
+           fwrite(&rec, sizeof(TraceRec), 1, file) == 1;
+}
+
+/**
+ * Read one pipeline latch, with the trace record of its instruction, from a
+ * checkpoint file.
+ *
+ * @return true on success
+ */
+static bool checkpoint_read_latch(FILE *file, PipelineLatch *latch,
+                                  TraceRec *rec)
+{
+    uint8_t flags[3];
+
+    if (fread(flags, 1, sizeof(flags), file) != sizeof(flags) ||
+        fread(&latch->op_id, sizeof(latch->op_id), 1, file) != 1 ||
+        fread(rec, sizeof(TraceRec), 1, file) != 1)
+    {
+        return false;
+    }
+
+    latch->valid = flags[0] != 0;
+    latch->stall = flags[1] != 0;
+    latch->is_mispred_cbr = flags[2] != 0;
+    return true;
+}
+
+int checkpoint_save(const Pipeline *p, uint64_t trace_position,
+                    const char *filename)
+{
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.rec_size = sizeof(TraceRec);
+    header.pipe_width = p->config.pipe_width;
+    header.bpred_policy = p->config.bpred_policy;
+    header.trace_position = trace_position;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (int stage = 0; stage < NUM_LATCH_TYPES; stage++)
+    {
+        for (unsigned int i = 0; ok && i < p->config.pipe_width; i++)
+        {
+            ok = checkpoint_write_latch(file, p, &p->pipe_latch[stage][i]);
+        }
+    }
+
+    uint8_t flags[2] = {p->fetch_cbr_stall, p->halt};
+    uint64_t counters[4] = {p->stat_retired_inst, p->stat_num_cycle,
+                            p->last_op_id, p->halt_op_id};
+    ok = ok && fwrite(flags, 1, sizeof(flags), file) == sizeof(flags) &&
+         fwrite(counters, sizeof(counters), 1, file) == 1;
+
+    if (ok && p->b_pred != NULL)
+    {
+        ok = p->b_pred->save(file);
+    }
+
+    if (ok && p->btb != NULL)
+    {
+        uint64_t frontend[4] = {p->fetch_redirect_bubbles,
+                                p->stat_fetch_breaks,
+                                p->stat_fetch_break_lanes,
+                                p->stat_redirect_cycles};
+        ok = fwrite(frontend, sizeof(frontend), 1, file) == 1 &&
+             btb_save(p->btb, file);
+    }
+
+    if (fclose(file) != 0)
+    {
+        ok = false;
+    }
+    if (!ok)
+    {
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Read the header of an open checkpoint file and check that this simulator
+ * can read the rest of it.
+ *
+ * @return 0 on success, or -1 on error
+ */
+static int checkpoint_read_header_from(FILE *file, CheckpointHeader *header)
+{
+    if (fread(header, sizeof(*header), 1, file) != 1)
+    {
+        if (!ferror(file))
+        {
+            errno = EINVAL;
+        }
+        return -1;
+    }
+
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != CHECKPOINT_VERSION ||
+        header->rec_size != sizeof(TraceRec) ||
+        header->pipe_width < 1 || header->pipe_width > MAX_PIPE_WIDTH ||
+        header->bpred_policy >= NUM_BPRED_POLICIES)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int checkpoint_read_header(const char *filename, CheckpointHeader *header)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    int status = checkpoint_read_header_from(file, header);
+    fclose(file);
+    return status;
+}
+
+int checkpoint_restore(Pipeline *p, const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    CheckpointHeader header;
+    if (checkpoint_read_header_from(file, &header) != 0)
+    {
+        fclose(file);
+        return -1;
+    }
+    if (header.pipe_width != p->config.pipe_width ||
+        header.bpred_policy != (uint32_t)p->config.bpred_policy)
+    {
+        fclose(file);
+        errno = EINVAL;
+        return -1;
+    }
+
+    bool ok = true;
+    TraceRec recs[NUM_LATCH_TYPES][MAX_PIPE_WIDTH];
+    memset(recs, 0, sizeof(recs));
+    for (int stage = 0; stage < NUM_LATCH_TYPES; stage++)
+    {
+        for (unsigned int i = 0; ok && i < p->config.pipe_width; i++)
+        {
+            ok = checkpoint_read_latch(file, &p->pipe_latch[stage][i],
+                                       &recs[stage][i]);
+        }
+    }
+
+    pipe_sync_window(p, recs);
+    pipe_sync_scoreboards(p);
+
+    uint8_t flags[2];
+    uint64_t counters[4];
+    ok = ok && fread(flags, 1, sizeof(flags), file) == sizeof(flags) &&
+         fread(counters, sizeof(counters), 1, file) == 1;
+    if (ok)
+    {
+        p->fetch_cbr_stall = flags[0] != 0;
+        p->halt = flags[1] != 0;
+        p->stat_retired_inst = counters[0];
+        p->stat_num_cycle = counters[1];
+        p->last_op_id = counters[2];
+        p->halt_op_id = counters[3];
+    }
+
+    if (ok && p->b_pred != NULL)
+    {
+        ok = p->b_pred->restore(file);
+    }
+
+    if (ok && p->btb != NULL)
+    {
+        uint64_t frontend[4];
+        ok = fread(frontend, sizeof(frontend), 1, file) == 1 &&
+             btb_restore(p->btb, file);
+        if (ok)
+        {
+            p->fetch_redirect_bubbles = (uint32_t)frontend[0];
+            p->stat_fetch_breaks = frontend[1];
+            p->stat_fetch_break_lanes = frontend[2];
+            p->stat_redirect_cycles = frontend[3];
+        }
+    }
+
+    // Anything left over means the file doesn't match what was expected.
+    ok = ok && fgetc(file) == EOF && !ferror(file);
+
+    bool read_error = ferror(file) != 0;
+    fclose(file);
+    if (!ok)
+    {
+        if (!read_error)
+        {
+            errno = EINVAL;
+        }
+        return -1;
+    }
+    return 0;
+}
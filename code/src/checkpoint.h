@@ -0,0 +1,94 @@
+// checkpoint.h
+// Declares simulation checkpoints, which snapshot a pipeline mid-run so that
+// a later run can resume from the same point instead of re-simulating
+// everything before it.
+//
+// A checkpoint file is a CheckpointHeader followed by the pipeline state:
+//   latches:  for each of the NUM_LATCH_TYPES stages and each of the
+//             pipe_width lanes, valid, stall and is_mispred_cbr (one byte
+//             each), op_id (8 bytes) and the raw TraceRec
+//   scalars:  fetch_cbr_stall and halt (one byte each), then
+//             stat_retired_inst, stat_num_cycle, last_op_id and halt_op_id
+//             (8 bytes each)
+//   bpred:    the branch predictor state written by BPred::save(), if the
+//             policy is not BPRED_PERFECT
+//   frontend: if the front end is modeled, fetch_redirect_bubbles,
+//             stat_fetch_breaks, stat_fetch_break_lanes and
+//             stat_redirect_cycles (8 bytes each), then the BTB state
+//             written by btb_save()
+// All integers are in host byte order.
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include "pipeline.h"
+#include <inttypes.h>
+
+/**
+ * The magic bytes at the start of every checkpoint file.
+ */
+#define CHECKPOINT_MAGIC "LAB2CKP1"
+
+/**
+ * The version of the checkpoint format.
+ */
+#define CHECKPOINT_VERSION 2
+
+/**
+ * The header at the start of every checkpoint file.
+ */
+typedef struct CheckpointHeader
+{
+    /** CHECKPOINT_MAGIC, without the terminating NUL. */
+    char magic[8];
+    /** CHECKPOINT_VERSION. */
+    uint32_t version;
+    /** sizeof(TraceRec) on the machine that wrote the file. */
+    uint32_t rec_size;
+    /** The width of the pipeline that was saved. */
+    uint32_t pipe_width;
+    /** The branch prediction policy of the pipeline that was saved. */
+    uint32_t bpred_policy;
+    /** The index in the trace of the next record the pipeline would fetch. */
+    uint64_t trace_position;
+    /** Reserved for future use; zero. */
+    uint8_t reserved[32];
+} CheckpointHeader;
+
+/**
+ * Write a checkpoint of a pipeline and its branch predictor to a file.
+ *
+ * @param p the pipeline to save
+ * @param trace_position the index in the trace of the next record the
+ *        pipeline would fetch
+ * @param filename the path of the checkpoint file to write
+ * @return 0 on success, or -1 if the file could not be written
+ */
+int checkpoint_save(const Pipeline *p, uint64_t trace_position,
+                    const char *filename);
+
+/**
+ * Read and check the header of a checkpoint file.
+ *
+ * @param filename the path of the checkpoint file
+ * @param header set to the header of the file
+ * @return 0 on success, or -1 if the file could not be read or is not a
+ *         checkpoint written by this version of the simulator (errno is
+ *         EINVAL in that case)
+ */
+int checkpoint_read_header(const char *filename, CheckpointHeader *header);
+
+/**
+ * Restore the state of a pipeline and its branch predictor from a checkpoint
+ * file. The pipeline must have the width, branch prediction policy, and BTB
+ * the checkpoint was saved with, and its trace reader must already be positioned
+ * at the checkpoint's trace position.
+ *
+ * @param p the pipeline to restore, as returned by pipe_init()
+ * @param filename the path of the checkpoint file
+ * @return 0 on success, or -1 if the file could not be read or does not
+ *         match the pipeline (errno is EINVAL in that case)
+ */
+int checkpoint_restore(Pipeline *p, const char *filename);
+
+#endif
@@ -0,0 +1,488 @@
+// cpi_model.cpp
+// Implements the first-order analytical model of the pipeline declared in
+// cpi_model.h.
+//
+// The model updates the state of every tracked configuration per instruction,
+// so a pass costs time in proportion to their number; see cpi_model_init().
+// Each piece of state is a flat array with one column per configuration, and
+// the configurations of one width are adjacent, so that updating them is one
+// branch-free loop over contiguous entries, which AVX2 does four at a time.
+
+#include "cpi_model.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/** The index of the condition codes in CpiModel::reg_ready. */
+#define CPI_MODEL_CC 256
+
+/** The index of the scratch row in CpiModel::reg_ready. */
+#define CPI_MODEL_NOT_WRITTEN 257
+
+/** The index of the row of zeros in CpiModel::reg_ready. */
+#define CPI_MODEL_NOT_READ 258
+
+/** The number of rows in CpiModel::reg_ready. */
+#define CPI_MODEL_REG_ROWS 259
+
+/**
+ * [Internal] What one instruction needs from, and does to, the state of the
+ * configurations of a model. The gaps and masks are indexed by forwarding and
+ * policy combination, which every width repeats.
+ */
+typedef struct CpiModelInst
+{
+    /** The cycles after the instruction leaves ID that its readers can. */
+    const uint64_t *gap;
+    /** All ones if the instruction is a mispredicted branch, or else zero. */
+    const uint64_t *mispred_mask;
+    /** The rows of CpiModel::reg_ready of its sources and destinations. */
+    const uint64_t *src1;
+    const uint64_t *src2;
+    const uint64_t *cc;
+    uint64_t *dest;
+    uint64_t *cc_dest;
+    /** The row of CpiModel::next_cycle for the instruction. */
+    uint64_t *next_cycle;
+    /** The index of the instruction. */
+    uint64_t inst_num;
+} CpiModelInst;
+
+/** [Internal] The mispredicted branch masks of every other instruction. */
+static const uint64_t CPI_MODEL_NO_MISPRED[4 * NUM_BPRED_POLICIES] = {0};
+
+static unsigned int cpi_model_required_gap(unsigned int fwd, uint8_t op_type);
+static CpiModelUpdateFunc cpi_model_best_update(void);
+
+/**
+ * Allocate and initialize a new model that has seen no instructions.
+ *
+ * @param width_mask the widths to track: bit w - 1 set for width w, or
+ *        CPI_MODEL_ALL_WIDTHS
+ * @param policy_mask the branch prediction policies to track: bit p set for
+ *        policy p, or CPI_MODEL_ALL_POLICIES
+ * @return the new model, or NULL if it could not be allocated or either mask
+ *         selects nothing
+ */
+CpiModel *cpi_model_init(uint32_t width_mask, uint32_t policy_mask)
+{
+    CpiModel *m = (CpiModel *)calloc(1, sizeof(CpiModel));
+    if (m == NULL)
+    {
+        return NULL;
+    }
+
+    for (unsigned int width = 1; width <= MAX_PIPE_WIDTH; width++)
+    {
+        if (width_mask & (1u << (width - 1)))
+        {
+            m->widths[m->num_widths++] = width;
+        }
+    }
+    for (unsigned int policy = 0; policy < NUM_BPRED_POLICIES; policy++)
+    {
+        if (policy_mask & (1u << policy))
+        {
+            m->policies[m->num_policies++] = policy;
+        }
+    }
+    m->num_configs = m->num_widths * 4 * m->num_policies;
+    if (m->num_configs == 0)
+    {
+        free(m);
+        return NULL;
+    }
+
+    // One allocation holds every array, as rows of num_configs entries.
+    size_t num_rows = 2 + MAX_PIPE_WIDTH + CPI_MODEL_REG_ROWS;
+    uint64_t *state = (uint64_t *)calloc(num_rows * m->num_configs,
+                                         sizeof(uint64_t));
+    if (state == NULL)
+    {
+        free(m);
+        return NULL;
+    }
+    m->last_cycle = state;
+    m->fetch_ready = m->last_cycle + m->num_configs;
+    m->next_cycle = m->fetch_ready + m->num_configs;
+    m->reg_ready = m->next_cycle + MAX_PIPE_WIDTH * m->num_configs;
+
+    for (unsigned int i = 0; i < m->num_policies; i++)
+    {
+        unsigned int policy = m->policies[i];
+        if (policy != BPRED_PERFECT)
+        {
+            m->b_pred[policy] = new BPred((BPredPolicy)policy);
+        }
+    }
+
+    // The combinations of each width are ordered by forwarding paths, then
+    // policy, and the gap depends only on the forwarding paths.
+    for (unsigned int op_type = 0; op_type < NUM_OP_TYPES; op_type++)
+    {
+        for (unsigned int k = 0; k < 4 * m->num_policies; k++)
+        {
+            m->gap[op_type][k] = cpi_model_required_gap(k / m->num_policies,
+                                                        op_type);
+        }
+    }
+    m->update = cpi_model_best_update();
+    return m;
+}
+
+/**
+ * Free a model.
+ *
+ * @param m the model to free
+ */
+void cpi_model_free(CpiModel *m)
+{
+    if (m == NULL)
+    {
+        return;
+    }
+    for (int policy = 0; policy < NUM_BPRED_POLICIES; policy++)
+    {
+        delete m->b_pred[policy];
+    }
+    free(m->last_cycle);
+    free(m);
+}
+
+/**
+ * [Internal] Get a row of the model's register readiness.
+ *
+ * @param m the model
+ * @param row the register, or CPI_MODEL_CC, CPI_MODEL_NOT_WRITTEN or
+ *        CPI_MODEL_NOT_READ
+ * @return the row, with one entry per configuration
+ */
+static inline uint64_t *cpi_model_reg_row(const CpiModel *m, unsigned int row)
+{
+    return m->reg_ready + (size_t)row * m->num_configs;
+}
+
+/**
+ * [Internal] The number of cycles after a producer leaves ID that a consumer
+ * can leave ID, following the forwarding rules of the ID stage: one cycle if
+ * the producer forwards from EX, two if it forwards from MA, and three if the
+ * consumer waits for it to reach WB.
+ *
+ * @param fwd the forwarding paths: 2 for MA, plus 1 for EX
+ * @param op_type the type of the producing instruction
+ * @return the required gap in cycles
+ */
+static unsigned int cpi_model_required_gap(unsigned int fwd, uint8_t op_type)
+{
+    if (pipe_can_forward_EX((fwd & 1) != 0, op_type))
+    {
+        return 1;
+    }
+    if (pipe_can_forward_MA((fwd & 2) != 0))
+    {
+        return 2;
+    }
+    return 3;
+}
+
+/**
+ * [Internal] Wait for a register or the condition codes to be ready.
+ *
+ * @param ready the first cycle a reader can leave ID
+ * @param cycle the cycle the reader can leave ID so far
+ * @return the later of the two cycles
+ */
+static inline uint64_t cpi_model_wait(uint64_t ready, uint64_t cycle)
+{
+    return ready > cycle ? ready : cycle;
+}
+
+/**
+ * [Internal] Update every configuration of a model for one instruction, one
+ * configuration at a time.
+ *
+ * @param m the model
+ * @param inst the instruction
+ */
+static void cpi_model_update_scalar(CpiModel *m, const CpiModelInst *inst)
+{
+    // Copy the pointers first, or each store through one of them could change
+    // them as far as the compiler knows.
+    uint64_t *last_cycle = m->last_cycle;
+    uint64_t *fetch_ready = m->fetch_ready;
+    const uint64_t *src1 = inst->src1;
+    const uint64_t *src2 = inst->src2;
+    const uint64_t *cc = inst->cc;
+    uint64_t *dest = inst->dest;
+    uint64_t *cc_dest = inst->cc_dest;
+    uint64_t *next_cycle = inst->next_cycle;
+    const uint64_t *gap = inst->gap;
+    const uint64_t *mispred_mask = inst->mispred_mask;
+
+    const unsigned int num_combos = 4 * m->num_policies;
+    for (unsigned int i = 0; i < m->num_widths; i++)
+    {
+        // The instruction a full row back; before the first full row, a slot
+        // no instruction has written yet, so still zero.
+        const uint64_t *row_cycle =
+            m->next_cycle +
+            ((inst->inst_num - m->widths[i]) % MAX_PIPE_WIDTH) *
+                m->num_configs;
+
+        unsigned int base = i * num_combos;
+        for (unsigned int k = 0; k < num_combos; k++)
+        {
+            unsigned int c = base + k;
+            uint64_t cycle = last_cycle[c];
+            cycle = cpi_model_wait(row_cycle[c], cycle);
+            cycle = cpi_model_wait(fetch_ready[c], cycle);
+            cycle = cpi_model_wait(src1[c], cycle);
+            cycle = cpi_model_wait(src2[c], cycle);
+            cycle = cpi_model_wait(cc[c], cycle);
+
+            last_cycle[c] = cycle;
+            next_cycle[c] = cycle + 1;
+            dest[c] = cycle + gap[k];
+            cc_dest[c] = cycle + gap[k];
+            fetch_ready[c] = (fetch_ready[c] & ~mispred_mask[k]) |
+                             ((cycle + CPI_MODEL_MISPRED_CYCLES) &
+                              mispred_mask[k]);
+        }
+    }
+}
+
+#ifndef PIPE_NO_SIMD
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * [Internal] Wait for four configurations' registers to be ready. Cycles stay
+ * far below 2^63, so the signed comparison is exact.
+ *
+ * @see cpi_model_wait()
+ */
+__attribute__((target("avx2")))
+static inline __m256i cpi_model_wait_avx2(__m256i ready, __m256i cycle)
+{
+    return _mm256_blendv_epi8(cycle, ready, _mm256_cmpgt_epi64(ready, cycle));
+}
+
+/**
+ * [Internal] Update every configuration of a model for one instruction, four
+ * configurations per AVX2 instruction. Each width has a multiple of four
+ * configurations, so none are left over. Only call this on a CPU that
+ * supports AVX2.
+ *
+ * @see cpi_model_update_scalar()
+ */
+__attribute__((target("avx2")))
+static void cpi_model_update_avx2(CpiModel *m, const CpiModelInst *inst)
+{
+    const unsigned int num_combos = 4 * m->num_policies;
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i mispred_cycles = _mm256_set1_epi64x(CPI_MODEL_MISPRED_CYCLES);
+    for (unsigned int i = 0; i < m->num_widths; i++)
+    {
+        const uint64_t *row_cycle =
+            m->next_cycle +
+            ((inst->inst_num - m->widths[i]) % MAX_PIPE_WIDTH) *
+                m->num_configs;
+
+        unsigned int base = i * num_combos;
+        for (unsigned int k = 0; k < num_combos; k += 4)
+        {
+            unsigned int c = base + k;
+            __m256i fetch_ready =
+                _mm256_loadu_si256((const __m256i *)&m->fetch_ready[c]);
+            __m256i cycle =
+                _mm256_loadu_si256((const __m256i *)&m->last_cycle[c]);
+            cycle = cpi_model_wait_avx2(
+                _mm256_loadu_si256((const __m256i *)&row_cycle[c]), cycle);
+            cycle = cpi_model_wait_avx2(fetch_ready, cycle);
+            cycle = cpi_model_wait_avx2(
+                _mm256_loadu_si256((const __m256i *)&inst->src1[c]), cycle);
+            cycle = cpi_model_wait_avx2(
+                _mm256_loadu_si256((const __m256i *)&inst->src2[c]), cycle);
+            cycle = cpi_model_wait_avx2(
+                _mm256_loadu_si256((const __m256i *)&inst->cc[c]), cycle);
+
+            __m256i ready = _mm256_add_epi64(
+                cycle, _mm256_loadu_si256((const __m256i *)&inst->gap[k]));
+            __m256i mispred_mask =
+                _mm256_loadu_si256((const __m256i *)&inst->mispred_mask[k]);
+            _mm256_storeu_si256((__m256i *)&m->last_cycle[c], cycle);
+            _mm256_storeu_si256((__m256i *)&inst->next_cycle[c],
+                                _mm256_add_epi64(cycle, one));
+            _mm256_storeu_si256((__m256i *)&inst->dest[c], ready);
+            _mm256_storeu_si256((__m256i *)&inst->cc_dest[c], ready);
+            _mm256_storeu_si256(
+                (__m256i *)&m->fetch_ready[c],
+                _mm256_blendv_epi8(fetch_ready,
+                                   _mm256_add_epi64(cycle, mispred_cycles),
+                                   mispred_mask));
+        }
+    }
+}
+#endif
+#endif
+
+/**
+ * [Internal] Get the fastest update this CPU supports. Building with
+ * -DPIPE_NO_SIMD forces the scalar update.
+ *
+ * @return the update to use
+ */
+static CpiModelUpdateFunc cpi_model_best_update(void)
+{
+#ifndef PIPE_NO_SIMD
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return cpi_model_update_avx2;
+    }
+#endif
+#endif
+    return cpi_model_update_scalar;
+}
+
+/**
+ * Add one instruction of a trace to a model. Instructions must be added in
+ * trace order.
+ *
+ * @param m the model to add to
+ * @param rec the trace record of the instruction
+ */
+void cpi_model_add(CpiModel *m, const TraceRec *rec)
+{
+    CpiModelInst inst;
+    inst.inst_num = m->num_inst++;
+
+    // Each predictor sees the branches in trace order, exactly as it does when
+    // the IF stage checks them, so it makes the same predictions.
+    bool mispred[NUM_BPRED_POLICIES] = {false};
+    bool any_mispred = false;
+    if (rec->op_type == OP_CBR)
+    {
+        m->num_branches++;
+        for (int policy = 0; policy < NUM_BPRED_POLICIES; policy++)
+        {
+            BPred *b_pred = m->b_pred[policy];
+            if (b_pred != NULL)
+            {
+                BranchDirection prediction = b_pred->predict(rec->inst_addr);
+                b_pred->update(rec->inst_addr, prediction,
+                               (BranchDirection)rec->br_dir);
+                mispred[policy] = prediction != rec->br_dir;
+                any_mispred |= mispred[policy];
+            }
+        }
+    }
+
+    // Most instructions are not mispredicted branches, so share the tables
+    // of every other instruction of the same type.
+    inst.gap = m->gap[rec->op_type];
+    inst.mispred_mask = CPI_MODEL_NO_MISPRED;
+    uint64_t mispred_mask[4 * NUM_BPRED_POLICIES];
+    if (any_mispred)
+    {
+        for (unsigned int k = 0; k < 4 * m->num_policies; k++)
+        {
+            mispred_mask[k] = mispred[m->policies[k % m->num_policies]]
+                                  ? ~(uint64_t)0
+                                  : 0;
+        }
+        inst.mispred_mask = mispred_mask;
+    }
+
+    // Read the row of zeros for a source the instruction doesn't read, and
+    // write the scratch row for a destination it doesn't write.
+    inst.src1 = cpi_model_reg_row(
+        m, rec->src1_needed ? rec->src1_reg : CPI_MODEL_NOT_READ);
+    inst.src2 = cpi_model_reg_row(
+        m, rec->src2_needed ? rec->src2_reg : CPI_MODEL_NOT_READ);
+    inst.cc = cpi_model_reg_row(
+        m, rec->cc_read ? CPI_MODEL_CC : CPI_MODEL_NOT_READ);
+    inst.dest = cpi_model_reg_row(
+        m, rec->dest_needed ? rec->dest_reg : CPI_MODEL_NOT_WRITTEN);
+    inst.cc_dest = cpi_model_reg_row(
+        m, rec->cc_write ? CPI_MODEL_CC : CPI_MODEL_NOT_WRITTEN);
+    inst.next_cycle =
+        m->next_cycle + (inst.inst_num % MAX_PIPE_WIDTH) * m->num_configs;
+
+    m->update(m, &inst);
+}
+
+/**
+ * Add every remaining instruction of a trace to a model.
+ *
+ * @param m the model to add to
+ * @param reader the reader to take the trace records from
+ * @return 0 on success, or -1 if the trace could not be read or is invalid,
+ *         in which case an error message is printed
+ */
+int cpi_model_add_trace(CpiModel *m, TraceReader *reader)
+{
+    TraceRec rec;
+    TraceReadStatus status;
+    while ((status = trace_reader_next(reader, &rec)) == TRACE_READ_OK &&
+           rec.op_type < NUM_OP_TYPES)
+    {
+        cpi_model_add(m, &rec);
+    }
+
+    if (status == TRACE_READ_EOF)
+    {
+        return 0;
+    }
+    if (status == TRACE_READ_ERROR)
+    {
+        trace_reader_perror(reader, "Couldn't read trace");
+    }
+    else
+    {
+        fprintf(stderr, "Error: Invalid trace file\n");
+    }
+    return -1;
+}
+
+/**
+ * Estimate the CPI of a pipeline configuration over the instructions a model
+ * has seen.
+ *
+ * @param m the model
+ * @param config the configuration of the pipeline
+ * @return the estimated cycles per instruction, or -1.0 if the model does not
+ *         track the configuration's width or policy
+ */
+double cpi_model_estimate(const CpiModel *m, const PipeConfig *config)
+{
+    unsigned int width_index = 0;
+    while (width_index < m->num_widths &&
+           m->widths[width_index] != config->pipe_width)
+    {
+        width_index++;
+    }
+    unsigned int policy_index = 0;
+    while (policy_index < m->num_policies &&
+           m->policies[policy_index] != (unsigned int)config->bpred_policy)
+    {
+        policy_index++;
+    }
+    if (width_index == m->num_widths || policy_index == m->num_policies)
+    {
+        return -1.0;
+    }
+
+    if (m->num_inst == 0)
+    {
+        return 0.0;
+    }
+
+    unsigned int fwd = (config->enable_mem_fwd ? 2 : 0) +
+                       (config->enable_exe_fwd ? 1 : 0);
+    unsigned int c = (width_index * 4 + fwd) * m->num_policies + policy_index;
+    double cycles = m->last_cycle[c] + 1 + CPI_MODEL_FILL_CYCLES;
+    return cycles / m->num_inst;
+}
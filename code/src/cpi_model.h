@@ -0,0 +1,174 @@
+// cpi_model.h
+// Declares a first-order analytical model of the pipeline, which estimates the
+// CPI of a set of width, forwarding and branch prediction configurations from a
+// single pass over a trace instead of simulating each one cycle by cycle.
+
+#ifndef _CPI_MODEL_H_
+#define _CPI_MODEL_H_
+
+#include "bpred.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "trace_reader.h"
+#include <inttypes.h>
+
+/** The width mask of cpi_model_init() that tracks every width. */
+#define CPI_MODEL_ALL_WIDTHS ((1u << MAX_PIPE_WIDTH) - 1)
+
+/** The policy mask of cpi_model_init() that tracks every policy. */
+#define CPI_MODEL_ALL_POLICIES ((1u << NUM_BPRED_POLICIES) - 1)
+
+/**
+ * The cycles the pipeline spends beyond those in which instructions leave ID:
+ * fetching the first instruction, and taking the last through EX, MA and WB.
+ */
+#define CPI_MODEL_FILL_CYCLES 4
+
+/**
+ * The cycles from a mispredicted branch leaving ID to the next instruction
+ * leaving ID: fetch stalls until the branch reaches WB, and the next
+ * instruction is fetched in that cycle and decoded in the one after.
+ */
+#define CPI_MODEL_MISPRED_CYCLES 4
+
+struct CpiModel;
+struct CpiModelInst;
+
+/**
+ * [Internal] A function updating every configuration of a model for one
+ * instruction, given the rows of state the instruction reads and writes.
+ */
+typedef void (*CpiModelUpdateFunc)(struct CpiModel *m,
+                                   const struct CpiModelInst *inst);
+
+/**
+ * A first-order model of the pipeline for a set of configurations at once:
+ * every combination of forwarding paths for each tracked width and policy.
+ *
+ * For each configuration, the model tracks only the cycle each instruction
+ * leaves ID: no earlier than the instruction before it, a cycle after the
+ * instruction a full row before it, once each of its producers can forward to
+ * it (or has reached WB) under the same rules as the ID stage, and once fetch
+ * has resumed after a mispredicted branch. Effects the detailed pipeline
+ * models beyond these are ignored, such as lane order, or a reader that
+ * misses a producer's cycle in EX waiting for WB when MA cannot forward.
+ */
+typedef struct CpiModel
+{
+    /** The number of instructions seen. */
+    uint64_t num_inst;
+    /** The number of conditional branches seen. */
+    uint64_t num_branches;
+    /**
+     * The branch predictor of each tracked policy, or NULL for BPRED_PERFECT
+     * and the policies not tracked. Their statistics count the mispredicted
+     * branches.
+     */
+    BPred *b_pred[NUM_BPRED_POLICIES];
+
+    /** [Internal] The tracked widths, in increasing order. */
+    unsigned int widths[MAX_PIPE_WIDTH];
+    /** [Internal] The number of tracked widths. */
+    unsigned int num_widths;
+    /** [Internal] The tracked policies, in increasing order. */
+    unsigned int policies[NUM_BPRED_POLICIES];
+    /** [Internal] The number of tracked policies. */
+    unsigned int num_policies;
+    /**
+     * [Internal] The number of configurations tracked. Each array below holds
+     * one entry per configuration, ordered by width, then forwarding paths,
+     * then policy, so that the configurations of one width are contiguous.
+     */
+    unsigned int num_configs;
+
+    /**
+     * [Internal] For each configuration, the cycle the last instruction left
+     * ID.
+     */
+    uint64_t *last_cycle;
+    /**
+     * [Internal] For each configuration, the first cycle an instruction can
+     * leave ID after the last mispredicted branch.
+     */
+    uint64_t *fetch_ready;
+    /**
+     * [Internal] For each of the last MAX_PIPE_WIDTH instructions, by
+     * instruction number modulo MAX_PIPE_WIDTH, a row with the cycle after
+     * the one the instruction left ID in each configuration.
+     */
+    uint64_t *next_cycle;
+    /**
+     * [Internal] For each register, the condition codes at row 256, a row
+     * with the first cycle a reader can leave ID in each configuration. Row
+     * 257 is written for instructions without a destination, and never read,
+     * and row 258 is read for sources an instruction doesn't read, and always
+     * zero.
+     */
+    uint64_t *reg_ready;
+    /**
+     * [Internal] For each instruction type, and each forwarding and policy
+     * combination of a width, the cycles after an instruction leaves ID that
+     * its readers can.
+     */
+    uint64_t gap[NUM_OP_TYPES][4 * NUM_BPRED_POLICIES];
+
+    /** [Internal] The update the CPU runs fastest. */
+    CpiModelUpdateFunc update;
+} CpiModel;
+
+/**
+ * Allocate and initialize a new model that has seen no instructions.
+ *
+ * Adding an instruction updates every tracked configuration, so the cost of a
+ * pass grows with their number. On a 10-million-instruction trace, tracking
+ * all 192 configurations measured about 4 s, eight times as long as simulating
+ * one configuration in detail, and tracking one width and one policy about
+ * 0.4 s, most of it reading the trace and running the branch predictor.
+ *
+ * @param width_mask the widths to track: bit w - 1 set for width w, or
+ *        CPI_MODEL_ALL_WIDTHS
+ * @param policy_mask the branch prediction policies to track: bit p set for
+ *        policy p, or CPI_MODEL_ALL_POLICIES
+ * @return the new model, or NULL if it could not be allocated or either mask
+ *         selects nothing
+ */
+CpiModel *cpi_model_init(uint32_t width_mask, uint32_t policy_mask);
+
+/**
+ * Free a model.
+ *
+ * @param m the model to free
+ */
+void cpi_model_free(CpiModel *m);
+
+/**
+ * Add one instruction of a trace to a model. Instructions must be added in
+ * trace order.
+ *
+ * @param m the model to add to
+ * @param rec the trace record of the instruction
+ */
+void cpi_model_add(CpiModel *m, const TraceRec *rec);
+
+/**
+ * Add every remaining instruction of a trace to a model.
+ *
+ * @param m the model to add to
+ * @param reader the reader to take the trace records from
+ * @return 0 on success, or -1 if the trace could not be read or is invalid,
+ *         in which case an error message is printed
+ */
+int cpi_model_add_trace(CpiModel *m, TraceReader *reader);
+
+/**
+ * Estimate the CPI of a pipeline configuration over the instructions a model
+ * has seen.
+ *
+ * @param m the model
+ * @param config the configuration of the pipeline
+ * @return the estimated cycles per instruction, or -1.0 if the model does not
+ *         track the configuration's width or policy
+ */
+double cpi_model_estimate(const CpiModel *m, const PipeConfig *config);
+
+#endif
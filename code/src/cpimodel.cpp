@@ -0,0 +1,300 @@
+// cpimodel.cpp
+// Estimates the CPI of every pipeline width, forwarding and branch prediction
+// configuration for each trace with the analytical model of cpi_model.h, from
+// one pass over the trace. With -compare, also runs the detailed pipeline for
+// each configuration and reports the model's error against it.
+
+#include "cpi_model.h"
+#include "pipeline.h"
+#include "trace_cache.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The model's errors against the detailed pipeline over every configuration
+ * compared.
+ */
+typedef struct ModelErrors
+{
+    /** The number of configurations compared. */
+    unsigned int num_compared;
+    /** The sum of the absolute relative errors. */
+    double sum_abs_error;
+    /** The largest absolute relative error. */
+    double max_abs_error;
+} ModelErrors;
+
+int model_trace(const char *trace_path, const char *cache_dir,
+                unsigned int width, int bpred_policy, bool compare,
+                ModelErrors *errors);
+int simulate(const char *trace_path, const char *cache_dir,
+             const PipeConfig *config, double *cpi);
+void print_usage(char *program_name);
+
+int main(int argc, char *argv[])
+{
+    const char *cache_dir = getenv(TRACE_CACHE_DIR_ENV);
+    if (cache_dir != NULL && cache_dir[0] == '\0')
+    {
+        cache_dir = NULL;
+    }
+    unsigned int width = 0;
+    int bpred_policy = -1;
+    bool compare = false;
+    int first_trace = argc;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char **value = NULL;
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+        else if (strcmp(argv[i], "-pipewidth") == 0)
+        {
+            if (++i >= argc || atoi(argv[i]) < 1 ||
+                atoi(argv[i]) > MAX_PIPE_WIDTH)
+            {
+                fprintf(stderr, "Error: -pipewidth needs a width from 1 to %d\n",
+                        MAX_PIPE_WIDTH);
+                return 2;
+            }
+            width = atoi(argv[i]);
+        }
+        else if (strcmp(argv[i], "-bpredpolicy") == 0)
+        {
+            if (++i >= argc || atoi(argv[i]) < 0 ||
+                atoi(argv[i]) >= NUM_BPRED_POLICIES)
+            {
+                fprintf(stderr, "Error: -bpredpolicy needs a policy from 0 to %d\n",
+                        NUM_BPRED_POLICIES - 1);
+                return 2;
+            }
+            bpred_policy = atoi(argv[i]);
+        }
+        else if (strcmp(argv[i], "-compare") == 0)
+        {
+            compare = true;
+        }
+        else if (strcmp(argv[i], "-notracecache") == 0)
+        {
+            cache_dir = NULL;
+        }
+        else if (strcmp(argv[i], "-tracecache") == 0)
+        {
+            value = &cache_dir;
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+            return 2;
+        }
+        else
+        {
+            first_trace = i;
+            break;
+        }
+
+        if (value != NULL)
+        {
+            if (++i >= argc)
+            {
+                fprintf(stderr, "Error: missing argument to %s\n",
+                        argv[i - 1]);
+                return 2;
+            }
+            *value = argv[i];
+        }
+    }
+    if (first_trace >= argc)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    ModelErrors errors;
+    memset(&errors, 0, sizeof(errors));
+    int status = 0;
+    for (int i = first_trace; i < argc && status == 0; i++)
+    {
+        status = model_trace(argv[i], cache_dir, width, bpred_policy, compare,
+                             &errors);
+    }
+
+    if (status == 0 && errors.num_compared > 0)
+    {
+        printf("Mean absolute error %.2f%%, max %.2f%% over %u configurations\n",
+               100.0 * errors.sum_abs_error / errors.num_compared,
+               100.0 * errors.max_abs_error, errors.num_compared);
+    }
+    return status;
+}
+
+/**
+ * Get the seconds elapsed since a start time.
+ */
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Build the model of one trace and print its estimate for each configuration,
+ * and with compare, the detailed pipeline's CPI and the model's error.
+ *
+ * @param width the only width to estimate, or 0 for every width
+ * @param bpred_policy the only policy to estimate, or -1 for every policy
+ * @return 0 on success, or nonzero if the trace could not be read
+ */
+int model_trace(const char *trace_path, const char *cache_dir,
+                unsigned int width, int bpred_policy, bool compare,
+                ModelErrors *errors)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    TraceOpenMethod method;
+    TraceReader *reader = trace_reader_open(trace_path, cache_dir, &method);
+    if (reader == NULL)
+    {
+        fprintf(stderr, "Error: couldn't open trace file %s: %s\n",
+                trace_path, strerror(errno));
+        return 1;
+    }
+    // Only track the configurations that will be printed.
+    uint32_t width_mask = width != 0 ? 1u << (width - 1)
+                                     : CPI_MODEL_ALL_WIDTHS;
+    uint32_t policy_mask = bpred_policy >= 0 ? 1u << bpred_policy
+                                             : CPI_MODEL_ALL_POLICIES;
+    CpiModel *m = cpi_model_init(width_mask, policy_mask);
+    if (m == NULL)
+    {
+        perror("Couldn't allocate model");
+        trace_reader_free(reader);
+        return 1;
+    }
+    if (cpi_model_add_trace(m, reader) != 0)
+    {
+        cpi_model_free(m);
+        trace_reader_free(reader);
+        return 1;
+    }
+    trace_reader_free(reader);
+
+    printf("%s: %llu instructions, %llu branches, modeled in %.2f s\n",
+           trace_path, (unsigned long long)m->num_inst,
+           (unsigned long long)m->num_branches, seconds_since(&start));
+    printf("  width memfwd exefwd bpred  model_cpi%s\n",
+           compare ? "    sim_cpi    error" : "");
+
+    int status = 0;
+    for (unsigned int w = 1; w <= MAX_PIPE_WIDTH && status == 0; w++)
+    {
+        if (width != 0 && w != width)
+        {
+            continue;
+        }
+        for (int fwd = 0; fwd < 4 && status == 0; fwd++)
+        {
+            for (int policy = 0; policy < NUM_BPRED_POLICIES && status == 0;
+                 policy++)
+            {
+                if (bpred_policy >= 0 && policy != bpred_policy)
+                {
+                    continue;
+                }
+
+                PipeConfig config;
+                pipe_config_init(&config);
+                config.pipe_width = w;
+                config.enable_mem_fwd = (fwd & 2) != 0;
+                config.enable_exe_fwd = (fwd & 1) != 0;
+                config.bpred_policy = (BPredPolicy)policy;
+
+                double model_cpi = cpi_model_estimate(m, &config);
+                printf("  %5u %6d %6d %5d %10.4f", w, config.enable_mem_fwd,
+                       config.enable_exe_fwd, policy, model_cpi);
+                if (compare)
+                {
+                    double sim_cpi;
+                    status = simulate(trace_path, cache_dir, &config,
+                                      &sim_cpi);
+                    if (status == 0)
+                    {
+                        double error = (model_cpi - sim_cpi) / sim_cpi;
+                        printf(" %10.4f %+7.2f%%", sim_cpi, 100.0 * error);
+                        errors->num_compared++;
+                        errors->sum_abs_error += fabs(error);
+                        if (fabs(error) > errors->max_abs_error)
+                        {
+                            errors->max_abs_error = fabs(error);
+                        }
+                    }
+                }
+                printf("\n");
+            }
+        }
+    }
+
+    cpi_model_free(m);
+    return status;
+}
+
+/**
+ * Run the detailed pipeline over a trace.
+ *
+ * @param config the configuration of the pipeline
+ * @param cpi set to the cycles per instruction of the simulation
+ * @return 0 on success, or nonzero if the trace could not be opened
+ */
+int simulate(const char *trace_path, const char *cache_dir,
+             const PipeConfig *config, double *cpi)
+{
+    TraceOpenMethod method;
+    TraceReader *reader = trace_reader_open(trace_path, cache_dir, &method);
+    if (reader == NULL)
+    {
+        fprintf(stderr, "Error: couldn't open trace file %s: %s\n",
+                trace_path, strerror(errno));
+        return 1;
+    }
+
+    Pipeline *p = pipe_init(config, reader);
+    while (!p->halt)
+    {
+        pipe_cycle(p);
+    }
+
+    PipeStats stats;
+    pipe_get_stats(p, &stats);
+    *cpi = stats.cpi;
+
+    pipe_free(p);
+    trace_reader_free(reader);
+    return 0;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <trace file> ...\n\n", program_name);
+    fprintf(stderr, "Estimates the CPI of each pipeline configuration for each trace with an\n");
+    fprintf(stderr, "analytical model, from a single pass over the trace\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -pipewidth <n>      Only estimate width <n> (Default: widths 1 to %d)\n",
+            MAX_PIPE_WIDTH);
+    fprintf(stderr, "    -bpredpolicy <p>    Only estimate branch prediction policy <p>\n");
+    fprintf(stderr, "                        (Default: every policy)\n");
+    fprintf(stderr, "    -compare            Also run the detailed pipeline for each configuration\n");
+    fprintf(stderr, "                        and report the model's error against it\n");
+    fprintf(stderr, "    -tracecache <dir>   Cache decompressed traces in <dir> (Default: $%s,\n",
+            TRACE_CACHE_DIR_ENV);
+    fprintf(stderr, "                        or else no cache)\n");
+    fprintf(stderr, "    -notracecache       Don't use the trace cache\n");
+}
@@ -0,0 +1,266 @@
+// perceptron.cpp
+// Implements the perceptron branch predictor declared in perceptron.h.
+
+#include "perceptron.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+void perceptron_config_init(PerceptronConfig *config)
+{
+    config->hist_len = 31;
+    config->num_rows = 256;
+    config->theta = 0;
+}
+
+bool perceptron_config_valid(const PerceptronConfig *config)
+{
+    return config->hist_len >= 1 && config->hist_len <= PERCEPTRON_MAX_HIST &&
+           config->num_rows >= 1 && config->num_rows <= PERCEPTRON_MAX_ROWS &&
+           (config->num_rows & (config->num_rows - 1)) == 0;
+}
+
+/**
+ * [Internal] Compute the dot product of a row of weights with the history one
+ * weight at a time.
+ *
+ * @param weights the row of weights
+ * @param neg_mask the history: 0x00 to add a weight, 0xFF to subtract it
+ * @param row_len the length of the row
+ * @return the dot product
+ */
+static int32_t perceptron_dot_scalar(const int8_t *weights,
+                                     const uint8_t *neg_mask,
+                                     uint32_t row_len)
+{
+    int32_t sum = 0;
+    for (uint32_t i = 0; i < row_len; i++)
+    {
+        sum += neg_mask[i] != 0 ? -weights[i] : weights[i];
+    }
+    return sum;
+}
+
+#ifndef PIPE_NO_SIMD
+// The vector dot products negate a weight w by flipping its bits, to -w - 1,
+// and correct by adding the number of negated weights afterwards. They sum
+// the bytes with SAD instructions, which treat them as unsigned, so they also
+// flip the sign bits to add 128 to each, and subtract that afterwards too.
+
+#ifdef __SSE2__
+/**
+ * [Internal] Compute the dot product of a row of weights with the history 16
+ * weights per SSE2 instruction.
+ *
+ * @see perceptron_dot_scalar()
+ */
+static int32_t perceptron_dot_sse2(const int8_t *weights,
+                                   const uint8_t *neg_mask, uint32_t row_len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i sign = _mm_set1_epi8((char)0x80);
+    __m128i sum = zero;
+    __m128i num_neg = zero;
+    for (uint32_t i = 0; i < row_len; i += 16)
+    {
+        __m128i w = _mm_loadu_si128((const __m128i *)&weights[i]);
+        __m128i neg = _mm_loadu_si128((const __m128i *)&neg_mask[i]);
+        w = _mm_xor_si128(_mm_xor_si128(w, neg), sign);
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(w, zero));
+        num_neg = _mm_add_epi64(num_neg, _mm_sad_epu8(neg, zero));
+    }
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    num_neg = _mm_add_epi64(num_neg, _mm_unpackhi_epi64(num_neg, num_neg));
+    return _mm_cvtsi128_si32(sum) - 128 * (int32_t)row_len +
+           _mm_cvtsi128_si32(num_neg) / 0xFF;
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * [Internal] Compute the dot product of a row of weights with the history 32
+ * weights per AVX2 instruction. Only call this on a CPU that supports AVX2.
+ *
+ * @see perceptron_dot_scalar()
+ */
+__attribute__((target("avx2")))
+static int32_t perceptron_dot_avx2(const int8_t *weights,
+                                   const uint8_t *neg_mask, uint32_t row_len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i sign = _mm256_set1_epi8((char)0x80);
+    __m256i sum = zero;
+    __m256i num_neg = zero;
+    for (uint32_t i = 0; i < row_len; i += 32)
+    {
+        __m256i w = _mm256_loadu_si256((const __m256i *)&weights[i]);
+        __m256i neg = _mm256_loadu_si256((const __m256i *)&neg_mask[i]);
+        w = _mm256_xor_si256(_mm256_xor_si256(w, neg), sign);
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(w, zero));
+        num_neg = _mm256_add_epi64(num_neg, _mm256_sad_epu8(neg, zero));
+    }
+    __m128i sum128 = _mm_add_epi64(_mm256_castsi256_si128(sum),
+                                   _mm256_extracti128_si256(sum, 1));
+    __m128i neg128 = _mm_add_epi64(_mm256_castsi256_si128(num_neg),
+                                   _mm256_extracti128_si256(num_neg, 1));
+    sum128 = _mm_add_epi64(sum128, _mm_unpackhi_epi64(sum128, sum128));
+    neg128 = _mm_add_epi64(neg128, _mm_unpackhi_epi64(neg128, neg128));
+    return _mm_cvtsi128_si32(sum128) - 128 * (int32_t)row_len +
+           _mm_cvtsi128_si32(neg128) / 0xFF;
+}
+#endif
+#endif
+
+/**
+ * [Internal] Get the fastest dot product this CPU supports. Building with
+ * -DPIPE_NO_SIMD forces the scalar dot product, like the pipeline's lane
+ * comparisons.
+ *
+ * @return the dot product to use
+ */
+static PerceptronDotFunc perceptron_best_dot(void)
+{
+#ifndef PIPE_NO_SIMD
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return perceptron_dot_avx2;
+    }
+#endif
+#ifdef __SSE2__
+    return perceptron_dot_sse2;
+#endif
+#endif
+    return perceptron_dot_scalar;
+}
+
+int32_t perceptron_theta(const PerceptronConfig *config)
+{
+    if (config->theta != 0)
+    {
+        return config->theta;
+    }
+    return (int32_t)(1.93 * config->hist_len + 14);
+}
+
+Perceptron *perceptron_init(const PerceptronConfig *config)
+{
+    Perceptron *p = (Perceptron *)calloc(1, sizeof(Perceptron));
+    p->config = *config;
+    p->theta = perceptron_theta(config);
+
+    // Every weight starts at 0, and the history at all taken. The padding
+    // weights stay 0, so the padding adds nothing to the dot product.
+    p->row_len = (config->hist_len + 1 + PERCEPTRON_ROW_ALIGN - 1) /
+                 PERCEPTRON_ROW_ALIGN * PERCEPTRON_ROW_ALIGN;
+    p->weights = (int8_t *)calloc((size_t)config->num_rows * p->row_len, 1);
+    p->neg_mask = (uint8_t *)calloc(p->row_len, 1);
+
+    p->row_shift = 32;
+    for (uint32_t rows = config->num_rows; rows > 1; rows >>= 1)
+    {
+        p->row_shift--;
+    }
+
+    p->dot = perceptron_best_dot();
+    return p;
+}
+
+void perceptron_free(Perceptron *p)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+    free(p->weights);
+    free(p->neg_mask);
+    free(p);
+}
+
+bool perceptron_predict(Perceptron *p, uint64_t pc)
+{
+    // Pick the perceptron by Fibonacci hashing, which takes the top bits of
+    // the address times 2^32 / phi, so that every address bit counts.
+    uint64_t hash = (uint32_t)((uint32_t)(pc ^ (pc >> 32)) * 0x9E3779B9u);
+    uint32_t row = (uint32_t)(hash >> p->row_shift);
+    int32_t output = p->dot(&p->weights[(size_t)row * p->row_len],
+                            p->neg_mask, p->row_len);
+
+    p->lookup_valid = true;
+    p->lookup_pc = pc;
+    p->lookup_row = row;
+    p->lookup_output = output;
+    return output >= 0;
+}
+
+void perceptron_update(Perceptron *p, uint64_t pc, bool taken)
+{
+    if (!p->lookup_valid || p->lookup_pc != pc)
+    {
+        perceptron_predict(p, pc);
+    }
+    p->lookup_valid = false;
+
+    // Train on a misprediction, or on a correct prediction that was not
+    // confident enough: move each weight toward agreeing with the outcome.
+    int32_t output = p->lookup_output;
+    bool predicted = output >= 0;
+    if (predicted != taken || abs(output) <= p->theta)
+    {
+        int8_t *weights = &p->weights[(size_t)p->lookup_row * p->row_len];
+        for (uint32_t i = 0; i <= p->config.hist_len; i++)
+        {
+            bool agrees = (p->neg_mask[i] == 0) == taken;
+            if (agrees && weights[i] < INT8_MAX)
+            {
+                weights[i]++;
+            }
+            else if (!agrees && weights[i] > INT8_MIN)
+            {
+                weights[i]--;
+            }
+        }
+    }
+
+    // Shift the outcome into the history, after the bias.
+    memmove(&p->neg_mask[2], &p->neg_mask[1], p->config.hist_len - 1);
+    p->neg_mask[1] = taken ? 0x00 : 0xFF;
+}
+
+bool perceptron_save(const Perceptron *p, FILE *file)
+{
+    size_t num_weights = (size_t)p->config.num_rows * p->row_len;
+
+    return fwrite(&p->config, sizeof(p->config), 1, file) == 1 &&
+           fwrite(p->neg_mask, 1, p->row_len, file) == p->row_len &&
+           fwrite(p->weights, 1, num_weights, file) == num_weights;
+}
+
+bool perceptron_restore(Perceptron *p, FILE *file)
+{
+    PerceptronConfig saved_config;
+    if (fread(&saved_config, sizeof(saved_config), 1, file) != 1 ||
+        memcmp(&saved_config, &p->config, sizeof(saved_config)) != 0)
+    {
+        return false;
+    }
+
+    size_t num_weights = (size_t)p->config.num_rows * p->row_len;
+    p->lookup_valid = false;
+    return fread(p->neg_mask, 1, p->row_len, file) == p->row_len &&
+           fread(p->weights, 1, num_weights, file) == num_weights;
+}
+
+uint64_t perceptron_storage_bits(const Perceptron *p)
+{
+    return 8 * (uint64_t)p->config.num_rows * (p->config.hist_len + 1) +
+           p->config.hist_len;
+}
+
+size_t perceptron_table_bytes(const Perceptron *p)
+{
+    return (size_t)p->config.num_rows * p->row_len;
+}
@@ -0,0 +1,190 @@
+// perceptron.h
+// Declares the perceptron branch predictor used by the BPRED_PERCEPTRON
+// policy: a table of perceptrons, one picked by hashing the branch address,
+// each weighing the outcomes of the last hist_len branches.
+//
+// A prediction is the dot product of the picked perceptron's 8-bit weights
+// with the global history, taken as +1 for taken and -1 for not taken, and
+// computed with SSE2 or AVX2 when the CPU supports it.
+
+#ifndef _PERCEPTRON_H_
+#define _PERCEPTRON_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * The longest history a perceptron can weigh, in branches.
+ */
+#define PERCEPTRON_MAX_HIST 255
+
+/**
+ * The most perceptrons a table can have.
+ */
+#define PERCEPTRON_MAX_ROWS (1u << 20)
+
+/**
+ * The number of weights each perceptron's row of the table is padded to a
+ * multiple of, so that the dot product can run on whole AVX2 vectors.
+ */
+#define PERCEPTRON_ROW_ALIGN 32
+
+/**
+ * The geometry and training threshold of a perceptron predictor.
+ *
+ * sim and pipe_config_parse set these with -bpred_perceptron_hist,
+ * -bpred_perceptron_rows and -bpred_perceptron_theta.
+ */
+typedef struct PerceptronConfig
+{
+    /** The length of the global history, in branches. */
+    uint32_t hist_len;
+    /** The number of perceptrons, a power of two. */
+    uint32_t num_rows;
+    /** Train on correct predictions whose output is at most this far from
+        zero, or 0 for the usual floor(1.93 * hist_len + 14). */
+    uint32_t theta;
+} PerceptronConfig;
+
+/**
+ * [Internal] A function computing the dot product of a row of weights with
+ * the history, given as a mask of 0x00 for +1 and 0xFF for -1 per weight.
+ */
+typedef int32_t (*PerceptronDotFunc)(const int8_t *weights,
+                                     const uint8_t *neg_mask,
+                                     uint32_t row_len);
+
+/**
+ * A perceptron branch predictor.
+ */
+typedef struct Perceptron
+{
+    /** The geometry of the predictor. */
+    PerceptronConfig config;
+    /** The training threshold in effect. */
+    int32_t theta;
+    /** The number of weights per row: the bias and one per branch of
+        history, padded to a multiple of PERCEPTRON_ROW_ALIGN. */
+    uint32_t row_len;
+    /** The shift taking a 32-bit hash of an address to a row. */
+    uint32_t row_shift;
+
+    /** The weights, row_len per perceptron, one perceptron after another. */
+    int8_t *weights;
+    /** The history as multipliers of the weights, row_len long: 0x00 (+1)
+        for the bias and taken branches, 0xFF (-1) for not-taken ones, the
+        most recent first after the bias, and 0x00 for the padding. */
+    uint8_t *neg_mask;
+
+    /** The dot product the CPU runs fastest. */
+    PerceptronDotFunc dot;
+
+    // The lookup of the last branch predicted, reused by its update.
+    bool lookup_valid;
+    uint64_t lookup_pc;
+    uint32_t lookup_row;
+    int32_t lookup_output;
+} Perceptron;
+
+/**
+ * Set a perceptron geometry to the defaults: 256 perceptrons weighing 31
+ * branches of history, 8 KiB of weights, trained with the usual threshold.
+ *
+ * @param config the geometry to initialize
+ */
+void perceptron_config_init(PerceptronConfig *config);
+
+/**
+ * Check whether a perceptron geometry can be simulated: a history of 1 to
+ * PERCEPTRON_MAX_HIST branches, and a power of two perceptrons up to
+ * PERCEPTRON_MAX_ROWS.
+ *
+ * @param config the geometry to check
+ * @return true if the geometry is valid
+ */
+bool perceptron_config_valid(const PerceptronConfig *config);
+
+/**
+ * Get the training threshold of a perceptron geometry.
+ *
+ * @param config the geometry
+ * @return theta, or the usual threshold for hist_len if theta is 0
+ */
+int32_t perceptron_theta(const PerceptronConfig *config);
+
+/**
+ * Allocate and initialize a new perceptron predictor with every weight 0.
+ *
+ * @param config the geometry of the predictor, which must be valid
+ * @return the new predictor
+ */
+Perceptron *perceptron_init(const PerceptronConfig *config);
+
+/**
+ * Free a perceptron predictor.
+ *
+ * @param p the predictor to free
+ */
+void perceptron_free(Perceptron *p);
+
+/**
+ * Predict the direction of a branch.
+ *
+ * @param p the predictor
+ * @param pc the address of the branch
+ * @return true if the branch is predicted taken
+ */
+bool perceptron_predict(Perceptron *p, uint64_t pc);
+
+/**
+ * Train a perceptron predictor with the outcome of a branch and add it to
+ * the history. Cheapest right after perceptron_predict() for the same
+ * branch, whose output it reuses.
+ *
+ * @param p the predictor
+ * @param pc the address of the branch
+ * @param taken whether the branch was taken
+ */
+void perceptron_update(Perceptron *p, uint64_t pc, bool taken);
+
+/**
+ * Write the geometry, history, and weights of a perceptron predictor to a
+ * checkpoint file.
+ *
+ * @param p the predictor
+ * @param file the file to write to
+ * @return true on success, or false if the file could not be written
+ */
+bool perceptron_save(const Perceptron *p, FILE *file);
+
+/**
+ * Replace the history and weights of a perceptron predictor with those
+ * written to a checkpoint file by perceptron_save().
+ *
+ * @param p the predictor
+ * @param file the file to read from
+ * @return true on success, or false if the file could not be read or was
+ *         saved by a predictor with a different geometry
+ */
+bool perceptron_restore(Perceptron *p, FILE *file);
+
+/**
+ * Get the number of bits of state the modeled hardware would need: 8 bits
+ * per weight, and the history.
+ *
+ * @param p the predictor
+ * @return the storage budget in bits
+ */
+uint64_t perceptron_storage_bits(const Perceptron *p);
+
+/**
+ * Get the number of bytes the weights of a perceptron predictor take up in
+ * the simulator's memory, padding included.
+ *
+ * @param p the predictor
+ * @return the table size in bytes
+ */
+size_t perceptron_table_bytes(const Perceptron *p);
+
+#endif
@@ -10,61 +10,303 @@
 
 #include "pipeline.h"
 #include <cstdlib>
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 /**
- * Read a single trace record from the trace file and use it to populate the
- * given fetch_op.
+ * Check whether a pipeline holds no instructions.
  *
- * You should not modify this function.
+ * @param p the pipeline to check
+ * @return true if every latch in the pipeline holds a bubble
+ */
+static bool pipe_is_empty(Pipeline *p)
+{
+    for (int stage = 0; stage < NUM_LATCH_TYPES; stage++)
+    {
+        for (unsigned int i = 0; i < p->config.pipe_width; i++)
+        {
+            if (p->pipe_latch[stage][i].valid)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * [Internal] Free every slot of a pipeline's instruction window.
  *
- * @param p the pipeline whose trace file should be read
- * @param fetch_op the PipelineLatch struct to populate
+ * @param p the pipeline whose window should be emptied
  */
-void pipe_get_fetch_op(Pipeline *p, PipelineLatch *fetch_op)
+static void pipe_window_clear(Pipeline *p)
 {
-    TraceRec *trace_rec = &fetch_op->trace_rec;
-    uint8_t *trace_rec_buf = (uint8_t *)trace_rec;
-    size_t bytes_read_total = 0;
-    ssize_t bytes_read_last = 0;
-    size_t bytes_left = sizeof(*trace_rec);
+    for (unsigned int i = 0; i < PIPE_WINDOW_SIZE; i++)
+    {
+        p->window_free[i] = PIPE_WINDOW_SIZE - 1 - i;
+    }
+    p->window_num_free = PIPE_WINDOW_SIZE;
+}
+
+// Window slots are numbered by the latches' uint8_t slot field.
+static_assert(PIPE_WINDOW_SIZE <= 256, "Window slots must fit in a uint8_t");
 
-    // Read a total of sizeof(TraceRec) bytes from the trace file.
-    while (bytes_left > 0)
+// Scoreboard lane masks have one bit per lane.
+static_assert(MAX_PIPE_WIDTH <= 8, "PipeScoreboard lane masks are 8 bits");
+
+/**
+ * [Internal] Remove the instruction in a latch from the scoreboard of its row.
+ *
+ * @param p the pipeline that holds the latch
+ * @param sb the scoreboard of the latch's row
+ * @param lane the lane of the latch
+ * @param latch the latch, before it is overwritten
+ */
+static inline void pipe_scoreboard_remove(const Pipeline *p,
+                                          PipeScoreboard *sb,
+                                          unsigned int lane,
+                                          const PipelineLatch *latch)
+{
+    if (latch->valid)
     {
-        bytes_read_last = read(p->trace_fd, trace_rec_buf, bytes_left);
-        if (bytes_read_last <= 0)
+        const TraceRec *rec = pipe_latch_rec(p, latch);
+        uint8_t mask = ~(1u << lane);
+        if (rec->dest_needed)
         {
-            // EOF or error
-            break;
+            sb->reg_lanes[rec->dest_reg] &= mask;
+        }
+        if (rec->cc_write)
+        {
+            sb->cc_lanes &= mask;
+        }
+    }
+}
+
+/**
+ * [Internal] Add the instruction in a latch to the scoreboard of its row.
+ *
+ * @param p the pipeline that holds the latch
+ * @param sb the scoreboard of the latch's row
+ * @param lane the lane of the latch
+ * @param latch the latch, after it is written
+ */
+static inline void pipe_scoreboard_add(const Pipeline *p, PipeScoreboard *sb,
+                                       unsigned int lane,
+                                       const PipelineLatch *latch)
+{
+    if (latch->valid)
+    {
+        const TraceRec *rec = pipe_latch_rec(p, latch);
+        uint8_t bit = 1u << lane;
+        sb->lane_ages[lane] = (uint32_t)latch->op_id;
+        if (rec->dest_needed)
+        {
+            sb->reg_lanes[rec->dest_reg] |= bit;
+        }
+        if (rec->cc_write)
+        {
+            sb->cc_lanes |= bit;
+        }
+    }
+}
+
+/**
+ * [Internal] Find the lanes of a row whose instructions write a register or
+ * condition codes that an instruction reads.
+ *
+ * @param sb the scoreboard of the row
+ * @param rec the trace record of the reading instruction
+ * @return the mask of conflicting lanes, regardless of age
+ */
+static inline uint8_t pipe_scoreboard_conflicts(const PipeScoreboard *sb,
+                                                const TraceRec *rec)
+{
+    uint8_t lanes = 0;
+    if (rec->src1_needed)
+    {
+        lanes |= sb->reg_lanes[rec->src1_reg];
+    }
+    if (rec->src2_needed)
+    {
+        lanes |= sb->reg_lanes[rec->src2_reg];
+    }
+    if (rec->cc_read)
+    {
+        lanes |= sb->cc_lanes;
+    }
+    return lanes;
+}
+
+/**
+ * [Internal] The ways the ID stage can compare the age of an instruction
+ * against the lanes of a row.
+ */
+typedef enum PipeLaneCompareEnum
+{
+    PIPE_LANES_SCALAR, // One lane at a time, on any CPU.
+    PIPE_LANES_SSE2,   // Four lanes per SSE2 instruction.
+    PIPE_LANES_AVX2,   // Eight lanes per AVX2 instruction.
+} PipeLaneCompare;
+
+// The vector comparisons cover every lane of a row at once.
+static_assert(MAX_PIPE_WIDTH == 8, "Lane comparisons assume 8-lane rows");
+
+/**
+ * [Internal] Find the lanes of a row that hold instructions older than, or
+ * if same_age is set no younger than, an instruction, comparing one lane at a
+ * time.
+ *
+ * Ages are compared by the sign of the 32-bit difference of op_ids, which is
+ * exact because the instructions in flight are never more than a few dozen
+ * op_ids apart.
+ *
+ * @param sb the scoreboard of the row
+ * @param lanes the lanes to compare, which must all hold valid instructions
+ * @param op_id the op_id of the instruction
+ * @param same_age whether lanes holding the instruction itself count
+ * @return the subset of lanes that hold older instructions
+ */
+static inline uint8_t pipe_lanes_older_scalar(const PipeScoreboard *sb,
+                                              uint8_t lanes, uint64_t op_id,
+                                              bool same_age)
+{
+    const int32_t bound = same_age ? -1 : 0;
+    uint8_t older = 0;
+    for (; lanes != 0; lanes &= lanes - 1)
+    {
+        unsigned int j = __builtin_ctz(lanes);
+        if ((int32_t)((uint32_t)op_id - sb->lane_ages[j]) > bound)
+        {
+            older |= 1u << j;
         }
+    }
+    return older;
+}
+
+#ifdef __SSE2__
+/**
+ * [Internal] Find the lanes of a row that hold instructions older than an
+ * instruction, comparing four lanes per SSE2 instruction.
+ *
+ * @see pipe_lanes_older_scalar()
+ */
+static inline uint8_t pipe_lanes_older_sse2(const PipeScoreboard *sb,
+                                            uint8_t lanes, uint64_t op_id,
+                                            bool same_age)
+{
+    const __m128i id = _mm_set1_epi32((int32_t)op_id);
+    const __m128i bound = _mm_set1_epi32(same_age ? -1 : 0);
+    __m128i lo = _mm_loadu_si128((const __m128i *)&sb->lane_ages[0]);
+    __m128i hi = _mm_loadu_si128((const __m128i *)&sb->lane_ages[4]);
+    lo = _mm_cmpgt_epi32(_mm_sub_epi32(id, lo), bound);
+    hi = _mm_cmpgt_epi32(_mm_sub_epi32(id, hi), bound);
+    unsigned int older = _mm_movemask_ps(_mm_castsi128_ps(lo)) |
+                         _mm_movemask_ps(_mm_castsi128_ps(hi)) << 4;
+    return lanes & older;
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * [Internal] Find the lanes of a row that hold instructions older than an
+ * instruction, comparing all eight lanes in one AVX2 instruction. Only call
+ * this from code built for AVX2, on a CPU that supports it.
+ *
+ * @see pipe_lanes_older_scalar()
+ */
+__attribute__((target("avx2")))
+static inline uint8_t pipe_lanes_older_avx2(const PipeScoreboard *sb,
+                                            uint8_t lanes, uint64_t op_id,
+                                            bool same_age)
+{
+    const __m256i id = _mm256_set1_epi32((int32_t)op_id);
+    const __m256i bound = _mm256_set1_epi32(same_age ? -1 : 0);
+    __m256i ages = _mm256_loadu_si256((const __m256i *)sb->lane_ages);
+    ages = _mm256_cmpgt_epi32(_mm256_sub_epi32(id, ages), bound);
+    return lanes & _mm256_movemask_ps(_mm256_castsi256_ps(ages));
+}
+#endif
 
-        trace_rec_buf += bytes_read_last;
-        bytes_read_total += bytes_read_last;
-        bytes_left -= bytes_read_last;
+/**
+ * [Internal] Find the lanes of a row that hold instructions older than, or
+ * if same_age is set no younger than, an instruction, using the lane
+ * comparison L.
+ *
+ * @see pipe_lanes_older_scalar()
+ */
+template <PipeLaneCompare L>
+static inline uint8_t pipe_lanes_older(const PipeScoreboard *sb,
+                                       uint8_t lanes, uint64_t op_id,
+                                       bool same_age)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (L == PIPE_LANES_AVX2)
+    {
+        return pipe_lanes_older_avx2(sb, lanes, op_id, same_age);
+    }
+#endif
+#ifdef __SSE2__
+    if (L == PIPE_LANES_SSE2)
+    {
+        return pipe_lanes_older_sse2(sb, lanes, op_id, same_age);
     }
+#endif
+    return pipe_lanes_older_scalar(sb, lanes, op_id, same_age);
+}
+
+/**
+ * Read a single trace record from the trace file and use it to populate the
+ * given fetch_op. Records come from the pipeline's buffered trace reader, so
+ * most calls do not issue a read() system call.
+ *
+ * The record is read straight into a free slot of the pipeline's instruction
+ * window, which the instruction keeps until it retires.
+ *
+ * You should not modify this function.
+ *
+ * @param p the pipeline whose trace file should be read
+ * @param fetch_op the PipelineLatch struct to populate
+ */
+void pipe_get_fetch_op(Pipeline *p, PipelineLatch *fetch_op)
+{
+    // Some slot is always free here: the IF latch being refilled holds either
+    // a bubble or an instruction that has already moved on to ID.
+    fetch_op->slot = p->window_free[p->window_num_free - 1];
+    TraceRec *trace_rec = &p->window[fetch_op->slot];
+
+    // Take the next record from the reader's block buffer.
+    TraceReadStatus status = trace_reader_next(p->trace_reader, trace_rec);
 
     // Check for error conditions.
-    if (bytes_left > 0 || trace_rec->op_type >= NUM_OP_TYPES)
+    if (status != TRACE_READ_OK || trace_rec->op_type >= NUM_OP_TYPES)
     {
         fetch_op->valid = false;
+        fetch_op->stall = false;
+        fetch_op->is_mispred_cbr = false;
+        fetch_op->op_id = 0;
         p->halt_op_id = p->last_op_id;
 
-        if (p->last_op_id == 0)
+        // If every instruction has already retired, as when the trace ends
+        // right after a mispredicted branch, nothing is left to reach WB.
+        if (p->last_op_id == 0 || pipe_is_empty(p))
         {
             p->halt = true;
         }
 
-        if (bytes_read_last == -1)
+        if (status == TRACE_READ_ERROR)
         {
             fprintf(stderr, "\n");
-            perror("Couldn't read from pipe");
+            trace_reader_perror(p->trace_reader, "Couldn't read trace");
             return;
         }
 
-        if (bytes_read_total == 0)
+        if (status == TRACE_READ_EOF)
         {
             // No more trace records to read
             return;
@@ -77,6 +319,7 @@ void pipe_get_fetch_op(Pipeline *p, PipelineLatch *fetch_op)
     }
 
     // Got a valid trace record!
+    p->window_num_free--;
     fetch_op->valid = true;
     fetch_op->stall = false;
     fetch_op->is_mispred_cbr = false;
@@ -84,131 +327,1126 @@ void pipe_get_fetch_op(Pipeline *p, PipelineLatch *fetch_op)
 }
 
 /**
- * Allocate and initialize a new pipeline.
+ * Set a pipeline configuration to the defaults.
+ *
+ * @param config the configuration to initialize
+ */
+void pipe_config_init(PipeConfig *config)
+{
+    config->pipe_width = 1;
+    config->enable_mem_fwd = false;
+    config->enable_exe_fwd = false;
+    config->bpred_policy = BPRED_PERFECT;
+    config->bpred_hist_bits = BPRED_DEFAULT_HIST_BITS;
+    config->bpred_pht_entries = BPRED_DEFAULT_PHT_ENTRIES;
+    tage_config_init(&config->tage_config);
+    perceptron_config_init(&config->perceptron_config);
+    btb_config_init(&config->btb_config);
+}
+
+/**
+ * Allocate and initialize a new pipeline.
+ *
+ * You should not need to modify this function.
+ *
+ * @param config the configuration of the pipeline, which is copied
+ * @param trace_reader the reader from which to read trace records
+ * @return a pointer to a newly allocated pipeline
+ */
+Pipeline *pipe_init(const PipeConfig *config, TraceReader *trace_reader)
+{
+    // Allocate pipeline.
+    Pipeline *p = (Pipeline *)calloc(1, sizeof(Pipeline));
+
+    // Initialize pipeline.
+    p->config = *config;
+    p->trace_reader = trace_reader;
+    p->halt_op_id = (uint64_t)(-1) - 3;
+    pipe_window_clear(p);
+
+    p->cycle_kernel = pipe_select_kernel(config);
+
+    // Allocate and initialize a branch predictor if needed.
+    if (config->bpred_policy != BPRED_PERFECT)
+    {
+        p->b_pred = new BPred(config->bpred_policy, config->bpred_hist_bits,
+                              config->bpred_pht_entries, &config->tage_config,
+                              &config->perceptron_config);
+    }
+
+    // Allocate a BTB if the front end is modeled.
+    if (config->btb_config.num_entries > 0)
+    {
+        p->btb = btb_init(&config->btb_config);
+    }
+
+    return p;
+}
+
+/**
+ * Free a pipeline, its branch predictor, and its BTB, but not its trace
+ * reader.
+ *
+ * @param p the pipeline to free
+ */
+void pipe_free(Pipeline *p)
+{
+    delete p->b_pred;
+    btb_free(p->btb);
+    free(p);
+}
+
+/**
+ * Parse the numeric argument of a command-line option.
+ *
+ * @param arg the argument, or NULL if the option had none
+ * @param value set to the argument, if it is valid
+ * @return true if the argument is a whole decimal number that fits in 64 bits,
+ *         with nothing after it
+ */
+bool pipe_parse_uint64(const char *arg, uint64_t *value)
+{
+    // strtoull() would also skip leading spaces and accept a sign.
+    if (arg == NULL || arg[0] < '0' || arg[0] > '9')
+    {
+        return false;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long parsed = strtoull(arg, &end, 10);
+    if (*end != '\0' || errno == ERANGE)
+    {
+        return false;
+    }
+    *value = (uint64_t)parsed;
+    return true;
+}
+
+/**
+ * [Internal] Parse the numeric argument of a pipeline option.
+ *
+ * @param arg the argument, or NULL if the option had none
+ * @param value set to the argument, if it is valid
+ * @return true if the argument is a whole decimal number that fits in 32 bits,
+ *         with nothing after it
+ */
+static bool pipe_parse_uint(const char *arg, uint32_t *value)
+{
+    uint64_t parsed;
+    if (!pipe_parse_uint64(arg, &parsed) || parsed > UINT32_MAX)
+    {
+        return false;
+    }
+    *value = (uint32_t)parsed;
+    return true;
+}
+
+/**
+ * Apply one option, written as on the command line, to a pipeline
+ * configuration.
+ *
+ * @param option the option
+ * @param arg the argument after the option, or NULL if there is none
+ * @param config the configuration to update
+ * @param used_arg set to whether the option takes arg as its argument
+ * @return whether the option was applied, was not a pipeline option, or had a
+ *         missing or invalid argument
+ */
+PipeOptionStatus pipe_config_parse_option(const char *option, const char *arg,
+                                          PipeConfig *config, bool *used_arg)
+{
+    *used_arg = false;
+    if (strcmp(option, "-enablememfwd") == 0)
+    {
+        config->enable_mem_fwd = true;
+        return PIPE_OPTION_OK;
+    }
+    if (strcmp(option, "-enableexefwd") == 0)
+    {
+        config->enable_exe_fwd = true;
+        return PIPE_OPTION_OK;
+    }
+
+    // Every other option takes an argument. Limits that depend on other
+    // options are left to pipe_config_check(), so that options can come in
+    // any order.
+    bool valid;
+    if (strcmp(option, "-pipewidth") == 0)
+    {
+        uint32_t value;
+        valid = pipe_parse_uint(arg, &value) && value >= 1 &&
+                value <= MAX_PIPE_WIDTH;
+        if (valid)
+        {
+            config->pipe_width = value;
+        }
+    }
+    else if (strcmp(option, "-bpredpolicy") == 0)
+    {
+        uint32_t value;
+        valid = pipe_parse_uint(arg, &value) && value < NUM_BPRED_POLICIES;
+        if (valid)
+        {
+            config->bpred_policy = (BPredPolicy)value;
+        }
+    }
+    else if (strcmp(option, "-bpred_hist_bits") == 0)
+    {
+        valid = pipe_parse_uint(arg, &config->bpred_hist_bits);
+    }
+    else if (strcmp(option, "-bpred_pht_entries") == 0)
+    {
+        valid = pipe_parse_uint(arg, &config->bpred_pht_entries);
+    }
+    else if (strcmp(option, "-tageconfig") == 0)
+    {
+        // tage_config_load() reports its own errors.
+        if (arg != NULL && tage_config_load(arg, &config->tage_config) != 0)
+        {
+            *used_arg = true;
+            return PIPE_OPTION_INVALID;
+        }
+        valid = true;
+    }
+    else if (strcmp(option, "-bpred_perceptron_hist") == 0)
+    {
+        valid = pipe_parse_uint(arg, &config->perceptron_config.hist_len);
+    }
+    else if (strcmp(option, "-bpred_perceptron_rows") == 0)
+    {
+        valid = pipe_parse_uint(arg, &config->perceptron_config.num_rows);
+    }
+    else if (strcmp(option, "-bpred_perceptron_theta") == 0)
+    {
+        valid = pipe_parse_uint(arg, &config->perceptron_config.theta);
+    }
+    else if (strcmp(option, "-btb_entries") == 0)
+    {
+        valid = pipe_parse_uint(arg, &config->btb_config.num_entries);
+    }
+    else if (strcmp(option, "-btb_assoc") == 0)
+    {
+        valid = pipe_parse_uint(arg, &config->btb_config.assoc);
+    }
+    else if (strcmp(option, "-btb_miss_penalty") == 0)
+    {
+        valid = pipe_parse_uint(arg, &config->btb_config.miss_penalty);
+    }
+    else
+    {
+        return PIPE_OPTION_UNKNOWN;
+    }
+
+    *used_arg = true;
+    if (arg == NULL)
+    {
+        fprintf(stderr, "Error: missing argument to %s\n", option);
+        return PIPE_OPTION_INVALID;
+    }
+    if (!valid)
+    {
+        fprintf(stderr, "Error: invalid argument for %s\n", option);
+        return PIPE_OPTION_INVALID;
+    }
+    return PIPE_OPTION_OK;
+}
+
+/**
+ * Check that the predictor and BTB geometries of a pipeline configuration can
+ * be simulated, as set by options that may depend on each other.
+ *
+ * @param config the configuration to check
+ * @return true if the configuration is valid, or else false, in which case an
+ *         error message is printed
+ */
+bool pipe_config_check(const PipeConfig *config)
+{
+    if (!bpred_geometry_valid(config->bpred_hist_bits,
+                              config->bpred_pht_entries))
+    {
+        fprintf(stderr, "Error: gshare history must be at most %d bits, and "
+                        "its table a power of two from 2 to %u entries\n",
+                BPRED_MAX_HIST_BITS, BPRED_MAX_PHT_ENTRIES);
+        return false;
+    }
+
+    if (!perceptron_config_valid(&config->perceptron_config))
+    {
+        fprintf(stderr, "Error: perceptron history must be 1 to %d branches, "
+                        "and its table a power of two up to %u rows\n",
+                PERCEPTRON_MAX_HIST, PERCEPTRON_MAX_ROWS);
+        return false;
+    }
+
+    if (!btb_config_valid(&config->btb_config))
+    {
+        fprintf(stderr, "Error: the BTB must have a power of two entries up "
+                        "to %u, in sets of a power of two ways up to %d, and "
+                        "a miss penalty of at most %d cycles\n",
+                BTB_MAX_ENTRIES, BTB_MAX_ASSOC, BTB_MAX_MISS_PENALTY);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Apply options written as on the command line to a pipeline configuration.
+ *
+ * @param options the options to apply, separated by spaces
+ * @param config the configuration to update
+ * @return 0 on success, or 2 if an option was not recognized or had an
+ *         invalid argument
+ */
+int pipe_config_parse(const char *options, PipeConfig *config)
+{
+    char *copy = strdup(options);
+    if (copy == NULL)
+    {
+        perror("Couldn't parse configuration");
+        return 2;
+    }
+
+    int status = 0;
+    char *save = NULL;
+    char *option = strtok_r(copy, " \t", &save);
+    while (option != NULL && status == 0)
+    {
+        char *arg = strtok_r(NULL, " \t", &save);
+        bool used_arg;
+        switch (pipe_config_parse_option(option, arg, config, &used_arg))
+        {
+        case PIPE_OPTION_OK:
+            break;
+        case PIPE_OPTION_UNKNOWN:
+            fprintf(stderr, "Error: unrecognized option: %s\n", option);
+            status = 2;
+            break;
+        case PIPE_OPTION_INVALID:
+            status = 2;
+            break;
+        }
+        option = used_arg ? strtok_r(NULL, " \t", &save) : arg;
+    }
+
+    if (status == 0 && !pipe_config_check(config))
+    {
+        status = 2;
+    }
+
+    free(copy);
+    return status;
+}
+
+/**
+ * Get the statistics of a pipeline.
+ *
+ * @param p the pipeline
+ * @param stats set to the statistics of the pipeline
+ */
+void pipe_get_stats(const Pipeline *p, PipeStats *stats)
+{
+    stats->num_inst = p->stat_retired_inst;
+    stats->num_cycles = p->stat_num_cycle;
+    stats->cpi = (double)p->stat_num_cycle / (double)p->stat_retired_inst;
+    stats->has_bpred = p->b_pred != NULL;
+    stats->num_branches = p->b_pred != NULL ? p->b_pred->stat_num_branches : 0;
+    stats->num_mispred = p->b_pred != NULL ? p->b_pred->stat_num_mispred : 0;
+}
+
+/**
+ * Format pipeline statistics as the LAB2_* lines that report the lab's
+ * results.
+ *
+ * @param stats the statistics to format
+ * @param buf the buffer to write the lines to
+ * @param size the size of buf
+ * @return the length of the formatted lines, as snprintf() returns
+ */
+int pipe_format_stats(const PipeStats *stats, char *buf, size_t size)
+{
+    int len = snprintf(buf, size,
+                       "LAB2_NUM_INST           \t : %10lu\n"
+                       "LAB2_NUM_CYCLES         \t : %10lu\n"
+                       "LAB2_CPI                \t : %10.3f\n",
+                       (unsigned long)stats->num_inst,
+                       (unsigned long)stats->num_cycles, stats->cpi);
+    if (stats->has_bpred && len >= 0 && (size_t)len < size)
+    {
+        len += pipe_format_bpred_stats(stats, buf + len, size - len);
+    }
+    return len;
+}
+
+/**
+ * Format the branch prediction statistics of a pipeline as the LAB2_BPRED_*
+ * and LAB2_MISPRED_RATE lines.
+ *
+ * @param stats the statistics to format, which must have has_bpred set
+ * @param buf the buffer to write the lines to
+ * @param size the size of buf
+ * @return the length of the formatted lines, as snprintf() returns
+ */
+int pipe_format_bpred_stats(const PipeStats *stats, char *buf, size_t size)
+{
+    double mispred_rate = 100.0 * (double)stats->num_mispred /
+                          (double)stats->num_branches;
+    return snprintf(buf, size,
+                    "LAB2_BPRED_BRANCHES     \t : %10lu\n"
+                    "LAB2_BPRED_MISPRED      \t : %10lu\n"
+                    "LAB2_MISPRED_RATE       \t : %10.3f\n",
+                    (unsigned long)stats->num_branches,
+                    (unsigned long)stats->num_mispred, mispred_rate);
+}
+
+/**
+ * Empty a pipeline so that it can simulate a new stretch of the trace.
+ *
+ * @param p the pipeline to reset
+ */
+void pipe_reset(Pipeline *p)
+{
+    memset(p->pipe_latch, 0, sizeof(p->pipe_latch));
+    memset(p->scoreboard, 0, sizeof(p->scoreboard));
+    pipe_window_clear(p);
+    p->fetch_cbr_stall = false;
+    p->fetch_redirect_bubbles = 0;
+    p->halt_op_id = (uint64_t)(-1) - 3;
+    p->halt = false;
+}
+
+/**
+ * Rebuild a pipeline's scoreboards from its latches.
+ *
+ * @param p the pipeline whose scoreboards should be rebuilt
+ */
+void pipe_sync_scoreboards(Pipeline *p)
+{
+    memset(p->scoreboard, 0, sizeof(p->scoreboard));
+    for (int stage = ID_LATCH; stage < NUM_LATCH_TYPES; stage++)
+    {
+        for (unsigned int i = 0; i < p->config.pipe_width; i++)
+        {
+            pipe_scoreboard_add(p, &p->scoreboard[stage], i,
+                                &p->pipe_latch[stage][i]);
+        }
+    }
+}
+
+/**
+ * Refill a pipeline's instruction window with the trace records of the
+ * instructions in its latches, giving each instruction a slot.
+ *
+ * @param p the pipeline whose window should be refilled
+ * @param recs the trace record of each latch, indexed like pipe_latch; only
+ *        those of valid latches are used
+ */
+void pipe_sync_window(Pipeline *p,
+                      const TraceRec recs[NUM_LATCH_TYPES][MAX_PIPE_WIDTH])
+{
+    pipe_window_clear(p);
+    for (int stage = 0; stage < NUM_LATCH_TYPES; stage++)
+    {
+        for (unsigned int i = 0; i < p->config.pipe_width; i++)
+        {
+            PipelineLatch *latch = &p->pipe_latch[stage][i];
+            if (!latch->valid)
+            {
+                continue;
+            }
+
+            // A stalled instruction is held by both its IF and ID latches,
+            // which must share one slot.
+            bool placed = false;
+            for (int s = 0; s <= stage && !placed; s++)
+            {
+                unsigned int end = s < stage ? p->config.pipe_width : i;
+                for (unsigned int j = 0; j < end && !placed; j++)
+                {
+                    const PipelineLatch *other = &p->pipe_latch[s][j];
+                    if (other->valid && other->op_id == latch->op_id)
+                    {
+                        latch->slot = other->slot;
+                        placed = true;
+                    }
+                }
+            }
+
+            if (!placed)
+            {
+                latch->slot = p->window_free[--p->window_num_free];
+                p->window[latch->slot] = recs[stage][i];
+            }
+        }
+    }
+}
+
+/**
+ * Skip trace records without simulating them in the pipeline, passing the
+ * conditional branches among them through the branch predictor.
+ *
+ * The predictor and the BTB see exactly the branches, in exactly the order,
+ * they would see at fetch, so their state and statistics stay identical to a
+ * full simulation.
+ *
+ * @param p the pipeline whose trace should be fast-forwarded
+ * @param num_insts the number of trace records to skip
+ * @return the number of records skipped
+ */
+uint64_t pipe_fast_forward(Pipeline *p, uint64_t num_insts)
+{
+    TraceRec trace_rec;
+    uint64_t skipped = 0;
+
+    while (skipped < num_insts)
+    {
+        TraceReadStatus status = trace_reader_next(p->trace_reader,
+                                                   &trace_rec);
+        if (status == TRACE_READ_ERROR)
+        {
+            fprintf(stderr, "\n");
+            trace_reader_perror(p->trace_reader, "Couldn't read trace");
+            break;
+        }
+        if (status == TRACE_READ_EOF)
+        {
+            break;
+        }
+        if (status != TRACE_READ_OK || trace_rec.op_type >= NUM_OP_TYPES)
+        {
+            fprintf(stderr, "\n");
+            fprintf(stderr, "Error: Invalid trace file\n");
+            break;
+        }
+
+        if (p->b_pred != NULL && trace_rec.op_type == OP_CBR)
+        {
+            BranchDirection prediction = p->b_pred->predict(trace_rec.inst_addr);
+            p->b_pred->update(trace_rec.inst_addr, prediction,
+                              (BranchDirection)trace_rec.br_dir);
+        }
+        if (p->btb != NULL && trace_rec.op_type == OP_CBR &&
+            trace_rec.br_dir == TAKEN)
+        {
+            btb_access(p->btb, trace_rec.inst_addr, trace_rec.br_target);
+        }
+
+        // Keep op_ids in step with positions in the trace.
+        p->last_op_id++;
+        skipped++;
+    }
+
+    return skipped;
+}
+
+/**
+ * Print out the state of the pipeline latches for debugging purposes.
+ *
+ * You may use this function to help debug your pipeline implementation, but
+ * please remove calls to this function before submitting the lab.
+ *
+ * @param p the pipeline
+ */
+void pipe_print_state(Pipeline *p)
+{
+    printf("\n");
+    // Print table header
+    for (uint8_t latch_type = 0; latch_type < NUM_LATCH_TYPES; latch_type++)
+    {
+        switch (latch_type)
+        {
+        case IF_LATCH:
+            printf(" IF:    ");
+            break;
+        case ID_LATCH:
+            printf(" ID:    ");
+            break;
+        case EX_LATCH:
+            printf(" EX:    ");
+            break;
+        case MA_LATCH:
+            printf(" MA:    ");
+            break;
+        default:
+            printf(" ------ ");
+        }
+    }
+    printf("\n");
+
+    // Print row for each lane in pipeline width
+    for (uint8_t i = 0; i < p->config.pipe_width; i++)
+    {
+        for (uint8_t latch_type = 0; latch_type < NUM_LATCH_TYPES;
+             latch_type++)
+        {
+            if (p->pipe_latch[latch_type][i].valid)
+            {
+                printf(" %6lu ",
+                       (unsigned long)p->pipe_latch[latch_type][i].op_id);
+            }
+            else
+            {
+                printf(" ------ ");
+            }
+        }
+        printf("\n");
+    }
+    for (uint8_t i = 0; i < p->config.pipe_width; i++)
+    {
+        for (uint8_t latch_type = 0; latch_type < NUM_LATCH_TYPES;
+             latch_type++)
+        {
+            if (p->pipe_latch[latch_type][i].valid)
+            {
+                const TraceRec *trace_rec =
+                    pipe_latch_rec(p, &p->pipe_latch[latch_type][i]);
+                int dest = (trace_rec->dest_needed) ?
+                        trace_rec->dest_reg : -1;
+                int src1 = (trace_rec->src1_needed) ?
+                        trace_rec->src1_reg : -1;
+                int src2 = (trace_rec->src2_needed) ?
+                        trace_rec->src2_reg : -1;
+                int cc_read = trace_rec->cc_read;
+                int cc_write = trace_rec->cc_write;
+                int br_dir = trace_rec->br_dir;
+
+                const char *op_type;
+                if (trace_rec->op_type == OP_ALU)
+                    op_type = "ALU";
+                else if (trace_rec->op_type == OP_LD)
+                    op_type = "LD";
+                else if (trace_rec->op_type == OP_ST)
+                    op_type = "ST";
+                else if (trace_rec->op_type == OP_CBR)
+                    op_type = "BR";
+                else
+                    op_type = "OTHER";
+
+                printf("(%lu : %s) dest: %d, src1: %d, src2: %d , ccread: %d, ccwrite: %d, br_dir: %d\n",
+                       (unsigned long)p->pipe_latch[latch_type][i].op_id,
+                       op_type,
+                       dest,
+                       src1,
+                       src2,
+                       cc_read,
+                       cc_write,
+                       br_dir);
+            }
+            else
+            {
+                printf(" ------ \n");
+            }
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * [Internal] Get the width a cycle kernel should simulate.
+ *
+ * @param p the pipeline to simulate
+ * @return W, or the pipeline's configured width if W is 0
+ */
+template <unsigned int W>
+static inline unsigned int pipe_kernel_width(const Pipeline *p)
+{
+    return W != 0 ? W : p->config.pipe_width;
+}
+
+/**
+ * [Internal] Simulate one cycle of the Write Back stage (WB) of a pipeline of
+ * width W, or of its configured width if W is 0.
+ *
+ * @param p the pipeline to simulate
+ */
+template <unsigned int W>
+static inline void pipe_stage_WB(Pipeline *p)
+{
+    const unsigned int width = pipe_kernel_width<W>(p);
+    for (unsigned int i = 0; i < width; i++)
+    {
+        if (p->pipe_latch[MA_LATCH][i].valid)
+        {
+            p->stat_retired_inst++;
+
+            // Give the instruction's window slot back for fetch to reuse.
+            p->window_free[p->window_num_free++] =
+                p->pipe_latch[MA_LATCH][i].slot;
+
+            /* retire mispredicted intr, unstall IF */
+            if (p->pipe_latch[MA_LATCH][i].is_mispred_cbr) {
+                p->fetch_cbr_stall = false;
+            }
+
+            if (p->pipe_latch[MA_LATCH][i].op_id >= p->halt_op_id)
+            {
+                // Halt the pipeline if we've reached the end of the trace.
+                p->halt = true;
+            }
+        }
+    }
+}
+
+/**
+ * [Internal] Simulate one cycle of the Memory Access stage (MA) of a pipeline
+ * of width W, or of its configured width if W is 0.
+ *
+ * @param p the pipeline to simulate
+ */
+template <unsigned int W>
+static inline void pipe_stage_MA(Pipeline *p)
+{
+    const unsigned int width = pipe_kernel_width<W>(p);
+    PipeScoreboard *sb = &p->scoreboard[MA_LATCH];
+    for (unsigned int i = 0; i < width; i++)
+    {
+        // Copy each instruction from the EX latch to the MA latch.
+        pipe_scoreboard_remove(p, sb, i, &p->pipe_latch[MA_LATCH][i]);
+        p->pipe_latch[MA_LATCH][i] = p->pipe_latch[EX_LATCH][i];
+        pipe_scoreboard_add(p, sb, i, &p->pipe_latch[MA_LATCH][i]);
+    }
+}
+
+/**
+ * [Internal] Simulate one cycle of the Execute stage (EX) of a pipeline of
+ * width W, or of its configured width if W is 0.
+ *
+ * @param p the pipeline to simulate
+ */
+template <unsigned int W>
+static inline void pipe_stage_EX(Pipeline *p)
+{
+    const unsigned int width = pipe_kernel_width<W>(p);
+    PipeScoreboard *sb = &p->scoreboard[EX_LATCH];
+    for (unsigned int i = 0; i < width; i++)
+    {
+        // Copy each instruction from the ID latch to the EX latch.
+        pipe_scoreboard_remove(p, sb, i, &p->pipe_latch[EX_LATCH][i]);
+        p->pipe_latch[EX_LATCH][i] = p->pipe_latch[ID_LATCH][i];
+
+        /* If ID.stall == TRUE then insert a BUBBLE (valid == FALSE) */
+        if (p->pipe_latch[ID_LATCH][i].stall) {
+            p->pipe_latch[EX_LATCH][i].valid = false;
+        }
+
+        pipe_scoreboard_add(p, sb, i, &p->pipe_latch[EX_LATCH][i]);
+    }
+}
+
+/**
+ * [Internal] Simulate one cycle of the Instruction Decode stage (ID) of a
+ * pipeline of width W, or of its configured width if W is 0, with forwarding
+ * from MA and EX as given by MEM_FWD and EXE_FWD, comparing ages with L.
+ *
+ * @param p the pipeline to simulate
+ */
+template <unsigned int W, bool MEM_FWD, bool EXE_FWD, PipeLaneCompare L>
+static inline void pipe_stage_ID(Pipeline *p)
+{
+    const unsigned int width = pipe_kernel_width<W>(p);
+    PipeScoreboard *sb = p->scoreboard;
+
+    // A scalar pipeline has no other ID lanes to depend on, so it needs no ID
+    // scoreboard.
+    const bool use_ID_scoreboard = width > 1;
+
+    for (unsigned int i = 0; i < width; i++)
+    {
+        // Copy each instruction from the IF latch to the ID latch.
+        if (use_ID_scoreboard) {
+            pipe_scoreboard_remove(p, &sb[ID_LATCH], i, &p->pipe_latch[ID_LATCH][i]);
+        }
+        p->pipe_latch[ID_LATCH][i] = p->pipe_latch[IF_LATCH][i];
+        if (use_ID_scoreboard) {
+            pipe_scoreboard_add(p, &sb[ID_LATCH], i, &p->pipe_latch[ID_LATCH][i]);
+        }
+    }
+
+    /* detect dependencies*/
+    for (unsigned int i = 0; i < width; i++) {
+
+        /* we don't skip mispredicted branches, as in real life we don't know the resolved branch until EX stage so we have to do dependency checking & forwarding */
+
+        PipelineLatch *op = &p->pipe_latch[ID_LATCH][i];
+        if (!op->valid) { continue; }
+        const TraceRec *rec = pipe_latch_rec(p, op);
+
+        /* The scoreboards give the lanes writing a register or the CC that
+           this instruction reads; of those, only older instructions count. */
+
+        /* ---------------- detect dependencies in ID stage ---------------- */
+        uint8_t lanes = use_ID_scoreboard ? pipe_scoreboard_conflicts(&sb[ID_LATCH], rec) : 0;
+        bool dependency_in_ID = lanes != 0 && pipe_lanes_older<L>(&sb[ID_LATCH], lanes, op->op_id, false) != 0;
+
+        if (dependency_in_ID) {
+            op->stall = true;
+            continue;
+        }
+
+        /* ---------------- detect dependencies in EX stage ---------------- */
+        uint64_t youngest_EX_DEP_opid = 0;
+        uint64_t youngest_EX_DEP_type = OP_LD;
+
+        lanes = pipe_scoreboard_conflicts(&sb[EX_LATCH], rec);
+        if (lanes != 0) {
+            lanes = pipe_lanes_older<L>(&sb[EX_LATCH], lanes, op->op_id, true);
+        }
+        bool dependency_in_EX = lanes != 0;
+        for (; lanes != 0; lanes &= lanes - 1) {
+            const PipelineLatch *dep = &p->pipe_latch[EX_LATCH][__builtin_ctz(lanes)];
+
+            /* keep track of the youngest instr in EX */
+            if (dep->op_id > youngest_EX_DEP_opid) {
+                youngest_EX_DEP_opid = dep->op_id;
+                youngest_EX_DEP_type = pipe_latch_rec(p, dep)->op_type;
+            }
+        }
+
+        /* --------------------- forward from EX stage --------------------- */
+        if (dependency_in_EX) {
+            op->stall = !pipe_can_forward_EX(EXE_FWD, youngest_EX_DEP_type);
+            continue;
+        }
+
+        /* ---------------- detect dependencies in MA stage ---------------- */
+        lanes = pipe_scoreboard_conflicts(&sb[MA_LATCH], rec);
+        bool dependency_in_MA = lanes != 0 && pipe_lanes_older<L>(&sb[MA_LATCH], lanes, op->op_id, true) != 0;
+
+        /* --------------------- forward from MA stage --------------------- */
+        if (dependency_in_MA) {
+            op->stall = !pipe_can_forward_MA(MEM_FWD);
+        }
+    }
+
+
+    /* maintain in-order property */
+    for (unsigned int i = 0; i < width; i++) {
+        if (p->pipe_latch[ID_LATCH][i].stall) {
+            for (unsigned int j = 0; j < width; j++) {
+                /* if an instruction is stalled, then all instructions younger to it must be stalled */
+                if (p->pipe_latch[ID_LATCH][j].op_id > p->pipe_latch[ID_LATCH][i].op_id) {
+                    p->pipe_latch[ID_LATCH][j].stall = true;
+                }
+            }
+            break;
+        }
+    }
+
+}
+
+/**
+ * [Internal] If the instruction just fetched is a taken conditional branch,
+ * look its target up in the BTB, which learns it for next time. Unless the
+ * branch was mispredicted, in which case fetch stalls until it retires
+ * anyway, fetch goes on at the target: next cycle if the BTB had it, or after
+ * the miss penalty if not.
+ *
+ * @param p the pipeline, whose front end must be modeled
+ * @param fetch_op the pipeline latch containing the operation fetched
+ * @return true if fetch was redirected to the branch's target, ending the
+ *         fetch group
+ */
+static inline bool pipe_check_btb(Pipeline *p, const PipelineLatch *fetch_op)
+{
+    if (!fetch_op->valid)
+    {
+        return false;
+    }
+    const TraceRec *trace_rec = pipe_latch_rec(p, fetch_op);
+    if (trace_rec->op_type != OP_CBR || trace_rec->br_dir != TAKEN)
+    {
+        return false;
+    }
+
+    bool hit = btb_access(p->btb, trace_rec->inst_addr, trace_rec->br_target);
+    if (fetch_op->is_mispred_cbr)
+    {
+        return false;
+    }
+    if (!hit)
+    {
+        p->fetch_redirect_bubbles = p->config.btb_config.miss_penalty;
+    }
+    return true;
+}
+
+/**
+ * [Internal] Simulate one cycle of the Instruction Fetch stage (IF) of a
+ * pipeline of width W, or of its configured width if W is 0, consulting the
+ * branch predictor only if BPRED is set, and modeling the front end (see
+ * PipeConfig::btb_config) only if FRONTEND is set.
+ *
+ * @param p the pipeline to simulate
+ */
+template <unsigned int W, bool BPRED, bool FRONTEND = false>
+static inline void pipe_stage_IF(Pipeline *p)
+{
+    const unsigned int width = pipe_kernel_width<W>(p);
+
+    // While fetch is redirected after a BTB miss, or after a taken branch
+    // ends the fetch group, the lanes get bubbles.
+    bool redirecting = FRONTEND && p->fetch_redirect_bubbles > 0;
+    bool group_ended = false;
+    if (redirecting)
+    {
+        p->fetch_redirect_bubbles--;
+        p->stat_redirect_cycles++;
+    }
+
+    for (unsigned int i = 0; i < width; i++)
+    {
+         /* if ID.stall == TRUE then don't FETCH */
+        if (p->pipe_latch[ID_LATCH][i].stall) { continue; }
+
+        /* if fetch_cbr_stall then insert a NOP */
+        if (p->fetch_cbr_stall) {
+            p->pipe_latch[IF_LATCH][i].valid = false;
+            continue;
+        }
+
+        if (FRONTEND && (redirecting || group_ended))
+        {
+            p->pipe_latch[IF_LATCH][i].valid = false;
+            p->stat_fetch_break_lanes += group_ended;
+            continue;
+        }
+
+        // Read an instruction from the trace file.
+        PipelineLatch fetch_op;
+        pipe_get_fetch_op(p, &fetch_op);
+
+        // Handle branch (mis)prediction.
+        if (BPRED)
+        {
+            pipe_check_bpred(p, &fetch_op);
+        }
+
+        // Redirect fetch after a taken branch.
+        if (FRONTEND && pipe_check_btb(p, &fetch_op) && i + 1 < width)
+        {
+            group_ended = true;
+            p->stat_fetch_breaks++;
+        }
+
+        // Copy the instruction to the IF latch.
+        p->pipe_latch[IF_LATCH][i] = fetch_op;
+    }
+}
+
+/**
+ * [Internal] Simulate one cycle of every stage of a pipeline, specialized for
+ * one configuration so that the compiler can unroll the lane loops and drop
+ * the checks for options that are off.
+ *
+ * @param p the pipeline to simulate, whose configuration must match the
+ *        template arguments
+ */
+template <unsigned int W, bool MEM_FWD, bool EXE_FWD, bool BPRED>
+static void pipe_cycle_kernel(Pipeline *p)
+{
+    // In hardware, all pipeline stages execute in parallel, and each pipeline
+    // latch is populated at the start of the next clock cycle.
+
+    // In our simulator, we simulate the pipeline stages one at a time in
+    // reverse order, from the Write Back stage (WB) to the Fetch stage (IF).
+    // We do this so that each stage can read from the latch before it and
+    // write to the latch after it without needing to "double-buffer" the
+    // latches.
+
+    // Additionally, it means that earlier pipeline stages can know about
+    // stalls triggered in later pipeline stages in the same cycle, as would be
+    // the case with hardware stall signals asserted by combinational logic.
+
+    pipe_stage_WB<W>(p);
+    pipe_stage_MA<W>(p);
+    pipe_stage_EX<W>(p);
+    pipe_stage_ID<W, MEM_FWD, EXE_FWD, PIPE_LANES_SCALAR>(p);
+    pipe_stage_IF<W, BPRED>(p);
+}
+
+/**
+ * [Internal] Simulate one cycle of every stage of a pipeline of any
+ * configuration, reading the configuration at run time.
+ *
+ * @param p the pipeline to simulate
+ */
+static void pipe_cycle_generic(Pipeline *p)
+{
+    pipe_cycle_WB(p);
+    pipe_cycle_MA(p);
+    pipe_cycle_EX(p);
+    pipe_cycle_ID(p);
+    pipe_cycle_IF(p);
+}
+
+/**
+ * [Internal] Simulate one cycle of the Instruction Decode stage (ID) of a
+ * pipeline of its configured width and forwarding, comparing ages with L.
+ *
+ * @param p the pipeline to simulate
+ */
+template <PipeLaneCompare L>
+static inline void pipe_stage_ID_any(Pipeline *p)
+{
+    if (p->config.enable_mem_fwd)
+    {
+        if (p->config.enable_exe_fwd)
+        {
+            pipe_stage_ID<0, true, true, L>(p);
+        }
+        else
+        {
+            pipe_stage_ID<0, true, false, L>(p);
+        }
+    }
+    else
+    {
+        if (p->config.enable_exe_fwd)
+        {
+            pipe_stage_ID<0, false, true, L>(p);
+        }
+        else
+        {
+            pipe_stage_ID<0, false, false, L>(p);
+        }
+    }
+}
+
+/**
+ * [Internal] Simulate one cycle of every stage of a wide pipeline of any
+ * configuration, like pipe_cycle_generic(), comparing ages in the ID stage
+ * with L.
+ *
+ * @param p the pipeline to simulate
+ */
+template <PipeLaneCompare L>
+static inline void pipe_cycle_wide(Pipeline *p)
+{
+    pipe_cycle_WB(p);
+    pipe_cycle_MA(p);
+    pipe_cycle_EX(p);
+    pipe_stage_ID_any<L>(p);
+    pipe_cycle_IF(p);
+}
+
+#ifdef __SSE2__
+/**
+ * [Internal] Simulate one cycle of a wide pipeline with SSE2 lane
+ * comparisons.
+ *
+ * @param p the pipeline to simulate
+ */
+static void pipe_cycle_wide_sse2(Pipeline *p)
+{
+    pipe_cycle_wide<PIPE_LANES_SSE2>(p);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * [Internal] Simulate one cycle of a wide pipeline with AVX2 lane
+ * comparisons. Only call this on a CPU that supports AVX2.
+ *
+ * The stages are built for the default target, so they are flattened into
+ * this function; otherwise the AVX2 comparisons could not be inlined into
+ * them.
+ *
+ * @param p the pipeline to simulate
+ */
+__attribute__((target("avx2"), flatten))
+static void pipe_cycle_wide_avx2(Pipeline *p)
+{
+    pipe_cycle_wide<PIPE_LANES_AVX2>(p);
+}
+#endif
+
+/**
+ * [Internal] Get the fastest lane comparison this CPU supports. Building with
+ * -DPIPE_NO_SIMD forces the scalar comparison.
  *
- * You should not need to modify this function.
- *
- * @param trace_fd the file descriptor from which to read trace records
- * @return a pointer to a newly allocated pipeline
+ * @return the lane comparison wide pipelines should use
  */
-Pipeline *pipe_init(int trace_fd)
+static PipeLaneCompare pipe_best_lane_compare(void)
 {
-    printf("\n** PIPELINE IS %d WIDE **\n\n", PIPE_WIDTH);
-
-    // Allocate pipeline.
-    Pipeline *p = (Pipeline *)calloc(1, sizeof(Pipeline));
-
-    // Initialize pipeline.
-    p->trace_fd = trace_fd;
-    p->halt_op_id = (uint64_t)(-1) - 3;
-
-    // Allocate and initialize a branch predictor if needed.
-    if (BPRED_POLICY != BPRED_PERFECT)
+#ifndef PIPE_NO_SIMD
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
     {
-        p->b_pred = new BPred(BPRED_POLICY);
+        return PIPE_LANES_AVX2;
     }
-
-    return p;
+#endif
+#ifdef __SSE2__
+    return PIPE_LANES_SSE2;
+#endif
+#endif
+    return PIPE_LANES_SCALAR;
 }
 
 /**
- * Print out the state of the pipeline latches for debugging purposes.
- *
- * You may use this function to help debug your pipeline implementation, but
- * please remove calls to this function before submitting the lab.
+ * [Internal] The widest pipeline that gets a specialized cycle kernel. The ID
+ * stage compares every lane against every other, so fully unrolled kernels
+ * grow with the square of the width; past 3 lanes they measured slower than
+ * the generic stages, which wider pipelines use instead, with the lane
+ * comparisons vectorized if the CPU supports it.
+ */
+#define PIPE_KERNEL_MAX_WIDTH 3
+
+#define PIPE_CYCLE_KERNELS_FOR_WIDTH(W)                                      \
+    {{{pipe_cycle_kernel<W, false, false, false>,                            \
+       pipe_cycle_kernel<W, false, false, true>},                            \
+      {pipe_cycle_kernel<W, false, true, false>,                             \
+       pipe_cycle_kernel<W, false, true, true>}},                            \
+     {{pipe_cycle_kernel<W, true, false, false>,                             \
+       pipe_cycle_kernel<W, true, false, true>},                             \
+      {pipe_cycle_kernel<W, true, true, false>,                              \
+       pipe_cycle_kernel<W, true, true, true>}}}
+
+/**
+ * [Internal] The specialized cycle kernels, indexed by [pipe_width - 1]
+ * [enable_mem_fwd][enable_exe_fwd][bpred_policy != BPRED_PERFECT].
+ */
+static PipeCycleKernel const
+    PIPE_CYCLE_KERNELS[PIPE_KERNEL_MAX_WIDTH][2][2][2] = {
+        PIPE_CYCLE_KERNELS_FOR_WIDTH(1),
+        PIPE_CYCLE_KERNELS_FOR_WIDTH(2),
+        PIPE_CYCLE_KERNELS_FOR_WIDTH(3),
+};
+
+/**
+ * Get the cycle kernel specialized for a pipeline configuration.
  *
- * @param p the pipeline
+ * @param config the configuration of the pipeline
+ * @return the kernel that simulates one cycle of a pipeline so configured
  */
-void pipe_print_state(Pipeline *p)
+PipeCycleKernel pipe_select_kernel(const PipeConfig *config)
 {
-    printf("\n");
-    // Print table header
-    for (uint8_t latch_type = 0; latch_type < NUM_LATCH_TYPES; latch_type++)
+    // The front end model is an opt-in study, so it gets no kernels of its
+    // own; the generic stages check for it at run time.
+    if (config->btb_config.num_entries > 0 &&
+        config->pipe_width <= PIPE_KERNEL_MAX_WIDTH)
     {
-        switch (latch_type)
-        {
-        case IF_LATCH:
-            printf(" IF:    ");
-            break;
-        case ID_LATCH:
-            printf(" ID:    ");
-            break;
-        case EX_LATCH:
-            printf(" EX:    ");
-            break;
-        case MA_LATCH:
-            printf(" MA:    ");
-            break;
-        default:
-            printf(" ------ ");
-        }
-    }
-    printf("\n");
-
-    // Print row for each lane in pipeline width
-    for (uint8_t i = 0; i < PIPE_WIDTH; i++)
-    {
-        for (uint8_t latch_type = 0; latch_type < NUM_LATCH_TYPES;
-             latch_type++)
-        {
-            if (p->pipe_latch[latch_type][i].valid)
-            {
-                printf(" %6lu ",
-                       (unsigned long)p->pipe_latch[latch_type][i].op_id);
-            }
-            else
-            {
-                printf(" ------ ");
-            }
-        }
-        printf("\n");
+        return pipe_cycle_generic;
     }
-    for (uint8_t i = 0; i < PIPE_WIDTH; i++)
+    if (config->pipe_width > PIPE_KERNEL_MAX_WIDTH)
     {
-        for (uint8_t latch_type = 0; latch_type < NUM_LATCH_TYPES;
-             latch_type++)
+        switch (pipe_best_lane_compare())
         {
-            if (p->pipe_latch[latch_type][i].valid)
-            {
-                int dest = (p->pipe_latch[latch_type][i].trace_rec.dest_needed) ?
-                        p->pipe_latch[latch_type][i].trace_rec.dest_reg : -1;
-                int src1 = (p->pipe_latch[latch_type][i].trace_rec.src1_needed) ?
-                        p->pipe_latch[latch_type][i].trace_rec.src1_reg : -1;
-                int src2 = (p->pipe_latch[latch_type][i].trace_rec.src2_needed) ?
-                        p->pipe_latch[latch_type][i].trace_rec.src2_reg : -1;
-                int cc_read = p->pipe_latch[latch_type][i].trace_rec.cc_read;
-                int cc_write = p->pipe_latch[latch_type][i].trace_rec.cc_write;
-                int br_dir = p->pipe_latch[latch_type][i].trace_rec.br_dir;
-
-                const char *op_type;
-                if (p->pipe_latch[latch_type][i].trace_rec.op_type == OP_ALU)
-                    op_type = "ALU";
-                else if (p->pipe_latch[latch_type][i].trace_rec.op_type == OP_LD)
-                    op_type = "LD";
-                else if (p->pipe_latch[latch_type][i].trace_rec.op_type == OP_ST)
-                    op_type = "ST";
-                else if (p->pipe_latch[latch_type][i].trace_rec.op_type == OP_CBR)
-                    op_type = "BR";
-                else
-                    op_type = "OTHER";
-
-                printf("(%lu : %s) dest: %d, src1: %d, src2: %d , ccread: %d, ccwrite: %d, br_dir: %d\n",
-                       (unsigned long)p->pipe_latch[latch_type][i].op_id,
-                       op_type,
-                       dest,
-                       src1,
-                       src2,
-                       cc_read,
-                       cc_write,
-                       br_dir);
-            }
-            else
-            {
-                printf(" ------ \n");
-            }
+#if defined(__x86_64__) || defined(__i386__)
+        case PIPE_LANES_AVX2:
+            return pipe_cycle_wide_avx2;
+#endif
+#ifdef __SSE2__
+        case PIPE_LANES_SSE2:
+            return pipe_cycle_wide_sse2;
+#endif
+        default:
+            return pipe_cycle_generic;
         }
-        printf("\n");
     }
+    return PIPE_CYCLE_KERNELS[config->pipe_width - 1][config->enable_mem_fwd]
+                             [config->enable_exe_fwd]
+                             [config->bpred_policy != BPRED_PERFECT];
 }
 
 /**
@@ -231,24 +1469,9 @@ void pipe_cycle(Pipeline *p)
             (unsigned long)p->stat_retired_inst);
     #endif
 
-    // In hardware, all pipeline stages execute in parallel, and each pipeline
-    // latch is populated at the start of the next clock cycle.
-
-    // In our simulator, we simulate the pipeline stages one at a time in
-    // reverse order, from the Write Back stage (WB) to the Fetch stage (IF).
-    // We do this so that each stage can read from the latch before it and
-    // write to the latch after it without needing to "double-buffer" the
-    // latches.
-
-    // Additionally, it means that earlier pipeline stages can know about
-    // stalls triggered in later pipeline stages in the same cycle, as would be
-    // the case with hardware stall signals asserted by combinational logic.
-
-    pipe_cycle_WB(p);
-    pipe_cycle_MA(p);
-    pipe_cycle_EX(p);
-    pipe_cycle_ID(p);
-    pipe_cycle_IF(p);
+    // Run the stages, from WB back to IF, through the kernel specialized for
+    // this pipeline's configuration.
+    p->cycle_kernel(p);
 
     // Compile with "make debug" to have this show!
     #ifdef DEBUG
@@ -257,271 +1480,94 @@ void pipe_cycle(Pipeline *p)
 }
 
 /**
- * Simulate one cycle of the Write Back stage (WB) of a pipeline.
+ * Check that a pipeline is not deadlocked: at every heartbeat, once every
+ * PIPE_HEARTBEAT_CYCLES cycles, it must have retired an instruction since the
+ * heartbeat before.
  *
- * Some skeleton code has been provided for you. You must implement anything
- * else you need for the pipeline simulation to work properly.
+ * @param p the pipeline to check
+ * @param last_hbeat_inst the number of retired instructions at the last
+ *        heartbeat, which is updated at each heartbeat
+ * @return false if the pipeline is deadlocked, or else true
+ */
+bool pipe_check_progress(const Pipeline *p, uint64_t *last_hbeat_inst)
+{
+    if (p->stat_num_cycle % PIPE_HEARTBEAT_CYCLES != 0)
+    {
+        return true;
+    }
+    if (p->stat_retired_inst == *last_hbeat_inst)
+    {
+        return false;
+    }
+    *last_hbeat_inst = p->stat_retired_inst;
+    return true;
+}
+
+/**
+ * Simulate one cycle of the Write Back stage (WB) of a pipeline.
  *
  * @param p the pipeline to simulate
  */
 void pipe_cycle_WB(Pipeline *p)
 {
-    for (unsigned int i = 0; i < PIPE_WIDTH; i++)
-    {
-        if (p->pipe_latch[MA_LATCH][i].valid)
-        {
-            p->stat_retired_inst++;
-
-            /* retire mispredicted intr, unstall IF */
-            if (p->pipe_latch[MA_LATCH][i].is_mispred_cbr) {
-                p->fetch_cbr_stall = false;
-            }
-
-            if (p->pipe_latch[MA_LATCH][i].op_id >= p->halt_op_id)
-            {
-                // Halt the pipeline if we've reached the end of the trace.
-                p->halt = true;
-            }
-        }
-    }
+    pipe_stage_WB<0>(p);
 }
 
 /**
  * Simulate one cycle of the Memory Access stage (MA) of a pipeline.
  *
- * Some skeleton code has been provided for you. You must implement anything
- * else you need for the pipeline simulation to work properly.
- *
  * @param p the pipeline to simulate
  */
 void pipe_cycle_MA(Pipeline *p)
 {
-    for (unsigned int i = 0; i < PIPE_WIDTH; i++)
-    {
-        // Copy each instruction from the EX latch to the MA latch.
-        p->pipe_latch[MA_LATCH][i] = p->pipe_latch[EX_LATCH][i];
-    }
+    pipe_stage_MA<0>(p);
 }
 
 /**
  * Simulate one cycle of the Execute stage (EX) of a pipeline.
  *
- * Some skeleton code has been provided for you. You must implement anything
- * else you need for the pipeline simulation to work properly.
- *
  * @param p the pipeline to simulate
  */
 void pipe_cycle_EX(Pipeline *p)
 {
-    for (unsigned int i = 0; i < PIPE_WIDTH; i++)
-    {
-        // Copy each instruction from the ID latch to the EX latch.
-        p->pipe_latch[EX_LATCH][i] = p->pipe_latch[ID_LATCH][i];
-
-        /* If ID.stall == TRUE then insert a BUBBLE (valid == FALSE) */
-        if (p->pipe_latch[ID_LATCH][i].stall) {
-            p->pipe_latch[EX_LATCH][i].valid = false;
-        }
-
-    }
+    pipe_stage_EX<0>(p);
 }
 
 /**
  * Simulate one cycle of the Instruction Decode stage (ID) of a pipeline.
  *
- * Some skeleton code has been provided for you. You must implement anything
- * else you need for the pipeline simulation to work properly.
- *
  * @param p the pipeline to simulate
  */
 void pipe_cycle_ID(Pipeline *p)
 {
-
-    for (unsigned int i = 0; i < PIPE_WIDTH; i++)
-    {
-        // Copy each instruction from the ID latch to the  latch.
-        p->pipe_latch[ID_LATCH][i] = p->pipe_latch[IF_LATCH][i];
-    }
-
-    /* detect dependencies*/
-    for (unsigned int i = 0; i < PIPE_WIDTH; i++) {
-
-        /* branch prediction: if ID instr is invalid then don't waste time here */
-
-        /* we don't line below us, as in real life we don't know the resolved branch until EX stage so we have to do dependency checking & forwarding */
-        /* if (p->pipe_latch[ID_LATCH][i].is_mispred_cbr) { continue; } */
-
-
-        if (!p->pipe_latch[ID_LATCH][i].valid) { continue; }
-
-        bool dependency_in_ID = false;
-        bool dependency_in_EX = false;
-        bool dependency_in_MA = false;
-
-        uint64_t youngest_EX_DEP_opid = 0;
-        uint64_t youngest_EX_DEP_type = 1; //OP_LD
-
-        /* ---------------- detect dependencies in ID stage ---------------- */
-        for (unsigned int j = 0; j < PIPE_WIDTH; j++) {
-            if (!dependency_in_ID && p->pipe_latch[ID_LATCH][j].valid && p->pipe_latch[ID_LATCH][i].op_id > p->pipe_latch[ID_LATCH][j].op_id) {
-
-                /* (i.op_id > j.op_id) && (i.cc_read && j.cc_write) */
-                if ((p->pipe_latch[ID_LATCH][i].trace_rec.cc_read && p->pipe_latch[ID_LATCH][j].trace_rec.cc_write)) {
-                    dependency_in_ID = true;
-                }
-
-                /* (i.op_id > j.op_id) && (i.src_reg1 == j.dest_reg) */
-                if ((p->pipe_latch[ID_LATCH][i].trace_rec.src1_needed && p->pipe_latch[ID_LATCH][j].trace_rec.dest_needed) &&
-                    (p->pipe_latch[ID_LATCH][i].trace_rec.src1_reg == p->pipe_latch[ID_LATCH][j].trace_rec.dest_reg)) {
-                    dependency_in_ID = true;
-                }
-
-                /* (i.op_id > j.op_id) && (i.src_reg2 == j.dest_reg) */
-                if ((p->pipe_latch[ID_LATCH][i].trace_rec.src2_needed && p->pipe_latch[ID_LATCH][j].trace_rec.dest_needed) &&
-                    (p->pipe_latch[ID_LATCH][i].trace_rec.src2_reg == p->pipe_latch[ID_LATCH][j].trace_rec.dest_reg)) {
-                    dependency_in_ID = true;
-                }
-
-                if (dependency_in_ID) { p->pipe_latch[ID_LATCH][i].stall = true; }
-            }
-        }
-
-        /* ---------------- detect dependencies in EX stage ---------------- */
-        for (unsigned int j = 0; j < PIPE_WIDTH; j++) {
-            if (!dependency_in_ID /*&& !dependency_in_EX */&& p->pipe_latch[EX_LATCH][j].valid
-            && (p->pipe_latch[ID_LATCH][i].op_id >= p->pipe_latch[EX_LATCH][j].op_id)) {
-
-                /* ID cc_read && EX cc_write */
-                if (p->pipe_latch[ID_LATCH][i].trace_rec.cc_read && p->pipe_latch[EX_LATCH][j].trace_rec.cc_write) {
-                    dependency_in_EX = true;
-
-                    /* keep track of the youngest instr in EX */
-                    if (p->pipe_latch[EX_LATCH][j].op_id > youngest_EX_DEP_opid) {
-                        youngest_EX_DEP_opid = p->pipe_latch[EX_LATCH][j].op_id;
-                        youngest_EX_DEP_type = p->pipe_latch[EX_LATCH][j].trace_rec.op_type;
-                    }
-                }
-
-                /* ID src_reg1 == EX dest_reg */
-                if ((p->pipe_latch[ID_LATCH][i].trace_rec.src1_needed && p->pipe_latch[EX_LATCH][j].trace_rec.dest_needed)
-                && (p->pipe_latch[ID_LATCH][i].trace_rec.src1_reg == p->pipe_latch[EX_LATCH][j].trace_rec.dest_reg)) {
-                    dependency_in_EX = true;
-
-                    /* keep track of the youngest instr in EX */
-                    if (p->pipe_latch[EX_LATCH][j].op_id > youngest_EX_DEP_opid) {
-                        youngest_EX_DEP_opid = p->pipe_latch[EX_LATCH][j].op_id;
-                        youngest_EX_DEP_type = p->pipe_latch[EX_LATCH][j].trace_rec.op_type;
-                    }
-                }
-
-                /* ID src_reg2 == EX dest_reg */
-                if ((p->pipe_latch[ID_LATCH][i].trace_rec.src2_needed && p->pipe_latch[EX_LATCH][j].trace_rec.dest_needed)
-                && (p->pipe_latch[ID_LATCH][i].trace_rec.src2_reg == p->pipe_latch[EX_LATCH][j].trace_rec.dest_reg)) {
-                    dependency_in_EX = true;
-
-                    /* keep track of the youngest instr in EX */
-                    if (p->pipe_latch[EX_LATCH][j].op_id > youngest_EX_DEP_opid) {
-                        youngest_EX_DEP_opid = p->pipe_latch[EX_LATCH][j].op_id;
-                        youngest_EX_DEP_type = p->pipe_latch[EX_LATCH][j].trace_rec.op_type;
-                    }
-                }
-
-                if (dependency_in_EX) { p->pipe_latch[ID_LATCH][i].stall = true; }
-            }
-        }
-
-
-        /* --------------------- forward from EX stage --------------------- */
-        if (!dependency_in_ID && ENABLE_EXE_FWD && dependency_in_EX) {
-            if (youngest_EX_DEP_type != OP_LD) {
-                p->pipe_latch[ID_LATCH][i].stall = false;
-            }
-        }
-
-
-        /* ---------------- detect dependencies in MA stage ---------------- */
-        for (unsigned int j = 0; j < PIPE_WIDTH; j++) {
-            if (!dependency_in_ID && !dependency_in_EX && !dependency_in_MA
-            && p->pipe_latch[MA_LATCH][j].valid
-            && (p->pipe_latch[ID_LATCH][i].op_id >= p->pipe_latch[MA_LATCH][j].op_id)) {
-
-                /* ID cc_read && MA cc_write */
-                if (p->pipe_latch[ID_LATCH][i].trace_rec.cc_read && p->pipe_latch[MA_LATCH][j].trace_rec.cc_write) {
-                    dependency_in_MA = true;
-                }
-
-                /* ID src_reg1 == MA dest_reg */
-                if ((p->pipe_latch[ID_LATCH][i].trace_rec.src1_needed && p->pipe_latch[MA_LATCH][j].trace_rec.dest_needed)
-                && (p->pipe_latch[ID_LATCH][i].trace_rec.src1_reg == p->pipe_latch[MA_LATCH][j].trace_rec.dest_reg)) {
-                    dependency_in_MA = true;
-                }
-
-                /* ID src_reg2 == MA dest_reg */
-                if ((p->pipe_latch[ID_LATCH][i].trace_rec.src2_needed && p->pipe_latch[MA_LATCH][j].trace_rec.dest_needed)
-                && (p->pipe_latch[ID_LATCH][i].trace_rec.src2_reg == p->pipe_latch[MA_LATCH][j].trace_rec.dest_reg)) {
-                    dependency_in_MA = true;
-                }
-
-                if (dependency_in_MA) { p->pipe_latch[ID_LATCH][i].stall = true; }
-            }
-        }
-
-
-        /* --------------------- forward from MA stage --------------------- */
-        if (!dependency_in_ID && !dependency_in_EX && ENABLE_MEM_FWD && dependency_in_MA) {
-            p->pipe_latch[ID_LATCH][i].stall = false;
-        }
-    }
-
-
-    /* maintain in-order property */
-    for (unsigned int i = 0; i < PIPE_WIDTH; i++) {
-        if (p->pipe_latch[ID_LATCH][i].stall) {
-            for (unsigned int j = 0; j < PIPE_WIDTH; j++) {
-                /* if an instruction is stalled, then all instructions younger to it must be stalled */
-                if (p->pipe_latch[ID_LATCH][j].op_id > p->pipe_latch[ID_LATCH][i].op_id) {
-                    p->pipe_latch[ID_LATCH][j].stall = true;
-                }
-            }
-            break;
-        }
-    }
-
+    pipe_stage_ID_any<PIPE_LANES_SCALAR>(p);
 }
 
 /**
  * Simulate one cycle of the Instruction Fetch stage (IF) of a pipeline.
  *
- * Some skeleton code has been provided for you. You must implement anything
- * else you need for the pipeline simulation to work properly.
- *
  * @param p the pipeline to simulate
  */
 void pipe_cycle_IF(Pipeline *p)
 {
-    for (unsigned int i = 0; i < PIPE_WIDTH; i++)
+    if (p->btb != NULL)
     {
-         /* if ID.stall == TRUE then don't FETCH */
-        if (p->pipe_latch[ID_LATCH][i].stall) { continue; }
-
-        /* if fetch_cbr_stall then insert a NOP */
-        if (p->fetch_cbr_stall) {
-            p->pipe_latch[IF_LATCH][i].valid = false;
-            continue;
+        if (p->config.bpred_policy != BPRED_PERFECT)
+        {
+            pipe_stage_IF<0, true, true>(p);
         }
-
-        // Read an instruction from the trace file.
-        PipelineLatch fetch_op;
-        pipe_get_fetch_op(p, &fetch_op);
-
-        // Handle branch (mis)prediction.
-        if (BPRED_POLICY != BPRED_PERFECT)
+        else
         {
-            pipe_check_bpred(p, &fetch_op);
+            pipe_stage_IF<0, false, true>(p);
         }
-
-        // Copy the instruction to the IF latch.
-        p->pipe_latch[IF_LATCH][i] = fetch_op;
+    }
+    else if (p->config.bpred_policy != BPRED_PERFECT)
+    {
+        pipe_stage_IF<0, true>(p);
+    }
+    else
+    {
+        pipe_stage_IF<0, false>(p);
     }
 }
 
@@ -537,18 +1583,20 @@ void pipe_cycle_IF(Pipeline *p)
  */
 void pipe_check_bpred(Pipeline *p, PipelineLatch *fetch_op)
 {
-    if (fetch_op->trace_rec.op_type != OP_CBR) { return; }
+    if (!fetch_op->valid) { return; }
+    const TraceRec *trace_rec = pipe_latch_rec(p, fetch_op);
+    if (trace_rec->op_type != OP_CBR) { return; }
 
     /* get prediction */
-    BranchDirection  prediction = p->b_pred->predict(fetch_op->trace_rec.inst_addr);
+    BranchDirection  prediction = p->b_pred->predict(trace_rec->inst_addr);
 
     /* record the misprediction */
-    if (prediction != fetch_op->trace_rec.br_dir) {
+    if (prediction != trace_rec->br_dir) {
         fetch_op->is_mispred_cbr = true;
     }
 
     /* update GHR & PHT */
-    p->b_pred->update(fetch_op->trace_rec.inst_addr, prediction, (BranchDirection)fetch_op->trace_rec.br_dir);
+    p->b_pred->update(trace_rec->inst_addr, prediction, (BranchDirection)trace_rec->br_dir);
 
     /* unstall IF */
     if (fetch_op->is_mispred_cbr) {
@@ -13,7 +13,10 @@
 
 #include "trace.h"
 #include "bpred.h"
+#include "btb.h"
+#include "trace_reader.h"
 #include <inttypes.h>
+#include <stddef.h>
 
 /**
  * [Internal] The maximum allowed width of the pipeline.
@@ -24,49 +27,137 @@
 #define MAX_PIPE_WIDTH 8
 
 /**
- * The width of the pipeline; that is, the maximum number of instructions that
- * can be in each stage of the pipeline at any given time.
- * 
- * When the width is 1, the pipeline is scalar.
- * When the width is greater than 1, the pipeline is superscalar.
- * 
- * You should not modify this value directly; it is set by the command-line
- * argument -pipewidth.
+ * The number of cycles in which a pipeline must retire at least one
+ * instruction, or else be deadlocked; see pipe_check_progress().
  */
-extern uint32_t PIPE_WIDTH;
+#define PIPE_HEARTBEAT_CYCLES 10000
 
 /**
- * A Boolean indicating whether forwarding from the Memory Access stage (MA)
- * should be simulated.
- * 
- * You should not modify this value directly; it is set by the command-line
- * argument -enablememfwd.
+ * The configuration of one pipeline. Each pipeline keeps its own copy, so
+ * that pipelines with different configurations can be simulated side by side,
+ * in one thread or in several.
  */
-extern uint32_t ENABLE_MEM_FWD;
+typedef struct PipeConfig
+{
+    /**
+     * The width of the pipeline; that is, the maximum number of instructions
+     * that can be in each stage of the pipeline at any given time.
+     *
+     * When the width is 1, the pipeline is scalar.
+     * When the width is greater than 1, the pipeline is superscalar.
+     *
+     * sim sets this with the command-line argument -pipewidth.
+     */
+    uint32_t pipe_width;
+
+    /**
+     * Whether forwarding from the Memory Access stage (MA) should be
+     * simulated.
+     *
+     * sim sets this with the command-line argument -enablememfwd.
+     */
+    bool enable_mem_fwd;
+
+    /**
+     * Whether forwarding from the Execute stage (EX) should be simulated.
+     *
+     * sim sets this with the command-line argument -enableexefwd.
+     */
+    bool enable_exe_fwd;
+
+    /**
+     * The branch prediction policy that should be simulated.
+     *
+     * Refer to the BpredPolicy enumeration in bpred.h for a description of
+     * the possible values. sim sets this with the command-line argument
+     * -bpredpolicy.
+     */
+    BPredPolicy bpred_policy;
+
+    /**
+     * The length of the gshare global history register, in bits.
+     *
+     * sim sets this with the command-line argument -bpred_hist_bits.
+     */
+    uint32_t bpred_hist_bits;
+
+    /**
+     * The number of 2-bit counters in the gshare pattern history table, a
+     * power of two.
+     *
+     * sim sets this with the command-line argument -bpred_pht_entries.
+     */
+    uint32_t bpred_pht_entries;
+
+    /**
+     * The geometry of the TAGE predictor.
+     *
+     * sim reads this from the file given with the command-line argument
+     * -tageconfig.
+     */
+    TageConfig tage_config;
+
+    /**
+     * The geometry and training threshold of the perceptron predictor.
+     *
+     * sim sets this with the command-line arguments -bpred_perceptron_hist,
+     * -bpred_perceptron_rows and -bpred_perceptron_theta.
+     */
+    PerceptronConfig perceptron_config;
+
+    /**
+     * The branch target buffer of the front end, and the cost of missing in
+     * it. With no entries, the default, the front end is not modeled: fetch
+     * goes on past taken branches as if they were not there.
+     *
+     * Otherwise a taken branch ends its fetch group, leaving the lanes after
+     * it empty that cycle, and one whose target is not in the BTB also makes
+     * fetch insert miss_penalty cycles of bubbles while it is redirected.
+     *
+     * sim sets this with the command-line arguments -btb_entries, -btb_assoc
+     * and -btb_miss_penalty.
+     */
+    BtbConfig btb_config;
+} PipeConfig;
 
 /**
- * A Boolean indicating whether forwarding from the Execute stage (EX) should
- * be simulated.
- * 
- * You should not modify this value directly; it is set by the command-line
- * argument -enableexefwd.
+ * The outcomes of applying one command-line option to a pipeline
+ * configuration with pipe_config_parse_option().
  */
-extern uint32_t ENABLE_EXE_FWD;
+typedef enum PipeOptionStatusEnum
+{
+    PIPE_OPTION_OK,      // The option was applied.
+    PIPE_OPTION_UNKNOWN, // The option is not a pipeline option.
+    PIPE_OPTION_INVALID  // The option's argument was missing or invalid.
+} PipeOptionStatus;
 
 /**
- * The branch prediction policy that should be simulated.
- * 
- * Refer to the BpredPolicy enumeration in bpred.h for a description of the
- * possible values.
- * 
- * You should not modify this value directly; it is set by the command-line
- * argument -bpredpolicy.
+ * The statistics of a pipeline, in the form reported as the lab's results.
  */
-extern BPredPolicy BPRED_POLICY;
+typedef struct PipeStats
+{
+    /** The number of instructions retired. */
+    uint64_t num_inst;
+    /** The number of cycles simulated. */
+    uint64_t num_cycles;
+    /** The cycles per instruction. */
+    double cpi;
+    /** Whether the pipeline has a branch predictor. */
+    bool has_bpred;
+    /** The number of conditional branches predicted, if has_bpred. */
+    uint64_t num_branches;
+    /** The number of conditional branches mispredicted, if has_bpred. */
+    uint64_t num_mispred;
+} PipeStats;
 
 /**
  * One of the latches in the pipeline. Each one of these can contain one
  * operation to be processed by the next pipeline stage.
+ *
+ * A latch holds only the operation's place in the pipeline. Its trace record
+ * is written once, at fetch, to the pipeline's instruction window, so moving
+ * an operation from stage to stage copies only a few bytes; use
+ * pipe_latch_rec() to read the record.
  */
 typedef struct PipelineLatchStruct
 {
@@ -106,11 +197,11 @@ typedef struct PipelineLatchStruct
     bool stall;
 
     /**
-     * The trace record containing information about this instruction, such as
-     * what type of instruction it is, its address, what registers it reads and
-     * writes, and so on.
+     * The slot of the pipeline's instruction window that holds the trace
+     * record of this instruction: what type of instruction it is, its address,
+     * what registers it reads and writes, and so on.
      */
-    TraceRec trace_rec;
+    uint8_t slot;
 
     /**
      * Is this operation a conditional branch that the branch predictor
@@ -137,11 +228,85 @@ typedef enum LatchTypeEnum
     NUM_LATCH_TYPES
 } LatchType;
 
+/**
+ * Check whether the ID stage may forward a register or condition codes from
+ * an instruction in EX to an instruction that reads them, instead of stalling
+ * the reader. Loads have no value to forward until they reach MA.
+ *
+ * @param exe_fwd whether forwarding from EX is enabled
+ * @param op_type the type of the writing instruction in EX
+ * @return true if the reader need not stall
+ */
+static inline bool pipe_can_forward_EX(bool exe_fwd, uint8_t op_type)
+{
+    return exe_fwd && op_type != OP_LD;
+}
+
+/**
+ * Check whether the ID stage may forward a register or condition codes from
+ * an instruction in MA to an instruction that reads them, instead of stalling
+ * the reader.
+ *
+ * @param mem_fwd whether forwarding from MA is enabled
+ * @return true if the reader need not stall
+ */
+static inline bool pipe_can_forward_MA(bool mem_fwd)
+{
+    return mem_fwd;
+}
+
+/**
+ * [Internal] The number of slots in a pipeline's instruction window. Every
+ * instruction in flight is held by a latch of the IF, ID, EX or MA stage, so
+ * this is enough for the widest pipeline.
+ */
+#define PIPE_WINDOW_SIZE (NUM_LATCH_TYPES * MAX_PIPE_WIDTH)
+
+/**
+ * [Internal] The registers written by the instructions in one row of pipeline
+ * latches, kept up to date as instructions move through the pipeline so that
+ * the ID stage can find hazards with a few lookups instead of comparing every
+ * pair of lanes field by field.
+ *
+ * Lane masks have bit i set for lane i of the row; only valid latches count.
+ */
+typedef struct PipeScoreboard
+{
+    /**
+     * For each lane, the low 32 bits of the op_id of its instruction, packed
+     * so that the ages of a whole row can be compared at once.
+     */
+    uint32_t lane_ages[MAX_PIPE_WIDTH];
+    /** For each register, the lanes whose instructions write it. */
+    uint8_t reg_lanes[256];
+    /** The lanes whose instructions write the condition codes. */
+    uint8_t cc_lanes;
+} PipeScoreboard;
+
+struct Pipeline;
+
+/**
+ * A function that simulates one cycle of every stage of a pipeline; see
+ * pipe_select_kernel().
+ */
+typedef void (*PipeCycleKernel)(struct Pipeline *p);
+
 /**
  * The data structure for a pipelined processor.
+ *
+ * Pipelines share no state with each other, so different pipelines may be
+ * stepped on different threads at the same time. Each pipeline, however, must
+ * be stepped and read by one thread at a time.
  */
 typedef struct Pipeline
 {
+    /**
+     * The configuration of this pipeline.
+     *
+     * Use config.pipe_width to see how many latches should be used in each
+     * stage of the pipeline.
+     */
+    PipeConfig config;
     /**
      * All pipeline latches for all stages of the pipeline across the entire
      * width of the (possibly superscalar) pipeline.
@@ -150,8 +315,8 @@ typedef struct Pipeline
      * the IF stage writes are pipe_latch[IF_LATCH][0] and
      * pipe_latch[IF_LATCH][1].
      * 
-     * Refer to the global variable PIPE_WIDTH to see how many latches should
-     * be used in each stage of the pipeline.
+     * Refer to config.pipe_width to see how many latches should be used in
+     * each stage of the pipeline.
      */
     PipelineLatch pipe_latch[NUM_LATCH_TYPES][MAX_PIPE_WIDTH];
 
@@ -184,6 +349,26 @@ typedef struct Pipeline
      */
     bool fetch_cbr_stall;
 
+    /**
+     * The branch target buffer, or NULL if the front end is not modeled; see
+     * PipeConfig::btb_config.
+     */
+    Btb *btb;
+
+    /**
+     * The number of cycles the IF stage has yet to insert bubbles for while
+     * fetch is redirected after a taken branch missed in the BTB.
+     */
+    uint32_t fetch_redirect_bubbles;
+
+    /** The number of fetch groups a taken branch ended before their last
+        lane, if the front end is modeled. */
+    uint64_t stat_fetch_breaks;
+    /** The number of fetch lanes left empty after taken branches. */
+    uint64_t stat_fetch_break_lanes;
+    /** The number of cycles fetch was redirected after BTB misses. */
+    uint64_t stat_redirect_cycles;
+
     /**
      * The total number of committed instructions.
      * 
@@ -200,27 +385,220 @@ typedef struct Pipeline
      */
     uint64_t stat_num_cycle;
 
-    /** [Internal] The file descriptor from which to read trace records. */
-    int trace_fd;
+    /** [Internal] The buffered reader from which to read trace records. */
+    TraceReader *trace_reader;
     /** [Internal] The last op_id assigned. */
     uint64_t last_op_id;
     /** [Internal] The op_id of the last instruction in the trace. */
     uint64_t halt_op_id;
     /** [Internal] Whether the pipeline is done. */
     bool halt;
+    /** [Internal] The cycle kernel for this pipeline's configuration. */
+    PipeCycleKernel cycle_kernel;
+    /**
+     * [Internal] The scoreboard of each row of latches, indexed like
+     * pipe_latch; only the ID, EX and MA rows are kept.
+     */
+    PipeScoreboard scoreboard[NUM_LATCH_TYPES];
+    /**
+     * [Internal] The instruction window: the trace records of the
+     * instructions in flight, each in the slot its latches refer to.
+     */
+    TraceRec window[PIPE_WINDOW_SIZE];
+    /** [Internal] The window slots not holding an instruction in flight. */
+    uint8_t window_free[PIPE_WINDOW_SIZE];
+    /** [Internal] The number of slots in window_free. */
+    unsigned int window_num_free;
 } Pipeline;
 
+/**
+ * Get the trace record of the instruction in a pipeline latch.
+ *
+ * @param p the pipeline that holds the latch
+ * @param latch the latch, which must be valid
+ * @return the instruction's trace record, in the pipeline's window
+ */
+static inline const TraceRec *pipe_latch_rec(const Pipeline *p,
+                                             const PipelineLatch *latch)
+{
+    return &p->window[latch->slot];
+}
+
+
 
+/**
+ * Set a pipeline configuration to the defaults: a scalar pipeline without
+ * forwarding and with perfect branch prediction.
+ *
+ * @param config the configuration to initialize
+ */
+void pipe_config_init(PipeConfig *config);
 
 /**
  * Allocate and initialize a new pipeline.
  * 
  * You should not need to modify this function.
  * 
- * @param trace_fd the file descriptor from which to read trace records
+ * @param config the configuration of the pipeline, which is copied
+ * @param trace_reader the reader from which to read trace records
  * @return a pointer to a newly allocated pipeline
  */
-Pipeline *pipe_init(int trace_fd);
+Pipeline *pipe_init(const PipeConfig *config, TraceReader *trace_reader);
+
+/**
+ * Free a pipeline, its branch predictor, and its BTB, but not its trace
+ * reader.
+ *
+ * @param p the pipeline to free
+ */
+void pipe_free(Pipeline *p);
+
+/**
+ * Parse the numeric argument of a command-line option. Unlike strtoull(), this
+ * rejects leading spaces, signs, trailing characters and values that overflow.
+ *
+ * @param arg the argument, or NULL if the option had none
+ * @param value set to the argument, if it is valid
+ * @return true if the argument is a whole decimal number that fits in 64 bits,
+ *         with nothing after it
+ */
+bool pipe_parse_uint64(const char *arg, uint64_t *value);
+
+/**
+ * Apply one option, written as on the command line, to a pipeline
+ * configuration: -pipewidth <width>, -enablememfwd, -enableexefwd,
+ * -bpredpolicy <num>, -bpred_hist_bits <bits>, -bpred_pht_entries <entries>,
+ * -tageconfig <file>, -bpred_perceptron_hist <branches>,
+ * -bpred_perceptron_rows <rows>, -bpred_perceptron_theta <theta>,
+ * -btb_entries <entries>, -btb_assoc <ways> or -btb_miss_penalty <cycles>.
+ *
+ * This is the one table of pipeline options, which pipe_config_parse() and
+ * sim's command line both go through. Numeric arguments must be whole decimal
+ * numbers; limits that depend on other options are checked afterwards by
+ * pipe_config_check().
+ *
+ * @param option the option
+ * @param arg the argument after the option, or NULL if there is none
+ * @param config the configuration to update
+ * @param used_arg set to whether the option takes arg as its argument, so
+ *        that the caller can skip it
+ * @return PIPE_OPTION_OK if the option was applied, PIPE_OPTION_UNKNOWN if it
+ *         is not a pipeline option, or PIPE_OPTION_INVALID if its argument
+ *         was missing or invalid, in which case an error message is printed
+ */
+PipeOptionStatus pipe_config_parse_option(const char *option, const char *arg,
+                                          PipeConfig *config, bool *used_arg);
+
+/**
+ * Check that the predictor and BTB geometries of a pipeline configuration can
+ * be simulated, once all of its options have been applied.
+ *
+ * @param config the configuration to check
+ * @return true if the configuration is valid, or else false, in which case an
+ *         error message is printed
+ */
+bool pipe_config_check(const PipeConfig *config);
+
+/**
+ * Apply options written as on the command line, separated by spaces, to a
+ * pipeline configuration, with pipe_config_parse_option(), and check the
+ * result with pipe_config_check().
+ *
+ * @param options the options to apply
+ * @param config the configuration to update
+ * @return 0 on success, or 2 if an option was not recognized or had an
+ *         invalid argument, or the configuration is invalid, in which case an
+ *         error message is printed
+ */
+int pipe_config_parse(const char *options, PipeConfig *config);
+
+/**
+ * Get the statistics of a pipeline.
+ *
+ * @param p the pipeline
+ * @param stats set to the statistics of the pipeline
+ */
+void pipe_get_stats(const Pipeline *p, PipeStats *stats);
+
+/**
+ * Format pipeline statistics as the LAB2_* lines that report the lab's
+ * results, one "LAB2_<name> : <value>" line per statistic.
+ *
+ * @param stats the statistics to format
+ * @param buf the buffer to write the lines to
+ * @param size the size of buf
+ * @return the length of the formatted lines, as snprintf() returns
+ */
+int pipe_format_stats(const PipeStats *stats, char *buf, size_t size);
+
+/**
+ * Format just the branch prediction statistics of a pipeline, the
+ * LAB2_BPRED_* and LAB2_MISPRED_RATE lines that pipe_format_stats() ends
+ * with, as a predictor simulated without a pipeline reports them.
+ *
+ * @param stats the statistics to format, which must have has_bpred set
+ * @param buf the buffer to write the lines to
+ * @param size the size of buf
+ * @return the length of the formatted lines, as snprintf() returns
+ */
+int pipe_format_bpred_stats(const PipeStats *stats, char *buf, size_t size);
+
+/**
+ * Empty a pipeline so that it can simulate a new stretch of the trace: clear
+ * its latches, the branch misprediction and redirect stalls, and the
+ * end-of-trace state, but keep its statistics, op_ids, branch predictor, and
+ * BTB.
+ *
+ * @param p the pipeline to reset
+ */
+void pipe_reset(Pipeline *p);
+
+/**
+ * Rebuild a pipeline's scoreboards from its latches. Code that writes the
+ * latches directly, rather than through the pipeline stages, must call this
+ * afterwards.
+ *
+ * @param p the pipeline whose scoreboards should be rebuilt
+ */
+void pipe_sync_scoreboards(Pipeline *p);
+
+/**
+ * Refill a pipeline's instruction window with the trace records of the
+ * instructions in its latches, giving each instruction a slot. Code that
+ * writes the latches directly, rather than through the pipeline stages, must
+ * call this afterwards, before pipe_sync_scoreboards().
+ *
+ * @param p the pipeline whose window should be refilled
+ * @param recs the trace record of each latch, indexed like pipe_latch; only
+ *        those of valid latches are used
+ */
+void pipe_sync_window(Pipeline *p,
+                      const TraceRec recs[NUM_LATCH_TYPES][MAX_PIPE_WIDTH]);
+
+/**
+ * Skip trace records without simulating them in the pipeline, passing the
+ * conditional branches among them through the branch predictor and the BTB
+ * so that they stay warm. This is how sampled simulation fast-forwards between samples.
+ *
+ * @param p the pipeline whose trace should be fast-forwarded
+ * @param num_insts the number of trace records to skip
+ * @return the number of records skipped; fewer than num_insts only if the
+ *         trace ended or could not be read
+ */
+uint64_t pipe_fast_forward(Pipeline *p, uint64_t num_insts);
+
+/**
+ * Get the cycle kernel specialized for a pipeline configuration: a function
+ * that simulates one cycle of every stage, compiled for that width and those
+ * options, so that its lane loops are unrolled and the checks for options
+ * that are off are gone. Wide pipelines, for which that measured slower, get
+ * a kernel that runs the generic pipe_cycle_*() stages, as do pipelines
+ * whose front end is modeled. pipe_init() picks each pipeline's kernel.
+ *
+ * @param config the configuration of the pipeline
+ * @return the kernel that simulates one cycle of a pipeline so configured
+ */
+PipeCycleKernel pipe_select_kernel(const PipeConfig *config);
 
 /**
  * Simulate one cycle of all stages of a pipeline.
@@ -228,17 +606,30 @@ Pipeline *pipe_init(int trace_fd);
  * You should not need to modify this function except for debugging purposes.
  * If you add code to print debug output in this function, remove it or comment
  * it out before you submit the lab.
+ *
+ * The stages run through the pipeline's cycle kernel, which is specialized for
+ * its configuration. The pipe_cycle_*() functions below are the same stages
+ * for any configuration.
  * 
  * @param p the pipeline to simulate
  */
 void pipe_cycle(Pipeline *p);
 
+/**
+ * Check that a pipeline is not deadlocked, as every driver does after each
+ * pipe_cycle(): once every PIPE_HEARTBEAT_CYCLES cycles, the heartbeat, it
+ * must have retired an instruction since the heartbeat before.
+ *
+ * @param p the pipeline to check
+ * @param last_hbeat_inst the number of retired instructions at the last
+ *        heartbeat, 0 to start with, which is updated at each heartbeat
+ * @return false if the pipeline is deadlocked, or else true
+ */
+bool pipe_check_progress(const Pipeline *p, uint64_t *last_hbeat_inst);
+
 /**
  * Simulate one cycle of the Instruction Fetch stage (IF) of a pipeline.
  * 
- * Some skeleton code has been provided for you. You must implement anything
- * else you need for the pipeline simulation to work properly.
- * 
  * @param p the pipeline to simulate
  */
 void pipe_cycle_IF(Pipeline *p);
@@ -246,9 +637,6 @@ void pipe_cycle_IF(Pipeline *p);
 /**
  * Simulate one cycle of the Instruction Decode stage (ID) of a pipeline.
  * 
- * Some skeleton code has been provided for you. You must implement anything
- * else you need for the pipeline simulation to work properly.
- * 
  * @param p the pipeline to simulate
  */
 void pipe_cycle_ID(Pipeline *p);
@@ -256,9 +644,6 @@ void pipe_cycle_ID(Pipeline *p);
 /**
  * Simulate one cycle of the Execute stage (EX) of a pipeline.
  * 
- * Some skeleton code has been provided for you. You must implement anything
- * else you need for the pipeline simulation to work properly.
- * 
  * @param p the pipeline to simulate
  */
 void pipe_cycle_EX(Pipeline *p);
@@ -266,9 +651,6 @@ void pipe_cycle_EX(Pipeline *p);
 /**
  * Simulate one cycle of the Memory Access stage (MA) of a pipeline.
  * 
- * Some skeleton code has been provided for you. You must implement anything
- * else you need for the pipeline simulation to work properly.
- * 
  * @param p the pipeline to simulate
  */
 void pipe_cycle_MA(Pipeline *p);
@@ -276,9 +658,6 @@ void pipe_cycle_MA(Pipeline *p);
 /**
  * Simulate one cycle of the Write Back stage (WB) of a pipeline.
  * 
- * Some skeleton code has been provided for you. You must implement anything
- * else you need for the pipeline simulation to work properly.
- * 
  * @param p the pipeline to simulate
  */
 void pipe_cycle_WB(Pipeline *p);
@@ -0,0 +1,494 @@
+// ptpack.cpp
+// Converts a gzip-compressed trace into the packed trace format, and can
+// verify and benchmark the result, including decoding it on many threads at
+// once through the footer index.
+
+#include "trace_packed.h"
+#include "trace_reader.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+#include <zlib.h>
+
+int pack_trace(const char *in_filename, const char *out_filename,
+               uint32_t block_records, bool deflate);
+int verify_trace(const char *in_filename, const char *out_filename);
+int bench_trace(const char *in_filename, const char *out_filename,
+                unsigned num_threads);
+void print_usage(char *program_name);
+
+int main(int argc, char *argv[])
+{
+    uint32_t block_records = TRACE_PACKED_DEFAULT_BLOCK_RECORDS;
+    bool deflate = false;
+    bool verify = false;
+    bool bench = false;
+    unsigned num_threads = 1;
+    const char *filenames[2] = {NULL, NULL};
+    int num_filenames = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+        else if (strcmp(argv[i], "-block") == 0)
+        {
+            if (++i >= argc)
+            {
+                fprintf(stderr, "Error: missing argument to -block\n");
+                return 2;
+            }
+
+            int n = atoi(argv[i]);
+            if (n < 1 || n > TRACE_PACKED_MAX_BLOCK_RECORDS)
+            {
+                fprintf(stderr, "Error: block size must be between 1 and %d\n",
+                        TRACE_PACKED_MAX_BLOCK_RECORDS);
+                return 2;
+            }
+            block_records = n;
+        }
+        else if (strcmp(argv[i], "-deflate") == 0)
+        {
+            deflate = true;
+        }
+        else if (strcmp(argv[i], "-threads") == 0)
+        {
+            if (++i >= argc)
+            {
+                fprintf(stderr, "Error: missing argument to -threads\n");
+                return 2;
+            }
+
+            int n = atoi(argv[i]);
+            if (n < 1)
+            {
+                fprintf(stderr, "Error: thread count must be at least 1\n");
+                return 2;
+            }
+            num_threads = n;
+        }
+        else if (strcmp(argv[i], "-verify") == 0)
+        {
+            verify = true;
+        }
+        else if (strcmp(argv[i], "-bench") == 0)
+        {
+            bench = true;
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+            return 2;
+        }
+        else if (num_filenames < 2)
+        {
+            filenames[num_filenames++] = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "Error: too many file names\n");
+            return 2;
+        }
+    }
+
+    if (num_filenames != 2)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    int status = 0;
+    if (!bench)
+    {
+        status = pack_trace(filenames[0], filenames[1], block_records,
+                            deflate);
+    }
+    if (status == 0 && (verify || bench))
+    {
+        status = verify_trace(filenames[0], filenames[1]);
+    }
+    if (status == 0 && bench)
+    {
+        status = bench_trace(filenames[0], filenames[1], num_threads);
+    }
+    return status;
+}
+
+/**
+ * Write all of a buffer to a file, reporting any error.
+ *
+ * @return 0 on success, or 1 on error
+ */
+static int write_all(FILE *out, const void *buf, size_t n)
+{
+    if (fwrite(buf, 1, n, out) != n)
+    {
+        perror("Couldn't write packed trace");
+        return 1;
+    }
+    return 0;
+}
+
+int pack_trace(const char *in_filename, const char *out_filename,
+               uint32_t block_records, bool deflate)
+{
+    TraceReader *in = trace_reader_open_gzip(in_filename,
+                                             TRACE_READER_BUF_SIZE);
+    if (in == NULL)
+    {
+        perror("Couldn't open trace file");
+        return 1;
+    }
+
+    FILE *out = fopen(out_filename, "wb");
+    if (out == NULL)
+    {
+        perror("Couldn't create packed trace");
+        trace_reader_free(in);
+        return 1;
+    }
+
+    TraceRec *recs = (TraceRec *)malloc(block_records * sizeof(TraceRec));
+    uint8_t *payload = (uint8_t *)malloc(block_records *
+                                         TRACE_PACKED_MAX_REC_SIZE);
+    uLong compressed_capacity = compressBound(block_records *
+                                              TRACE_PACKED_MAX_REC_SIZE);
+    uint8_t *compressed = deflate ? (uint8_t *)malloc(compressed_capacity)
+                                  : NULL;
+    if (recs == NULL || payload == NULL || (deflate && compressed == NULL))
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        free(recs);
+        free(payload);
+        free(compressed);
+        fclose(out);
+        trace_reader_free(in);
+        return 1;
+    }
+
+    TracePackedHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_PACKED_MAGIC, sizeof(header.magic));
+    header.version = TRACE_PACKED_VERSION;
+    header.block_records = block_records;
+    header.flags = deflate ? TRACE_PACKED_FLAG_DEFLATE : 0;
+
+    // Leave room for the header, and fill it in once the counts and the
+    // index offset are known.
+    std::vector<TracePackedIndexEntry> index;
+    uint64_t offset = sizeof(header);
+    int status = write_all(out, &header, sizeof(header));
+    TraceReadStatus read_status = TRACE_READ_OK;
+    while (status == 0 && read_status == TRACE_READ_OK)
+    {
+        uint32_t n = 0;
+        while (n < block_records &&
+               (read_status = trace_reader_next(in, &recs[n])) == TRACE_READ_OK)
+        {
+            n++;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+
+        TracePackedBlockHeader block;
+        block.num_records = n;
+        block.payload_size = trace_packed_encode_block(recs, n, payload);
+        block.first_record = header.num_records;
+
+        const uint8_t *block_payload = payload;
+        if (deflate)
+        {
+            uLongf compressed_size = compressed_capacity;
+            if (compress2(compressed, &compressed_size, payload,
+                          block.payload_size, Z_DEFAULT_COMPRESSION) != Z_OK)
+            {
+                fprintf(stderr, "Error: couldn't compress block\n");
+                status = 1;
+                break;
+            }
+            block.payload_size = compressed_size;
+            block_payload = compressed;
+        }
+
+        TracePackedIndexEntry entry;
+        entry.first_record = block.first_record;
+        entry.offset = offset;
+        index.push_back(entry);
+
+        status = write_all(out, &block, sizeof(block));
+        if (status == 0)
+        {
+            status = write_all(out, block_payload, block.payload_size);
+        }
+
+        offset += sizeof(block) + block.payload_size;
+        header.num_records += n;
+        header.num_blocks++;
+    }
+
+    if (status == 0 && read_status == TRACE_READ_ERROR)
+    {
+        trace_reader_perror(in, "Couldn't read trace");
+        status = 1;
+    }
+    else if (status == 0 && read_status == TRACE_READ_TRUNCATED)
+    {
+        fprintf(stderr, "Error: Invalid trace file: partial trace record\n");
+        status = 1;
+    }
+
+    if (status == 0)
+    {
+        header.index_offset = offset;
+        if (!index.empty())
+        {
+            status = write_all(out, &index[0],
+                               index.size() * sizeof(TracePackedIndexEntry));
+        }
+    }
+    if (status == 0)
+    {
+        rewind(out);
+        status = write_all(out, &header, sizeof(header));
+    }
+    if (fclose(out) != 0 && status == 0)
+    {
+        perror("Couldn't write packed trace");
+        status = 1;
+    }
+
+    if (status == 0)
+    {
+        struct stat in_st, out_st;
+        stat(in_filename, &in_st);
+        stat(out_filename, &out_st);
+        uint64_t raw_size = header.num_records * sizeof(TraceRec);
+
+        printf("Records:            %10llu\n",
+               (unsigned long long)header.num_records);
+        printf("Blocks:             %10llu\n",
+               (unsigned long long)header.num_blocks);
+        printf("Raw size:           %10llu bytes\n",
+               (unsigned long long)raw_size);
+        printf("Input size:         %10llu bytes\n",
+               (unsigned long long)in_st.st_size);
+        printf("Packed size:        %10llu bytes (%.2f bytes/record)\n",
+               (unsigned long long)out_st.st_size,
+               (double)out_st.st_size / (double)header.num_records);
+        printf("Raw / packed:       %10.2fx\n",
+               (double)raw_size / (double)out_st.st_size);
+    }
+    else
+    {
+        remove(out_filename);
+    }
+
+    free(recs);
+    free(payload);
+    free(compressed);
+    trace_reader_free(in);
+    return status;
+}
+
+/**
+ * Compare every field of two trace records, ignoring padding.
+ */
+static bool trace_rec_equal(const TraceRec *a, const TraceRec *b)
+{
+    return a->inst_addr == b->inst_addr && a->op_type == b->op_type &&
+           a->dest_reg == b->dest_reg && a->dest_needed == b->dest_needed &&
+           a->src1_reg == b->src1_reg && a->src2_reg == b->src2_reg &&
+           a->src1_needed == b->src1_needed &&
+           a->src2_needed == b->src2_needed && a->cc_read == b->cc_read &&
+           a->cc_write == b->cc_write && a->mem_addr == b->mem_addr &&
+           a->mem_write == b->mem_write && a->mem_read == b->mem_read &&
+           a->br_dir == b->br_dir && a->br_target == b->br_target;
+}
+
+int verify_trace(const char *in_filename, const char *out_filename)
+{
+    TraceReader *in = trace_reader_open_gzip(in_filename,
+                                             TRACE_READER_BUF_SIZE);
+    TraceReader *packed = trace_reader_open_packed(out_filename);
+    if (in == NULL || packed == NULL)
+    {
+        fprintf(stderr, "Error: couldn't open traces to verify\n");
+        trace_reader_free(in);
+        trace_reader_free(packed);
+        return 1;
+    }
+
+    uint64_t n = 0;
+    int status = 0;
+    for (;;)
+    {
+        TraceRec a, b;
+        TraceReadStatus sa = trace_reader_next(in, &a);
+        TraceReadStatus sb = trace_reader_next(packed, &b);
+        if (sa != TRACE_READ_OK || sb != TRACE_READ_OK)
+        {
+            if (sa != TRACE_READ_EOF || sb != TRACE_READ_EOF)
+            {
+                fprintf(stderr, "Error: traces end differently after %llu "
+                                "records\n", (unsigned long long)n);
+                status = 1;
+            }
+            break;
+        }
+        if (!trace_rec_equal(&a, &b))
+        {
+            fprintf(stderr, "Error: record %llu differs\n",
+                    (unsigned long long)n);
+            status = 1;
+            break;
+        }
+        n++;
+    }
+
+    if (status == 0)
+    {
+        printf("Verified:           %10llu records\n", (unsigned long long)n);
+    }
+    trace_reader_free(in);
+    trace_reader_free(packed);
+    return status;
+}
+
+/**
+ * Read every record from a reader and return the elapsed wall time.
+ */
+static double time_reader(TraceReader *r, uint64_t *num_records)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    TraceRec rec;
+    uint64_t checksum = 0;
+    *num_records = 0;
+    while (trace_reader_next(r, &rec) == TRACE_READ_OK)
+    {
+        checksum += rec.inst_addr;
+        (*num_records)++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (checksum == 1)
+    {
+        // Keep the loop from being optimized away.
+        printf(" ");
+    }
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/**
+ * Decode one contiguous range of records of a packed trace, on its own
+ * reader, as one thread of a parallel decode.
+ */
+static void decode_range(const char *filename, uint64_t first, uint64_t count,
+                         uint64_t *num_records)
+{
+    *num_records = 0;
+    TraceReader *r = trace_reader_open_packed(filename);
+    if (r == NULL || trace_reader_seek(r, first) != TRACE_READ_OK)
+    {
+        trace_reader_free(r);
+        return;
+    }
+    trace_reader_set_limit(r, count);
+    time_reader(r, num_records);
+    trace_reader_free(r);
+}
+
+int bench_trace(const char *in_filename, const char *out_filename,
+                unsigned num_threads)
+{
+    TraceReader *in = trace_reader_open_gzip(in_filename,
+                                             TRACE_READER_BUF_SIZE);
+    TraceReader *packed = trace_reader_open_packed(out_filename);
+    if (in == NULL || packed == NULL)
+    {
+        fprintf(stderr, "Error: couldn't open traces to benchmark\n");
+        trace_reader_free(in);
+        trace_reader_free(packed);
+        return 1;
+    }
+
+    uint64_t total = trace_packed_num_records(packed);
+    uint64_t n_gzip, n_packed;
+    double t_gzip = time_reader(in, &n_gzip);
+    double t_packed = time_reader(packed, &n_packed);
+
+    printf("gzip decode:        %10.3f s (%.1f Mrec/s)\n", t_gzip,
+           n_gzip / t_gzip / 1e6);
+    printf("packed decode:      %10.3f s (%.1f Mrec/s)\n", t_packed,
+           n_packed / t_packed / 1e6);
+    printf("Speedup:            %10.2fx\n", t_gzip / t_packed);
+
+    if (num_threads > 1)
+    {
+        // Split the trace into one contiguous range per thread; each thread
+        // seeks to its range through the index and decodes it on its own.
+        std::vector<std::thread> threads;
+        std::vector<uint64_t> counts(num_threads);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (unsigned i = 0; i < num_threads; i++)
+        {
+            uint64_t first = total * i / num_threads;
+            uint64_t last = total * (i + 1) / num_threads;
+            threads.push_back(std::thread(decode_range, out_filename, first,
+                                          last - first, &counts[i]));
+        }
+        uint64_t n_parallel = 0;
+        for (unsigned i = 0; i < num_threads; i++)
+        {
+            threads[i].join();
+            n_parallel += counts[i];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double t_parallel = (end.tv_sec - start.tv_sec) +
+                            (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        printf("parallel decode:    %10.3f s (%.1f Mrec/s, %u threads)\n",
+               t_parallel, n_parallel / t_parallel / 1e6, num_threads);
+        if (n_parallel != total)
+        {
+            fprintf(stderr, "Error: parallel decode read %llu of %llu "
+                            "records\n", (unsigned long long)n_parallel,
+                    (unsigned long long)total);
+            trace_reader_free(in);
+            trace_reader_free(packed);
+            return 1;
+        }
+    }
+
+    trace_reader_free(in);
+    trace_reader_free(packed);
+    return 0;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <trace file> <packed trace file>\n\n",
+            program_name);
+    fprintf(stderr, "Converts a trace into the packed trace format\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -block <records>    Set the number of records per block (Default: %d)\n",
+            TRACE_PACKED_DEFAULT_BLOCK_RECORDS);
+    fprintf(stderr, "    -deflate            Also compress each block with zlib\n");
+    fprintf(stderr, "    -verify             Check that the packed trace decodes to the original\n");
+    fprintf(stderr, "    -bench              Don't convert; verify an existing packed trace and\n");
+    fprintf(stderr, "                        compare its decode speed against gzip\n");
+    fprintf(stderr, "    -threads <n>        With -bench, also decode on <n> threads at once\n");
+}
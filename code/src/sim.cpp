@@ -8,65 +8,318 @@
 
 #include "pipeline.h"
 #include "bpred.h"
+#include "branch_stream.h"
+#include "checkpoint.h"
+#include "trace_cache.h"
+#include "trace_fanout.h"
+#include "trace_packed.h"
+#include "trace_prefetch.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
 
 /**
- * The width of the pipeline; that is, the maximum number of instructions that
- * can be in each stage of the pipeline at any given time.
- * 
- * When the width is 1, the pipeline is scalar.
- * When the width is greater than 1, the pipeline is superscalar.
- * 
+ * A Boolean indicating whether the trace should be decompressed by a forked
+ * gunzip process and read through a pipe, rather than in-process with zlib.
+ *
  * You should not modify this value directly; it is set by the command-line
- * argument -pipewidth.
+ * argument -gunzip.
  */
-uint32_t PIPE_WIDTH = 1;
+uint32_t USE_GUNZIP_PIPE = 0;
 
 /**
- * A Boolean indicating whether forwarding from the Memory Access stage (MA)
- * should be simulated.
- * 
+ * The number of batches in the trace prefetch ring, or 0 if trace records
+ * should be read on the simulation thread.
+ *
+ * When this is nonzero, a producer thread reads and decompresses the trace
+ * ahead of the simulation. You should not modify this value directly; it is
+ * set by the command-line argument -prefetch.
+ */
+uint32_t TRACE_PREFETCH_DEPTH = 0;
+
+/**
+ * The directory in which decompressed copies of traces are cached, or NULL if
+ * traces should be decompressed on every run.
+ *
+ * You should not modify this value directly; it is set by the command-line
+ * argument -tracecache, or else by the TRACE_CACHE_DIR environment variable.
+ */
+const char *TRACE_CACHE_DIR = NULL;
+
+/**
+ * The index of the first trace record to simulate. Packed traces with an
+ * index seek straight to it; other traces skip the records before it.
+ *
+ * You should not modify this value directly; it is set by the command-line
+ * argument -start.
+ */
+uint64_t TRACE_START = 0;
+
+/**
+ * The number of trace records to simulate, or 0 to simulate to the end of
+ * the trace.
+ *
+ * You should not modify this value directly; it is set by the command-line
+ * argument -count.
+ */
+uint64_t TRACE_COUNT = 0;
+
+/**
+ * The number of trace records in each sampling period, or 0 if the whole
+ * trace should be simulated in detail.
+ *
+ * When this is nonzero, each period of the trace is mostly fast-forwarded,
+ * with only the branch predictor kept warm, and ends with a short stretch of
+ * detailed simulation: SAMPLE_WARMUP records to refill the pipeline, then
+ * SAMPLE_INTERVAL records whose CPI is measured. The CPI of the whole trace
+ * is estimated from the measured samples. You should not modify this value
+ * directly; it is set by the command-line argument -sample.
+ */
+uint64_t SAMPLE_PERIOD = 0;
+
+/**
+ * The number of trace records measured in each sample.
+ *
+ * You should not modify this value directly; it is set by the command-line
+ * argument -sampleinterval.
+ */
+uint64_t SAMPLE_INTERVAL = 10000;
+
+/**
+ * The number of trace records simulated in detail, but not measured, before
+ * each sample.
+ *
+ * You should not modify this value directly; it is set by the command-line
+ * argument -samplewarmup.
+ */
+uint64_t SAMPLE_WARMUP = 1000;
+
+/**
+ * The file to which a checkpoint of the simulation should be written, or NULL
+ * if no checkpoint should be written.
+ *
+ * You should not modify this value directly; it is set by the command-line
+ * argument -checkpoint.
+ */
+const char *CHECKPOINT_FILE = NULL;
+
+/**
+ * The number of retired instructions after which the simulation should stop
+ * and write its checkpoint, or 0 to write it at the end of the trace.
+ *
+ * You should not modify this value directly; it is set by the command-line
+ * argument -checkpointat.
+ */
+uint64_t CHECKPOINT_INST = 0;
+
+/**
+ * The checkpoint file from which the simulation should resume, or NULL if it
+ * should start from the beginning.
+ *
+ * You should not modify this value directly; it is set by the command-line
+ * argument -restore.
+ */
+const char *RESTORE_FILE = NULL;
+
+/**
+ * The maximum number of configurations that can be simulated side by side.
+ */
+#define MAX_CONFIGS 64
+
+/**
+ * The configurations to simulate side by side over a single pass of the
+ * trace, or none to simulate just the configuration set by the options
+ * above. Each is written as "[<name>=]<options>", where the options are any
+ * of the pipeline options that pipe_config_parse() accepts, and default to
+ * the ones given outside -config.
+ *
+ * You should not modify these values directly; they are set by the
+ * command-line argument -config, which may be repeated.
+ */
+const char *CONFIG_SPECS[MAX_CONFIGS];
+uint32_t NUM_CONFIGS = 0;
+
+/**
+ * A Boolean indicating whether each configuration given with -config should
+ * be simulated on its own thread.
+ *
  * You should not modify this value directly; it is set by the command-line
- * argument -enablememfwd.
+ * argument -configthreads.
+ */
+uint32_t CONFIG_THREADS = 0;
+
+/**
+ * The maximum number of segments a trace can be split into.
+ */
+#define MAX_SEGMENTS 64
+
+/**
+ * The number of contiguous segments into which the trace should be split, each
+ * simulated on its own thread, or 0 if the trace should be simulated as a
+ * whole.
+ *
+ * When this is nonzero, each segment starts with SEGMENT_WARMUP records that
+ * overlap the end of the segment before it. They are simulated in detail, to
+ * refill the pipeline and warm the branch predictor, but not measured. The
+ * cycles measured in each segment are added up to give the cycles of the
+ * whole trace. You should not modify this value directly; it is set by the
+ * command-line argument -segments.
  */
-uint32_t ENABLE_MEM_FWD = 0;
+uint32_t NUM_SEGMENTS = 0;
 
 /**
- * A Boolean indicating whether forwarding from the Execute stage (EX) should
- * be simulated.
- * 
+ * The number of trace records simulated in detail, but not measured, before
+ * each segment.
+ *
  * You should not modify this value directly; it is set by the command-line
- * argument -enableexefwd.
+ * argument -segmentwarmup.
  */
-uint32_t ENABLE_EXE_FWD = 0;
+uint64_t SEGMENT_WARMUP = 10000;
 
 /**
- * The branch prediction policy that should be simulated.
- * 
- * Refer to the BpredPolicy enumeration in bpred.h for a description of the
- * possible values.
- * 
+ * A Boolean indicating whether the trace should also be simulated as a whole
+ * alongside its segments, to measure how far the CPI of the segments deviates
+ * from it.
+ *
  * You should not modify this value directly; it is set by the command-line
- * argument -bpredpolicy.
+ * argument -segmentcompare.
+ */
+uint32_t SEGMENT_COMPARE = 0;
+
+/**
+ * A Boolean indicating whether only the branch predictors should be
+ * simulated: the conditional branches of the trace are replayed through them
+ * in one pass, without a pipeline, which is all it takes to measure their
+ * misprediction rates.
+ *
+ * The predictors are those of the configurations given with -config, or else
+ * the one set by the options above; with -configthreads, each replays the
+ * branches on its own thread. The branches can also be replayed from a
+ * branch stream file, extracted from the trace by brstream, given in place
+ * of the trace. You should not modify this value directly; it is set by the
+ * command-line argument -bpredonly.
+ */
+uint32_t BPRED_ONLY = 0;
+
+/**
+ * The number of conditional branches read from the trace at a time and
+ * replayed through every predictor in predictor-only mode, so that each
+ * predictor's tables stay in the cache for a whole batch.
+ */
+#define BPRED_ONLY_BATCH_SIZE 65536
+
+/**
+ * One of the configurations simulated side by side.
+ */
+typedef struct ConfigRun
+{
+    /** The name printed with this configuration's statistics. */
+    char name[64];
+    /** The configuration of the pipeline. */
+    PipeConfig config;
+    /** The pipeline simulating this configuration. */
+    Pipeline *pipeline;
+    /** The branch predictor replaying this configuration's branches, in
+        predictor-only mode, which simulates no pipeline. */
+    BPred *b_pred;
+    /** The number of retired instructions at the last heartbeat. */
+    uint64_t last_hbeat_inst;
+    /** Nonzero if simulating this configuration failed. */
+    int status;
+} ConfigRun;
+
+/**
+ * One of the segments of a trace simulated in parallel.
  */
-BPredPolicy BPRED_POLICY = BPRED_PERFECT;
+typedef struct SegmentRun
+{
+    /** The trace file to simulate. */
+    const char *trace_filename;
+    /** The configuration of the pipeline. */
+    PipeConfig config;
+    /** The first trace record simulated, where the warmup starts. */
+    uint64_t warmup_start;
+    /** The first trace record measured. */
+    uint64_t start;
+    /** One past the last trace record measured. */
+    uint64_t end;
+    /**
+     * Whether the segment ends where the simulated part of the trace does,
+     * so that its pipeline drains at its end as the whole trace's would.
+     * Other segments stop measuring once their last record retires, while
+     * the records after it keep their pipelines full.
+     */
+    bool drains;
+    /** The statistics measured after the warmup. */
+    PipeStats stats;
+    /** Nonzero if simulating this segment failed. */
+    int status;
+} SegmentRun;
 
-#define HEARTBEAT_CYCLES 10000
-#define STAT_CYCLES (HEARTBEAT_CYCLES * 50)
+/**
+ * Totals gathered over the samples of a sampled simulation.
+ */
+typedef struct SampleStats
+{
+    /** The number of samples measured. */
+    uint64_t num_samples;
+    /** The number of instructions retired while measuring samples. */
+    uint64_t num_inst;
+    /** The number of cycles simulated while measuring samples. */
+    uint64_t num_cycles;
+    /** The sum of the CPIs of the samples. */
+    double sum_cpi;
+    /** The sum of the squares of the CPIs of the samples. */
+    double sum_cpi_sq;
+} SampleStats;
 
-Pipeline *pipeline;
-uint64_t last_hbeat_inst = 0;
+#define STAT_CYCLES (PIPE_HEARTBEAT_CYCLES * 50)
 
-int parse_args(int argc, char *argv[], char **trace_filename);
+int parse_args(int argc, char *argv[], PipeConfig *config,
+               char **trace_filename);
 int open_gunzip_pipe(const char *filename, int *fd, pid_t *pid);
-int check_heartbeat();
-void print_stats();
+int parse_config(const char *spec, const PipeConfig *defaults,
+                 ConfigRun *run);
+int simulate_sampled(Pipeline *p, uint64_t *last_hbeat_inst,
+                     SampleStats *sample_stats);
+int simulate_configs(ConfigRun *config_runs, TraceReader *trace_reader);
+void simulate_config(ConfigRun *run);
+int run_bpred_only(ConfigRun *config_runs, const PipeConfig *config,
+                   TraceReader *trace_reader, BranchStream *branch_stream);
+int simulate_bpred_only(ConfigRun *config_runs, uint32_t num_runs,
+                        TraceReader *trace_reader,
+                        BranchStream *branch_stream);
+int read_branches(TraceReader *trace_reader, BranchStream *branch_stream,
+                  BranchRec *branches, uint32_t *num_branches,
+                  uint64_t *last_branch_op_id);
+void replay_branches(ConfigRun *run, const BranchRec *branches,
+                     uint32_t num_branches);
+int simulate_segments(SegmentRun *segment_runs, uint32_t *num_segments,
+                      SegmentRun *serial_run, const char *trace_filename,
+                      const PipeConfig *config, TraceReader *trace_reader);
+void simulate_segment(SegmentRun *run);
+int check_pipeline_heartbeat(Pipeline *p, uint64_t *last_hbeat_inst,
+                             bool verbose);
+double t_critical_95(uint64_t dof);
+void print_stats(Pipeline *p, const SampleStats *sample_stats);
+void print_config_stats(ConfigRun *config_runs);
+void print_bpred_only_stats(const ConfigRun *config_runs, uint32_t num_runs,
+                            TraceReader *trace_reader,
+                            const BranchStream *branch_stream);
+void print_segment_stats(const SegmentRun *segment_runs,
+                         uint32_t num_segments, const SegmentRun *serial_run);
+void print_pipeline_stats(const PipeStats *stats);
+void print_bpred_stats(const PipeConfig *config, const BPred *b_pred);
+void print_tournament_stats(const BPred *b_pred);
+void print_frontend_stats(const Pipeline *p);
+void print_sample_stats(Pipeline *p, const SampleStats *sample_stats);
+void print_trace_stats(TraceReader *reader);
 void print_usage(char *program_name);
 
 int main(int argc, char *argv[])
@@ -75,55 +328,305 @@ int main(int argc, char *argv[])
     int status;
 
     // Parse the command-line arguments.
+    PipeConfig config;
     char *trace_filename = NULL;
-    status = parse_args(argc, argv, &trace_filename);
+    status = parse_args(argc, argv, &config, &trace_filename);
     if (status != 0)
     {
         return status;
     }
 
-    // Open the trace file using gunzip.
-    int trace_fd;
-    pid_t pid;
-    printf("Opening trace file with gunzip: %s\n", trace_filename);
-    status = open_gunzip_pipe(trace_filename, &trace_fd, &pid);
-    if (status != 0)
+    // Parse the configurations only now, so that they default to the options
+    // given anywhere outside -config.
+    ConfigRun config_runs[MAX_CONFIGS];
+    memset(config_runs, 0, sizeof(config_runs));
+    for (uint32_t i = 0; i < NUM_CONFIGS; i++)
+    {
+        status = parse_config(CONFIG_SPECS[i], &config, &config_runs[i]);
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+
+    // Resume where the checkpoint left off in the trace.
+    if (RESTORE_FILE != NULL)
+    {
+        CheckpointHeader header;
+        if (checkpoint_read_header(RESTORE_FILE, &header) != 0)
+        {
+            perror("Couldn't read checkpoint");
+            return 1;
+        }
+        if (header.pipe_width != config.pipe_width ||
+            header.bpred_policy != (uint32_t)config.bpred_policy)
+        {
+            fprintf(stderr, "Error: checkpoint was saved with -pipewidth %u "
+                            "-bpredpolicy %u\n",
+                    header.pipe_width, header.bpred_policy);
+            return 2;
+        }
+        printf("Restoring checkpoint: %s\n", RESTORE_FILE);
+        TRACE_START = header.trace_position;
+    }
+
+    // A branch stream holds just the branches -bpredonly replays, so it is
+    // read directly rather than through a trace reader.
+    if (branch_stream_is_stream(trace_filename))
+    {
+        if (!BPRED_ONLY || TRACE_START > 0 || TRACE_COUNT > 0 ||
+            USE_GUNZIP_PIPE || TRACE_PREFETCH_DEPTH > 0)
+        {
+            fprintf(stderr, "Error: a branch stream can only be replayed with "
+                            "-bpredonly, and without -start, -count, -gunzip "
+                            "or -prefetch\n");
+            return 2;
+        }
+
+        printf("Opening branch stream file: %s\n", trace_filename);
+        BranchStream *branch_stream = branch_stream_open(trace_filename);
+        if (branch_stream == NULL)
+        {
+            perror("Couldn't open branch stream file");
+            return 1;
+        }
+        status = run_bpred_only(config_runs, &config, NULL, branch_stream);
+        branch_stream_free(branch_stream);
+        return status;
+    }
+
+    // Open the trace file, either in-process or using gunzip.
+    TraceReader *trace_reader;
+    int trace_fd = -1;
+    pid_t pid = -1;
+    if (USE_GUNZIP_PIPE && !trace_packed_is_packed(trace_filename))
+    {
+        printf("Opening trace file with gunzip: %s\n", trace_filename);
+        status = open_gunzip_pipe(trace_filename, &trace_fd, &pid);
+        if (status != 0)
+        {
+            return status;
+        }
+        trace_reader = trace_reader_init(trace_fd, TRACE_READER_BUF_SIZE);
+    }
+    else
+    {
+        TraceOpenMethod method;
+        trace_reader = trace_reader_open(trace_filename, TRACE_CACHE_DIR,
+                                         &method);
+        switch (method)
+        {
+        case TRACE_OPEN_PACKED:
+            printf("Opening packed trace file: %s\n", trace_filename);
+            break;
+        case TRACE_OPEN_CACHE_HIT:
+        case TRACE_OPEN_CACHE_MISS:
+            printf("Opening trace file from cache (%s): %s\n",
+                   method == TRACE_OPEN_CACHE_HIT ? "hit" : "miss",
+                   trace_filename);
+            break;
+        case TRACE_OPEN_GZIP:
+            if (TRACE_CACHE_DIR != NULL)
+            {
+                fprintf(stderr, "Warning: couldn't cache trace in %s\n",
+                        TRACE_CACHE_DIR);
+            }
+            printf("Opening trace file with zlib: %s\n", trace_filename);
+            break;
+        }
+    }
+    if (trace_reader == NULL)
+    {
+        perror("Couldn't open trace file");
+        return 1;
+    }
+
+    // Simulate the segments of the trace in parallel; each opens the trace
+    // itself, so the reader is only used to count the records.
+    if (NUM_SEGMENTS > 0)
+    {
+        SegmentRun segment_runs[MAX_SEGMENTS];
+        SegmentRun serial_run;
+        uint32_t num_segments = 0;
+        status = simulate_segments(segment_runs, &num_segments, &serial_run,
+                                   trace_filename, &config, trace_reader);
+        trace_reader_free(trace_reader);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        print_segment_stats(segment_runs, num_segments,
+                            SEGMENT_COMPARE ? &serial_run : NULL);
+        return 0;
+    }
+    if (TRACE_START > 0)
+    {
+        printf("Starting at trace record %llu\n",
+               (unsigned long long)TRACE_START);
+        TraceReadStatus seek_status = trace_reader_seek(trace_reader,
+                                                        TRACE_START);
+        if (seek_status == TRACE_READ_ERROR)
+        {
+            trace_reader_perror(trace_reader, "Couldn't read trace");
+            return 1;
+        }
+        if (seek_status != TRACE_READ_OK)
+        {
+            fprintf(stderr, "Error: trace has fewer than %llu records\n",
+                    (unsigned long long)TRACE_START);
+            return 1;
+        }
+    }
+    if (TRACE_PREFETCH_DEPTH > 0)
+    {
+        printf("Prefetching trace on a separate thread (depth %u)\n",
+               TRACE_PREFETCH_DEPTH);
+        trace_reader = trace_reader_start_prefetch(trace_reader,
+                                                   TRACE_PREFETCH_DEPTH);
+        if (trace_reader == NULL)
+        {
+            fprintf(stderr, "Error: couldn't start trace prefetch thread\n");
+            return 1;
+        }
+    }
+
+    if (TRACE_COUNT > 0)
+    {
+        trace_reader_set_limit(trace_reader, TRACE_COUNT);
+    }
+
+    // Replay just the branches of the trace through the predictor of every
+    // configuration given with -config, or else of the one configuration.
+    if (BPRED_ONLY)
     {
+        status = run_bpred_only(config_runs, &config, trace_reader, NULL);
+        if (USE_GUNZIP_PIPE)
+        {
+            close(trace_fd);
+            waitpid(pid, NULL, 0);
+        }
+        trace_reader_free(trace_reader);
         return status;
     }
 
+    // Simulate every configuration given with -config over one pass of the
+    // trace; the consumers of the fan-out take over the trace reader.
+    if (NUM_CONFIGS > 0)
+    {
+        status = simulate_configs(config_runs, trace_reader);
+        if (USE_GUNZIP_PIPE)
+        {
+            close(trace_fd);
+            waitpid(pid, NULL, 0);
+        }
+        if (status != 0)
+        {
+            return status;
+        }
+
+        print_config_stats(config_runs);
+        for (uint32_t i = 0; i < NUM_CONFIGS; i++)
+        {
+            trace_reader_free(config_runs[i].pipeline->trace_reader);
+            pipe_free(config_runs[i].pipeline);
+        }
+        return 0;
+    }
+
     // Simulate the pipeline.
-    pipeline = pipe_init(trace_fd);
+    printf("\n** PIPELINE IS %d WIDE **\n\n", config.pipe_width);
+    Pipeline *pipeline = pipe_init(&config, trace_reader);
+    uint64_t last_hbeat_inst = 0;
+    SampleStats sample_stats;
+    memset(&sample_stats, 0, sizeof(sample_stats));
     status = 0;
+    if (RESTORE_FILE != NULL)
+    {
+        if (checkpoint_restore(pipeline, RESTORE_FILE) != 0)
+        {
+            perror("Couldn't restore checkpoint");
+            return 1;
+        }
+        last_hbeat_inst = pipeline->stat_retired_inst;
+    }
+    if (SAMPLE_PERIOD > 0)
+    {
+        printf("Sampling %llu of every %llu records (warmup %llu)\n",
+               (unsigned long long)SAMPLE_INTERVAL,
+               (unsigned long long)SAMPLE_PERIOD,
+               (unsigned long long)SAMPLE_WARMUP);
+        status = simulate_sampled(pipeline, &last_hbeat_inst, &sample_stats);
+    }
     while (status == 0 && !pipeline->halt)
     {
         pipe_cycle(pipeline);
-        status = check_heartbeat();
+        status = check_pipeline_heartbeat(pipeline, &last_hbeat_inst, true);
+
+        if (CHECKPOINT_INST > 0 &&
+            pipeline->stat_retired_inst >= CHECKPOINT_INST)
+        {
+            break;
+        }
     }
-    close(trace_fd);
-    if (status != 0)
+
+    if (status == 0 && CHECKPOINT_FILE != NULL)
     {
-        waitpid(pid, NULL, 0);
-        return status;
+        uint64_t trace_position = TRACE_START +
+                                  trace_reader->stat_num_records;
+        if (checkpoint_save(pipeline, trace_position, CHECKPOINT_FILE) != 0)
+        {
+            perror("Couldn't write checkpoint");
+            status = 1;
+        }
+        else
+        {
+            printf("\nWrote checkpoint at trace record %llu: %s\n",
+                   (unsigned long long)trace_position, CHECKPOINT_FILE);
+        }
     }
 
-    // Wait for the child process to finish.
-    waitpid(pid, &status, 0);
-    status = WEXITSTATUS(status);
-    if (status == 127)
+    if (USE_GUNZIP_PIPE)
     {
-        return 1;
+        close(trace_fd);
+        if (status != 0)
+        {
+            waitpid(pid, NULL, 0);
+            return status;
+        }
+
+        // Wait for the child process to finish.
+        waitpid(pid, &status, 0);
+        status = WEXITSTATUS(status);
+        if (status == 127)
+        {
+            return 1;
+        }
+    }
+    else if (status != 0)
+    {
+        return status;
     }
 
     // Print statistics.
-    print_stats();
+    print_stats(pipeline, &sample_stats);
+    pipe_free(pipeline);
+    trace_reader_free(trace_reader);
     return 0;
 }
 
-int parse_args(int argc, char *argv[], char **trace_filename)
+int parse_args(int argc, char *argv[], PipeConfig *config,
+               char **trace_filename)
 {
+    pipe_config_init(config);
     *trace_filename = NULL;
 
+    const char *cache_dir = getenv(TRACE_CACHE_DIR_ENV);
+    if (cache_dir != NULL && cache_dir[0] != '\0')
+    {
+        TRACE_CACHE_DIR = cache_dir;
+    }
+
     if (argc < 2)
     {
         print_usage(argv[0]);
@@ -134,85 +637,339 @@ int parse_args(int argc, char *argv[], char **trace_filename)
     {
         if (argv[i][0] == '-')
         {
-            // Parse options.
-            if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+            // Parse options. The pipeline options are parsed by the library,
+            // as they are in -config.
+            bool used_arg;
+            PipeOptionStatus option_status = pipe_config_parse_option(
+                argv[i], i + 1 < argc ? argv[i + 1] : NULL, config, &used_arg);
+            if (option_status == PIPE_OPTION_INVALID)
+            {
+                return 2;
+            }
+            else if (option_status == PIPE_OPTION_OK)
+            {
+                i += used_arg;
+            }
+            else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
             {
                 print_usage(argv[0]);
                 return 2;
             }
-            else if (strcmp(argv[i], "-pipewidth") == 0)
+            else if (strcmp(argv[i], "-gunzip") == 0)
+            {
+                USE_GUNZIP_PIPE = 1;
+            }
+            else if (strcmp(argv[i], "-tracecache") == 0)
             {
                 if (++i >= argc)
                 {
-                    fprintf(stderr, "Error: missing argument to -pipewidth\n");
+                    fprintf(stderr, "Error: missing argument to -tracecache\n");
                     return 2;
                 }
 
-                int pipe_width = atoi(argv[i]);
-                if (pipe_width < 1 || pipe_width > MAX_PIPE_WIDTH)
+                TRACE_CACHE_DIR = argv[i];
+            }
+            else if (strcmp(argv[i], "-notracecache") == 0)
+            {
+                TRACE_CACHE_DIR = NULL;
+            }
+            else if (strcmp(argv[i], "-start") == 0)
+            {
+                if (++i >= argc)
                 {
-                    fprintf(stderr, "Error: pipe width must be between 1 and %d\n", MAX_PIPE_WIDTH);
+                    fprintf(stderr, "Error: missing argument to -start\n");
                     return 2;
                 }
 
-                PIPE_WIDTH = pipe_width;
-            }
-            else if (strcmp(argv[i], "-enablememfwd") == 0)
-            {
-                ENABLE_MEM_FWD = 1;
+                if (!pipe_parse_uint64(argv[i], &TRACE_START))
+                {
+                    fprintf(stderr, "Error: invalid argument for -start\n");
+                    return 2;
+                }
             }
-            else if (strcmp(argv[i], "-enableexefwd") == 0)
+            else if (strcmp(argv[i], "-count") == 0)
             {
-                ENABLE_EXE_FWD = 1;
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -count\n");
+                    return 2;
+                }
+
+                if (!pipe_parse_uint64(argv[i], &TRACE_COUNT))
+                {
+                    fprintf(stderr, "Error: invalid argument for -count\n");
+                    return 2;
+                }
             }
-            else if (strcmp(argv[i], "-bpredpolicy") == 0)
+            else if (strcmp(argv[i], "-config") == 0)
             {
                 if (++i >= argc)
                 {
-                    fprintf(stderr, "Error: missing argument to -bpredpolicy\n");
+                    fprintf(stderr, "Error: missing argument to -config\n");
                     return 2;
                 }
 
-                int policy = atoi(argv[i]);
-                if (policy < 0 || policy >= NUM_BPRED_POLICIES)
+                if (NUM_CONFIGS == MAX_CONFIGS)
                 {
-                    fprintf(stderr, "Error: invalid argument for -bpredpolicy\n");
+                    fprintf(stderr, "Error: at most %d configurations may be specified\n", MAX_CONFIGS);
                     return 2;
                 }
 
-                BPRED_POLICY = (BPredPolicy)policy;
+                CONFIG_SPECS[NUM_CONFIGS++] = argv[i];
             }
-            else
+            else if (strcmp(argv[i], "-configthreads") == 0)
             {
-                fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+                CONFIG_THREADS = 1;
             }
-        }
-        else
-        {
-            // Parse trace file name.
-            if (*trace_filename != NULL)
+            else if (strcmp(argv[i], "-checkpoint") == 0)
             {
-                fprintf(stderr, "Error: only one trace file may be specified\n");
-                return 2;
-            }
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -checkpoint\n");
+                    return 2;
+                }
 
-            *trace_filename = argv[i];
-        }
-    }
+                CHECKPOINT_FILE = argv[i];
+            }
+            else if (strcmp(argv[i], "-checkpointat") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -checkpointat\n");
+                    return 2;
+                }
 
-    if (*trace_filename == NULL)
-    {
-        fprintf(stderr, "Error: no trace file specified\n");
-        return 2;
-    }
+                if (!pipe_parse_uint64(argv[i], &CHECKPOINT_INST))
+                {
+                    fprintf(stderr, "Error: invalid argument for -checkpointat\n");
+                    return 2;
+                }
+            }
+            else if (strcmp(argv[i], "-restore") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -restore\n");
+                    return 2;
+                }
 
-    return 0;
-}
+                RESTORE_FILE = argv[i];
+            }
+            else if (strcmp(argv[i], "-sample") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -sample\n");
+                    return 2;
+                }
 
-int open_gunzip_pipe(const char *filename, int *fd, pid_t *pid)
-{
-    int status;
-    int pipefd[2];
+                if (!pipe_parse_uint64(argv[i], &SAMPLE_PERIOD))
+                {
+                    fprintf(stderr, "Error: invalid argument for -sample\n");
+                    return 2;
+                }
+            }
+            else if (strcmp(argv[i], "-sampleinterval") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -sampleinterval\n");
+                    return 2;
+                }
+
+                if (!pipe_parse_uint64(argv[i], &SAMPLE_INTERVAL))
+                {
+                    fprintf(stderr, "Error: invalid argument for -sampleinterval\n");
+                    return 2;
+                }
+                if (SAMPLE_INTERVAL < 1)
+                {
+                    fprintf(stderr, "Error: sample interval must be at least 1\n");
+                    return 2;
+                }
+            }
+            else if (strcmp(argv[i], "-samplewarmup") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -samplewarmup\n");
+                    return 2;
+                }
+
+                if (!pipe_parse_uint64(argv[i], &SAMPLE_WARMUP))
+                {
+                    fprintf(stderr, "Error: invalid argument for -samplewarmup\n");
+                    return 2;
+                }
+            }
+            else if (strcmp(argv[i], "-segments") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -segments\n");
+                    return 2;
+                }
+
+                uint64_t num_segments;
+                if (!pipe_parse_uint64(argv[i], &num_segments))
+                {
+                    fprintf(stderr, "Error: invalid argument for -segments\n");
+                    return 2;
+                }
+                if (num_segments < 1 || num_segments > MAX_SEGMENTS)
+                {
+                    fprintf(stderr, "Error: number of segments must be between 1 and %d\n", MAX_SEGMENTS);
+                    return 2;
+                }
+
+                NUM_SEGMENTS = num_segments;
+            }
+            else if (strcmp(argv[i], "-segmentwarmup") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -segmentwarmup\n");
+                    return 2;
+                }
+
+                if (!pipe_parse_uint64(argv[i], &SEGMENT_WARMUP))
+                {
+                    fprintf(stderr, "Error: invalid argument for -segmentwarmup\n");
+                    return 2;
+                }
+            }
+            else if (strcmp(argv[i], "-segmentcompare") == 0)
+            {
+                SEGMENT_COMPARE = 1;
+            }
+            else if (strcmp(argv[i], "-bpredonly") == 0)
+            {
+                BPRED_ONLY = 1;
+            }
+            else if (strcmp(argv[i], "-prefetch") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -prefetch\n");
+                    return 2;
+                }
+
+                uint64_t depth;
+                if (!pipe_parse_uint64(argv[i], &depth) || depth > UINT32_MAX)
+                {
+                    fprintf(stderr, "Error: invalid argument for -prefetch\n");
+                    return 2;
+                }
+                if (depth < 1)
+                {
+                    fprintf(stderr, "Error: prefetch depth must be at least 1\n");
+                    return 2;
+                }
+
+                TRACE_PREFETCH_DEPTH = depth;
+            }
+            else
+            {
+                fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+            }
+        }
+        else
+        {
+            // Parse trace file name.
+            if (*trace_filename != NULL)
+            {
+                fprintf(stderr, "Error: only one trace file may be specified\n");
+                return 2;
+            }
+
+            *trace_filename = argv[i];
+        }
+    }
+
+    if (*trace_filename == NULL)
+    {
+        fprintf(stderr, "Error: no trace file specified\n");
+        return 2;
+    }
+
+    if (!pipe_config_check(config))
+    {
+        return 2;
+    }
+
+    if (NUM_CONFIGS > 0 && (SAMPLE_PERIOD > 0 || CHECKPOINT_FILE != NULL ||
+                            RESTORE_FILE != NULL))
+    {
+        fprintf(stderr, "Error: -config cannot be used with -sample, "
+                        "-checkpoint or -restore\n");
+        return 2;
+    }
+
+    if (RESTORE_FILE != NULL && TRACE_START > 0)
+    {
+        fprintf(stderr, "Error: -start cannot be used with -restore\n");
+        return 2;
+    }
+
+    if (SAMPLE_PERIOD > 0 && (CHECKPOINT_FILE != NULL || RESTORE_FILE != NULL))
+    {
+        fprintf(stderr, "Error: -sample cannot be used with -checkpoint or "
+                        "-restore\n");
+        return 2;
+    }
+
+    if (NUM_SEGMENTS > 0 && (NUM_CONFIGS > 0 || SAMPLE_PERIOD > 0 ||
+                             CHECKPOINT_FILE != NULL || RESTORE_FILE != NULL ||
+                             USE_GUNZIP_PIPE || TRACE_PREFETCH_DEPTH > 0))
+    {
+        fprintf(stderr, "Error: -segments cannot be used with -config, "
+                        "-sample, -checkpoint, -restore, -gunzip or "
+                        "-prefetch\n");
+        return 2;
+    }
+
+    if (BPRED_ONLY && (SAMPLE_PERIOD > 0 || CHECKPOINT_FILE != NULL ||
+                       RESTORE_FILE != NULL || NUM_SEGMENTS > 0))
+    {
+        fprintf(stderr, "Error: -bpredonly cannot be used with -sample, "
+                        "-checkpoint, -restore or -segments\n");
+        return 2;
+    }
+
+    if (SAMPLE_PERIOD > 0 && SAMPLE_PERIOD < SAMPLE_WARMUP + SAMPLE_INTERVAL)
+    {
+        fprintf(stderr, "Error: sampling period must be at least the sample "
+                        "warmup plus the sample interval\n");
+        return 2;
+    }
+
+    return 0;
+}
+
+int parse_config(const char *spec, const PipeConfig *defaults,
+                 ConfigRun *run)
+{
+    run->config = *defaults;
+
+    // Take the name from before an '=', or else use the options themselves.
+    const char *options = strchr(spec, '=');
+    size_t name_len = options != NULL ? (size_t)(options - spec)
+                                      : strlen(spec);
+    options = options != NULL ? options + 1 : spec;
+    if (name_len >= sizeof(run->name))
+    {
+        name_len = sizeof(run->name) - 1;
+    }
+    memcpy(run->name, spec, name_len);
+    run->name[name_len] = '\0';
+
+    return pipe_config_parse(options, &run->config);
+}
+
+int open_gunzip_pipe(const char *filename, int *fd, pid_t *pid)
+{
+    int status;
+    int pipefd[2];
 
     status = pipe(pipefd);
     if (status != 0)
@@ -248,33 +1005,499 @@ int open_gunzip_pipe(const char *filename, int *fd, pid_t *pid)
     return 0;
 }
 
-int check_heartbeat()
+int simulate_sampled(Pipeline *p, uint64_t *last_hbeat_inst,
+                     SampleStats *sample_stats)
 {
-    if (pipeline->stat_num_cycle % HEARTBEAT_CYCLES == 0)
+    TraceReader *reader = p->trace_reader;
+    uint64_t trace_limit = reader->record_limit;
+    uint64_t skip = SAMPLE_PERIOD - SAMPLE_WARMUP - SAMPLE_INTERVAL;
+    int status = 0;
+
+    while (status == 0)
     {
-        // Print a heartbeat.
-        printf(".");
-        fflush(stdout);
+        // Fast-forward to the next sample, keeping the branch predictor warm.
+        if (pipe_fast_forward(p, skip) < skip)
+        {
+            break;
+        }
+
+        // Simulate the warmup and the sample in detail, stopping the trace
+        // where the sample ends so that the pipeline drains there.
+        uint64_t sample_end = reader->stat_num_records + SAMPLE_WARMUP +
+                              SAMPLE_INTERVAL;
+        trace_reader_set_limit(reader, sample_end < trace_limit ?
+                                           sample_end : trace_limit);
+        pipe_reset(p);
+
+        uint64_t warmup_end = p->stat_retired_inst + SAMPLE_WARMUP;
+        uint64_t start_inst = 0;
+        uint64_t start_cycle = 0;
+        bool measuring = false;
+        while (status == 0 && !p->halt)
+        {
+            if (!measuring && p->stat_retired_inst >= warmup_end)
+            {
+                start_inst = p->stat_retired_inst;
+                start_cycle = p->stat_num_cycle;
+                measuring = true;
+            }
+            pipe_cycle(p);
+            status = check_pipeline_heartbeat(p, last_hbeat_inst, true);
+        }
+
+        // Only count samples that the trace did not cut short.
+        trace_reader_set_limit(reader, trace_limit);
+        if (status != 0 || reader->stat_num_records < sample_end)
+        {
+            break;
+        }
+
+        uint64_t num_inst = p->stat_retired_inst - start_inst;
+        uint64_t num_cycles = p->stat_num_cycle - start_cycle;
+        double cpi = (double)num_cycles / (double)num_inst;
+        sample_stats->num_samples++;
+        sample_stats->num_inst += num_inst;
+        sample_stats->num_cycles += num_cycles;
+        sample_stats->sum_cpi += cpi;
+        sample_stats->sum_cpi_sq += cpi * cpi;
+    }
+
+    if (status == 0 && sample_stats->num_samples == 0)
+    {
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Error: trace is too short for a sampling period of "
+                        "%llu records\n",
+                (unsigned long long)SAMPLE_PERIOD);
+        return 1;
+    }
+    return status;
+}
+
+int simulate_configs(ConfigRun *config_runs, TraceReader *trace_reader)
+{
+    // Consumers copy raw batches out of the shared reader, so they have to
+    // enforce any -count limit themselves.
+    uint64_t record_limit = trace_reader->record_limit;
+    TraceReader *consumers[MAX_CONFIGS];
+    if (trace_reader_start_fanout(trace_reader, NUM_CONFIGS,
+                                  TRACE_FANOUT_DEFAULT_DEPTH, consumers) != 0)
+    {
+        fprintf(stderr, "Error: couldn't share the trace between "
+                        "configurations\n");
+        trace_reader_free(trace_reader);
+        return 1;
+    }
+
+    printf("Simulating %u configurations over one pass of the trace%s\n",
+           NUM_CONFIGS, CONFIG_THREADS ? ", one thread each" : "");
+    for (uint32_t i = 0; i < NUM_CONFIGS; i++)
+    {
+        trace_reader_set_limit(consumers[i], record_limit);
+        config_runs[i].pipeline = pipe_init(&config_runs[i].config,
+                                            consumers[i]);
+    }
+
+    if (CONFIG_THREADS)
+    {
+        std::thread threads[MAX_CONFIGS];
+        for (uint32_t i = 0; i < NUM_CONFIGS; i++)
+        {
+            threads[i] = std::thread(simulate_config, &config_runs[i]);
+        }
+        for (uint32_t i = 0; i < NUM_CONFIGS; i++)
+        {
+            threads[i].join();
+        }
+    }
+    else
+    {
+        // Always advance the pipeline that is furthest behind in the trace,
+        // one batch at a time, so that no pipeline ever has to wait for the
+        // fan-out ring to free a slot.
+        for (;;)
+        {
+            ConfigRun *run = NULL;
+            for (uint32_t i = 0; i < NUM_CONFIGS; i++)
+            {
+                ConfigRun *candidate = &config_runs[i];
+                if (candidate->status == 0 && !candidate->pipeline->halt &&
+                    (run == NULL ||
+                     candidate->pipeline->trace_reader->stat_num_reads <
+                         run->pipeline->trace_reader->stat_num_reads))
+                {
+                    run = candidate;
+                }
+            }
+            if (run == NULL)
+            {
+                break;
+            }
+
+            Pipeline *p = run->pipeline;
+            uint64_t num_batches = p->trace_reader->stat_num_reads;
+            while (run->status == 0 && !p->halt &&
+                   p->trace_reader->stat_num_reads == num_batches)
+            {
+                pipe_cycle(p);
+                run->status = check_pipeline_heartbeat(
+                    p, &run->last_hbeat_inst, false);
+            }
+            if (run->status != 0 || p->halt)
+            {
+                trace_fanout_detach(p->trace_reader);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < NUM_CONFIGS; i++)
+    {
+        if (config_runs[i].status != 0)
+        {
+            return config_runs[i].status;
+        }
+    }
+    return 0;
+}
+
+void simulate_config(ConfigRun *run)
+{
+    Pipeline *p = run->pipeline;
+    while (run->status == 0 && !p->halt)
+    {
+        pipe_cycle(p);
+        run->status = check_pipeline_heartbeat(p, &run->last_hbeat_inst,
+                                               false);
+    }
+
+    // Let the other configurations run ahead without this one.
+    trace_fanout_detach(p->trace_reader);
+}
+
+int run_bpred_only(ConfigRun *config_runs, const PipeConfig *config,
+                   TraceReader *trace_reader, BranchStream *branch_stream)
+{
+    uint32_t num_runs = NUM_CONFIGS;
+    if (num_runs == 0)
+    {
+        config_runs[0].config = *config;
+        num_runs = 1;
+    }
+
+    int status = simulate_bpred_only(config_runs, num_runs, trace_reader,
+                                     branch_stream);
+    if (status == 0)
+    {
+        print_bpred_only_stats(config_runs, num_runs, trace_reader,
+                               branch_stream);
+    }
+    for (uint32_t i = 0; i < num_runs; i++)
+    {
+        delete config_runs[i].b_pred;
+    }
+    return status;
+}
+
+int simulate_bpred_only(ConfigRun *config_runs, uint32_t num_runs,
+                        TraceReader *trace_reader,
+                        BranchStream *branch_stream)
+{
+    for (uint32_t i = 0; i < num_runs; i++)
+    {
+        const PipeConfig *config = &config_runs[i].config;
+        if (config->bpred_policy == BPRED_PERFECT)
+        {
+            fprintf(stderr, "Error: -bpredonly needs a branch predictor, but "
+                            "%s%s-bpredpolicy is 0\n",
+                    config_runs[i].name, config_runs[i].name[0] ? "'s " : "");
+            return 2;
+        }
+        config_runs[i].b_pred = new BPred(
+            config->bpred_policy, config->bpred_hist_bits,
+            config->bpred_pht_entries, &config->tage_config,
+            &config->perceptron_config);
+    }
+
+    printf("Replaying the branches of the trace through %u predictor%s%s\n",
+           num_runs, num_runs == 1 ? "" : "s",
+           CONFIG_THREADS && num_runs > 1 ? ", one thread each" : "");
+
+    // Read the next batch of branches while the predictors replay the last
+    // one, if they have threads of their own to do it on.
+    static BranchRec batches[2][BPRED_ONLY_BATCH_SIZE];
+    uint32_t num_branches[2] = {0, 0};
+    uint64_t last_branch_op_id = 0;
+    int status = read_branches(trace_reader, branch_stream, batches[0],
+                               &num_branches[0], &last_branch_op_id);
+    bool threaded = CONFIG_THREADS && num_runs > 1;
+    for (uint32_t cur = 0; status == 0 && num_branches[cur] > 0; cur ^= 1)
+    {
+        const BranchRec *batch = batches[cur];
+        std::thread threads[MAX_CONFIGS];
+        for (uint32_t i = 0; threaded && i < num_runs; i++)
+        {
+            threads[i] = std::thread(replay_branches, &config_runs[i], batch,
+                                     num_branches[cur]);
+        }
+
+        status = read_branches(trace_reader, branch_stream, batches[cur ^ 1],
+                               &num_branches[cur ^ 1], &last_branch_op_id);
+
+        for (uint32_t i = 0; i < num_runs; i++)
+        {
+            if (threaded)
+            {
+                threads[i].join();
+            }
+            else
+            {
+                replay_branches(&config_runs[i], batch, num_branches[cur]);
+            }
+        }
+    }
+    return status;
+}
 
-        // Check for deadlock.
-        if (pipeline->stat_retired_inst == last_hbeat_inst)
+int read_branches(TraceReader *trace_reader, BranchStream *branch_stream,
+                  BranchRec *branches, uint32_t *num_branches,
+                  uint64_t *last_branch_op_id)
+{
+    if (branch_stream != NULL)
+    {
+        if (branch_stream_read(branch_stream, branches, BPRED_ONLY_BATCH_SIZE,
+                               num_branches) != 0)
         {
-            fprintf(stderr, "\n");
-            fprintf(stderr, "Error: pipeline is deadlocked: no instructions "
-                            "committed in %u cycles\n",
-                    HEARTBEAT_CYCLES);
+            fprintf(stderr, "Error: Invalid branch stream file\n");
             return 1;
         }
+        return 0;
+    }
 
-        // Update the heartbeat info.
-        last_hbeat_inst = pipeline->stat_retired_inst;
+    TraceRec trace_rec;
+    *num_branches = 0;
+    while (*num_branches < BPRED_ONLY_BATCH_SIZE)
+    {
+        TraceReadStatus status = trace_reader_next(trace_reader, &trace_rec);
+        if (status == TRACE_READ_EOF)
+        {
+            break;
+        }
+        if (status == TRACE_READ_ERROR)
+        {
+            trace_reader_perror(trace_reader, "Couldn't read trace");
+            return 1;
+        }
+        if (status != TRACE_READ_OK || trace_rec.op_type >= NUM_OP_TYPES)
+        {
+            fprintf(stderr, "Error: Invalid trace file\n");
+            return 1;
+        }
+
+        // Keep just the fields of a branch stream, so that batches read
+        // from either are the same.
+        if (trace_rec.op_type == OP_CBR)
+        {
+            uint64_t op_id = trace_reader->stat_num_records;
+            BranchRec *branch = &branches[(*num_branches)++];
+            branch->inst_addr = trace_rec.inst_addr;
+            branch->br_target = trace_rec.br_target;
+            branch->op_distance = op_id - *last_branch_op_id;
+            branch->br_dir = trace_rec.br_dir;
+            *last_branch_op_id = op_id;
+        }
+    }
+    return 0;
+}
+
+void replay_branches(ConfigRun *run, const BranchRec *branches,
+                     uint32_t num_branches)
+{
+    // Predict and update in order, exactly as the IF stage would.
+    BPred *b_pred = run->b_pred;
+    for (uint32_t i = 0; i < num_branches; i++)
+    {
+        BranchDirection prediction = b_pred->predict(branches[i].inst_addr);
+        b_pred->update(branches[i].inst_addr, prediction,
+                       (BranchDirection)branches[i].br_dir);
     }
+}
 
-    if (pipeline->stat_num_cycle % STAT_CYCLES == 0)
+int simulate_segments(SegmentRun *segment_runs, uint32_t *num_segments,
+                      SegmentRun *serial_run, const char *trace_filename,
+                      const PipeConfig *config, TraceReader *trace_reader)
+{
+    uint64_t num_records;
+    TraceReadStatus count_status = trace_reader_count(trace_reader,
+                                                      &num_records);
+    if (count_status != TRACE_READ_OK)
+    {
+        trace_reader_perror(trace_reader, "Couldn't read trace");
+        return 1;
+    }
+    if (num_records <= TRACE_START)
+    {
+        fprintf(stderr, "Error: trace has fewer than %llu records\n",
+                (unsigned long long)TRACE_START + 1);
+        return 1;
+    }
+    num_records -= TRACE_START;
+    if (TRACE_COUNT > 0 && TRACE_COUNT < num_records)
+    {
+        num_records = TRACE_COUNT;
+    }
+
+    // Split the records as evenly as possible. Each segment's warmup reaches
+    // back into the one before it, but never before the first record
+    // simulated, where the whole trace's pipeline would start cold.
+    *num_segments = NUM_SEGMENTS < num_records ? NUM_SEGMENTS
+                                                : (uint32_t)num_records;
+    uint64_t end = TRACE_START + num_records;
+    for (uint32_t i = 0; i < *num_segments; i++)
+    {
+        SegmentRun *run = &segment_runs[i];
+        memset(run, 0, sizeof(*run));
+        run->trace_filename = trace_filename;
+        run->config = *config;
+        run->start = TRACE_START + num_records * i / *num_segments;
+        run->end = TRACE_START + num_records * (i + 1) / *num_segments;
+        run->warmup_start = run->start - TRACE_START > SEGMENT_WARMUP
+                                ? run->start - SEGMENT_WARMUP
+                                : TRACE_START;
+        run->drains = run->end == end;
+    }
+
+    // The whole trace is just a segment without a warmup.
+    memset(serial_run, 0, sizeof(*serial_run));
+    serial_run->trace_filename = trace_filename;
+    serial_run->config = *config;
+    serial_run->warmup_start = TRACE_START;
+    serial_run->start = TRACE_START;
+    serial_run->end = end;
+    serial_run->drains = true;
+
+    printf("Simulating %u segments of %llu records in parallel (warmup "
+           "%llu)%s\n",
+           *num_segments, (unsigned long long)num_records,
+           (unsigned long long)SEGMENT_WARMUP,
+           SEGMENT_COMPARE ? ", and the whole trace" : "");
+
+    std::thread threads[MAX_SEGMENTS];
+    for (uint32_t i = 0; i < *num_segments; i++)
+    {
+        threads[i] = std::thread(simulate_segment, &segment_runs[i]);
+    }
+    if (SEGMENT_COMPARE)
+    {
+        simulate_segment(serial_run);
+    }
+    for (uint32_t i = 0; i < *num_segments; i++)
+    {
+        threads[i].join();
+    }
+
+    if (serial_run->status != 0)
+    {
+        return serial_run->status;
+    }
+    for (uint32_t i = 0; i < *num_segments; i++)
+    {
+        if (segment_runs[i].status != 0)
+        {
+            return segment_runs[i].status;
+        }
+    }
+    return 0;
+}
+
+void simulate_segment(SegmentRun *run)
+{
+    TraceOpenMethod method;
+    TraceReader *reader = trace_reader_open(run->trace_filename,
+                                            TRACE_CACHE_DIR, &method);
+    if (reader == NULL)
+    {
+        perror("Couldn't open trace file");
+        run->status = 1;
+        return;
+    }
+    if (trace_reader_seek(reader, run->warmup_start) != TRACE_READ_OK)
+    {
+        trace_reader_perror(reader, "Couldn't read trace");
+        trace_reader_free(reader);
+        run->status = 1;
+        return;
+    }
+
+    // A segment that doesn't drain reads on past its end, far enough to keep
+    // every latch full until its last record retires.
+    uint64_t num_warmup = run->start - run->warmup_start;
+    uint64_t num_records = run->end - run->warmup_start;
+    trace_reader_set_limit(reader, run->drains ? num_records
+                                               : num_records +
+                                                     PIPE_WINDOW_SIZE);
+
+    Pipeline *p = pipe_init(&run->config, reader);
+    uint64_t last_hbeat_inst = 0;
+    PipeStats start_stats;
+    bool measuring = false;
+    while (run->status == 0 && !p->halt)
+    {
+        if (!measuring && p->stat_retired_inst >= num_warmup)
+        {
+            pipe_get_stats(p, &start_stats);
+            measuring = true;
+        }
+        if (!run->drains && p->stat_retired_inst >= num_records)
+        {
+            break;
+        }
+        pipe_cycle(p);
+        run->status = check_pipeline_heartbeat(p, &last_hbeat_inst, false);
+    }
+    if (!measuring)
+    {
+        pipe_get_stats(p, &start_stats);
+    }
+
+    // Segments that share a boundary stop and start measuring in the same
+    // cycle of the whole trace's simulation, when the same instruction
+    // retires, so their cycles add up without gaps or overlaps.
+    pipe_get_stats(p, &run->stats);
+    run->stats.num_inst -= start_stats.num_inst;
+    run->stats.num_cycles -= start_stats.num_cycles;
+    run->stats.num_branches -= start_stats.num_branches;
+    run->stats.num_mispred -= start_stats.num_mispred;
+    run->stats.cpi = (double)run->stats.num_cycles /
+                     (double)run->stats.num_inst;
+
+    pipe_free(p);
+    trace_reader_free(reader);
+}
+
+int check_pipeline_heartbeat(Pipeline *p, uint64_t *last_hbeat_inst,
+                             bool verbose)
+{
+    if (verbose && p->stat_num_cycle % PIPE_HEARTBEAT_CYCLES == 0)
+    {
+        // Print a heartbeat.
+        printf(".");
+        fflush(stdout);
+    }
+
+    // Check for deadlock.
+    if (!pipe_check_progress(p, last_hbeat_inst))
+    {
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Error: pipeline is deadlocked: no instructions "
+                        "committed in %u cycles\n",
+                PIPE_HEARTBEAT_CYCLES);
+        return 1;
+    }
+
+    if (verbose && p->stat_num_cycle % STAT_CYCLES == 0)
     {
         // Print statistics.
-        uint64_t stat_num_inst = pipeline->stat_num_cycle;
-        uint64_t stat_num_cycle = pipeline->stat_retired_inst;
+        uint64_t stat_num_inst = p->stat_num_cycle;
+        uint64_t stat_num_cycle = p->stat_retired_inst;
         double cpi = (double)stat_num_inst / (double)stat_num_cycle;
 
         printf("\n");
@@ -286,30 +1509,348 @@ int check_heartbeat()
     return 0;
 }
 
-void print_stats()
+double t_critical_95(uint64_t dof)
+{
+    // Two-sided 95% critical values of Student's t distribution for 1 to 30
+    // degrees of freedom; beyond that, the normal distribution is close enough.
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+    if (dof >= 1 && dof <= 30)
+    {
+        return table[dof - 1];
+    }
+    return 1.960;
+}
+
+void print_stats(Pipeline *p, const SampleStats *sample_stats)
+{
+    PipeStats stats;
+    pipe_get_stats(p, &stats);
+
+    if (SAMPLE_PERIOD > 0)
+    {
+        // Extrapolate the mean CPI of the samples to the whole trace.
+        stats.num_inst = p->trace_reader->stat_num_records;
+        stats.cpi = sample_stats->sum_cpi /
+                    (double)sample_stats->num_samples;
+        stats.num_cycles = (uint64_t)(stats.cpi * (double)stats.num_inst +
+                                      0.5);
+    }
+
+    printf("\n\n");
+    print_pipeline_stats(&stats);
+    printf("\n");
+    print_bpred_stats(&p->config, p->b_pred);
+    print_frontend_stats(p);
+
+    if (SAMPLE_PERIOD > 0)
+    {
+        print_sample_stats(p, sample_stats);
+    }
+
+    print_trace_stats(p->trace_reader);
+    printf("\n");
+}
+
+void print_config_stats(ConfigRun *config_runs)
 {
-    unsigned long stat_num_inst = pipeline->stat_retired_inst;
-    unsigned long stat_num_cycle = pipeline->stat_num_cycle;
-    double cpi = (double)stat_num_cycle / (double)stat_num_inst;
+    printf("\n\n");
+
+    for (uint32_t i = 0; i < NUM_CONFIGS; i++)
+    {
+        PipeStats stats;
+        pipe_get_stats(config_runs[i].pipeline, &stats);
+
+        printf("CONFIG                  \t : %s\n", config_runs[i].name);
+        print_pipeline_stats(&stats);
+        printf("\n");
+        print_bpred_stats(&config_runs[i].config,
+                          config_runs[i].pipeline->b_pred);
+        print_frontend_stats(config_runs[i].pipeline);
+    }
+
+    // Every configuration read the same records, so report them once.
+    print_trace_stats(config_runs[0].pipeline->trace_reader);
+    printf("\n");
+}
 
+void print_bpred_only_stats(const ConfigRun *config_runs, uint32_t num_runs,
+                            TraceReader *trace_reader,
+                            const BranchStream *branch_stream)
+{
     printf("\n\n");
 
-    printf("LAB2_NUM_INST           \t : %10lu\n", stat_num_inst);
-    printf("LAB2_NUM_CYCLES         \t : %10lu\n", stat_num_cycle);
-    printf("LAB2_CPI                \t : %10.3f\n", cpi);
+    for (uint32_t i = 0; i < num_runs; i++)
+    {
+        const BPred *b_pred = config_runs[i].b_pred;
+        PipeStats stats;
+        memset(&stats, 0, sizeof(stats));
+        stats.has_bpred = true;
+        stats.num_branches = b_pred->stat_num_branches;
+        stats.num_mispred = b_pred->stat_num_mispred;
 
-    if (BPRED_POLICY != BPRED_PERFECT)
+        char buf[256];
+        pipe_format_bpred_stats(&stats, buf, sizeof(buf));
+        if (NUM_CONFIGS > 0)
+        {
+            printf("CONFIG                  \t : %s\n", config_runs[i].name);
+        }
+        fputs(buf, stdout);
+        printf("\n");
+        print_bpred_stats(&config_runs[i].config, b_pred);
+    }
+
+    if (branch_stream != NULL)
+    {
+        printf("TRACE_RECORDS           \t : %10lu\n",
+               (unsigned long)branch_stream->header.num_records);
+        printf("BRANCH_STREAM_BYTES     \t : %10lu\n",
+               (unsigned long)branch_stream->map_size);
+    }
+    else
     {
-        unsigned long stat_num_branches = pipeline->b_pred->stat_num_branches;
-        unsigned long stat_num_mispred = pipeline->b_pred->stat_num_mispred;
-        double bpred_mispred_rate = 100.0 * (double)stat_num_mispred / (double)stat_num_branches;
+        print_trace_stats(trace_reader);
+    }
+    printf("\n");
+}
 
-        printf("LAB2_BPRED_BRANCHES     \t : %10lu\n", stat_num_branches);
-        printf("LAB2_BPRED_MISPRED      \t : %10lu\n", stat_num_mispred);
-        printf("LAB2_MISPRED_RATE       \t : %10.3f\n", bpred_mispred_rate);
+void print_segment_stats(const SegmentRun *segment_runs,
+                         uint32_t num_segments, const SegmentRun *serial_run)
+{
+    PipeStats stats = segment_runs[0].stats;
+    uint64_t num_detailed = 0;
+    for (uint32_t i = 0; i < num_segments; i++)
+    {
+        const PipeStats *segment_stats = &segment_runs[i].stats;
+        if (i > 0)
+        {
+            stats.num_inst += segment_stats->num_inst;
+            stats.num_cycles += segment_stats->num_cycles;
+            stats.num_branches += segment_stats->num_branches;
+            stats.num_mispred += segment_stats->num_mispred;
+        }
+        num_detailed += segment_runs[i].end - segment_runs[i].warmup_start;
     }
+    stats.cpi = (double)stats.num_cycles / (double)stats.num_inst;
 
+    printf("\n\n");
+    print_pipeline_stats(&stats);
     printf("\n");
+
+    uint64_t num_records = segment_runs[num_segments - 1].end -
+                           segment_runs[0].start;
+    printf("SEGMENT_COUNT           \t : %10u\n", num_segments);
+    printf("SEGMENT_DETAILED_PCT    \t : %10.3f\n",
+           100.0 * (double)num_detailed / (double)num_records);
+    if (serial_run != NULL)
+    {
+        printf("SEGMENT_SERIAL_CPI      \t : %10.3f\n", serial_run->stats.cpi);
+        printf("SEGMENT_CPI_DEVIATION_PCT\t : %10.3f\n",
+               100.0 * (stats.cpi - serial_run->stats.cpi) /
+                   serial_run->stats.cpi);
+    }
+    printf("\n");
+}
+
+void print_pipeline_stats(const PipeStats *stats)
+{
+    char buf[512];
+    pipe_format_stats(stats, buf, sizeof(buf));
+    fputs(buf, stdout);
+}
+
+void print_bpred_stats(const PipeConfig *config, const BPred *b_pred)
+{
+    // Only gshare, the tournament, TAGE, and the perceptrons have tables whose
+    // size can be configured.
+    if (config->bpred_policy == BPRED_GSHARE ||
+        config->bpred_policy == BPRED_TOURNAMENT)
+    {
+        printf("BPRED_HIST_BITS         \t : %10u\n", config->bpred_hist_bits);
+        printf("BPRED_PHT_ENTRIES       \t : %10u\n", config->bpred_pht_entries);
+        if (config->bpred_policy == BPRED_TOURNAMENT)
+        {
+            print_tournament_stats(b_pred);
+        }
+    }
+    else if (config->bpred_policy == BPRED_TAGE)
+    {
+        const TageConfig *tage_config = &config->tage_config;
+        uint32_t hist_len[TAGE_MAX_TABLES];
+        tage_history_lengths(tage_config, hist_len);
+        printf("BPRED_TAGE_TABLES       \t : %10u\n", tage_config->num_tables);
+        printf("BPRED_TAGE_TABLE_ENTRIES\t : %10u\n",
+               tage_config->table_entries);
+        printf("BPRED_TAGE_BASE_ENTRIES \t : %10u\n", tage_config->base_entries);
+        printf("BPRED_TAGE_TAG_BITS     \t : %10u\n", tage_config->tag_bits);
+        printf("BPRED_TAGE_HIST_LENGTHS \t :");
+        for (uint32_t i = 0; i < tage_config->num_tables; i++)
+        {
+            printf(" %u", hist_len[i]);
+        }
+        printf("\n");
+    }
+    else if (config->bpred_policy == BPRED_PERCEPTRON)
+    {
+        const PerceptronConfig *perceptron_config = &config->perceptron_config;
+        printf("BPRED_PERCEPTRON_HIST   \t : %10u\n", perceptron_config->hist_len);
+        printf("BPRED_PERCEPTRON_ROWS   \t : %10u\n", perceptron_config->num_rows);
+        printf("BPRED_PERCEPTRON_THETA  \t : %10d\n",
+               perceptron_theta(perceptron_config));
+    }
+    else
+    {
+        return;
+    }
+
+    uint64_t storage_bits = b_pred->storage_bits();
+    printf("BPRED_STORAGE_BITS      \t : %10lu\n", (unsigned long)storage_bits);
+    printf("BPRED_STORAGE_KIB       \t : %10.3f\n",
+           (double)storage_bits / 8192.0);
+    printf("BPRED_TABLE_BYTES       \t : %10lu\n",
+           (unsigned long)b_pred->table_bytes());
+    printf("\n");
+}
+
+void print_tournament_stats(const BPred *b_pred)
+{
+    static const char *const NAMES[NUM_TOURNAMENT_COMPONENTS] = {
+        "BIMODAL", "LOCAL", "GSHARE"};
+
+    // Each component's accuracy over every branch, whether the chooser picked
+    // it or not, and the share of branches the chooser picked it for.
+    const Tournament *t = b_pred->tournament_state();
+    uint64_t num_branches = b_pred->stat_num_branches;
+    double scale = num_branches > 0 ? 100.0 / num_branches : 0.0;
+    char name[32];
+    for (int c = 0; c < NUM_TOURNAMENT_COMPONENTS; c++)
+    {
+        uint64_t bits = b_pred->component_storage_bits((TournamentComponent)c);
+        snprintf(name, sizeof(name), "BPRED_%s_ACCURACY", NAMES[c]);
+        printf("%-24s\t : %10.3f\n", name, t->stat_correct[c] * scale);
+        snprintf(name, sizeof(name), "BPRED_%s_CHOSEN_PCT", NAMES[c]);
+        printf("%-24s\t : %10.3f\n", name, t->stat_chosen[c] * scale);
+        snprintf(name, sizeof(name), "BPRED_%s_BITS", NAMES[c]);
+        printf("%-24s\t : %10lu\n", name, (unsigned long)bits);
+    }
+    printf("BPRED_CHOOSER_BITS      \t : %10lu\n",
+           (unsigned long)b_pred->component_storage_bits(
+               NUM_TOURNAMENT_COMPONENTS));
+}
+
+void print_frontend_stats(const Pipeline *p)
+{
+    if (p->btb == NULL)
+    {
+        return;
+    }
+
+    const BtbConfig *btb_config = &p->config.btb_config;
+    uint64_t lookups = p->btb->stat_lookups;
+    double miss_rate = lookups > 0 ? 100.0 * (double)p->btb->stat_misses /
+                                         (double)lookups
+                                   : 0.0;
+    printf("BTB_ENTRIES             \t : %10u\n", btb_config->num_entries);
+    printf("BTB_ASSOC               \t : %10u\n", btb_config->assoc);
+    printf("BTB_MISS_PENALTY        \t : %10u\n", btb_config->miss_penalty);
+    printf("BTB_LOOKUPS             \t : %10lu\n", (unsigned long)lookups);
+    printf("BTB_MISSES              \t : %10lu\n",
+           (unsigned long)p->btb->stat_misses);
+    printf("BTB_MISS_RATE           \t : %10.3f\n", miss_rate);
+    printf("FETCH_BREAKS            \t : %10lu\n",
+           (unsigned long)p->stat_fetch_breaks);
+    printf("FETCH_BREAK_LANES       \t : %10lu\n",
+           (unsigned long)p->stat_fetch_break_lanes);
+    printf("FETCH_REDIRECT_CYCLES   \t : %10lu\n",
+           (unsigned long)p->stat_redirect_cycles);
+    printf("\n");
+}
+
+void print_sample_stats(Pipeline *p, const SampleStats *sample_stats)
+{
+    uint64_t n = sample_stats->num_samples;
+    double mean = sample_stats->sum_cpi / (double)n;
+
+    // Half-width of the 95% confidence interval of the mean CPI, from the
+    // sample variance of the per-sample CPIs.
+    double half_width = NAN;
+    if (n > 1)
+    {
+        double variance = (sample_stats->sum_cpi_sq -
+                           (double)n * mean * mean) /
+                          (double)(n - 1);
+        if (variance < 0.0)
+        {
+            variance = 0.0;
+        }
+        half_width = t_critical_95(n - 1) * sqrt(variance / (double)n);
+    }
+
+    unsigned long num_detailed = (unsigned long)(n * (SAMPLE_WARMUP +
+                                                      SAMPLE_INTERVAL));
+    double detailed_pct = 100.0 * (double)num_detailed /
+                          (double)p->trace_reader->stat_num_records;
+
+    printf("SAMPLE_COUNT            \t : %10lu\n", (unsigned long)n);
+    printf("SAMPLE_MEASURED_INST    \t : %10lu\n",
+           (unsigned long)sample_stats->num_inst);
+    printf("SAMPLE_MEASURED_CYCLES  \t : %10lu\n",
+           (unsigned long)sample_stats->num_cycles);
+    printf("SAMPLE_DETAILED_PCT     \t : %10.3f\n", detailed_pct);
+    printf("SAMPLE_CPI_CI95         \t : %10.3f\n", half_width);
+    printf("SAMPLE_CPI_CI95_PCT     \t : %10.3f\n", 100.0 * half_width / mean);
+
+    printf("\n");
+}
+
+void print_trace_stats(TraceReader *reader)
+{
+    printf("TRACE_RECORDS           \t : %10lu\n",
+           (unsigned long)reader->stat_num_records);
+    if (reader->source == TRACE_SOURCE_FANOUT)
+    {
+        printf("TRACE_FANOUT_BATCHES    \t : %10lu\n",
+               (unsigned long)reader->stat_num_reads);
+        printf("TRACE_FANOUT_WAITS      \t : %10lu\n",
+               (unsigned long)trace_fanout_num_waits(reader));
+        reader = reader->src;
+    }
+    if (reader->source == TRACE_SOURCE_PREFETCH)
+    {
+        printf("TRACE_PREFETCH_BATCHES  \t : %10lu\n",
+               (unsigned long)reader->stat_num_reads);
+        printf("TRACE_PREFETCH_STALLS   \t : %10lu\n",
+               (unsigned long)trace_prefetch_num_stalls(reader));
+        reader = reader->src;
+    }
+    switch (reader->source)
+    {
+    case TRACE_SOURCE_FD:
+        printf("TRACE_READ_SYSCALLS     \t : %10lu\n",
+               (unsigned long)reader->stat_num_reads);
+        printf("TRACE_SYSCALLS_SAVED    \t : %10lu\n",
+               (unsigned long)trace_reader_syscalls_saved(reader));
+        break;
+    case TRACE_SOURCE_GZIP:
+        printf("TRACE_GZREAD_CALLS      \t : %10lu\n",
+               (unsigned long)reader->stat_num_reads);
+        break;
+    case TRACE_SOURCE_PACKED:
+        printf("TRACE_PACKED_BLOCKS     \t : %10lu\n",
+               (unsigned long)reader->stat_num_reads);
+        printf("TRACE_MAPPED_BYTES      \t : %10lu\n",
+               (unsigned long)reader->map_size);
+        break;
+    case TRACE_SOURCE_MMAP:
+        printf("TRACE_MAPPED_BYTES      \t : %10lu\n",
+               (unsigned long)reader->map_size);
+        break;
+    default:
+        break;
+    }
 }
 
 void print_usage(char *program_name)
@@ -322,6 +1863,68 @@ void print_usage(char *program_name)
     fprintf(stderr, "                        (disabled by default)\n");
     fprintf(stderr, "    -enableexefwd       Enable forwarding from Execute (EX) stage (disabled by\n");
     fprintf(stderr, "                        default)\n");
+    fprintf(stderr, "    -gunzip             Decompress the trace with a forked gunzip process\n");
+    fprintf(stderr, "                        instead of in-process zlib\n");
+    fprintf(stderr, "    -tracecache <dir>   Decompress the trace once into <dir> and map it on\n");
+    fprintf(stderr, "                        later runs (Default: $%s)\n", TRACE_CACHE_DIR_ENV);
+    fprintf(stderr, "    -notracecache       Don't use the trace cache\n");
+    fprintf(stderr, "    -start <n>          Start simulating at trace record <n> (Default: 0)\n");
+    fprintf(stderr, "    -count <n>          Simulate at most <n> trace records (Default: all)\n");
+    fprintf(stderr, "    -config <spec>      Also simulate configuration \"[<name>=]<options>\",\n");
+    fprintf(stderr, "                        e.g. \"A3=-pipewidth 2 -enableexefwd\"; may be\n");
+    fprintf(stderr, "                        repeated to simulate many over one pass of the trace\n");
+    fprintf(stderr, "    -configthreads      Simulate each -config on its own thread\n");
+    fprintf(stderr, "    -checkpoint <file>  Write a checkpoint of the simulation to <file>\n");
+    fprintf(stderr, "    -checkpointat <n>   Stop and write the checkpoint once <n> instructions\n");
+    fprintf(stderr, "                        have retired (Default: at the end of the trace)\n");
+    fprintf(stderr, "    -restore <file>     Resume the simulation from checkpoint <file>\n");
+    fprintf(stderr, "    -sample <period>    Simulate one sample in detail per <period> records\n");
+    fprintf(stderr, "                        and fast-forward the rest (disabled by default)\n");
+    fprintf(stderr, "    -sampleinterval <n> Measure <n> records per sample (Default: 10000)\n");
+    fprintf(stderr, "    -samplewarmup <n>   Simulate <n> records before each sample (Default:\n");
+    fprintf(stderr, "                        1000)\n");
+    fprintf(stderr, "    -segments <k>       Split the trace into <k> segments and simulate each on\n");
+    fprintf(stderr, "                        its own thread (disabled by default); best with a\n");
+    fprintf(stderr, "                        packed or cached trace, which segments seek into\n");
+    fprintf(stderr, "    -segmentwarmup <n>  Simulate <n> records before each segment (Default:\n");
+    fprintf(stderr, "                        10000)\n");
+    fprintf(stderr, "    -segmentcompare     Also simulate the whole trace and report how far the\n");
+    fprintf(stderr, "                        segments' CPI deviates from it\n");
+    fprintf(stderr, "    -bpredonly          Simulate only the branch predictors, replaying the\n");
+    fprintf(stderr, "                        trace's branches through each -config's predictor,\n");
+    fprintf(stderr, "                        or else the one given, in one pass; the trace may\n");
+    fprintf(stderr, "                        also be a branch stream extracted by brstream\n");
+    fprintf(stderr, "    -prefetch <depth>   Read the trace on a separate thread through a ring of\n");
+    fprintf(stderr, "                        <depth> batches (disabled by default)\n");
     fprintf(stderr, "    -bpredpolicy <num>  Set branch predictor [0: Perfect, 1: Always Taken,\n");
-    fprintf(stderr, "                        2: Gshare] (Default: 0)\n");
+    fprintf(stderr, "                        2: Gshare, 3: TAGE, 4: Perceptron,\n");
+    fprintf(stderr, "                        5: Tournament] (Default: 0)\n");
+    fprintf(stderr, "    -bpred_hist_bits <n>\n");
+    fprintf(stderr, "                        Set the gshare history length to <n> bits (Default:\n");
+    fprintf(stderr, "                        %d)\n", BPRED_DEFAULT_HIST_BITS);
+    fprintf(stderr, "    -bpred_pht_entries <n>\n");
+    fprintf(stderr, "                        Set the gshare table size to <n> 2-bit counters, a\n");
+    fprintf(stderr, "                        power of two (Default: %d)\n", BPRED_DEFAULT_PHT_ENTRIES);
+    fprintf(stderr, "    -tageconfig <file>  Read the TAGE geometry from <file>, one \"<field>\n");
+    fprintf(stderr, "                        <value>\" per line, with the fields num_tables,\n");
+    fprintf(stderr, "                        base_entries, table_entries, tag_bits, min_hist,\n");
+    fprintf(stderr, "                        max_hist and useful_reset_period (Default: 7\n");
+    fprintf(stderr, "                        tables of 1024 entries, histories of 4 to 200)\n");
+    fprintf(stderr, "    -bpred_perceptron_hist <n>\n");
+    fprintf(stderr, "                        Set the perceptron history length to <n> branches\n");
+    fprintf(stderr, "                        (Default: 31)\n");
+    fprintf(stderr, "    -bpred_perceptron_rows <n>\n");
+    fprintf(stderr, "                        Set the number of perceptrons to <n>, a power of two\n");
+    fprintf(stderr, "                        (Default: 256)\n");
+    fprintf(stderr, "    -bpred_perceptron_theta <n>\n");
+    fprintf(stderr, "                        Train the perceptrons on correct predictions with\n");
+    fprintf(stderr, "                        outputs within <n> of 0 (Default: 1.93 times the\n");
+    fprintf(stderr, "                        history length plus 14)\n");
+    fprintf(stderr, "    -btb_entries <n>    Model the front end with a BTB of <n> entries, a\n");
+    fprintf(stderr, "                        power of two (Default: 0, not modeled)\n");
+    fprintf(stderr, "    -btb_assoc <n>      Set the BTB associativity to <n> ways, a power of\n");
+    fprintf(stderr, "                        two (Default: 4)\n");
+    fprintf(stderr, "    -btb_miss_penalty <n>\n");
+    fprintf(stderr, "                        Insert <n> cycles of fetch bubbles after a taken\n");
+    fprintf(stderr, "                        branch misses in the BTB (Default: 2)\n");
 }
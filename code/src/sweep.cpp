@@ -0,0 +1,723 @@
+// sweep.cpp
+// Runs a sweep of simulations, one per (trace, configuration) job, on a
+// work-stealing pool of threads inside one process. By default it runs the
+// lab's A1-B2 configurations over every trace, writes the same .res files and
+// report.txt as runall.sh, and checks the results against the reference
+// results as runtests.sh does.
+
+#include "pipeline.h"
+#include "trace_cache.h"
+#include <deque>
+#include <dirent.h>
+#include <errno.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+/**
+ * The suffix of trace files in the trace directory.
+ */
+#define TRACE_SUFFIX ".ptr.gz"
+
+/**
+ * One named configuration of the default sweep.
+ */
+typedef struct SweepConfig
+{
+    /** The name of the configuration, which prefixes its .res files. */
+    const char *name;
+    /** The options of the configuration, as passed to sim. */
+    const char *options;
+} SweepConfig;
+
+/**
+ * The configurations run by runall.sh and runtests.sh.
+ */
+static const SweepConfig DEFAULT_CONFIGS[] = {
+    {"A1", "-pipewidth 1"},
+    {"A2", "-pipewidth 2"},
+    {"A3", "-pipewidth 2 -enablememfwd -enableexefwd"},
+    {"B1", "-pipewidth 2 -enablememfwd -enableexefwd -bpredpolicy 1"},
+    {"B2", "-pipewidth 2 -enablememfwd -enableexefwd -bpredpolicy 2"},
+};
+
+/**
+ * One simulation in the sweep, and its results.
+ */
+typedef struct SweepJob
+{
+    /** The name of the configuration. */
+    char name[64];
+    /** The name of the trace, without its directory or suffix. */
+    char trace_name[64];
+    /** The path of the trace file. */
+    char trace_path[1024];
+    /** The configuration of the pipeline. */
+    PipeConfig config;
+    /** The size of the trace file, used to start the longest jobs first. */
+    uint64_t trace_size;
+
+    /** Nonzero if the simulation failed. */
+    int status;
+    /** The LAB2_* statistics of the simulation, as sim prints them. */
+    char stats[512];
+    /** The wall time the simulation took, in seconds. */
+    double seconds;
+} SweepJob;
+
+/**
+ * One thread of the pool and its queue of jobs.
+ *
+ * Each worker takes jobs from the front of its own queue. A worker whose
+ * queue is empty steals from the back of another worker's queue, so the jobs
+ * dealt out longest-first are run longest-first, and the short jobs at the
+ * backs of the queues even out the load at the end.
+ */
+typedef struct SweepWorker
+{
+    /** Guards queue. */
+    std::mutex mutex;
+    /** Indices into the job list. */
+    std::deque<size_t> queue;
+    /** The number of jobs this worker stole from others. */
+    uint64_t stat_num_steals;
+} SweepWorker;
+
+/**
+ * The state shared by all threads of the sweep.
+ */
+typedef struct Sweep
+{
+    /** The jobs to run. */
+    std::vector<SweepJob> jobs;
+    /** The workers of the pool. */
+    std::vector<SweepWorker> workers;
+    /** The directory to write .res files to. */
+    const char *results_dir;
+    /** The trace cache directory, or NULL to decompress every trace. */
+    const char *cache_dir;
+    /** Guards num_done and progress output. */
+    std::mutex print_mutex;
+    /** The number of jobs finished so far. */
+    size_t num_done;
+} Sweep;
+
+int add_default_jobs(Sweep *sweep, const char *traces_dir,
+                     char **trace_names, int num_trace_names);
+int add_job_file(Sweep *sweep, const char *traces_dir, const char *filename);
+int add_job(Sweep *sweep, const char *name, const char *trace,
+            const char *traces_dir, const char *options);
+void run_sweep(Sweep *sweep, unsigned num_threads);
+void run_worker(Sweep *sweep, size_t self);
+void run_job(Sweep *sweep, SweepJob *job);
+int write_report(const Sweep *sweep, const char *filename);
+int check_results(const Sweep *sweep, const char *ref_dir);
+void print_usage(char *program_name);
+
+int main(int argc, char *argv[])
+{
+    Sweep sweep;
+    sweep.results_dir = "../results";
+    sweep.cache_dir = NULL;
+    sweep.num_done = 0;
+    const char *traces_dir = "../traces";
+    const char *report_file = "report.txt";
+    const char *ref_dir = "../ref/results";
+    const char *job_file = NULL;
+    unsigned num_threads = std::thread::hardware_concurrency();
+    char **trace_names = NULL;
+    int num_trace_names = 0;
+
+    const char *cache_dir = getenv(TRACE_CACHE_DIR_ENV);
+    if (cache_dir != NULL && cache_dir[0] != '\0')
+    {
+        sweep.cache_dir = cache_dir;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char **value = NULL;
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+        else if (strcmp(argv[i], "-threads") == 0)
+        {
+            if (++i >= argc || atoi(argv[i]) < 1)
+            {
+                fprintf(stderr, "Error: -threads needs a positive count\n");
+                return 2;
+            }
+            num_threads = atoi(argv[i]);
+        }
+        else if (strcmp(argv[i], "-notracecache") == 0)
+        {
+            sweep.cache_dir = NULL;
+        }
+        else if (strcmp(argv[i], "-noref") == 0)
+        {
+            ref_dir = NULL;
+        }
+        else if (strcmp(argv[i], "-jobs") == 0)
+        {
+            value = &job_file;
+        }
+        else if (strcmp(argv[i], "-traces") == 0)
+        {
+            value = &traces_dir;
+        }
+        else if (strcmp(argv[i], "-results") == 0)
+        {
+            value = &sweep.results_dir;
+        }
+        else if (strcmp(argv[i], "-report") == 0)
+        {
+            value = &report_file;
+        }
+        else if (strcmp(argv[i], "-ref") == 0)
+        {
+            value = &ref_dir;
+        }
+        else if (strcmp(argv[i], "-tracecache") == 0)
+        {
+            value = &sweep.cache_dir;
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+            return 2;
+        }
+        else
+        {
+            if (trace_names == NULL)
+            {
+                trace_names = &argv[i];
+            }
+            num_trace_names++;
+            continue;
+        }
+
+        if (value != NULL)
+        {
+            if (++i >= argc)
+            {
+                fprintf(stderr, "Error: missing argument to %s\n",
+                        argv[i - 1]);
+                return 2;
+            }
+            *value = argv[i];
+        }
+        if (trace_names != NULL)
+        {
+            fprintf(stderr, "Error: options must come before trace names\n");
+            return 2;
+        }
+    }
+    if (num_threads < 1)
+    {
+        num_threads = 1;
+    }
+
+    int status = job_file != NULL
+                     ? add_job_file(&sweep, traces_dir, job_file)
+                     : add_default_jobs(&sweep, traces_dir, trace_names,
+                                        num_trace_names);
+    if (status != 0)
+    {
+        return status;
+    }
+    if (sweep.jobs.empty())
+    {
+        fprintf(stderr, "Error: no jobs to run\n");
+        return 2;
+    }
+
+    if (mkdir(sweep.results_dir, 0777) != 0 && errno != EEXIST)
+    {
+        perror("Couldn't create results directory");
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_sweep(&sweep, num_threads);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double total_seconds = (end.tv_sec - start.tv_sec) +
+                           (end.tv_nsec - start.tv_nsec) / 1e9;
+    double longest_seconds = 0.0;
+    uint64_t num_steals = 0;
+    int num_failed = 0;
+    for (size_t i = 0; i < sweep.jobs.size(); i++)
+    {
+        if (sweep.jobs[i].seconds > longest_seconds)
+        {
+            longest_seconds = sweep.jobs[i].seconds;
+        }
+        if (sweep.jobs[i].status != 0)
+        {
+            num_failed++;
+        }
+    }
+    for (size_t i = 0; i < sweep.workers.size(); i++)
+    {
+        num_steals += sweep.workers[i].stat_num_steals;
+    }
+    printf("Ran %zu jobs on %u threads in %.2f s (longest job %.2f s, "
+           "%llu steals)\n",
+           sweep.jobs.size(), num_threads, total_seconds, longest_seconds,
+           (unsigned long long)num_steals);
+
+    status = num_failed > 0 ? 1 : 0;
+    if (write_report(&sweep, report_file) != 0)
+    {
+        perror("Couldn't write report");
+        status = 1;
+    }
+    if (ref_dir != NULL && check_results(&sweep, ref_dir) != 0)
+    {
+        status = 1;
+    }
+    return status;
+}
+
+/**
+ * Check whether a file name ends with the given suffix.
+ */
+static bool has_suffix(const char *name, const char *suffix)
+{
+    size_t name_len = strlen(name);
+    size_t suffix_len = strlen(suffix);
+    return name_len > suffix_len &&
+           strcmp(name + name_len - suffix_len, suffix) == 0;
+}
+
+/**
+ * Compare two C strings for qsort().
+ */
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int add_default_jobs(Sweep *sweep, const char *traces_dir,
+                     char **trace_names, int num_trace_names)
+{
+    // Without trace names, run every trace in the trace directory.
+    std::vector<char *> found;
+    if (num_trace_names == 0)
+    {
+        DIR *dir = opendir(traces_dir);
+        if (dir == NULL)
+        {
+            perror("Couldn't open trace directory");
+            return 1;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (has_suffix(entry->d_name, TRACE_SUFFIX))
+            {
+                char *name = strdup(entry->d_name);
+                name[strlen(name) - strlen(TRACE_SUFFIX)] = '\0';
+                found.push_back(name);
+            }
+        }
+        closedir(dir);
+        if (!found.empty())
+        {
+            qsort(&found[0], found.size(), sizeof(char *), compare_strings);
+            trace_names = &found[0];
+        }
+        num_trace_names = found.size();
+    }
+
+    int status = 0;
+    size_t num_configs = sizeof(DEFAULT_CONFIGS) / sizeof(DEFAULT_CONFIGS[0]);
+    for (size_t c = 0; c < num_configs && status == 0; c++)
+    {
+        for (int t = 0; t < num_trace_names && status == 0; t++)
+        {
+            status = add_job(sweep, DEFAULT_CONFIGS[c].name, trace_names[t],
+                             traces_dir, DEFAULT_CONFIGS[c].options);
+        }
+    }
+
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        free(found[i]);
+    }
+    return status;
+}
+
+int add_job_file(Sweep *sweep, const char *traces_dir, const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        perror("Couldn't open job file");
+        return 1;
+    }
+
+    // Each line is "<name> <trace> [options]"; blank lines and lines
+    // starting with '#' are ignored.
+    char line[1024];
+    int line_num = 0;
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        line_num++;
+        char name[64];
+        char trace[1024];
+        int options_pos = 0;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (sscanf(line, " %63s %1023s %n", name, trace, &options_pos) < 2)
+        {
+            if (sscanf(line, " %1s", name) == 1 && name[0] != '#')
+            {
+                fprintf(stderr, "Error: %s:%d: expected a name and a trace\n",
+                        filename, line_num);
+                status = 2;
+            }
+            continue;
+        }
+        if (name[0] == '#')
+        {
+            continue;
+        }
+        status = add_job(sweep, name, trace, traces_dir, line + options_pos);
+    }
+
+    fclose(file);
+    return status;
+}
+
+int add_job(Sweep *sweep, const char *name, const char *trace,
+            const char *traces_dir, const char *options)
+{
+    SweepJob job;
+    memset(&job, 0, sizeof(job));
+    snprintf(job.name, sizeof(job.name), "%s", name);
+
+    // A trace is either a path, or the name of a trace in the trace
+    // directory.
+    if (strchr(trace, '/') != NULL)
+    {
+        snprintf(job.trace_path, sizeof(job.trace_path), "%s", trace);
+        const char *base = strrchr(trace, '/') + 1;
+        snprintf(job.trace_name, sizeof(job.trace_name), "%s", base);
+        job.trace_name[strcspn(job.trace_name, ".")] = '\0';
+    }
+    else
+    {
+        snprintf(job.trace_path, sizeof(job.trace_path), "%s/%s%s",
+                 traces_dir, trace, TRACE_SUFFIX);
+        snprintf(job.trace_name, sizeof(job.trace_name), "%s", trace);
+    }
+
+    pipe_config_init(&job.config);
+    if (pipe_config_parse(options, &job.config) != 0)
+    {
+        fprintf(stderr, "Error: invalid options for job %s.%s\n", job.name,
+                job.trace_name);
+        return 2;
+    }
+
+    struct stat st;
+    job.trace_size = stat(job.trace_path, &st) == 0 ? st.st_size : 0;
+    sweep->jobs.push_back(job);
+    return 0;
+}
+
+void run_sweep(Sweep *sweep, unsigned num_threads)
+{
+    // Deal the jobs out longest-first, judging length by trace size, so that
+    // the longest ones start right away.
+    std::vector<size_t> order;
+    for (size_t i = 0; i < sweep->jobs.size(); i++)
+    {
+        order.push_back(i);
+    }
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        for (size_t j = i; j > 0 && sweep->jobs[order[j]].trace_size >
+                                        sweep->jobs[order[j - 1]].trace_size;
+             j--)
+        {
+            size_t tmp = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = tmp;
+        }
+    }
+
+    if (num_threads > sweep->jobs.size())
+    {
+        num_threads = sweep->jobs.size();
+    }
+    sweep->workers = std::vector<SweepWorker>(num_threads);
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        sweep->workers[i % num_threads].queue.push_back(order[i]);
+    }
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        sweep->workers[i].stat_num_steals = 0;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++)
+    {
+        threads.push_back(std::thread(run_worker, sweep, i));
+    }
+    run_worker(sweep, 0);
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+}
+
+/**
+ * Take the next job for a worker: the front of its own queue, or else the
+ * back of the first other queue that isn't empty.
+ *
+ * @return true if a job was taken, or false if every queue is empty
+ */
+static bool take_job(Sweep *sweep, size_t self, size_t *job)
+{
+    size_t num_workers = sweep->workers.size();
+    for (size_t k = 0; k < num_workers; k++)
+    {
+        SweepWorker *victim = &sweep->workers[(self + k) % num_workers];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (victim->queue.empty())
+        {
+            continue;
+        }
+
+        if (k == 0)
+        {
+            *job = victim->queue.front();
+            victim->queue.pop_front();
+        }
+        else
+        {
+            *job = victim->queue.back();
+            victim->queue.pop_back();
+            sweep->workers[self].stat_num_steals++;
+        }
+        return true;
+    }
+
+    // No job creates new jobs, so once every queue is empty, the sweep is
+    // done.
+    return false;
+}
+
+void run_worker(Sweep *sweep, size_t self)
+{
+    size_t job;
+    while (take_job(sweep, self, &job))
+    {
+        run_job(sweep, &sweep->jobs[job]);
+    }
+}
+
+void run_job(Sweep *sweep, SweepJob *job)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    TraceOpenMethod method;
+    TraceReader *reader = trace_reader_open(job->trace_path, sweep->cache_dir,
+                                            &method);
+    if (reader == NULL)
+    {
+        int errnum = errno;
+        std::lock_guard<std::mutex> lock(sweep->print_mutex);
+        fprintf(stderr, "Error: couldn't open trace file %s: %s\n",
+                job->trace_path, strerror(errnum));
+        job->status = 1;
+        sweep->num_done++;
+        return;
+    }
+
+    Pipeline *p = pipe_init(&job->config, reader);
+    uint64_t last_hbeat_inst = 0;
+    while (!p->halt)
+    {
+        pipe_cycle(p);
+        if (!pipe_check_progress(p, &last_hbeat_inst))
+        {
+            job->status = 1;
+            break;
+        }
+    }
+
+    // Format the statistics exactly as sim prints them.
+    PipeStats stats;
+    pipe_get_stats(p, &stats);
+    pipe_format_stats(&stats, job->stats, sizeof(job->stats));
+
+    pipe_free(p);
+    trace_reader_free(reader);
+
+    char res_path[1200];
+    snprintf(res_path, sizeof(res_path), "%s/%s.%s.res", sweep->results_dir,
+             job->name, job->trace_name);
+    FILE *res = fopen(res_path, "w");
+    if (res == NULL || fputs(job->stats, res) == EOF || fclose(res) != 0)
+    {
+        job->status = 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->seconds = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    std::lock_guard<std::mutex> lock(sweep->print_mutex);
+    sweep->num_done++;
+    printf("[%3zu/%zu] %s.%s: %.2f s%s\n", sweep->num_done,
+           sweep->jobs.size(), job->name, job->trace_name, job->seconds,
+           job->status != 0 ? " (failed)" : "");
+    fflush(stdout);
+}
+
+/**
+ * Find the line of a job's statistics that starts with the given key.
+ *
+ * @return the length of the line, including its newline, or 0 if the key
+ *         isn't there; *line is set to its start
+ */
+static size_t find_stat(const SweepJob *job, const char *key,
+                        const char **line)
+{
+    const char *found = strstr(job->stats, key);
+    if (found == NULL)
+    {
+        return 0;
+    }
+    *line = found;
+    return strcspn(found, "\n") + 1;
+}
+
+int write_report(const Sweep *sweep, const char *filename)
+{
+    FILE *report = fopen(filename, "w");
+    if (report == NULL)
+    {
+        return -1;
+    }
+
+    // Match runall.sh, which greps the .res files in name order: every CPI,
+    // then every misprediction rate.
+    std::vector<const SweepJob *> jobs;
+    for (size_t i = 0; i < sweep->jobs.size(); i++)
+    {
+        if (sweep->jobs[i].status == 0)
+        {
+            jobs.push_back(&sweep->jobs[i]);
+        }
+    }
+    for (size_t i = 1; i < jobs.size(); i++)
+    {
+        for (size_t j = i; j > 0; j--)
+        {
+            int cmp = strcmp(jobs[j - 1]->name, jobs[j]->name);
+            if (cmp == 0)
+            {
+                cmp = strcmp(jobs[j - 1]->trace_name, jobs[j]->trace_name);
+            }
+            if (cmp <= 0)
+            {
+                break;
+            }
+            const SweepJob *tmp = jobs[j];
+            jobs[j] = jobs[j - 1];
+            jobs[j - 1] = tmp;
+        }
+    }
+
+    const char *keys[] = {"LAB2_CPI", "LAB2_MISPRED_RATE"};
+    for (size_t k = 0; k < 2; k++)
+    {
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            const char *line;
+            size_t len = find_stat(jobs[i], keys[k], &line);
+            if (len > 0)
+            {
+                fprintf(report, "%s/%s.%s.res:%.*s", sweep->results_dir,
+                        jobs[i]->name, jobs[i]->trace_name, (int)len, line);
+            }
+        }
+    }
+
+    return fclose(report) == 0 ? 0 : -1;
+}
+
+int check_results(const Sweep *sweep, const char *ref_dir)
+{
+    int num_checked = 0;
+    int num_passed = 0;
+
+    for (size_t i = 0; i < sweep->jobs.size(); i++)
+    {
+        const SweepJob *job = &sweep->jobs[i];
+        char ref_path[1200];
+        snprintf(ref_path, sizeof(ref_path), "%s/%s.%s.res", ref_dir,
+                 job->name, job->trace_name);
+        FILE *file = fopen(ref_path, "r");
+        if (file == NULL)
+        {
+            continue;
+        }
+
+        char expected[sizeof(job->stats)];
+        size_t len = fread(expected, 1, sizeof(expected) - 1, file);
+        expected[len] = '\0';
+        fclose(file);
+
+        num_checked++;
+        if (job->status == 0 && strcmp(expected, job->stats) == 0)
+        {
+            num_passed++;
+            continue;
+        }
+
+        printf("Test %s.%s failed\n", job->name, job->trace_name);
+        printf("  Reference results:\n%s", expected);
+        printf("  Your results:\n%s", job->stats);
+    }
+
+    printf("Passed %d/%d tests\n", num_passed, num_checked);
+    return num_passed == num_checked ? 0 : 1;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] [<trace name> ...]\n\n",
+            program_name);
+    fprintf(stderr, "Runs the lab's A1-B2 configurations over the named traces (Default: every\n");
+    fprintf(stderr, "trace in the trace directory) on a pool of threads, writes a .res file per\n");
+    fprintf(stderr, "job and a report, and checks the results against the reference results\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -threads <n>        Run <n> jobs at once (Default: one per CPU)\n");
+    fprintf(stderr, "    -jobs <file>        Run the jobs in <file> instead, one per line, as\n");
+    fprintf(stderr, "                        \"<name> <trace> [sim options]\"\n");
+    fprintf(stderr, "    -traces <dir>       Find trace names in <dir> (Default: ../traces)\n");
+    fprintf(stderr, "    -results <dir>      Write .res files to <dir> (Default: ../results)\n");
+    fprintf(stderr, "    -report <file>      Write the report to <file> (Default: report.txt)\n");
+    fprintf(stderr, "    -ref <dir>          Check results against <dir> (Default: ../ref/results)\n");
+    fprintf(stderr, "    -noref              Don't check results\n");
+    fprintf(stderr, "    -tracecache <dir>   Cache decompressed traces in <dir> (Default: $%s,\n",
+            TRACE_CACHE_DIR_ENV);
+    fprintf(stderr, "                        or else no cache)\n");
+    fprintf(stderr, "    -notracecache       Don't use the trace cache\n");
+}
@@ -0,0 +1,564 @@
+// tage.cpp
+// Implements the TAGE branch predictor declared in tage.h.
+
+#include "tage.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+void tage_config_init(TageConfig *config)
+{
+    config->num_tables = 7;
+    config->base_entries = 8192;
+    config->table_entries = 1024;
+    config->tag_bits = 10;
+    config->min_hist = 4;
+    config->max_hist = 200;
+    config->useful_reset_period = 1u << 18;
+}
+
+/**
+ * [Internal] Check whether a table size is a power of two the predictor
+ * supports.
+ *
+ * @param entries the number of entries
+ * @return true if the size is valid
+ */
+static bool tage_entries_valid(uint32_t entries)
+{
+    return entries >= 2 && entries <= TAGE_MAX_ENTRIES &&
+           (entries & (entries - 1)) == 0;
+}
+
+bool tage_config_valid(const TageConfig *config)
+{
+    return config->num_tables >= 1 && config->num_tables <= TAGE_MAX_TABLES &&
+           tage_entries_valid(config->base_entries) &&
+           tage_entries_valid(config->table_entries) &&
+           config->tag_bits >= TAGE_MIN_TAG_BITS &&
+           config->tag_bits <= TAGE_MAX_TAG_BITS &&
+           config->min_hist >= 1 && config->min_hist <= config->max_hist &&
+           config->max_hist < TAGE_HIST_BUFFER &&
+           config->max_hist - config->min_hist + 1 >= config->num_tables &&
+           config->useful_reset_period >= 1;
+}
+
+int tage_config_load(const char *filename, TageConfig *config)
+{
+    static const struct
+    {
+        const char *name;
+        size_t offset;
+    } FIELDS[] = {
+        {"num_tables", offsetof(TageConfig, num_tables)},
+        {"base_entries", offsetof(TageConfig, base_entries)},
+        {"table_entries", offsetof(TageConfig, table_entries)},
+        {"tag_bits", offsetof(TageConfig, tag_bits)},
+        {"min_hist", offsetof(TageConfig, min_hist)},
+        {"max_hist", offsetof(TageConfig, max_hist)},
+        {"useful_reset_period", offsetof(TageConfig, useful_reset_period)},
+    };
+
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        perror("Couldn't open TAGE configuration");
+        return 2;
+    }
+
+    char line[256];
+    int line_num = 0;
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        line_num++;
+        char name[64];
+        unsigned long value;
+        int num_read = sscanf(line, " %63s %lu", name, &value);
+        if (num_read < 1 || name[0] == '#')
+        {
+            continue;
+        }
+
+        size_t f = 0;
+        while (f < sizeof(FIELDS) / sizeof(FIELDS[0]) &&
+               strcmp(name, FIELDS[f].name) != 0)
+        {
+            f++;
+        }
+        if (f == sizeof(FIELDS) / sizeof(FIELDS[0]))
+        {
+            fprintf(stderr, "Error: %s:%d: unknown field %s\n", filename,
+                    line_num, name);
+            status = 2;
+        }
+        else if (num_read < 2 || value > UINT32_MAX)
+        {
+            fprintf(stderr, "Error: %s:%d: expected a value for %s\n",
+                    filename, line_num, name);
+            status = 2;
+        }
+        else
+        {
+            *(uint32_t *)((char *)config + FIELDS[f].offset) = value;
+        }
+    }
+
+    if (status == 0 && ferror(file))
+    {
+        perror("Couldn't read TAGE configuration");
+        status = 2;
+    }
+    else if (status == 0 && !tage_config_valid(config))
+    {
+        fprintf(stderr, "Error: %s: TAGE needs 1 to %d tables of a power of "
+                        "two from 2 to %u entries, tags of %d to %d bits, and "
+                        "a distinct history of less than %d branches for "
+                        "each table\n",
+                filename, TAGE_MAX_TABLES, TAGE_MAX_ENTRIES,
+                TAGE_MIN_TAG_BITS, TAGE_MAX_TAG_BITS, TAGE_HIST_BUFFER);
+        status = 2;
+    }
+
+    fclose(file);
+    return status;
+}
+
+void tage_history_lengths(const TageConfig *config, uint32_t *hist_len)
+{
+    double ratio = (double)config->max_hist / config->min_hist;
+    for (uint32_t i = 0; i < config->num_tables; i++)
+    {
+        double exponent = config->num_tables > 1
+                              ? (double)i / (config->num_tables - 1)
+                              : 1.0;
+        hist_len[i] = (uint32_t)(config->min_hist * pow(ratio, exponent) + 0.5);
+
+        // Short series round to repeated lengths; keep each table distinct.
+        if (i > 0 && hist_len[i] <= hist_len[i - 1])
+        {
+            hist_len[i] = hist_len[i - 1] + 1;
+        }
+    }
+}
+
+/**
+ * [Internal] Get the base 2 logarithm of a power of two.
+ *
+ * @param x the power of two
+ * @return the logarithm
+ */
+static uint32_t tage_log2(uint32_t x)
+{
+    uint32_t bits = 0;
+    while ((1u << bits) < x)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * [Internal] Start a folded-history register over an empty history.
+ *
+ * @param f the register
+ * @param orig_len the length of the history, in branches
+ * @param comp_len the length of the folded history, in bits
+ */
+static void tage_fold_init(TageFoldedHist *f, uint32_t orig_len,
+                           uint32_t comp_len)
+{
+    f->comp = 0;
+    f->comp_len = comp_len;
+    f->orig_len = orig_len;
+    f->out_shift = orig_len % comp_len;
+}
+
+/**
+ * [Internal] Shift the newest outcome into a folded-history register, and the
+ * outcome that just left its history out of it.
+ *
+ * @param f the register
+ * @param in_bit the newest outcome
+ * @param out_bit the outcome orig_len branches before it
+ */
+static inline void tage_fold_update(TageFoldedHist *f, uint32_t in_bit,
+                                    uint32_t out_bit)
+{
+    f->comp = (f->comp << 1) | in_bit;
+    f->comp ^= out_bit << f->out_shift;
+    f->comp ^= f->comp >> f->comp_len;
+    f->comp &= (1u << f->comp_len) - 1;
+}
+
+Tage *tage_init(const TageConfig *config)
+{
+    Tage *t = (Tage *)calloc(1, sizeof(Tage));
+    t->config = *config;
+    tage_history_lengths(config, t->hist_len);
+
+    // Every base counter starts weakly taken, as gshare's do; the tagged
+    // entries start empty and useless.
+    t->base = (uint8_t *)malloc(config->base_entries);
+    memset(t->base, 2, config->base_entries);
+    t->entries = (TageEntry *)calloc((size_t)config->num_tables *
+                                         config->table_entries,
+                                     sizeof(TageEntry));
+
+    uint32_t index_bits = tage_log2(config->table_entries);
+    for (uint32_t i = 0; i < config->num_tables; i++)
+    {
+        tage_fold_init(&t->index_fold[i], t->hist_len[i], index_bits);
+        tage_fold_init(&t->tag_fold[i][0], t->hist_len[i], config->tag_bits);
+        tage_fold_init(&t->tag_fold[i][1], t->hist_len[i],
+                       config->tag_bits - 1);
+    }
+
+    t->rand_state = 0x2545F491;
+    return t;
+}
+
+void tage_free(Tage *t)
+{
+    if (t == NULL)
+    {
+        return;
+    }
+    free(t->base);
+    free(t->entries);
+    free(t);
+}
+
+/**
+ * [Internal] Get an entry of a tagged table.
+ *
+ * @param t the predictor
+ * @param table the table
+ * @param index the index of the entry in the table
+ * @return the entry
+ */
+static inline TageEntry *tage_entry(const Tage *t, int table, uint32_t index)
+{
+    return &t->entries[(size_t)table * t->config.table_entries + index];
+}
+
+/**
+ * [Internal] Get the index of a branch in the base table.
+ *
+ * @param t the predictor
+ * @param pc the address of the branch
+ * @return the index
+ */
+static inline uint32_t tage_base_index(const Tage *t, uint64_t pc)
+{
+    return (uint32_t)pc & (t->config.base_entries - 1);
+}
+
+bool tage_predict(Tage *t, uint64_t pc)
+{
+    const TageConfig *config = &t->config;
+    uint32_t pc32 = (uint32_t)pc;
+    uint32_t index_mask = config->table_entries - 1;
+    uint32_t index_bits = t->index_fold[0].comp_len;
+    uint32_t tag_mask = (1u << config->tag_bits) - 1;
+
+    // Hash each table's history into its index and tag, and find the two
+    // longest-history tables whose tags match.
+    t->provider = -1;
+    t->alt_provider = -1;
+    for (int i = config->num_tables - 1; i >= 0; i--)
+    {
+        uint32_t path = t->path_hist;
+        if (t->hist_len[i] < TAGE_PATH_BITS)
+        {
+            path &= (1u << t->hist_len[i]) - 1;
+        }
+        uint32_t index = (pc32 ^ (pc32 >> index_bits) ^ t->index_fold[i].comp ^
+                          path ^ (path >> index_bits)) & index_mask;
+        uint32_t tag = (pc32 ^ t->tag_fold[i][0].comp ^
+                        (t->tag_fold[i][1].comp << 1)) & tag_mask;
+        t->lookup_index[i] = index;
+        t->lookup_tag[i] = tag;
+
+        if (tage_entry(t, i, index)->tag == tag)
+        {
+            if (t->provider < 0)
+            {
+                t->provider = i;
+            }
+            else if (t->alt_provider < 0)
+            {
+                t->alt_provider = i;
+            }
+        }
+    }
+
+    bool base_pred = t->base[tage_base_index(t, pc)] >= 2;
+    t->alt_pred = t->alt_provider >= 0
+                      ? tage_entry(t, t->alt_provider,
+                                   t->lookup_index[t->alt_provider])->ctr >= 0
+                      : base_pred;
+
+    if (t->provider >= 0)
+    {
+        const TageEntry *e = tage_entry(t, t->provider,
+                                        t->lookup_index[t->provider]);
+        t->provider_pred = e->ctr >= 0;
+
+        // A weak counter in an entry that has never been useful is likely
+        // newly allocated, and the alternate prediction is often better.
+        bool newly_allocated = (e->ctr == 0 || e->ctr == -1) && e->useful == 0;
+        t->pred = newly_allocated && t->use_alt_on_na >= 0 ? t->alt_pred
+                                                           : t->provider_pred;
+    }
+    else
+    {
+        t->provider_pred = base_pred;
+        t->pred = base_pred;
+    }
+
+    t->lookup_valid = true;
+    t->lookup_pc = pc;
+    return t->pred;
+}
+
+/**
+ * [Internal] Move a signed saturating counter toward an outcome.
+ *
+ * @param ctr the counter
+ * @param taken whether the branch was taken
+ * @param min the minimum of the counter
+ * @param max the maximum of the counter
+ */
+static inline void tage_ctr_update(int8_t *ctr, bool taken, int min, int max)
+{
+    if (taken && *ctr < max)
+    {
+        (*ctr)++;
+    }
+    else if (!taken && *ctr > min)
+    {
+        (*ctr)--;
+    }
+}
+
+/**
+ * [Internal] Move a base table counter toward an outcome.
+ *
+ * @param t the predictor
+ * @param pc the address of the branch
+ * @param taken whether the branch was taken
+ */
+static inline void tage_base_update(Tage *t, uint64_t pc, bool taken)
+{
+    uint8_t *ctr = &t->base[tage_base_index(t, pc)];
+    if (taken && *ctr < 3)
+    {
+        (*ctr)++;
+    }
+    else if (!taken && *ctr > 0)
+    {
+        (*ctr)--;
+    }
+}
+
+/**
+ * [Internal] After a misprediction, allocate an entry for the branch in one
+ * table with a longer history than the provider's, or, if every candidate is
+ * still useful, age the candidates so that a later misprediction can.
+ *
+ * @param t the predictor
+ * @param taken whether the branch was taken
+ */
+static void tage_allocate(Tage *t, bool taken)
+{
+    int num_tables = t->config.num_tables;
+    int start = t->provider + 1;
+
+    // Sometimes skip the shortest candidate, so that branches which keep
+    // mispredicting spread over the longer tables instead of thrashing one.
+    t->rand_state ^= t->rand_state << 13;
+    t->rand_state ^= t->rand_state >> 17;
+    t->rand_state ^= t->rand_state << 5;
+    if ((t->rand_state & 1) != 0 && start < num_tables - 1)
+    {
+        start++;
+    }
+
+    for (int i = start; i < num_tables; i++)
+    {
+        TageEntry *e = tage_entry(t, i, t->lookup_index[i]);
+        if (e->useful == 0)
+        {
+            e->tag = t->lookup_tag[i];
+            e->ctr = taken ? 0 : -1;
+            return;
+        }
+    }
+
+    for (int i = start; i < num_tables; i++)
+    {
+        tage_entry(t, i, t->lookup_index[i])->useful--;
+    }
+}
+
+void tage_update(Tage *t, uint64_t pc, bool taken)
+{
+    if (!t->lookup_valid || t->lookup_pc != pc)
+    {
+        tage_predict(t, pc);
+    }
+    t->lookup_valid = false;
+
+    if (t->provider >= 0)
+    {
+        TageEntry *e = tage_entry(t, t->provider, t->lookup_index[t->provider]);
+        bool newly_allocated = (e->ctr == 0 || e->ctr == -1) && e->useful == 0;
+
+        // Learn whether to trust newly allocated entries.
+        if (newly_allocated && t->provider_pred != t->alt_pred)
+        {
+            if (t->alt_pred == taken && t->use_alt_on_na < 7)
+            {
+                t->use_alt_on_na++;
+            }
+            else if (t->alt_pred != taken && t->use_alt_on_na > -8)
+            {
+                t->use_alt_on_na--;
+            }
+        }
+
+        if (t->pred != taken && t->provider < (int)t->config.num_tables - 1)
+        {
+            tage_allocate(t, taken);
+        }
+
+        // A new entry hasn't learned anything yet, so keep training the
+        // prediction it falls back on as well.
+        if (newly_allocated)
+        {
+            if (t->alt_provider >= 0)
+            {
+                tage_ctr_update(&tage_entry(t, t->alt_provider,
+                                            t->lookup_index[t->alt_provider])->ctr,
+                                taken, -4, 3);
+            }
+            else
+            {
+                tage_base_update(t, pc, taken);
+            }
+        }
+        tage_ctr_update(&e->ctr, taken, -4, 3);
+
+        // An entry is useful when it is right where the alternative isn't.
+        if (t->provider_pred != t->alt_pred)
+        {
+            if (t->provider_pred == taken && e->useful < 3)
+            {
+                e->useful++;
+            }
+            else if (t->provider_pred != taken && e->useful > 0)
+            {
+                e->useful--;
+            }
+        }
+    }
+    else
+    {
+        if (t->pred != taken)
+        {
+            tage_allocate(t, taken);
+        }
+        tage_base_update(t, pc, taken);
+    }
+
+    // Age every useful counter periodically, so that entries which stopped
+    // being useful can eventually be replaced.
+    if (++t->num_updates % t->config.useful_reset_period == 0)
+    {
+        size_t num_entries = (size_t)t->config.num_tables *
+                             t->config.table_entries;
+        for (size_t i = 0; i < num_entries; i++)
+        {
+            t->entries[i].useful >>= 1;
+        }
+    }
+
+    // Shift the outcome into the global history, and every folded copy of
+    // it, and one address bit into the path history.
+    uint32_t in_bit = taken ? 1 : 0;
+    t->ghist_pos = (t->ghist_pos + 1) & (TAGE_HIST_BUFFER - 1);
+    t->ghist[t->ghist_pos] = in_bit;
+    for (uint32_t i = 0; i < t->config.num_tables; i++)
+    {
+        uint32_t out_bit =
+            t->ghist[(t->ghist_pos - t->hist_len[i]) & (TAGE_HIST_BUFFER - 1)];
+        tage_fold_update(&t->index_fold[i], in_bit, out_bit);
+        tage_fold_update(&t->tag_fold[i][0], in_bit, out_bit);
+        tage_fold_update(&t->tag_fold[i][1], in_bit, out_bit);
+    }
+    t->path_hist = ((t->path_hist << 1) | ((uint32_t)pc & 1)) &
+                   ((1u << TAGE_PATH_BITS) - 1);
+}
+
+bool tage_save(const Tage *t, FILE *file)
+{
+    size_t num_entries = (size_t)t->config.num_tables * t->config.table_entries;
+
+    return fwrite(&t->config, sizeof(t->config), 1, file) == 1 &&
+           fwrite(t->ghist, sizeof(t->ghist), 1, file) == 1 &&
+           fwrite(&t->ghist_pos, sizeof(t->ghist_pos), 1, file) == 1 &&
+           fwrite(&t->path_hist, sizeof(t->path_hist), 1, file) == 1 &&
+           fwrite(t->index_fold, sizeof(t->index_fold), 1, file) == 1 &&
+           fwrite(t->tag_fold, sizeof(t->tag_fold), 1, file) == 1 &&
+           fwrite(&t->use_alt_on_na, sizeof(t->use_alt_on_na), 1, file) == 1 &&
+           fwrite(&t->num_updates, sizeof(t->num_updates), 1, file) == 1 &&
+           fwrite(&t->rand_state, sizeof(t->rand_state), 1, file) == 1 &&
+           fwrite(t->base, 1, t->config.base_entries, file) ==
+               t->config.base_entries &&
+           fwrite(t->entries, sizeof(TageEntry), num_entries, file) ==
+               num_entries;
+}
+
+bool tage_restore(Tage *t, FILE *file)
+{
+    TageConfig saved_config;
+    if (fread(&saved_config, sizeof(saved_config), 1, file) != 1 ||
+        memcmp(&saved_config, &t->config, sizeof(saved_config)) != 0)
+    {
+        return false;
+    }
+
+    size_t num_entries = (size_t)t->config.num_tables * t->config.table_entries;
+    t->lookup_valid = false;
+    return fread(t->ghist, sizeof(t->ghist), 1, file) == 1 &&
+           fread(&t->ghist_pos, sizeof(t->ghist_pos), 1, file) == 1 &&
+           fread(&t->path_hist, sizeof(t->path_hist), 1, file) == 1 &&
+           fread(t->index_fold, sizeof(t->index_fold), 1, file) == 1 &&
+           fread(t->tag_fold, sizeof(t->tag_fold), 1, file) == 1 &&
+           fread(&t->use_alt_on_na, sizeof(t->use_alt_on_na), 1, file) == 1 &&
+           fread(&t->num_updates, sizeof(t->num_updates), 1, file) == 1 &&
+           fread(&t->rand_state, sizeof(t->rand_state), 1, file) == 1 &&
+           fread(t->base, 1, t->config.base_entries, file) ==
+               t->config.base_entries &&
+           fread(t->entries, sizeof(TageEntry), num_entries, file) ==
+               num_entries;
+}
+
+uint64_t tage_storage_bits(const Tage *t)
+{
+    // Each tagged entry has a 3-bit prediction counter, a 2-bit useful
+    // counter, and its tag; use_alt_on_na is 4 bits.
+    const TageConfig *config = &t->config;
+    return 2 * (uint64_t)config->base_entries +
+           (uint64_t)config->num_tables * config->table_entries *
+               (3 + 2 + config->tag_bits) +
+           config->max_hist + TAGE_PATH_BITS + 4;
+}
+
+size_t tage_table_bytes(const Tage *t)
+{
+    return t->config.base_entries +
+           (size_t)t->config.num_tables * t->config.table_entries *
+               sizeof(TageEntry);
+}
@@ -0,0 +1,253 @@
+// tage.h
+// Declares the TAGE branch predictor used by the BPRED_TAGE policy: a bimodal
+// base predictor backed by tagged tables indexed with geometrically increasing
+// lengths of global history, the longest-history table whose tag matches a
+// branch providing its prediction.
+//
+// Each table's index and tag hash the table's history through folded-history
+// registers, which are updated by one shift and two XORs per branch instead
+// of being recomputed from the whole history, so predicting and updating a
+// branch costs O(number of tables) however long the histories are.
+
+#ifndef _TAGE_H_
+#define _TAGE_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * The most tagged tables a TAGE predictor can have.
+ */
+#define TAGE_MAX_TABLES 16
+
+/**
+ * The size of the global history buffer, in branches; histories must be
+ * shorter than this. A power of two.
+ */
+#define TAGE_HIST_BUFFER 1024
+
+/**
+ * The most entries a TAGE base or tagged table can have.
+ */
+#define TAGE_MAX_ENTRIES (1u << 22)
+
+/**
+ * The shortest and longest tags a tagged table entry can have, in bits.
+ */
+#define TAGE_MIN_TAG_BITS 4
+#define TAGE_MAX_TAG_BITS 16
+
+/**
+ * The length of the path history, in branches: one address bit per branch.
+ */
+#define TAGE_PATH_BITS 16
+
+/**
+ * The geometry of a TAGE predictor.
+ *
+ * sim and pipe_config_parse set this from the file given with -tageconfig,
+ * which tage_config_load() reads.
+ */
+typedef struct TageConfig
+{
+    /** The number of tagged tables, from 1 to TAGE_MAX_TABLES. */
+    uint32_t num_tables;
+    /** The number of 2-bit counters in the bimodal base table. */
+    uint32_t base_entries;
+    /** The number of entries in each tagged table. */
+    uint32_t table_entries;
+    /** The length of each tagged table entry's tag, in bits. */
+    uint32_t tag_bits;
+    /** The history length of the first tagged table, in branches. */
+    uint32_t min_hist;
+    /** The history length of the last tagged table, in branches. */
+    uint32_t max_hist;
+    /** The number of branches between agings of the useful counters. */
+    uint32_t useful_reset_period;
+} TageConfig;
+
+/**
+ * An entry of a TAGE tagged table.
+ */
+typedef struct TageEntry
+{
+    /** The 3-bit signed prediction counter: taken if nonnegative. */
+    int8_t ctr;
+    /** The 2-bit useful counter; the entry may be replaced when 0. */
+    uint8_t useful;
+    /** The partial tag of the branch and history that allocated the entry. */
+    uint16_t tag;
+} TageEntry;
+
+/**
+ * [Internal] A folded-history register: a history of orig_len bits XORed
+ * down to comp_len bits, kept up to date one branch at a time.
+ */
+typedef struct TageFoldedHist
+{
+    uint32_t comp;
+    uint32_t comp_len;
+    uint32_t orig_len;
+    uint32_t out_shift;
+} TageFoldedHist;
+
+/**
+ * A TAGE branch predictor.
+ */
+typedef struct Tage
+{
+    /** The geometry of the predictor. */
+    TageConfig config;
+    /** The history length of each tagged table, in branches. */
+    uint32_t hist_len[TAGE_MAX_TABLES];
+
+    /** The base table: base_entries 2-bit counters, one per byte. */
+    uint8_t *base;
+    /** The tagged tables, table_entries entries each, one after another. */
+    TageEntry *entries;
+
+    /** The global history, one outcome per byte, as a ring buffer. */
+    uint8_t ghist[TAGE_HIST_BUFFER];
+    /** The position of the most recent outcome in ghist. */
+    uint32_t ghist_pos;
+    /** One address bit of each of the last TAGE_PATH_BITS branches. */
+    uint32_t path_hist;
+    /** Each tagged table's history, folded to its index width. */
+    TageFoldedHist index_fold[TAGE_MAX_TABLES];
+    /** Each tagged table's history, folded to its tag width and one less. */
+    TageFoldedHist tag_fold[TAGE_MAX_TABLES][2];
+
+    /** 4-bit signed counter: use the alternate prediction for new entries
+        if nonnegative. */
+    int32_t use_alt_on_na;
+    /** The number of branches updated, for aging the useful counters. */
+    uint64_t num_updates;
+    /** The state of the generator choosing which table to allocate in. */
+    uint32_t rand_state;
+
+    // The lookup of the last branch predicted, reused by its update.
+    bool lookup_valid;
+    uint64_t lookup_pc;
+    uint32_t lookup_index[TAGE_MAX_TABLES];
+    uint32_t lookup_tag[TAGE_MAX_TABLES];
+    int provider;
+    int alt_provider;
+    bool provider_pred;
+    bool alt_pred;
+    bool pred;
+} Tage;
+
+/**
+ * Set a TAGE geometry to the defaults: seven tagged tables of 1024 entries
+ * with 10-bit tags and histories from 4 to 200 branches, over an 8192-entry
+ * base table, about 15 KiB in all.
+ *
+ * @param config the geometry to initialize
+ */
+void tage_config_init(TageConfig *config);
+
+/**
+ * Check whether a TAGE geometry can be simulated.
+ *
+ * @param config the geometry to check
+ * @return true if the geometry is valid
+ */
+bool tage_config_valid(const TageConfig *config);
+
+/**
+ * Read a TAGE geometry from a file. Each line is "<field> <value>", where
+ * <field> is the name of a TageConfig field; fields not given keep their
+ * values, and blank lines and lines starting with '#' are ignored.
+ *
+ * @param filename the path of the file
+ * @param config the geometry to update
+ * @return 0 on success, or 2 if the file could not be read, had an unknown
+ *         field, or described an invalid geometry, in which case an error
+ *         message is printed
+ */
+int tage_config_load(const char *filename, TageConfig *config);
+
+/**
+ * Get the history length of each tagged table of a TAGE geometry: a
+ * geometric series from min_hist to max_hist.
+ *
+ * @param config the geometry, which must be valid
+ * @param hist_len the array to write num_tables lengths to
+ */
+void tage_history_lengths(const TageConfig *config, uint32_t *hist_len);
+
+/**
+ * Allocate and initialize a new TAGE predictor that has seen no branches.
+ *
+ * @param config the geometry of the predictor, which must be valid
+ * @return the new predictor
+ */
+Tage *tage_init(const TageConfig *config);
+
+/**
+ * Free a TAGE predictor.
+ *
+ * @param t the predictor to free
+ */
+void tage_free(Tage *t);
+
+/**
+ * Predict the direction of a branch.
+ *
+ * @param t the predictor
+ * @param pc the address of the branch
+ * @return true if the branch is predicted taken
+ */
+bool tage_predict(Tage *t, uint64_t pc);
+
+/**
+ * Train a TAGE predictor with the outcome of a branch and add it to the
+ * histories. Cheapest right after tage_predict() for the same branch, whose
+ * lookup it reuses.
+ *
+ * @param t the predictor
+ * @param pc the address of the branch
+ * @param taken whether the branch was taken
+ */
+void tage_update(Tage *t, uint64_t pc, bool taken);
+
+/**
+ * Write the geometry, histories, and tables of a TAGE predictor to a
+ * checkpoint file.
+ *
+ * @param t the predictor
+ * @param file the file to write to
+ * @return true on success, or false if the file could not be written
+ */
+bool tage_save(const Tage *t, FILE *file);
+
+/**
+ * Replace the histories and tables of a TAGE predictor with those written to
+ * a checkpoint file by tage_save().
+ *
+ * @param t the predictor
+ * @param file the file to read from
+ * @return true on success, or false if the file could not be read or was
+ *         saved by a predictor with a different geometry
+ */
+bool tage_restore(Tage *t, FILE *file);
+
+/**
+ * Get the number of bits of state the modeled hardware would need.
+ *
+ * @param t the predictor
+ * @return the storage budget in bits
+ */
+uint64_t tage_storage_bits(const Tage *t);
+
+/**
+ * Get the number of bytes the tables of a TAGE predictor take up in the
+ * simulator's memory.
+ *
+ * @param t the predictor
+ * @return the table size in bytes
+ */
+size_t tage_table_bytes(const Tage *t);
+
+#endif
@@ -0,0 +1,149 @@
+// tournament.cpp
+// Implements the tournament branch predictor components declared in
+// tournament.h.
+
+#include "tournament.h"
+#include <stdlib.h>
+#include <string.h>
+
+Tournament *tournament_init(void)
+{
+    Tournament *t = (Tournament *)calloc(1, sizeof(Tournament));
+
+    // Every counter starts weakly taken, as gshare's do, and the chooser
+    // starts weakly picking gshare.
+    memset(t->bimodal, 2, sizeof(t->bimodal));
+    memset(t->local_pht, 2, sizeof(t->local_pht));
+    memset(t->global_chooser, 2, sizeof(t->global_chooser));
+    memset(t->history_chooser, 2, sizeof(t->history_chooser));
+    return t;
+}
+
+void tournament_free(Tournament *t)
+{
+    free(t);
+}
+
+/**
+ * [Internal] Move a 2-bit counter toward an outcome.
+ *
+ * @param ctr the counter
+ * @param up whether to increment rather than decrement it
+ */
+static inline void tournament_ctr_update(uint8_t *ctr, bool up)
+{
+    if (up && *ctr < 3)
+    {
+        (*ctr)++;
+    }
+    else if (!up && *ctr > 0)
+    {
+        (*ctr)--;
+    }
+}
+
+/**
+ * [Internal] Get the local history of a branch.
+ *
+ * @param t the predictor
+ * @param pc the address of the branch
+ * @return the local history
+ */
+static inline uint16_t *tournament_local_hist(Tournament *t, uint64_t pc)
+{
+    return &t->local_hist[pc & (TOURNAMENT_LOCAL_HIST_ENTRIES - 1)];
+}
+
+bool tournament_predict(Tournament *t, uint64_t pc, bool gshare_pred)
+{
+    uint16_t local_hist = *tournament_local_hist(t, pc);
+    t->lookup_pred[TOURNAMENT_BIMODAL] =
+        t->bimodal[pc & (TOURNAMENT_BIMODAL_ENTRIES - 1)] >= 2;
+    t->lookup_pred[TOURNAMENT_LOCAL] = t->local_pht[local_hist] >= 2;
+    t->lookup_pred[TOURNAMENT_GSHARE] = gshare_pred;
+
+    // Pick between the two history-based components, and then between that
+    // and the bimodal table.
+    uint32_t index = pc & (TOURNAMENT_CHOOSER_ENTRIES - 1);
+    t->lookup_history_choice = t->global_chooser[index] >= 2
+                                   ? TOURNAMENT_GSHARE
+                                   : TOURNAMENT_LOCAL;
+    t->lookup_choice = t->history_chooser[index] >= 2
+                           ? t->lookup_history_choice
+                           : TOURNAMENT_BIMODAL;
+    return t->lookup_pred[t->lookup_choice];
+}
+
+void tournament_update(Tournament *t, uint64_t pc, bool taken)
+{
+    t->stat_chosen[t->lookup_choice]++;
+
+    for (int c = 0; c < NUM_TOURNAMENT_COMPONENTS; c++)
+    {
+        if (t->lookup_pred[c] == taken)
+        {
+            t->stat_correct[c]++;
+        }
+    }
+
+    // Teach each level of the chooser only where its two choices disagree,
+    // so that it learns which to trust rather than how predictable the
+    // branch is.
+    uint32_t index = pc & (TOURNAMENT_CHOOSER_ENTRIES - 1);
+    const bool *pred = t->lookup_pred;
+    if (pred[TOURNAMENT_GSHARE] != pred[TOURNAMENT_LOCAL])
+    {
+        tournament_ctr_update(&t->global_chooser[index],
+                              pred[TOURNAMENT_GSHARE] == taken);
+    }
+    if (pred[t->lookup_history_choice] != pred[TOURNAMENT_BIMODAL])
+    {
+        tournament_ctr_update(&t->history_chooser[index],
+                              pred[t->lookup_history_choice] == taken);
+    }
+
+    uint16_t *local_hist = tournament_local_hist(t, pc);
+    tournament_ctr_update(&t->bimodal[pc & (TOURNAMENT_BIMODAL_ENTRIES - 1)],
+                          taken);
+    tournament_ctr_update(&t->local_pht[*local_hist], taken);
+    *local_hist = ((*local_hist << 1) | (taken ? 1 : 0)) &
+                  ((1 << TOURNAMENT_LOCAL_HIST_BITS) - 1);
+}
+
+bool tournament_save(const Tournament *t, FILE *file)
+{
+    return fwrite(t->bimodal, sizeof(t->bimodal), 1, file) == 1 &&
+           fwrite(t->local_hist, sizeof(t->local_hist), 1, file) == 1 &&
+           fwrite(t->local_pht, sizeof(t->local_pht), 1, file) == 1 &&
+           fwrite(t->global_chooser, sizeof(t->global_chooser), 1, file) == 1 &&
+           fwrite(t->history_chooser, sizeof(t->history_chooser), 1, file) == 1 &&
+           fwrite(t->stat_correct, sizeof(t->stat_correct), 1, file) == 1 &&
+           fwrite(t->stat_chosen, sizeof(t->stat_chosen), 1, file) == 1;
+}
+
+bool tournament_restore(Tournament *t, FILE *file)
+{
+    return fread(t->bimodal, sizeof(t->bimodal), 1, file) == 1 &&
+           fread(t->local_hist, sizeof(t->local_hist), 1, file) == 1 &&
+           fread(t->local_pht, sizeof(t->local_pht), 1, file) == 1 &&
+           fread(t->global_chooser, sizeof(t->global_chooser), 1, file) == 1 &&
+           fread(t->history_chooser, sizeof(t->history_chooser), 1, file) == 1 &&
+           fread(t->stat_correct, sizeof(t->stat_correct), 1, file) == 1 &&
+           fread(t->stat_chosen, sizeof(t->stat_chosen), 1, file) == 1;
+}
+
+uint64_t tournament_storage_bits(TournamentComponent component)
+{
+    switch (component)
+    {
+    case TOURNAMENT_BIMODAL:
+        return 2 * TOURNAMENT_BIMODAL_ENTRIES;
+    case TOURNAMENT_LOCAL:
+        return TOURNAMENT_LOCAL_HIST_BITS * TOURNAMENT_LOCAL_HIST_ENTRIES +
+               2 * (1 << TOURNAMENT_LOCAL_HIST_BITS);
+    case TOURNAMENT_GSHARE:
+        return 0;
+    default:
+        return 2 * 2 * TOURNAMENT_CHOOSER_ENTRIES;
+    }
+}
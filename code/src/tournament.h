@@ -0,0 +1,144 @@
+// tournament.h
+// Declares the components of the tournament branch predictor used by the
+// BPRED_TOURNAMENT policy: a per-address bimodal table, a two-level
+// local-history predictor, and a chooser that picks between them and the
+// branch predictor's own gshare tables for each branch.
+
+#ifndef _TOURNAMENT_H_
+#define _TOURNAMENT_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * The number of 2-bit counters in the bimodal table, indexed by address.
+ */
+#define TOURNAMENT_BIMODAL_ENTRIES 4096
+
+/**
+ * The number of local histories, indexed by address.
+ */
+#define TOURNAMENT_LOCAL_HIST_ENTRIES 1024
+
+/**
+ * The length of each local history, in branches. The local pattern history
+ * table has a 2-bit counter for each history.
+ */
+#define TOURNAMENT_LOCAL_HIST_BITS 10
+
+/**
+ * The number of chooser entries, indexed by address.
+ */
+#define TOURNAMENT_CHOOSER_ENTRIES 4096
+
+/**
+ * The components a tournament predictor chooses between.
+ */
+typedef enum TournamentComponentEnum
+{
+    TOURNAMENT_BIMODAL, // The per-address bimodal table.
+    TOURNAMENT_LOCAL,   // The two-level local-history predictor.
+    TOURNAMENT_GSHARE,  // The branch predictor's gshare tables.
+    NUM_TOURNAMENT_COMPONENTS
+} TournamentComponent;
+
+/**
+ * The tables, choices, and statistics of a tournament predictor, apart from
+ * the gshare tables, which the branch predictor keeps itself.
+ */
+typedef struct Tournament
+{
+    /** The bimodal table: 2-bit counters. */
+    uint8_t bimodal[TOURNAMENT_BIMODAL_ENTRIES];
+    /** The local histories, most recent outcome in the low bit. */
+    uint16_t local_hist[TOURNAMENT_LOCAL_HIST_ENTRIES];
+    /** The local pattern history table: 2-bit counters. */
+    uint8_t local_pht[1 << TOURNAMENT_LOCAL_HIST_BITS];
+    /** The first level of the chooser: 2-bit counters picking gshare if at
+        least 2, or else the local predictor. */
+    uint8_t global_chooser[TOURNAMENT_CHOOSER_ENTRIES];
+    /** The second level of the chooser: 2-bit counters picking the first
+        level's pick if at least 2, or else the bimodal table. */
+    uint8_t history_chooser[TOURNAMENT_CHOOSER_ENTRIES];
+
+    /** The number of branches each component predicted correctly. */
+    uint64_t stat_correct[NUM_TOURNAMENT_COMPONENTS];
+    /** The number of branches the chooser picked each component for. */
+    uint64_t stat_chosen[NUM_TOURNAMENT_COMPONENTS];
+
+    // The lookup of the last branch predicted, reused by its update.
+    bool lookup_pred[NUM_TOURNAMENT_COMPONENTS];
+    TournamentComponent lookup_history_choice;
+    TournamentComponent lookup_choice;
+} Tournament;
+
+/**
+ * Allocate and initialize a new tournament predictor that has seen no
+ * branches.
+ *
+ * @return the new predictor
+ */
+Tournament *tournament_init(void);
+
+/**
+ * Free a tournament predictor.
+ *
+ * @param t the predictor to free
+ */
+void tournament_free(Tournament *t);
+
+/**
+ * Predict the direction of a branch with each component, and pick one.
+ *
+ * @param t the predictor
+ * @param pc the address of the branch
+ * @param gshare_pred the gshare tables' prediction: true if taken
+ * @return the chosen component's prediction: true if taken
+ */
+bool tournament_predict(Tournament *t, uint64_t pc, bool gshare_pred);
+
+/**
+ * Train the bimodal, local, and chooser tables with the outcome of a branch,
+ * and count how each component did. Must follow tournament_predict() for the
+ * same branch; the gshare tables are trained by the caller.
+ *
+ * @param t the predictor
+ * @param pc the address of the branch
+ * @param taken whether the branch was taken
+ */
+void tournament_update(Tournament *t, uint64_t pc, bool taken);
+
+/**
+ * Write the tables and statistics of a tournament predictor to a checkpoint
+ * file.
+ *
+ * @param t the predictor
+ * @param file the file to write to
+ * @return true on success, or false if the file could not be written
+ */
+bool tournament_save(const Tournament *t, FILE *file);
+
+/**
+ * Replace the tables and statistics of a tournament predictor with those
+ * written to a checkpoint file by tournament_save().
+ *
+ * @param t the predictor
+ * @param file the file to read from
+ * @return true on success, or false if the file could not be read
+ */
+bool tournament_restore(Tournament *t, FILE *file);
+
+/**
+ * Get the number of bits of state the modeled hardware would need for one
+ * component, or for the chooser.
+ *
+ * @param component the component, or NUM_TOURNAMENT_COMPONENTS for the
+ *        chooser
+ * @return the storage budget in bits, or 0 for TOURNAMENT_GSHARE, whose
+ *         tables the branch predictor holds and counts; see
+ *         BPred::component_storage_bits()
+ */
+uint64_t tournament_storage_bits(TournamentComponent component);
+
+#endif
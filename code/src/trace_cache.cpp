@@ -0,0 +1,255 @@
+// trace_cache.cpp
+// Implements the trace cache.
+
+#include "trace_cache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/** The size of the buffer used to hash and decompress traces, in bytes. */
+#define TRACE_CACHE_IO_SIZE (1 << 20)
+
+/**
+ * Compute the CRC-32 and size of a file's contents.
+ *
+ * @param filename the path of the file
+ * @param crc set to the CRC-32 of the file
+ * @param size set to the size of the file, in bytes
+ * @return 0 on success, or -1 if the file could not be read
+ */
+static int trace_cache_hash_file(const char *filename, uint32_t *crc,
+                                 uint64_t *size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    uint8_t *buf = (uint8_t *)malloc(TRACE_CACHE_IO_SIZE);
+    if (buf == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    uLong running_crc = crc32(0L, Z_NULL, 0);
+    uint64_t total = 0;
+    int status = 0;
+    for (;;)
+    {
+        ssize_t n = read(fd, buf, TRACE_CACHE_IO_SIZE);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            status = -1;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        running_crc = crc32(running_crc, buf, (uInt)n);
+        total += n;
+    }
+
+    free(buf);
+    close(fd);
+    *crc = (uint32_t)running_crc;
+    *size = total;
+    return status;
+}
+
+/**
+ * Write all of a buffer to a file descriptor.
+ *
+ * @return 0 on success, or -1 on error
+ */
+static int trace_cache_write_all(int fd, const void *buf, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    while (n > 0)
+    {
+        ssize_t written = write(fd, p, n);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += written;
+        n -= written;
+    }
+    return 0;
+}
+
+/**
+ * Check whether a cache file is complete and was built from the trace with
+ * the given hash on a machine with the same TraceRec layout.
+ *
+ * @return true if the cache file can be used
+ */
+static bool trace_cache_is_fresh(const char *cache_path, uint32_t crc,
+                                 uint64_t size)
+{
+    int fd = open(cache_path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    TraceCacheHeader header;
+    struct stat st;
+    bool fresh = read(fd, &header, sizeof(header)) == sizeof(header) &&
+                 fstat(fd, &st) == 0 &&
+                 memcmp(header.magic, TRACE_CACHE_MAGIC,
+                        sizeof(header.magic)) == 0 &&
+                 header.rec_size == sizeof(TraceRec) &&
+                 header.src_crc == crc && header.src_size == size &&
+                 (uint64_t)st.st_size == sizeof(header) + header.data_size;
+    close(fd);
+    return fresh;
+}
+
+/**
+ * Decompress a trace into a new cache file. The file is written under a
+ * temporary name and renamed into place only once it is complete, so that
+ * concurrent runs never see a partial cache file.
+ *
+ * @return 0 on success, or -1 on error
+ */
+static int trace_cache_build(const char *filename, const char *cache_path,
+                             uint32_t crc, uint64_t size)
+{
+    size_t tmp_len = strlen(cache_path) + sizeof(".XXXXXX");
+    char *tmp_path = (char *)malloc(tmp_len);
+    uint8_t *buf = (uint8_t *)malloc(TRACE_CACHE_IO_SIZE);
+    gzFile gz = gzopen(filename, "rb");
+    if (tmp_path == NULL || buf == NULL || gz == NULL)
+    {
+        free(tmp_path);
+        free(buf);
+        if (gz != NULL)
+        {
+            gzclose(gz);
+        }
+        return -1;
+    }
+    gzbuffer(gz, TRACE_READER_GZ_BUF_SIZE);
+
+    snprintf(tmp_path, tmp_len, "%s.XXXXXX", cache_path);
+    int fd = mkstemp(tmp_path);
+    int status = fd < 0 ? -1 : 0;
+    if (status == 0)
+    {
+        // mkstemp() creates the file private; let other users share it.
+        fchmod(fd, 0644);
+    }
+
+    TraceCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_CACHE_MAGIC, sizeof(header.magic));
+    header.rec_size = sizeof(TraceRec);
+    header.src_crc = crc;
+    header.src_size = size;
+
+    // Leave room for the header, and fill it in once the data size is known.
+    if (status == 0)
+    {
+        status = trace_cache_write_all(fd, &header, sizeof(header));
+    }
+    while (status == 0)
+    {
+        int n = gzread(gz, buf, TRACE_CACHE_IO_SIZE);
+        if (n < 0)
+        {
+            status = -1;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        status = trace_cache_write_all(fd, buf, n);
+        header.data_size += n;
+    }
+    if (status == 0 && lseek(fd, 0, SEEK_SET) == 0)
+    {
+        status = trace_cache_write_all(fd, &header, sizeof(header));
+    }
+    if (fd >= 0 && close(fd) != 0)
+    {
+        status = -1;
+    }
+    if (status == 0)
+    {
+        status = rename(tmp_path, cache_path);
+    }
+    if (status != 0 && fd >= 0)
+    {
+        unlink(tmp_path);
+    }
+
+    gzclose(gz);
+    free(buf);
+    free(tmp_path);
+    return status;
+}
+
+TraceReader *trace_cache_open(const char *filename, const char *cache_dir,
+                              bool *hit)
+{
+    *hit = false;
+
+    uint32_t crc;
+    uint64_t size;
+    if (trace_cache_hash_file(filename, &crc, &size) != 0)
+    {
+        return NULL;
+    }
+
+    if (mkdir(cache_dir, 0777) != 0 && errno != EEXIST)
+    {
+        return NULL;
+    }
+
+    // Name the cache file after the trace, for humans, and its hash.
+    const char *base = strrchr(filename, '/');
+    base = base == NULL ? filename : base + 1;
+    size_t base_len = strlen(base);
+    if (base_len > 3 && strcmp(base + base_len - 3, ".gz") == 0)
+    {
+        base_len -= 3;
+    }
+
+    size_t path_len = strlen(cache_dir) + base_len + 64;
+    char *cache_path = (char *)malloc(path_len);
+    if (cache_path == NULL)
+    {
+        return NULL;
+    }
+    snprintf(cache_path, path_len, "%s/%.*s-%08x-%llx.trc", cache_dir,
+             (int)base_len, base, (unsigned)crc, (unsigned long long)size);
+
+    *hit = trace_cache_is_fresh(cache_path, crc, size);
+    if (!*hit && trace_cache_build(filename, cache_path, crc, size) != 0)
+    {
+        free(cache_path);
+        return NULL;
+    }
+
+    TraceReader *r = trace_reader_open_mmap(cache_path,
+                                            sizeof(TraceCacheHeader));
+    free(cache_path);
+    return r;
+}
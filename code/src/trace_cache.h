@@ -0,0 +1,59 @@
+// trace_cache.h
+// Declares the trace cache, which decompresses each gzip trace once into a
+// file of raw trace records under a cache directory, keyed by a hash of the
+// compressed file's contents, so that later runs can memory-map it instead of
+// decompressing it again.
+
+#ifndef _TRACE_CACHE_H_
+#define _TRACE_CACHE_H_
+
+#include "trace_reader.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+/**
+ * The environment variable naming the default cache directory.
+ */
+#define TRACE_CACHE_DIR_ENV "TRACE_CACHE_DIR"
+
+/**
+ * The magic bytes at the start of every cache file.
+ */
+#define TRACE_CACHE_MAGIC "LAB2TRC1"
+
+/**
+ * The header at the start of every cache file. The raw trace records follow
+ * it, starting at offset sizeof(TraceCacheHeader).
+ */
+typedef struct TraceCacheHeader
+{
+    /** TRACE_CACHE_MAGIC, without the terminating NUL. */
+    char magic[8];
+    /** sizeof(TraceRec) on the machine that wrote the file. */
+    uint32_t rec_size;
+    /** The CRC-32 of the compressed trace file the cache was built from. */
+    uint32_t src_crc;
+    /** The size of the compressed trace file the cache was built from. */
+    uint64_t src_size;
+    /** The number of bytes of raw trace data following the header. */
+    uint64_t data_size;
+    /** Padding to keep the trace records aligned. */
+    uint8_t reserved[TRACE_READER_BUF_ALIGN - 32];
+} TraceCacheHeader;
+
+/**
+ * Open a trace through the cache: if the cache directory holds a complete
+ * copy of the trace, map it; otherwise decompress the trace into the cache
+ * first and then map it.
+ *
+ * @param filename the path of the gzip-compressed trace file
+ * @param cache_dir the cache directory, which is created if it does not exist
+ * @param hit set to true if a fresh cached copy already existed
+ * @return a pointer to a newly allocated TRACE_SOURCE_MMAP reader, or NULL if
+ *         the trace could not be cached, in which case the caller should fall
+ *         back to reading it directly
+ */
+TraceReader *trace_cache_open(const char *filename, const char *cache_dir,
+                              bool *hit);
+
+#endif
@@ -0,0 +1,252 @@
+// trace_fanout.cpp
+// Implements the trace fan-out.
+
+#include "trace_fanout.h"
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * One batch in the fan-out ring.
+ */
+typedef struct TraceFanoutSlot
+{
+    /** The raw trace data in this batch. */
+    uint8_t *data;
+    /** The number of valid bytes in data. */
+    size_t len;
+    /**
+     * Whether this is the last batch of the trace. If so, the trace ended
+     * inside it, either cleanly, with a partial record, or on a failed read.
+     */
+    bool last;
+} TraceFanoutSlot;
+
+/**
+ * A fan-out ring shared by several consumer readers.
+ *
+ * Batch b lives in slot (b % depth). Each consumer records the oldest batch
+ * it still needs; batch b may be read into its slot only once every attached
+ * consumer needs batch b - depth + 1 or later. Unlike the prefetch ring,
+ * there are several consumers, so the ring is guarded by a mutex.
+ */
+struct TraceFanout
+{
+    /** The reader batches are read from. */
+    TraceReader *src;
+
+    /** The ring of batches. */
+    TraceFanoutSlot *slots;
+    /** The backing memory for all slots' data. */
+    uint8_t *slot_mem;
+    /** The number of slots in the ring. */
+    size_t depth;
+    /** The capacity of each slot, in bytes. */
+    size_t slot_size;
+
+    /** Guards all of the fields below. */
+    std::mutex mutex;
+    /** Signaled whenever a consumer moves on or a batch is read. */
+    std::condition_variable cond;
+    /** The number of batches read from the source so far. */
+    uint64_t num_batches;
+    /** Whether the last batch has been read. */
+    bool done;
+    /** The number of consumers. */
+    size_t num_consumers;
+    /**
+     * For each consumer, the oldest batch it still needs, or UINT64_MAX once
+     * it has detached.
+     */
+    uint64_t *needed;
+    /** The number of consumers that have not been freed. */
+    size_t num_live;
+    /** The number of times a consumer waited for a slower one. */
+    uint64_t stat_num_waits;
+};
+
+/**
+ * Get the oldest batch any attached consumer still needs.
+ *
+ * @param fo the fan-out, whose mutex must be held
+ * @return the oldest batch needed, or UINT64_MAX if every consumer detached
+ */
+static uint64_t trace_fanout_min_needed(const TraceFanout *fo)
+{
+    uint64_t min_needed = UINT64_MAX;
+    for (size_t i = 0; i < fo->num_consumers; i++)
+    {
+        if (fo->needed[i] < min_needed)
+        {
+            min_needed = fo->needed[i];
+        }
+    }
+    return min_needed;
+}
+
+int trace_reader_start_fanout(TraceReader *src, size_t num_consumers,
+                              size_t depth, TraceReader **consumers)
+{
+    if (depth < 2)
+    {
+        depth = 2;
+    }
+
+    TraceFanout *fo = new (std::nothrow) TraceFanout();
+    if (fo == NULL)
+    {
+        return -1;
+    }
+
+    fo->src = src;
+    fo->num_consumers = num_consumers;
+    fo->depth = depth;
+    fo->slot_size = TRACE_FANOUT_BATCH_RECORDS * sizeof(TraceRec);
+    fo->slots = (TraceFanoutSlot *)calloc(depth, sizeof(TraceFanoutSlot));
+    fo->needed = (uint64_t *)calloc(num_consumers, sizeof(uint64_t));
+    void *slot_mem = NULL;
+    if (fo->slots == NULL || fo->needed == NULL ||
+        posix_memalign(&slot_mem, TRACE_READER_BUF_ALIGN,
+                       depth * fo->slot_size) != 0)
+    {
+        free(fo->needed);
+        free(fo->slots);
+        delete fo;
+        return -1;
+    }
+    fo->slot_mem = (uint8_t *)slot_mem;
+    for (size_t i = 0; i < depth; i++)
+    {
+        fo->slots[i].data = fo->slot_mem + i * fo->slot_size;
+    }
+
+    for (size_t i = 0; i < num_consumers; i++)
+    {
+        TraceReader *r = (TraceReader *)calloc(1, sizeof(TraceReader));
+        if (r == NULL)
+        {
+            // The caller still owns the source on failure.
+            while (i > 0)
+            {
+                free(consumers[--i]);
+            }
+            free(fo->slot_mem);
+            free(fo->slots);
+            free(fo->needed);
+            delete fo;
+            return -1;
+        }
+
+        r->source = TRACE_SOURCE_FANOUT;
+        r->fd = -1;
+        r->src = src;
+        r->fanout = fo;
+        r->fanout_index = i;
+        r->buf_size = fo->slot_size;
+        r->record_limit = UINT64_MAX;
+        consumers[i] = r;
+        fo->num_live++;
+    }
+
+    return 0;
+}
+
+void trace_fanout_refill(TraceReader *r)
+{
+    TraceFanout *fo = r->fanout;
+
+    // A partial record is only ever left over at the very end of the trace,
+    // since every batch but the last holds a whole number of records.
+    if (r->eof || r->error != 0)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(fo->mutex);
+
+    // Release the batch we just finished.
+    uint64_t batch = r->stat_num_reads;
+    fo->needed[r->fanout_index] = batch;
+    fo->cond.notify_all();
+
+    while (batch >= fo->num_batches && !fo->done)
+    {
+        // Read the next batch if no consumer still needs the batch it would
+        // replace; otherwise wait for the slowest consumer to move on.
+        uint64_t min_needed = trace_fanout_min_needed(fo);
+        if (fo->num_batches - min_needed < fo->depth)
+        {
+            TraceFanoutSlot *slot = &fo->slots[fo->num_batches % fo->depth];
+            slot->len = trace_reader_read_bytes(fo->src, slot->data,
+                                                fo->slot_size);
+            slot->last = slot->len < fo->slot_size;
+            fo->done = slot->last;
+            fo->num_batches++;
+            fo->cond.notify_all();
+        }
+        else
+        {
+            fo->stat_num_waits++;
+            fo->cond.wait(lock);
+        }
+    }
+
+    if (batch >= fo->num_batches)
+    {
+        // The last batch was already consumed.
+        r->eof = true;
+        return;
+    }
+
+    TraceFanoutSlot *slot = &fo->slots[batch % fo->depth];
+    r->buf = slot->data;
+    r->buf_pos = 0;
+    r->buf_len = slot->len;
+    r->stat_num_reads++;
+
+    if (slot->last)
+    {
+        r->error = fo->src->error;
+        r->eof = r->error == 0;
+    }
+}
+
+void trace_fanout_detach(TraceReader *r)
+{
+    TraceFanout *fo = r->fanout;
+    std::lock_guard<std::mutex> lock(fo->mutex);
+    fo->needed[r->fanout_index] = UINT64_MAX;
+    fo->cond.notify_all();
+}
+
+void trace_fanout_free(TraceReader *r)
+{
+    TraceFanout *fo = r->fanout;
+    trace_fanout_detach(r);
+    free(r);
+
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(fo->mutex);
+        last = --fo->num_live == 0;
+    }
+    if (!last)
+    {
+        return;
+    }
+
+    trace_reader_free(fo->src);
+    free(fo->slot_mem);
+    free(fo->slots);
+    free(fo->needed);
+    delete fo;
+}
+
+uint64_t trace_fanout_num_waits(const TraceReader *r)
+{
+    TraceFanout *fo = r->fanout;
+    std::lock_guard<std::mutex> lock(fo->mutex);
+    return fo->stat_num_waits;
+}
@@ -0,0 +1,82 @@
+// trace_fanout.h
+// Declares the trace fan-out, which decodes a trace once and hands the same
+// batches of trace records to several consumer readers, so that several
+// pipelines can be simulated over a single pass of the trace.
+
+#ifndef _TRACE_FANOUT_H_
+#define _TRACE_FANOUT_H_
+
+#include "trace_reader.h"
+#include <stddef.h>
+
+/**
+ * The default number of batches in the fan-out ring.
+ */
+#define TRACE_FANOUT_DEFAULT_DEPTH 4
+
+/**
+ * The number of trace records in each batch of the fan-out ring.
+ */
+#define TRACE_FANOUT_BATCH_RECORDS 4096
+
+/**
+ * Allocate num_consumers TRACE_SOURCE_FANOUT readers that all read the same
+ * records from src, which is read only once.
+ *
+ * Batches are read from src into a ring of depth slots by whichever consumer
+ * first needs them. A slot is reused only once every consumer has finished
+ * with the batch in it, so a consumer that runs more than depth - 1 batches
+ * ahead of the slowest one waits for it. Consumers may run on separate
+ * threads, one thread per consumer. On a single thread, always advancing the
+ * consumer with the fewest batches read (stat_num_reads) never waits.
+ *
+ * The consumers share ownership of src; src must not be used directly
+ * afterwards, and is freed along with the last consumer.
+ *
+ * @param src the reader to fan out
+ * @param num_consumers the number of consumer readers to allocate
+ * @param depth the number of batches in the ring (at least 2)
+ * @param consumers set to the newly allocated consumer readers
+ * @return 0 on success, or -1 if the ring could not be allocated
+ */
+int trace_reader_start_fanout(TraceReader *src, size_t num_consumers,
+                              size_t depth, TraceReader **consumers);
+
+/**
+ * Tell the fan-out that a consumer will read no more records, so that the
+ * other consumers need not wait for it. The consumer must still be freed
+ * with trace_reader_free().
+ *
+ * @param r a TRACE_SOURCE_FANOUT reader
+ */
+void trace_fanout_detach(TraceReader *r);
+
+/**
+ * [Internal] Release the batch a TRACE_SOURCE_FANOUT reader has consumed and
+ * point its buffer at the next batch, reading it from the source or waiting
+ * for slower consumers as needed. Called by the trace reader when its buffer
+ * runs dry.
+ *
+ * @param r the TRACE_SOURCE_FANOUT reader to refill
+ */
+void trace_fanout_refill(TraceReader *r);
+
+/**
+ * [Internal] Detach and free a TRACE_SOURCE_FANOUT reader, freeing the ring
+ * and the source reader along with the last consumer. Called by
+ * trace_reader_free().
+ *
+ * @param r the TRACE_SOURCE_FANOUT reader to free
+ */
+void trace_fanout_free(TraceReader *r);
+
+/**
+ * Get the number of times consumers had to wait for a slower consumer to
+ * free a slot in the ring.
+ *
+ * @param r a TRACE_SOURCE_FANOUT reader
+ * @return the number of waits, over all consumers
+ */
+uint64_t trace_fanout_num_waits(const TraceReader *r);
+
+#endif
@@ -0,0 +1,433 @@
+// trace_packed.cpp
+// Implements the packed trace format.
+
+#include "trace_packed.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/** Bits of byte 0 of an encoded record. */
+#define PK_OP_MASK      0x07
+#define PK_DEST_NEEDED  0x08
+#define PK_SRC1_NEEDED  0x10
+#define PK_SRC2_NEEDED  0x20
+#define PK_CC_READ      0x40
+#define PK_CC_WRITE     0x80
+
+/** Bits of byte 1 of an encoded record. */
+#define PK_MEM_WRITE    0x01
+#define PK_MEM_READ     0x02
+#define PK_BR_DIR       0x04
+#define PK_DEST_STORED  0x08
+#define PK_SRC1_STORED  0x10
+#define PK_SRC2_STORED  0x20
+#define PK_HAS_MEM_ADDR 0x40
+#define PK_HAS_BR_TGT   0x80
+
+/**
+ * Whether a record can be encoded without escaping it.
+ */
+static inline bool trace_packed_fits(const TraceRec *rec)
+{
+    return rec->op_type < TRACE_PACKED_ESCAPE &&
+           (rec->dest_needed | rec->src1_needed | rec->src2_needed |
+            rec->cc_read | rec->cc_write | rec->mem_write | rec->mem_read |
+            rec->br_dir) <= 1;
+}
+
+size_t trace_packed_encode_block(const TraceRec *recs, size_t n, uint8_t *out)
+{
+    uint8_t *start = out;
+    uint64_t prev_inst_addr = 0;
+    uint64_t prev_mem_addr = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const TraceRec *rec = &recs[i];
+
+        if (!trace_packed_fits(rec))
+        {
+            *out++ = TRACE_PACKED_ESCAPE;
+            memcpy(out, rec, sizeof(TraceRec));
+            out += sizeof(TraceRec);
+            continue;
+        }
+
+        uint8_t b0 = rec->op_type;
+        b0 |= rec->dest_needed ? PK_DEST_NEEDED : 0;
+        b0 |= rec->src1_needed ? PK_SRC1_NEEDED : 0;
+        b0 |= rec->src2_needed ? PK_SRC2_NEEDED : 0;
+        b0 |= rec->cc_read ? PK_CC_READ : 0;
+        b0 |= rec->cc_write ? PK_CC_WRITE : 0;
+
+        uint8_t b1 = 0;
+        b1 |= rec->mem_write ? PK_MEM_WRITE : 0;
+        b1 |= rec->mem_read ? PK_MEM_READ : 0;
+        b1 |= rec->br_dir ? PK_BR_DIR : 0;
+        b1 |= rec->dest_reg != TRACE_PACKED_NO_REG ? PK_DEST_STORED : 0;
+        b1 |= rec->src1_reg != TRACE_PACKED_NO_REG ? PK_SRC1_STORED : 0;
+        b1 |= rec->src2_reg != TRACE_PACKED_NO_REG ? PK_SRC2_STORED : 0;
+        b1 |= rec->mem_addr != 0 ? PK_HAS_MEM_ADDR : 0;
+        b1 |= rec->br_target != 0 ? PK_HAS_BR_TGT : 0;
+
+        *out++ = b0;
+        *out++ = b1;
+        out = varint_put(out, zigzag_encode(
+                                  (int64_t)(rec->inst_addr - prev_inst_addr)));
+        prev_inst_addr = rec->inst_addr;
+
+        if (b1 & PK_DEST_STORED)
+        {
+            *out++ = rec->dest_reg;
+        }
+        if (b1 & PK_SRC1_STORED)
+        {
+            *out++ = rec->src1_reg;
+        }
+        if (b1 & PK_SRC2_STORED)
+        {
+            *out++ = rec->src2_reg;
+        }
+        if (b1 & PK_HAS_MEM_ADDR)
+        {
+            out = varint_put(out, zigzag_encode(
+                                      (int64_t)(rec->mem_addr - prev_mem_addr)));
+            prev_mem_addr = rec->mem_addr;
+        }
+        if (b1 & PK_HAS_BR_TGT)
+        {
+            out = varint_put(out, zigzag_encode(
+                                      (int64_t)(rec->br_target - rec->inst_addr)));
+        }
+    }
+
+    return out - start;
+}
+
+int trace_packed_decode_block(const uint8_t *payload, size_t payload_size,
+                              size_t n, TraceRec *out)
+{
+    const uint8_t *in = payload;
+    const uint8_t *end = payload + payload_size;
+    uint64_t prev_inst_addr = 0;
+    uint64_t prev_mem_addr = 0;
+    uint64_t v;
+
+    memset(out, 0, n * sizeof(TraceRec));
+    for (size_t i = 0; i < n; i++)
+    {
+        TraceRec *rec = &out[i];
+
+        if (in >= end)
+        {
+            return -1;
+        }
+        uint8_t b0 = *in++;
+        if (b0 == TRACE_PACKED_ESCAPE)
+        {
+            if ((size_t)(end - in) < sizeof(TraceRec))
+            {
+                return -1;
+            }
+            memcpy(rec, in, sizeof(TraceRec));
+            in += sizeof(TraceRec);
+            continue;
+        }
+
+        if (in >= end)
+        {
+            return -1;
+        }
+        uint8_t b1 = *in++;
+
+        rec->op_type = b0 & PK_OP_MASK;
+        rec->dest_needed = (b0 & PK_DEST_NEEDED) != 0;
+        rec->src1_needed = (b0 & PK_SRC1_NEEDED) != 0;
+        rec->src2_needed = (b0 & PK_SRC2_NEEDED) != 0;
+        rec->cc_read = (b0 & PK_CC_READ) != 0;
+        rec->cc_write = (b0 & PK_CC_WRITE) != 0;
+        rec->mem_write = (b1 & PK_MEM_WRITE) != 0;
+        rec->mem_read = (b1 & PK_MEM_READ) != 0;
+        rec->br_dir = (b1 & PK_BR_DIR) != 0;
+
+        if ((in = varint_get(in, end, &v)) == NULL)
+        {
+            return -1;
+        }
+        rec->inst_addr = prev_inst_addr + zigzag_decode(v);
+        prev_inst_addr = rec->inst_addr;
+
+        // The register bytes, if any, are all in one place.
+        size_t num_regs = ((b1 & PK_DEST_STORED) != 0) +
+                          ((b1 & PK_SRC1_STORED) != 0) +
+                          ((b1 & PK_SRC2_STORED) != 0);
+        if ((size_t)(end - in) < num_regs)
+        {
+            return -1;
+        }
+        rec->dest_reg = (b1 & PK_DEST_STORED) ? *in++ : TRACE_PACKED_NO_REG;
+        rec->src1_reg = (b1 & PK_SRC1_STORED) ? *in++ : TRACE_PACKED_NO_REG;
+        rec->src2_reg = (b1 & PK_SRC2_STORED) ? *in++ : TRACE_PACKED_NO_REG;
+
+        if (b1 & PK_HAS_MEM_ADDR)
+        {
+            if ((in = varint_get(in, end, &v)) == NULL)
+            {
+                return -1;
+            }
+            rec->mem_addr = prev_mem_addr + zigzag_decode(v);
+            prev_mem_addr = rec->mem_addr;
+        }
+        if (b1 & PK_HAS_BR_TGT)
+        {
+            if ((in = varint_get(in, end, &v)) == NULL)
+            {
+                return -1;
+            }
+            rec->br_target = rec->inst_addr + zigzag_decode(v);
+        }
+    }
+
+    return in == end ? 0 : -1;
+}
+
+bool trace_packed_is_packed(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    char magic[sizeof(((TracePackedHeader *)0)->magic)];
+    bool packed = read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+                  memcmp(magic, TRACE_PACKED_MAGIC, sizeof(magic)) == 0;
+    close(fd);
+    return packed;
+}
+
+TraceReader *trace_reader_open_packed(const char *filename)
+{
+    void *map;
+    size_t map_size;
+    if (trace_reader_map_file(filename, &map, &map_size) != 0)
+    {
+        return NULL;
+    }
+
+    const TracePackedHeader *header = (const TracePackedHeader *)map;
+    bool valid = map_size >= sizeof(*header) &&
+                 memcmp(header->magic, TRACE_PACKED_MAGIC,
+                        sizeof(header->magic)) == 0 &&
+                 header->version >= 1 &&
+                 header->version <= TRACE_PACKED_VERSION &&
+                 header->block_records > 0 &&
+                 header->block_records <= TRACE_PACKED_MAX_BLOCK_RECORDS;
+    if (valid && header->version >= 2)
+    {
+        valid = (header->flags & ~TRACE_PACKED_FLAG_DEFLATE) == 0 &&
+                (header->index_offset == 0 ||
+                 (header->index_offset >= sizeof(*header) &&
+                  header->index_offset <= map_size &&
+                  (map_size - header->index_offset) /
+                          sizeof(TracePackedIndexEntry) ==
+                      header->num_blocks));
+    }
+    if (!valid)
+    {
+        if (map != NULL)
+        {
+            munmap(map, map_size);
+        }
+        return NULL;
+    }
+
+    TraceReader *r = trace_reader_init(-1,
+                                       header->block_records * sizeof(TraceRec));
+    if (r == NULL)
+    {
+        munmap(map, map_size);
+        return NULL;
+    }
+
+    r->source = TRACE_SOURCE_PACKED;
+    r->map = map;
+    r->map_size = map_size;
+    r->map_pos = sizeof(*header);
+    r->map_end = map_size;
+    if (header->version >= 2)
+    {
+        if (header->index_offset != 0)
+        {
+            r->map_end = header->index_offset;
+        }
+        if (header->flags & TRACE_PACKED_FLAG_DEFLATE)
+        {
+            r->scratch = (uint8_t *)malloc(header->block_records *
+                                           TRACE_PACKED_MAX_REC_SIZE);
+            if (r->scratch == NULL)
+            {
+                trace_reader_free(r);
+                return NULL;
+            }
+        }
+    }
+    return r;
+}
+
+/**
+ * Decode the block at the given offset into a reader's buffer.
+ *
+ * @param r the TRACE_SOURCE_PACKED reader
+ * @param offset the offset in the mapping of the block's header
+ * @return the offset just past the block, or 0 if the block is malformed
+ */
+static size_t trace_packed_load_block(TraceReader *r, size_t offset)
+{
+    const uint8_t *base = (const uint8_t *)r->map;
+    TracePackedBlockHeader block;
+    if (offset > r->map_end || r->map_end - offset < sizeof(block))
+    {
+        return 0;
+    }
+    memcpy(&block, base + offset, sizeof(block));
+
+    size_t payload_pos = offset + sizeof(block);
+    if (block.num_records * sizeof(TraceRec) > r->buf_size ||
+        r->map_end - payload_pos < block.payload_size)
+    {
+        return 0;
+    }
+
+    const uint8_t *payload = base + payload_pos;
+    size_t payload_size = block.payload_size;
+    if (r->scratch != NULL)
+    {
+        uLongf inflated_size = block.num_records * TRACE_PACKED_MAX_REC_SIZE;
+        if (uncompress(r->scratch, &inflated_size, payload,
+                       payload_size) != Z_OK)
+        {
+            return 0;
+        }
+        payload = r->scratch;
+        payload_size = inflated_size;
+    }
+
+    if (trace_packed_decode_block(payload, payload_size, block.num_records,
+                                  (TraceRec *)r->buf) != 0)
+    {
+        return 0;
+    }
+
+    r->buf_pos = 0;
+    r->buf_len = block.num_records * sizeof(TraceRec);
+    r->stat_num_reads++;
+    return payload_pos + block.payload_size;
+}
+
+void trace_packed_refill(TraceReader *r)
+{
+    // Blocks hold whole records, so nothing is ever left over.
+    r->buf_pos = 0;
+    r->buf_len = 0;
+
+    if (r->eof || r->error != 0)
+    {
+        return;
+    }
+    if (r->map_pos == r->map_end)
+    {
+        r->eof = true;
+        return;
+    }
+
+    size_t next_pos = trace_packed_load_block(r, r->map_pos);
+    if (next_pos == 0)
+    {
+        r->error = EINVAL;
+        return;
+    }
+    r->map_pos = next_pos;
+}
+
+int trace_packed_seek(TraceReader *r, uint64_t record)
+{
+    const TracePackedHeader *header = (const TracePackedHeader *)r->map;
+    if (header->version < 2 || header->index_offset == 0 ||
+        record > header->num_records)
+    {
+        return -1;
+    }
+
+    if (record == header->num_records)
+    {
+        // Seeking to the end leaves nothing to read.
+        r->map_pos = r->map_end;
+        r->buf_pos = 0;
+        r->buf_len = 0;
+        return 0;
+    }
+
+    if (header->num_blocks == 0)
+    {
+        return -1;
+    }
+
+    // Find the last block whose first record is at or before the target.
+    const TracePackedIndexEntry *index =
+        (const TracePackedIndexEntry *)((const uint8_t *)r->map +
+                                        header->index_offset);
+    uint64_t lo = 0;
+    uint64_t hi = header->num_blocks;
+    while (hi - lo > 1)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (index[mid].first_record <= record)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    // Check that the entry really points at a block holding the record before
+    // touching the reader, so that on failure trace_reader_seek() can still
+    // fall back to reading from where the reader was.
+    const TracePackedIndexEntry entry = index[lo];
+    TracePackedBlockHeader block;
+    if (entry.first_record > record || entry.offset < sizeof(*header) ||
+        entry.offset > r->map_end || r->map_end - entry.offset < sizeof(block))
+    {
+        return -1;
+    }
+    memcpy(&block, (const uint8_t *)r->map + entry.offset, sizeof(block));
+    if (block.first_record != entry.first_record ||
+        record - entry.first_record >= block.num_records)
+    {
+        return -1;
+    }
+
+    size_t next_pos = trace_packed_load_block(r, entry.offset);
+    if (next_pos == 0)
+    {
+        // The buffer may already be overwritten, so the reader is unusable.
+        r->buf_pos = 0;
+        r->buf_len = 0;
+        r->error = EINVAL;
+        return -1;
+    }
+    r->map_pos = next_pos;
+    r->buf_pos = (record - entry.first_record) * sizeof(TraceRec);
+    return 0;
+}
+
+uint64_t trace_packed_num_records(const TraceReader *r)
+{
+    return ((const TracePackedHeader *)r->map)->num_records;
+}
@@ -0,0 +1,269 @@
+// trace_packed.h
+// Declares the packed trace format, a compact on-disk encoding of trace
+// records that decodes much faster than gzip, along with its encoder and the
+// trace reader that decodes it.
+//
+// A packed trace file is a TracePackedHeader followed by blocks. Each block is
+// a TracePackedBlockHeader followed by its encoded records, and can be decoded
+// on its own, without any state from earlier blocks. If the file has the
+// TRACE_PACKED_FLAG_DEFLATE flag, each block's encoded records are further
+// compressed with zlib, again independently of other blocks.
+//
+// Since version 2, the blocks are followed by a footer index with one
+// TracePackedIndexEntry per block, which maps record numbers to the file
+// offsets of the blocks that hold them. This makes the file seekable: a
+// reader can start at any record by decoding only the block that holds it,
+// and separate threads can decode separate ranges of blocks at once.
+//
+// Each record is encoded as:
+//   byte 0:   op_type (bits 0-2), dest_needed, src1_needed, src2_needed,
+//             cc_read, cc_write (bits 3-7)
+//   byte 1:   mem_write, mem_read, br_dir, then whether dest_reg, src1_reg
+//             and src2_reg are stored, whether mem_addr is nonzero and
+//             whether br_target is nonzero (bits 0-7)
+//   varint:   inst_addr, as a zigzag delta from the previous inst_addr
+//   bytes:    dest_reg, src1_reg, src2_reg, each only if stored; registers
+//             that are not stored are TRACE_PACKED_NO_REG
+//   varint:   mem_addr, as a zigzag delta from the previous nonzero mem_addr,
+//             only if nonzero
+//   varint:   br_target, as a zigzag delta from inst_addr, only if nonzero
+//
+// Records that don't fit this scheme (an op_type that doesn't fit in 3 bits,
+// or a flag that isn't 0 or 1) are escaped: byte 0 is TRACE_PACKED_ESCAPE,
+// followed by the raw TraceRec. Escaped records leave the delta state alone.
+// All fields round-trip exactly; only the padding bytes of TraceRec are lost.
+
+#ifndef _TRACE_PACKED_H_
+#define _TRACE_PACKED_H_
+
+#include "trace_reader.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+/**
+ * The magic bytes at the start of every packed trace file.
+ */
+#define TRACE_PACKED_MAGIC "LAB2PTP1"
+
+/**
+ * The version of the packed trace format. Version 1 files have no index and
+ * no flags; they can still be read, but not seeked quickly.
+ */
+#define TRACE_PACKED_VERSION 2
+
+/**
+ * A header flag indicating that each block's payload is zlib-compressed.
+ */
+#define TRACE_PACKED_FLAG_DEFLATE 0x1
+
+/**
+ * The default number of records in each block.
+ */
+#define TRACE_PACKED_DEFAULT_BLOCK_RECORDS 65536
+
+/**
+ * The maximum number of records in each block.
+ */
+#define TRACE_PACKED_MAX_BLOCK_RECORDS (1 << 20)
+
+/**
+ * The largest number of bytes a single record can encode to.
+ */
+#define TRACE_PACKED_MAX_REC_SIZE (1 + sizeof(TraceRec))
+
+/**
+ * The register number that means "no register" in the traces; registers with
+ * this value are not stored.
+ */
+#define TRACE_PACKED_NO_REG 0xFF
+
+/**
+ * The value of byte 0 that marks an escaped record.
+ */
+#define TRACE_PACKED_ESCAPE 0x07
+
+/**
+ * [Internal] Map a signed delta to an unsigned value that is small when the
+ * delta is close to zero, so that it encodes to a short varint.
+ */
+static inline uint64_t zigzag_encode(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+/**
+ * [Internal] Undo zigzag_encode().
+ */
+static inline int64_t zigzag_decode(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/**
+ * [Internal] Write a varint: 7 bits per byte, least significant first, with
+ * the high bit set on every byte but the last.
+ *
+ * @return the byte after the varint
+ */
+static inline uint8_t *varint_put(uint8_t *out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *out++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (uint8_t)v;
+    return out;
+}
+
+/**
+ * [Internal] Read a varint, failing if it runs past end or is longer than 10
+ * bytes.
+ *
+ * @return the byte after the varint, or NULL if it is malformed
+ */
+static inline const uint8_t *varint_get(const uint8_t *in, const uint8_t *end,
+                                        uint64_t *v)
+{
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64 && in < end; shift += 7)
+    {
+        uint8_t byte = *in++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (byte < 0x80)
+        {
+            *v = result;
+            return in;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * The header at the start of every packed trace file.
+ */
+typedef struct TracePackedHeader
+{
+    /** TRACE_PACKED_MAGIC, without the terminating NUL. */
+    char magic[8];
+    /** TRACE_PACKED_VERSION. */
+    uint32_t version;
+    /** The maximum number of records in a block. */
+    uint32_t block_records;
+    /** The total number of records in the file. */
+    uint64_t num_records;
+    /** The number of blocks in the file. */
+    uint64_t num_blocks;
+    /** A combination of TRACE_PACKED_FLAG_* values. */
+    uint32_t flags;
+    /** Reserved; must be zero. */
+    uint32_t reserved0;
+    /**
+     * The file offset of the footer index, which holds num_blocks entries and
+     * runs to the end of the file, or 0 if the file has no index.
+     */
+    uint64_t index_offset;
+    /** Reserved; must be zero. */
+    uint8_t reserved[16];
+} TracePackedHeader;
+
+/**
+ * The header at the start of every block.
+ */
+typedef struct TracePackedBlockHeader
+{
+    /** The number of records in this block. */
+    uint32_t num_records;
+    /**
+     * The number of bytes of encoded records following this header, after
+     * compression if the file has TRACE_PACKED_FLAG_DEFLATE.
+     */
+    uint32_t payload_size;
+    /** The index in the trace of the first record in this block. */
+    uint64_t first_record;
+} TracePackedBlockHeader;
+
+/**
+ * One entry of the footer index.
+ */
+typedef struct TracePackedIndexEntry
+{
+    /** The index in the trace of the first record in the block. */
+    uint64_t first_record;
+    /** The file offset of the block's TracePackedBlockHeader. */
+    uint64_t offset;
+} TracePackedIndexEntry;
+
+/**
+ * Encode a block of trace records.
+ *
+ * @param recs the records to encode
+ * @param n the number of records
+ * @param out the buffer to encode into, which must hold at least
+ *        n * TRACE_PACKED_MAX_REC_SIZE bytes
+ * @return the number of bytes written to out
+ */
+size_t trace_packed_encode_block(const TraceRec *recs, size_t n, uint8_t *out);
+
+/**
+ * Decode a block of trace records.
+ *
+ * @param payload the encoded records
+ * @param payload_size the number of bytes in payload
+ * @param n the number of records in the block
+ * @param out the buffer to decode into, which must hold n records
+ * @return 0 on success, or -1 if the payload is malformed
+ */
+int trace_packed_decode_block(const uint8_t *payload, size_t payload_size,
+                              size_t n, TraceRec *out);
+
+/**
+ * Check whether a file is a packed trace file, by its magic bytes.
+ *
+ * @param filename the path of the file
+ * @return true if the file starts with TRACE_PACKED_MAGIC
+ */
+bool trace_packed_is_packed(const char *filename);
+
+/**
+ * Map a packed trace file and allocate a trace reader that decodes it one
+ * block at a time.
+ *
+ * @param filename the path of the packed trace file
+ * @return a pointer to a newly allocated TRACE_SOURCE_PACKED reader, or NULL
+ *         if the file could not be mapped or has an invalid header
+ */
+TraceReader *trace_reader_open_packed(const char *filename);
+
+/**
+ * Move a TRACE_SOURCE_PACKED reader so that the next record it returns is
+ * the given record of the trace, using the footer index to jump straight to
+ * the block that holds it.
+ *
+ * @param r the TRACE_SOURCE_PACKED reader
+ * @param record the index in the trace of the record to move to
+ * @return 0 on success, or -1 if the file has no index, the record is past
+ *         the end of the trace, or the index does not lead to it. The reader
+ *         is left where it was unless the block turns out to be malformed,
+ *         in which case its error is set to EINVAL.
+ */
+int trace_packed_seek(TraceReader *r, uint64_t record);
+
+/**
+ * Get the total number of records in the file a TRACE_SOURCE_PACKED reader
+ * is reading.
+ *
+ * @param r the TRACE_SOURCE_PACKED reader
+ * @return the number of records in the trace
+ */
+uint64_t trace_packed_num_records(const TraceReader *r);
+
+/**
+ * [Internal] Decode the next block of a TRACE_SOURCE_PACKED reader into its
+ * buffer. Called by the trace reader when its buffer runs dry.
+ *
+ * @param r the TRACE_SOURCE_PACKED reader to refill
+ */
+void trace_packed_refill(TraceReader *r);
+
+#endif
@@ -0,0 +1,228 @@
+// trace_prefetch.cpp
+// Implements the trace prefetcher.
+
+#include "trace_prefetch.h"
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <system_error>
+#include <thread>
+
+/** The size of a cache line, used to keep the ring indices apart. */
+#define CACHE_LINE_SIZE 64
+
+/**
+ * One batch in the prefetch ring.
+ */
+typedef struct TracePrefetchSlot
+{
+    /** The raw trace data in this batch. */
+    uint8_t *data;
+    /** The number of valid bytes in data. */
+    size_t len;
+    /**
+     * Whether this is the last batch the producer will publish. If so, the
+     * trace ended inside it, either cleanly, with a partial record, or on a
+     * failed read.
+     */
+    bool last;
+} TracePrefetchSlot;
+
+/**
+ * A prefetch thread and its single-producer/single-consumer ring.
+ *
+ * The producer fills slot (head % depth) and then publishes it by advancing
+ * head; the consumer reads slot (tail % depth) and then releases it by
+ * advancing tail. Each index is written by one thread only, so no locks are
+ * needed.
+ */
+struct TracePrefetch
+{
+    /** The reader the producer thread reads from. */
+    TraceReader *src;
+
+    /** The ring of batches. */
+    TracePrefetchSlot *slots;
+    /** The backing memory for all slots' data. */
+    uint8_t *slot_mem;
+    /** The number of slots in the ring. */
+    size_t depth;
+    /** The capacity of each slot, in bytes. */
+    size_t slot_size;
+
+    /** The number of batches published by the producer. */
+    std::atomic<uint64_t> head;
+    char pad_head[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+    /** The number of batches released by the consumer. */
+    std::atomic<uint64_t> tail;
+    char pad_tail[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+    /** Set by the consumer to ask the producer to exit early. */
+    std::atomic<bool> stop;
+
+    /** [Consumer] Whether the consumer currently holds slot (tail % depth). */
+    bool holding;
+    /** [Consumer] The number of times the consumer found the ring empty. */
+    uint64_t stat_num_stalls;
+
+    /** The producer thread. */
+    std::thread thread;
+};
+
+/**
+ * The body of the producer thread: fill free slots from the source reader
+ * until the trace ends or the consumer asks it to stop.
+ *
+ * @param pf the prefetcher
+ */
+static void trace_prefetch_run(TracePrefetch *pf)
+{
+    uint64_t head = pf->head.load(std::memory_order_relaxed);
+    bool last = false;
+
+    while (!last)
+    {
+        // Wait for a free slot.
+        while (head - pf->tail.load(std::memory_order_acquire) >= pf->depth)
+        {
+            if (pf->stop.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        TracePrefetchSlot *slot = &pf->slots[head % pf->depth];
+        slot->len = trace_reader_read_bytes(pf->src, slot->data,
+                                            pf->slot_size);
+        last = slot->len < pf->slot_size;
+        slot->last = last;
+
+        // Publish the slot.
+        pf->head.store(++head, std::memory_order_release);
+    }
+}
+
+TraceReader *trace_reader_start_prefetch(TraceReader *src, size_t depth)
+{
+    if (depth == 0)
+    {
+        depth = 1;
+    }
+
+    TraceReader *r = (TraceReader *)calloc(1, sizeof(TraceReader));
+    TracePrefetch *pf = new (std::nothrow) TracePrefetch();
+    if (r == NULL || pf == NULL)
+    {
+        free(r);
+        delete pf;
+        return NULL;
+    }
+
+    pf->src = src;
+    pf->depth = depth;
+    pf->slot_size = TRACE_PREFETCH_BATCH_RECORDS * sizeof(TraceRec);
+    pf->slots = (TracePrefetchSlot *)calloc(depth, sizeof(TracePrefetchSlot));
+    void *slot_mem = NULL;
+    if (pf->slots == NULL ||
+        posix_memalign(&slot_mem, TRACE_READER_BUF_ALIGN,
+                       depth * pf->slot_size) != 0)
+    {
+        free(pf->slots);
+        delete pf;
+        free(r);
+        return NULL;
+    }
+    pf->slot_mem = (uint8_t *)slot_mem;
+    for (size_t i = 0; i < depth; i++)
+    {
+        pf->slots[i].data = pf->slot_mem + i * pf->slot_size;
+    }
+    pf->head.store(0);
+    pf->tail.store(0);
+    pf->stop.store(false);
+
+    try
+    {
+        pf->thread = std::thread(trace_prefetch_run, pf);
+    }
+    catch (const std::system_error &)
+    {
+        free(pf->slot_mem);
+        free(pf->slots);
+        delete pf;
+        free(r);
+        return NULL;
+    }
+
+    r->source = TRACE_SOURCE_PREFETCH;
+    r->fd = -1;
+    r->src = src;
+    r->prefetch = pf;
+    r->buf_size = pf->slot_size;
+    r->record_limit = UINT64_MAX;
+    return r;
+}
+
+void trace_prefetch_refill(TraceReader *r)
+{
+    TracePrefetch *pf = r->prefetch;
+
+    // A partial record is only ever left over at the very end of the trace,
+    // since every batch but the last holds a whole number of records.
+    if (r->eof || r->error != 0)
+    {
+        return;
+    }
+
+    // Release the batch we just finished.
+    uint64_t tail = pf->tail.load(std::memory_order_relaxed);
+    if (pf->holding)
+    {
+        pf->tail.store(++tail, std::memory_order_release);
+        pf->holding = false;
+    }
+
+    // Wait for the next batch.
+    if (pf->head.load(std::memory_order_acquire) == tail)
+    {
+        pf->stat_num_stalls++;
+        while (pf->head.load(std::memory_order_acquire) == tail)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    TracePrefetchSlot *slot = &pf->slots[tail % pf->depth];
+    pf->holding = true;
+    r->buf = slot->data;
+    r->buf_pos = 0;
+    r->buf_len = slot->len;
+    r->stat_num_reads++;
+
+    if (slot->last)
+    {
+        // The acquire load of head above makes the source's final state
+        // visible here.
+        r->error = r->src->error;
+        r->eof = r->error == 0;
+    }
+}
+
+void trace_prefetch_stop(TracePrefetch *pf)
+{
+    pf->stop.store(true, std::memory_order_relaxed);
+    if (pf->thread.joinable())
+    {
+        pf->thread.join();
+    }
+
+    free(pf->slot_mem);
+    free(pf->slots);
+    delete pf;
+}
+
+uint64_t trace_prefetch_num_stalls(const TraceReader *r)
+{
+    return r->prefetch->stat_num_stalls;
+}
@@ -0,0 +1,63 @@
+// trace_prefetch.h
+// Declares the trace prefetcher, which runs trace I/O and decompression on a
+// producer thread and hands batches of trace records to the simulator through
+// a single-producer/single-consumer lock-free ring.
+
+#ifndef _TRACE_PREFETCH_H_
+#define _TRACE_PREFETCH_H_
+
+#include "trace_reader.h"
+#include <stddef.h>
+
+/**
+ * The default number of batches in the prefetch ring.
+ */
+#define TRACE_PREFETCH_DEFAULT_DEPTH 8
+
+/**
+ * The number of trace records in each batch of the prefetch ring.
+ */
+#define TRACE_PREFETCH_BATCH_RECORDS 4096
+
+/**
+ * Start a prefetch thread reading from the given reader, and allocate a
+ * TRACE_SOURCE_PREFETCH reader that consumes the batches it produces.
+ *
+ * The returned reader takes ownership of src; src must not be used directly
+ * afterwards. Records come out of the returned reader exactly as they would
+ * have come out of src, including how the trace ends.
+ *
+ * @param src the reader the prefetch thread should read from
+ * @param depth the number of batches in the ring (at least 1)
+ * @return a pointer to a newly allocated trace reader, or NULL if the ring
+ *         could not be allocated or the thread could not be started
+ */
+TraceReader *trace_reader_start_prefetch(TraceReader *src, size_t depth);
+
+/**
+ * [Internal] Release the batch a TRACE_SOURCE_PREFETCH reader has consumed
+ * and point its buffer at the next batch, waiting for the producer if the
+ * ring is empty. Called by the trace reader when its buffer runs dry.
+ *
+ * @param r the TRACE_SOURCE_PREFETCH reader to refill
+ */
+void trace_prefetch_refill(TraceReader *r);
+
+/**
+ * [Internal] Stop a prefetch thread, wait for it to exit, and free its ring.
+ * Called by trace_reader_free().
+ *
+ * @param pf the prefetcher to stop
+ */
+void trace_prefetch_stop(struct TracePrefetch *pf);
+
+/**
+ * Get the number of times the consumer found the ring empty and had to wait
+ * for the producer.
+ *
+ * @param r a TRACE_SOURCE_PREFETCH reader
+ * @return the number of consumer stalls
+ */
+uint64_t trace_prefetch_num_stalls(const TraceReader *r);
+
+#endif
@@ -0,0 +1,455 @@
+// trace_reader.cpp
+// Implements the buffered trace reader.
+
+#include "trace_reader.h"
+#include "trace_cache.h"
+#include "trace_fanout.h"
+#include "trace_packed.h"
+#include "trace_prefetch.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Move any unconsumed bytes to the start of the buffer and fill the rest of
+ * it from the file descriptor, stopping early only at EOF or on an error.
+ *
+ * Keeping the unconsumed tail at offset 0 means every record starts at a
+ * multiple of sizeof(TraceRec), so records in the buffer stay aligned.
+ *
+ * @param r the trace reader to refill
+ */
+static void trace_reader_refill(TraceReader *r)
+{
+    if (r->source == TRACE_SOURCE_PREFETCH)
+    {
+        trace_prefetch_refill(r);
+        return;
+    }
+
+    if (r->source == TRACE_SOURCE_FANOUT)
+    {
+        trace_fanout_refill(r);
+        return;
+    }
+
+    if (r->source == TRACE_SOURCE_MMAP)
+    {
+        // The whole trace is already in the buffer.
+        r->eof = true;
+        return;
+    }
+
+    if (r->source == TRACE_SOURCE_PACKED)
+    {
+        trace_packed_refill(r);
+        return;
+    }
+
+    size_t leftover = r->buf_len - r->buf_pos;
+    if (leftover > 0 && r->buf_pos > 0)
+    {
+        memmove(r->buf, r->buf + r->buf_pos, leftover);
+    }
+    r->buf_pos = 0;
+    r->buf_len = leftover;
+
+    while (r->buf_len < r->buf_size && !r->eof && r->error == 0)
+    {
+        if (r->source == TRACE_SOURCE_GZIP)
+        {
+            int bytes_read = gzread(r->gz, r->buf + r->buf_len,
+                                    (unsigned)(r->buf_size - r->buf_len));
+            r->stat_num_reads++;
+
+            if (bytes_read < 0)
+            {
+                r->error = EIO;
+            }
+            else if (bytes_read == 0)
+            {
+                r->eof = true;
+            }
+            else
+            {
+                r->buf_len += bytes_read;
+            }
+            continue;
+        }
+
+        ssize_t bytes_read = read(r->fd, r->buf + r->buf_len,
+                                  r->buf_size - r->buf_len);
+        r->stat_num_reads++;
+
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            r->error = errno;
+        }
+        else if (bytes_read == 0)
+        {
+            r->eof = true;
+        }
+        else
+        {
+            r->buf_len += bytes_read;
+        }
+    }
+}
+
+TraceReader *trace_reader_init(int fd, size_t buf_size)
+{
+    // Round the buffer down to a whole number of records so that a full
+    // buffer never splits a record.
+    buf_size -= buf_size % sizeof(TraceRec);
+    if (buf_size == 0)
+    {
+        buf_size = sizeof(TraceRec);
+    }
+
+    TraceReader *r = (TraceReader *)calloc(1, sizeof(TraceReader));
+    if (r == NULL)
+    {
+        return NULL;
+    }
+
+    void *buf = NULL;
+    if (posix_memalign(&buf, TRACE_READER_BUF_ALIGN, buf_size) != 0)
+    {
+        free(r);
+        return NULL;
+    }
+
+    r->source = TRACE_SOURCE_FD;
+    r->fd = fd;
+    r->gz = NULL;
+    r->buf = (uint8_t *)buf;
+    r->buf_size = buf_size;
+    r->record_limit = UINT64_MAX;
+    return r;
+}
+
+TraceReader *trace_reader_open_gzip(const char *filename, size_t buf_size)
+{
+    gzFile gz = gzopen(filename, "rb");
+    if (gz == NULL)
+    {
+        return NULL;
+    }
+    gzbuffer(gz, TRACE_READER_GZ_BUF_SIZE);
+
+    TraceReader *r = trace_reader_init(-1, buf_size);
+    if (r == NULL)
+    {
+        gzclose(gz);
+        return NULL;
+    }
+
+    r->source = TRACE_SOURCE_GZIP;
+    r->gz = gz;
+    return r;
+}
+
+TraceReader *trace_reader_open(const char *filename, const char *cache_dir,
+                               TraceOpenMethod *method)
+{
+    if (trace_packed_is_packed(filename))
+    {
+        *method = TRACE_OPEN_PACKED;
+        return trace_reader_open_packed(filename);
+    }
+
+    if (cache_dir != NULL)
+    {
+        bool hit;
+        TraceReader *r = trace_cache_open(filename, cache_dir, &hit);
+        if (r != NULL)
+        {
+            *method = hit ? TRACE_OPEN_CACHE_HIT : TRACE_OPEN_CACHE_MISS;
+            return r;
+        }
+    }
+
+    *method = TRACE_OPEN_GZIP;
+    return trace_reader_open_gzip(filename, TRACE_READER_BUF_SIZE);
+}
+
+int trace_reader_map_file(const char *filename, void **map, size_t *map_size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    *map_size = st.st_size;
+    *map = NULL;
+    if (*map_size > 0)
+    {
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        flags |= MAP_POPULATE;
+#endif
+        *map = mmap(NULL, *map_size, PROT_READ, flags, fd, 0);
+    }
+    close(fd);
+    if (*map == MAP_FAILED)
+    {
+        *map = NULL;
+        return -1;
+    }
+    if (*map != NULL)
+    {
+        madvise(*map, *map_size, MADV_SEQUENTIAL);
+    }
+    return 0;
+}
+
+TraceReader *trace_reader_open_mmap(const char *filename, size_t offset)
+{
+    void *map;
+    size_t map_size;
+    if (trace_reader_map_file(filename, &map, &map_size) != 0)
+    {
+        return NULL;
+    }
+
+    TraceReader *r = (TraceReader *)calloc(1, sizeof(TraceReader));
+    if (r == NULL || map_size < offset)
+    {
+        free(r);
+        if (map != NULL)
+        {
+            munmap(map, map_size);
+        }
+        return NULL;
+    }
+
+    r->source = TRACE_SOURCE_MMAP;
+    r->fd = -1;
+    r->map = map;
+    r->map_size = map_size;
+    r->buf = (uint8_t *)map + offset;
+    r->buf_size = map_size - offset;
+    r->buf_len = map_size - offset;
+    r->record_limit = UINT64_MAX;
+    return r;
+}
+
+void trace_reader_free(TraceReader *r)
+{
+    if (r == NULL)
+    {
+        return;
+    }
+
+    if (r->source == TRACE_SOURCE_PREFETCH)
+    {
+        trace_prefetch_stop(r->prefetch);
+        trace_reader_free(r->src);
+        free(r);
+        return;
+    }
+
+    if (r->source == TRACE_SOURCE_FANOUT)
+    {
+        trace_fanout_free(r);
+        return;
+    }
+
+    if (r->map != NULL)
+    {
+        munmap(r->map, r->map_size);
+    }
+    if (r->gz != NULL)
+    {
+        gzclose(r->gz);
+    }
+    if (r->source != TRACE_SOURCE_MMAP)
+    {
+        free(r->buf);
+    }
+    free(r->scratch);
+    free(r);
+}
+
+TraceReadStatus trace_reader_next(TraceReader *r, TraceRec *rec)
+{
+    if (r->stat_num_records == r->record_limit)
+    {
+        return TRACE_READ_EOF;
+    }
+
+    if (r->buf_len - r->buf_pos < sizeof(TraceRec))
+    {
+        trace_reader_refill(r);
+    }
+
+    size_t available = r->buf_len - r->buf_pos;
+    if (available < sizeof(TraceRec))
+    {
+        // Report an error first, as the original per-record read() loop did;
+        // otherwise distinguish a clean end from a partial record.
+        if (r->error != 0)
+        {
+            return TRACE_READ_ERROR;
+        }
+        if (available == 0)
+        {
+            return TRACE_READ_EOF;
+        }
+
+        // Drop the partial record so that later calls see a clean EOF.
+        r->buf_pos = r->buf_len;
+        return TRACE_READ_TRUNCATED;
+    }
+
+    memcpy(rec, r->buf + r->buf_pos, sizeof(TraceRec));
+    r->buf_pos += sizeof(TraceRec);
+    r->stat_num_records++;
+    return TRACE_READ_OK;
+}
+
+size_t trace_reader_read_bytes(TraceReader *r, void *dst, size_t n)
+{
+    uint8_t *out = (uint8_t *)dst;
+    size_t copied = 0;
+
+    while (copied < n)
+    {
+        if (r->buf_pos == r->buf_len)
+        {
+            trace_reader_refill(r);
+            if (r->buf_pos == r->buf_len)
+            {
+                break;
+            }
+        }
+
+        size_t chunk = r->buf_len - r->buf_pos;
+        if (chunk > n - copied)
+        {
+            chunk = n - copied;
+        }
+        memcpy(out + copied, r->buf + r->buf_pos, chunk);
+        r->buf_pos += chunk;
+        copied += chunk;
+    }
+
+    return copied;
+}
+
+TraceReadStatus trace_reader_seek(TraceReader *r, uint64_t record)
+{
+    if (r->source == TRACE_SOURCE_PACKED && trace_packed_seek(r, record) == 0)
+    {
+        return TRACE_READ_OK;
+    }
+
+    if (r->source == TRACE_SOURCE_MMAP)
+    {
+        uint64_t available = (r->buf_len - r->buf_pos) / sizeof(TraceRec);
+        if (record <= available)
+        {
+            r->buf_pos += record * sizeof(TraceRec);
+            return TRACE_READ_OK;
+        }
+    }
+
+    // Fall back to reading and discarding the records in between.
+    uint64_t limit = r->record_limit;
+    uint64_t num_records = r->stat_num_records;
+    r->record_limit = UINT64_MAX;
+
+    TraceReadStatus status = TRACE_READ_OK;
+    TraceRec rec;
+    for (uint64_t i = 0; i < record && status == TRACE_READ_OK; i++)
+    {
+        status = trace_reader_next(r, &rec);
+    }
+
+    r->record_limit = limit;
+    r->stat_num_records = num_records;
+    return status;
+}
+
+TraceReadStatus trace_reader_count(TraceReader *r, uint64_t *num_records)
+{
+    if (r->source == TRACE_SOURCE_PACKED)
+    {
+        *num_records = trace_packed_num_records(r);
+        return TRACE_READ_OK;
+    }
+    if (r->source == TRACE_SOURCE_MMAP)
+    {
+        *num_records = (r->buf_len - r->buf_pos) / sizeof(TraceRec);
+        return TRACE_READ_OK;
+    }
+
+    // Other sources can only be counted by reading them to the end.
+    r->record_limit = UINT64_MAX;
+    *num_records = 0;
+    TraceReadStatus status;
+    TraceRec rec;
+    while ((status = trace_reader_next(r, &rec)) == TRACE_READ_OK)
+    {
+        (*num_records)++;
+    }
+    return status == TRACE_READ_EOF ? TRACE_READ_OK : status;
+}
+
+void trace_reader_set_limit(TraceReader *r, uint64_t limit)
+{
+    r->record_limit = limit;
+}
+
+void trace_reader_perror(const TraceReader *r, const char *msg)
+{
+    if (r->source == TRACE_SOURCE_PREFETCH ||
+        r->source == TRACE_SOURCE_FANOUT)
+    {
+        trace_reader_perror(r->src, msg);
+        return;
+    }
+
+    if (r->source == TRACE_SOURCE_GZIP)
+    {
+        int errnum = Z_OK;
+        const char *zmsg = gzerror(r->gz, &errnum);
+        if (errnum == Z_ERRNO)
+        {
+            zmsg = strerror(errno);
+        }
+        fprintf(stderr, "%s: %s\n", msg, zmsg);
+        return;
+    }
+
+    fprintf(stderr, "%s: %s\n", msg, strerror(r->error));
+}
+
+uint64_t trace_reader_syscalls_saved(const TraceReader *r)
+{
+    // Reading one record at a time costs at least one read() per record plus
+    // the final read() that returns EOF.
+    uint64_t unbuffered_reads = r->stat_num_records + 1;
+    if (unbuffered_reads <= r->stat_num_reads)
+    {
+        return 0;
+    }
+    return unbuffered_reads - r->stat_num_reads;
+}
@@ -0,0 +1,290 @@
+// trace_reader.h
+// Declares the buffered trace reader, which pulls large blocks of trace data
+// into memory and hands out trace records from there, so that fetching an
+// instruction does not cost a read() system call. Trace data can come either
+// from a file descriptor or from a gzip file decompressed in-process.
+
+#ifndef _TRACE_READER_H_
+#define _TRACE_READER_H_
+
+#include "trace.h"
+#include <stddef.h>
+#include <inttypes.h>
+#include <zlib.h>
+
+/**
+ * The default size of the block buffer used by the trace reader, in bytes.
+ */
+#define TRACE_READER_BUF_SIZE (1 << 20)
+
+/**
+ * The alignment of the block buffer, in bytes. This is a cache line, which
+ * also satisfies the alignment of TraceRec.
+ */
+#define TRACE_READER_BUF_ALIGN 64
+
+/**
+ * The size of zlib's internal buffer for compressed input, in bytes.
+ */
+#define TRACE_READER_GZ_BUF_SIZE (256 << 10)
+
+/**
+ * Where a trace reader gets its trace data from.
+ */
+typedef enum TraceSourceEnum
+{
+    TRACE_SOURCE_FD,      // Raw trace records read from a file descriptor.
+    TRACE_SOURCE_GZIP,    // A gzip file decompressed in-process with zlib.
+    TRACE_SOURCE_MMAP,    // Raw trace records in a read-only memory mapping.
+    TRACE_SOURCE_PACKED,  // A packed trace file; see trace_packed.h.
+    TRACE_SOURCE_PREFETCH, // Batches produced by a prefetch thread; see
+                           // trace_prefetch.h.
+    TRACE_SOURCE_FANOUT    // Batches shared with other readers; see
+                           // trace_fanout.h.
+} TraceSource;
+
+struct TracePrefetch;
+struct TraceFanout;
+
+/**
+ * A buffered reader of trace records.
+ */
+typedef struct TraceReader
+{
+    /** Where this reader gets its trace data from. */
+    TraceSource source;
+    /** The file descriptor to read trace data from (TRACE_SOURCE_FD). */
+    int fd;
+    /** The gzip stream to read trace data from (TRACE_SOURCE_GZIP). */
+    gzFile gz;
+    /** The start of the file mapping (TRACE_SOURCE_MMAP and _PACKED). */
+    void *map;
+    /** The length of the file mapping (TRACE_SOURCE_MMAP and _PACKED). */
+    size_t map_size;
+    /** The offset in the mapping of the next block (TRACE_SOURCE_PACKED). */
+    size_t map_pos;
+    /** The offset in the mapping where blocks end (TRACE_SOURCE_PACKED). */
+    size_t map_end;
+    /** The buffer compressed blocks inflate into (TRACE_SOURCE_PACKED). */
+    uint8_t *scratch;
+    /**
+     * The reader a prefetch thread reads from (TRACE_SOURCE_PREFETCH), or
+     * that a fan-out ring is filled from (TRACE_SOURCE_FANOUT).
+     */
+    struct TraceReader *src;
+    /** The prefetch thread and its ring (TRACE_SOURCE_PREFETCH). */
+    struct TracePrefetch *prefetch;
+    /** The shared ring this reader consumes (TRACE_SOURCE_FANOUT). */
+    struct TraceFanout *fanout;
+    /** This reader's index among the consumers of the ring. */
+    size_t fanout_index;
+
+    /**
+     * The aligned block buffer. For TRACE_SOURCE_PREFETCH and
+     * TRACE_SOURCE_FANOUT, this points into the ring slot currently being
+     * consumed, and for TRACE_SOURCE_MMAP, it points into the mapping; in
+     * those cases it is not owned by the reader.
+     */
+    uint8_t *buf;
+    /** The capacity of buf, in bytes. */
+    size_t buf_size;
+    /** The offset in buf of the next unconsumed byte. */
+    size_t buf_pos;
+    /** The number of valid bytes in buf. */
+    size_t buf_len;
+
+    /** Whether the end of the trace data has been reached. */
+    bool eof;
+    /** The errno of the last failed read, or 0 if no read has failed. */
+    int error;
+
+    /**
+     * The number of block reads issued: read() system calls for
+     * TRACE_SOURCE_FD, gzread() calls for TRACE_SOURCE_GZIP.
+     */
+    uint64_t stat_num_reads;
+    /** The number of complete trace records handed out. */
+    uint64_t stat_num_records;
+    /**
+     * The number of records after which the reader reports the end of the
+     * trace; see trace_reader_set_limit().
+     */
+    uint64_t record_limit;
+} TraceReader;
+
+/**
+ * The possible outcomes of reading a trace record.
+ */
+typedef enum TraceReadStatusEnum
+{
+    TRACE_READ_OK,        // A complete trace record was read.
+    TRACE_READ_EOF,       // The trace ended cleanly on a record boundary.
+    TRACE_READ_TRUNCATED, // The trace ended in the middle of a record.
+    TRACE_READ_ERROR      // A block read failed; see trace_reader_perror().
+} TraceReadStatus;
+
+/**
+ * Allocate and initialize a new trace reader.
+ *
+ * @param fd the file descriptor from which to read trace data
+ * @param buf_size the size of the block buffer, in bytes
+ * @return a pointer to a newly allocated trace reader, or NULL if the buffer
+ *         could not be allocated
+ */
+TraceReader *trace_reader_init(int fd, size_t buf_size);
+
+/**
+ * Open a gzip-compressed trace file and allocate a trace reader that
+ * decompresses it in-process, straight into the reader's block buffer.
+ *
+ * Files that are not gzip-compressed are read as raw trace records.
+ *
+ * @param filename the path of the trace file
+ * @param buf_size the size of the block buffer, in bytes
+ * @return a pointer to a newly allocated trace reader, or NULL if the file
+ *         could not be opened or the buffer could not be allocated
+ */
+TraceReader *trace_reader_open_gzip(const char *filename, size_t buf_size);
+
+/**
+ * Map a file of raw trace records read-only and allocate a trace reader that
+ * hands out records straight from the mapping.
+ *
+ * @param filename the path of the file to map
+ * @param offset the offset in the file of the first trace record; must be a
+ *        multiple of TRACE_READER_BUF_ALIGN
+ * @return a pointer to a newly allocated trace reader, or NULL if the file
+ *         could not be opened or mapped
+ */
+TraceReader *trace_reader_open_mmap(const char *filename, size_t offset);
+
+/**
+ * The ways trace_reader_open() can open a trace.
+ */
+typedef enum TraceOpenMethodEnum
+{
+    TRACE_OPEN_PACKED,     // A packed trace, read with its block index.
+    TRACE_OPEN_CACHE_HIT,  // A cached copy of the trace, mapped.
+    TRACE_OPEN_CACHE_MISS, // A copy of the trace just cached, mapped.
+    TRACE_OPEN_GZIP        // The trace itself, decompressed with zlib.
+} TraceOpenMethod;
+
+/**
+ * Open a trace file the best way available: a packed trace directly, or else
+ * a gzip-compressed trace through the trace cache if there is one, or else
+ * through zlib.
+ *
+ * @param filename the path of the trace file
+ * @param cache_dir the trace cache directory, or NULL to use no cache
+ * @param method set to the way the trace was opened; TRACE_OPEN_GZIP with a
+ *        cache directory means the trace could not be cached
+ * @return a pointer to a newly allocated trace reader, or NULL if the file
+ *         could not be opened
+ */
+TraceReader *trace_reader_open(const char *filename, const char *cache_dir,
+                               TraceOpenMethod *method);
+
+/**
+ * [Internal] Map a whole file read-only, with hints that it will be read
+ * sequentially.
+ *
+ * @param filename the path of the file to map
+ * @param map set to the start of the mapping, or NULL for an empty file
+ * @param map_size set to the length of the mapping, in bytes
+ * @return 0 on success, or -1 if the file could not be opened or mapped
+ */
+int trace_reader_map_file(const char *filename, void **map, size_t *map_size);
+
+/**
+ * Free a trace reader and its buffer. This closes the gzip stream of a
+ * TRACE_SOURCE_GZIP reader, but does not close the file descriptor of a
+ * TRACE_SOURCE_FD reader, and unmaps the file of a TRACE_SOURCE_MMAP or
+ * TRACE_SOURCE_PACKED reader.
+ * A TRACE_SOURCE_PREFETCH reader stops its thread and frees the reader it was
+ * prefetching from. A TRACE_SOURCE_FANOUT reader frees the reader it shares
+ * only if it is the last of its ring's consumers.
+ *
+ * @param r the trace reader to free
+ */
+void trace_reader_free(TraceReader *r);
+
+/**
+ * Read the next trace record.
+ *
+ * On TRACE_READ_OK, *rec holds the record. On any other status, *rec is left
+ * in an unspecified state.
+ *
+ * @param r the trace reader
+ * @param rec the trace record to populate
+ * @return the outcome of the read
+ */
+TraceReadStatus trace_reader_next(TraceReader *r, TraceRec *rec);
+
+/**
+ * Copy up to n bytes of raw trace data out of a reader, refilling its block
+ * buffer as needed. Fewer than n bytes are copied only at the end of the
+ * trace or after a failed block read.
+ *
+ * @param r the trace reader
+ * @param dst the destination buffer
+ * @param n the number of bytes to copy
+ * @return the number of bytes copied
+ */
+size_t trace_reader_read_bytes(TraceReader *r, void *dst, size_t n);
+
+/**
+ * Skip records so that the next record a reader returns is the given record
+ * of the trace. Packed traces with an index and mapped traces jump straight
+ * there; other sources read and discard the records in between.
+ *
+ * This must be called before any records have been read. Skipped records do
+ * not count towards stat_num_records.
+ *
+ * @param r the trace reader
+ * @param record the index in the trace of the first record to return
+ * @return the outcome of skipping: TRACE_READ_OK if the reader is now at the
+ *         given record, or how the trace ended before reaching it
+ */
+TraceReadStatus trace_reader_seek(TraceReader *r, uint64_t record);
+
+/**
+ * Count the records of a trace. Packed traces with an index and mapped traces
+ * are counted without reading them; other sources are read to the end, after
+ * which the reader can only be freed.
+ *
+ * This must be called before any records have been read.
+ *
+ * @param r the trace reader
+ * @param num_records set to the number of records in the trace
+ * @return TRACE_READ_OK if the trace was counted, or how it failed to be read
+ */
+TraceReadStatus trace_reader_count(TraceReader *r, uint64_t *num_records);
+
+/**
+ * Make a reader report the end of the trace (TRACE_READ_EOF) once it has
+ * returned the given number of records.
+ *
+ * @param r the trace reader
+ * @param limit the number of records to return
+ */
+void trace_reader_set_limit(TraceReader *r, uint64_t limit);
+
+/**
+ * Print a message describing the last failed block read to stderr, in the
+ * style of perror().
+ *
+ * @param r the trace reader
+ * @param msg the message prefix
+ */
+void trace_reader_perror(const TraceReader *r, const char *msg);
+
+/**
+ * Get the number of read() system calls avoided compared to issuing one
+ * read() per trace record.
+ *
+ * @param r the trace reader
+ * @return the number of system calls saved
+ */
+uint64_t trace_reader_syscalls_saved(const TraceReader *r);
+
+#endif